@@ -17,3 +17,52 @@ CREATE TABLE radippool (
 CREATE INDEX radippool_poolname_expire ON radippool USING btree (pool_name, expiry_time);
 CREATE INDEX radippool_framedipaddress ON radippool USING btree (framedipaddress);
 CREATE INDEX radippool_nasip_poolkey_ipaddress ON radippool USING btree (nasipaddress, pool_key, framedipaddress);
+
+--
+-- Allocate an IP address in one round trip, for "allocate-single".
+--
+-- Any old lease for the NAS and pool key is cleared first, and only then
+-- is a free address looked for.  The two steps must be separate
+-- statements: the parts of a single statement all see the same
+-- snapshot, so a free address search in the same statement would not see
+-- the lease which has just been cleared.
+--
+-- SKIP LOCKED needs PostgreSQL 9.5 or later.
+--
+CREATE OR REPLACE FUNCTION fr_ippool_allocate (
+	v_pool_name VARCHAR(64),
+	v_nasipaddress VARCHAR(16),
+	v_pool_key VARCHAR(64),
+	v_username TEXT,
+	v_callingstationid TEXT,
+	v_lease_duration INT
+)
+RETURNS INET AS $$
+DECLARE
+	r_id BIGINT;
+	r_address INET;
+BEGIN
+	UPDATE radippool
+	SET nasipaddress = '', pool_key = 0, callingstationid = '',
+	expiry_time = LOCALTIMESTAMP(0) - '1 second'::interval
+	WHERE nasipaddress = v_nasipaddress AND pool_key = v_pool_key;
+
+	SELECT id, framedipaddress INTO r_id, r_address FROM radippool
+	WHERE pool_name = v_pool_name AND expiry_time < LOCALTIMESTAMP(0)
+	ORDER BY (username <> v_username), (callingstationid <> v_callingstationid), expiry_time
+	LIMIT 1
+	FOR UPDATE SKIP LOCKED;
+
+	IF r_id IS NULL THEN
+		RETURN NULL;
+	END IF;
+
+	UPDATE radippool
+	SET nasipaddress = v_nasipaddress, pool_key = v_pool_key,
+	callingstationid = v_callingstationid, username = v_username,
+	expiry_time = LOCALTIMESTAMP(0) + v_lease_duration * '1 second'::interval
+	WHERE id = r_id;
+
+	RETURN r_address;
+END
+$$ LANGUAGE plpgsql;
@@ -461,6 +461,7 @@ fi
 %doc %{_mandir}/man1/radwho.1.gz
 %doc %{_mandir}/man1/radzap.1.gz
 %doc %{_mandir}/man8/radsqlrelay.8.gz
+%doc %{_mandir}/man8/radusers.8.gz
 %doc %{_mandir}/man8/rlm_ippool_tool.8.gz
 
 %files krb5
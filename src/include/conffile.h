@@ -132,6 +132,7 @@ extern int cf_section2file(FILE *fp, const CONF_SECTION *cs);
  *	Big magic.
  */
 int cf_section_migrate(CONF_SECTION *dst, CONF_SECTION *src);
+int cf_section_cmp(CONF_SECTION *a, CONF_SECTION *b);
 
 #ifdef __cplusplus
 }
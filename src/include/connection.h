@@ -36,6 +36,41 @@ extern "C" {
 
 typedef struct fr_connection_pool_t fr_connection_pool_t;
 
+/** Connection pool counters
+ *
+ * A snapshot of the counters and timing histograms for a connection pool,
+ * as returned by fr_connection_pool_stats.
+ *
+ * The histograms use the same buckets as the request statistics:
+ * < 10us, < 100us, < 1ms, < 10ms, < 100ms, < 1s, < 10s, and >= 10s.
+ */
+typedef struct fr_connection_pool_stats_t {
+	int		num;		//!< Number of connections in the pool.
+	int		active;		//!< Number of currently reserved
+					//!< connections.
+	int		max;		//!< Maximum number of connections.
+
+	uint32_t	opened;		//!< Connections opened.
+	uint32_t	failed;		//!< Attempts to open a connection which
+					//!< failed.
+	uint32_t	closed;		//!< Connections closed.
+	uint32_t	reconnected;	//!< Connections re-opened by
+					//!< fr_connection_reconnect.
+	uint32_t	at_max;		//!< Requests for a connection refused
+					//!< because the pool was at "max".
+	uint32_t	reserved;	//!< Connections handed out by
+					//!< fr_connection_get.
+
+	uint64_t	acquire_usec;	//!< Total time spent waiting for
+					//!< connections.
+	uint64_t	hold_usec;	//!< Total time connections were
+					//!< reserved for.
+	uint32_t	acquire_time[8];//!< Histogram of time taken to
+					//!< reserve a connection.
+	uint32_t	hold_time[8];	//!< Histogram of time connections
+					//!< were reserved for.
+} fr_connection_pool_stats_t;
+
 /** Create a new connection handle
  *
  * This function will be called whenever the connection pool manager needs
@@ -86,6 +121,10 @@ void *fr_connection_reconnect(fr_connection_pool_t *pool, void *conn);
 int fr_connection_add(fr_connection_pool_t *pool, void *conn);
 int fr_connection_del(fr_connection_pool_t *pool, void *conn);
 
+void fr_connection_pool_set_name(fr_connection_pool_t *pool, const char *name);
+int fr_connection_pool_stats(const char *name,
+			     fr_connection_pool_stats_t *stats);
+
 #ifdef __cplusplus
 }
 #endif
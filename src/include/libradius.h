@@ -279,6 +279,7 @@ int		dict_addvendor(const char *name, unsigned int value);
 int		dict_addattr(const char *name, int attr, unsigned int vendor, int type, ATTR_FLAGS flags);
 int		dict_addvalue(const char *namestr, const char *attrstr, int value);
 int		dict_init(const char *dir, const char *fn);
+void		dict_set_cache(const char *file);
 void		dict_free(void);
 void 		dict_attr_free(DICT_ATTR * const *da);
 const DICT_ATTR	*dict_attr_copy(const DICT_ATTR *da);
@@ -561,6 +562,13 @@ void *fr_fifo_pop(fr_fifo_t *fi);
 void *fr_fifo_peek(fr_fifo_t *fi);
 int fr_fifo_num_elements(fr_fifo_t *fi);
 
+/*
+ *	Compiled regular expressions, cached per thread.  Returns
+ *	a regex_t *, from whichever regex library the server uses.
+ */
+void *fr_regcomp_cached(const char *pattern, int cflags,
+			char *errbuf, size_t errlen);
+
 #ifdef __cplusplus
 }
 #endif
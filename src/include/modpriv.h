@@ -62,6 +62,9 @@ typedef struct module_instance_t {
 	CONF_SECTION		*cs;
 	int			dead;
 	fr_module_hup_t	       	*mh;
+#ifdef WITH_STATS
+	int			stats_index;
+#endif
 } module_instance_t;
 
 module_instance_t *find_module_instance(CONF_SECTION *, const char *instname,
@@ -105,6 +105,12 @@ extern const section_type_value_t section_type_value[];
 						//!< Server will instantiated
 						//!< new instance, and then 
 						//!< destroy old instance.
+#define RLM_TYPE_HUP_CHANGED	(1 << 3)	//!< Only restarted on HUP if
+						//!< its configuration, or a
+						//!< PW_TYPE_FILENAME file,
+						//!< changed.  Module must not
+						//!< read any other files when
+						//!< instantiated.
 
 #define RLM_MODULE_MAGIC_NUMBER ((uint32_t) (0xf4ee4ad3))
 #define RLM_MODULE_INIT RLM_MODULE_MAGIC_NUMBER
@@ -168,6 +174,8 @@ typedef struct module_t {
 int setup_modules(int, CONF_SECTION *);
 int detach_modules(void);
 int module_hup(CONF_SECTION *modules);
+void module_instantiate_unlock(void);
+void module_instantiate_lock(void);
 rlm_rcode_t module_authorize(int type, REQUEST *request);
 rlm_rcode_t module_authenticate(int type, REQUEST *request);
 rlm_rcode_t module_preacct(REQUEST *request);
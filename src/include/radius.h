@@ -250,6 +250,7 @@ typedef enum {
 #define PW_FREERADIUS_CLIENT_SRC_IPV6_ADDRESS	1144
 
 #define PW_OTP_CHALLENGE		1145
+#define PW_MODULE_TIMING		1146
 /*
  *	Integer Translations
  */
@@ -210,6 +210,9 @@ struct auth_req {
 	const char		*component; /* ditto */
 
 	int			delay;
+#ifdef WITH_STATS
+	struct timeval		queued;	/* put into the thread queue */
+#endif
 
 	int			master_state;
 	int			child_state;
@@ -297,6 +300,8 @@ typedef struct pair_list {
 	struct pair_list	*lastdefault;
 } PAIR_LIST;
 
+typedef struct pair_db_t PAIR_DB;
+
 typedef int (*rad_listen_recv_t)(rad_listen_t *);
 typedef int (*rad_listen_send_t)(rad_listen_t *, REQUEST *);
 typedef int (*rad_listen_print_t)(const rad_listen_t *, char *, size_t);
@@ -433,6 +438,9 @@ typedef struct main_config_t {
 	const char	*name;
 	const char	*auth_badpass_msg;
 	const char	*auth_goodpass_msg;
+	int		instantiate_threads;
+	int		log_async;
+	int		module_timing;
 } MAIN_CONFIG_T;
 
 #define DEBUG	if(debug_flag)log_debug
@@ -583,6 +591,10 @@ RADCLIENT	*client_read(const char *filename, int in_server, int flag);
 /* files.c */
 int		pairlist_read(const char *file, PAIR_LIST **list, int complain);
 void		pairlist_free(PAIR_LIST **);
+int		pairlist_compile(const char *file, PAIR_LIST *list);
+int		pairlist_db_open(const char *file, PAIR_DB **pdb);
+PAIR_LIST	*pairlist_db_find(PAIR_DB *db, const char *name);
+void		pairlist_db_close(PAIR_DB **pdb);
 
 /* version.c */
 int 		ssl_check_version(void);
@@ -607,6 +619,8 @@ void radlog_request(int lvl, int priority, REQUEST *request, const char *msg, ..
 		__attribute__ ((format (printf, 4, 5)))
 #endif
 ;
+int		radlog_async_start(void);
+void		radlog_async_stop(void);
 
 /* auth.c */
 char	*auth_name(char *buf, size_t buflen, REQUEST *request, int do_cli);
@@ -656,6 +670,12 @@ typedef size_t (*RADIUS_ESCAPE_STRING)(REQUEST *, char *out, size_t outlen, cons
 
 size_t          radius_xlat(char * out, int outlen, const char *fmt,
 			    REQUEST * request, RADIUS_ESCAPE_STRING func, void *funcarg);
+typedef struct xlat_exp_t xlat_exp_t;
+xlat_exp_t	*radius_xlat_compile(const char *fmt);
+size_t		radius_xlat_exp(char *out, int outlen, const xlat_exp_t *exp,
+				REQUEST *request, RADIUS_ESCAPE_STRING func,
+				void *funcarg);
+void		radius_xlat_exp_free(xlat_exp_t **pexp);
 typedef size_t (*RAD_XLAT_FUNC)(void *instance, REQUEST *, const char *, char *, size_t);
 int		xlat_register(const char *module, RAD_XLAT_FUNC func,
 			      void *instance);
@@ -715,6 +735,11 @@ void revive_home_server(void *ctx);
 void mark_home_server_dead(home_server *home, struct timeval *when);
 
 /* evaluate.c */
+typedef struct fr_cond_t fr_cond_t;
+fr_cond_t *radius_cond_compile(const char **ptr);
+int radius_cond_evaluate(REQUEST *request, int modreturn,
+			 const fr_cond_t *cond, int *presult);
+void radius_cond_free(fr_cond_t **pcond);
 int radius_evaluate_condition(REQUEST *request, int modreturn, int depth,
 			      const char **ptr, int evaluate_it, int *presult);
 int radius_update_attrlist(REQUEST *request, CONF_SECTION *cs,
@@ -36,6 +36,12 @@ typedef uint64_t fr_uint_t;
 typedef uint32_t fr_uint_t;
 #endif
 
+/*
+ *	Used by the server, connection pool and TLS histograms.
+ */
+int radius_stats_bucket(const struct timeval *start,
+			const struct timeval *end, uint64_t *usec);
+
 #ifdef WITH_STATS
 typedef struct fr_stats_t {
 	fr_uint_t		total_requests;
@@ -55,6 +61,21 @@ typedef struct fr_stats_t {
 	fr_uint_t		elapsed[8];
 } fr_stats_t;
 
+/*
+ *	Latency histogram, with the same buckets as "elapsed".
+ */
+typedef struct fr_stats_timing_t {
+	fr_uint_t		count;
+	uint64_t		usec;
+	fr_uint_t		elapsed[8];
+} fr_stats_timing_t;
+
+typedef enum fr_stats_latency_t {
+	FR_STATS_LATENCY_QUEUE = 0,	/* waiting for a thread */
+	FR_STATS_LATENCY_PROXY,		/* waiting for a home server */
+	FR_STATS_LATENCY_COUNT
+} fr_stats_latency_t;
+
 typedef struct fr_stats_ema_t {
 	int		window;
 
@@ -88,15 +109,34 @@ void request_stats_reply(REQUEST *request);
 void radius_stats_ema(fr_stats_ema_t *ema,
 		      struct timeval *start, struct timeval *end);
 
-#define FR_STATS_INC(_x, _y) radius_ ## _x ## _stats._y++;if (listener) listener->stats._y++;if (client) client->_x._y++;
-#define FR_STATS_TYPE_INC(_x) _x++
+int radius_stats_module_index(const char *name);
+void radius_stats_module(int index, int component,
+			 const struct timeval *start,
+			 const struct timeval *end);
+void radius_stats_latency(fr_stats_latency_t which,
+			  const struct timeval *start,
+			  const struct timeval *end);
+int radius_stats_module_get(const char *name, fr_stats_timing_t *timing);
+void radius_stats_latency_get(fr_stats_latency_t which,
+			      fr_stats_timing_t *timing);
+
+fr_stats_t *radius_stats_local(fr_stats_t *stats);
+void radius_stats_get(const fr_stats_t *stats, fr_stats_t *out);
+void radius_stats_free(const fr_stats_t *stats);
+
+/*
+ *	Counters are updated per thread, and summed by
+ *	radius_stats_get().  Don't read them directly.
+ */
+#define FR_STATS_INC(_x, _y) radius_stats_local(&radius_ ## _x ## _stats)->_y++;if (listener) radius_stats_local(&listener->stats)->_y++;if (client) radius_stats_local(&client->_x)->_y++;
+#define FR_STATS_TYPE_INC(_x, _y) radius_stats_local(&(_x))->_y++
 
 #else  /* WITH_STATS */
 #define request_stats_init(_x)
 #define request_stats_final(_x)
 
 #define FR_STATS_INC(_x, _y)
-#define FR_STATS_TYPE_INC(_x)
+#define FR_STATS_TYPE_INC(_x, _y)
 
 #endif
 
@@ -39,6 +39,12 @@ RCSID("$Id$")
 #include	<sys/stat.h>
 #endif
 
+#ifdef HAVE_FCNTL_H
+#include	<fcntl.h>
+#endif
+
+#include	<sys/mman.h>
+
 
 #define DICT_VALUE_MAX_NAME_LEN (128)
 #define DICT_VENDOR_MAX_NAME_LEN (128)
@@ -87,6 +93,21 @@ typedef struct value_fixup_t {
  */
 static value_fixup_t *value_fixup = NULL;
 
+/*
+ *	Lookup caches used while reading the dictionaries.  They
+ *	point into the tables, so they're cleared by dict_free().
+ */
+static int max_attr = 0;
+static DICT_VENDOR *last_vendor = NULL;
+static const DICT_ATTR *last_attr = NULL;
+
+/*
+ *	The pre-compiled dictionary cache.  See dict_cache_load().
+ */
+static char *dict_cache_file = NULL;
+static void *dict_cache_map = NULL;
+static size_t dict_cache_len = 0;
+
 const FR_NAME_NUMBER dict_attr_types[] = {
 	{ "integer",	PW_TYPE_INTEGER },
 	{ "string",	PW_TYPE_STRING },
@@ -496,8 +517,17 @@ void dict_free(void)
 
 	memset(dict_base_attrs, 0, sizeof(dict_base_attrs));
 
+	last_vendor = NULL;
+	last_attr = NULL;
+
 	fr_pool_delete(&dict_pool);
 
+	if (dict_cache_map) {
+		munmap(dict_cache_map, dict_cache_len);
+		dict_cache_map = NULL;
+		dict_cache_len = 0;
+	}
+
 	dict_stat_free();
 }
 
@@ -573,7 +603,6 @@ int dict_addattr(const char *name, int attr, unsigned int vendor, int type,
 		 ATTR_FLAGS flags)
 {
 	size_t namelen;
-	static int      max_attr = 0;
 	const char	*p;
 	const DICT_ATTR	*da;
 	DICT_ATTR *n;
@@ -673,7 +702,6 @@ int dict_addattr(const char *name, int attr, unsigned int vendor, int type,
 
 	if ((vendor & (FR_MAX_VENDOR -1)) != 0) {
 		DICT_VENDOR *dv;
-		static DICT_VENDOR *last_vendor = NULL;
 
 		if (flags.has_tlv && (flags.encrypt != FLAG_ENCRYPT_NONE)) {
 			fr_strerror_printf("TLV's cannot be encrypted");
@@ -896,8 +924,6 @@ int dict_addvalue(const char *namestr, const char *attrstr, int value)
 	const DICT_ATTR	*dattr;
 	DICT_VALUE	*dval;
 
-	static const DICT_ATTR *last_attr = NULL;
-
 	if (!*namestr) {
 		fr_strerror_printf("dict_addvalue: empty names are not permitted");
 		return -1;
@@ -2239,26 +2265,10 @@ static int null_callback(void *ctx, void *data)
 
 
 /*
- *	Initialize the directory, then fix the attr member of
- *	all attributes.
+ *	Create the (empty) lookup tables.
  */
-int dict_init(const char *dir, const char *fn)
+static int dict_tables_create(void)
 {
-	/*
-	 *	Check if we need to change anything.  If not, don't do
-	 *	anything.
-	 */
-	if (dict_stat_check(dir, fn)) {
-		return 0;
-	}
-
-	/*
-	 *	Free the dictionaries, and the stat cache.
-	 */
-	dict_free();
-	stat_root_dir = strdup(dir);
-	stat_root_file = strdup(fn);
-
 	/*
 	 *	Create the table of vendor by name.   There MAY NOT
 	 *	be multiple vendors of the same name.
@@ -2333,6 +2343,656 @@ int dict_init(const char *dir, const char *fn)
 		return -1;
 	}
 
+	return 0;
+}
+
+/*
+ *	The pre-compiled dictionary cache.
+ *
+ *	Parsing the text dictionaries is a large part of the start-up
+ *	time.  So once they've been parsed, we write the resolved
+ *	vendors, attributes and values into one file, along with the
+ *	name and mtime of every dictionary file that was read.  On the
+ *	next start (or HUP), if none of those files has changed, the
+ *	cache is mmap'd, and the lookup tables are filled with pointers
+ *	into the map.  There's no parsing, and no per-entry allocation.
+ *
+ *	The file holds the in-memory structures as-is, so it is only
+ *	valid for the build which wrote it.  The header records enough
+ *	to tell when that isn't the case.
+ *
+ *	Layout: the header, then the tables, then the objects.  Each
+ *	table is a count followed by that many file offsets of objects.
+ *	Objects are 8-byte aligned.  An offset of zero means "none".
+ */
+#define DICT_CACHE_MAGIC	"FRDICT\r\n"
+#define DICT_CACHE_VERSION	(2)
+#define DICT_CACHE_ALIGN	(8)
+
+#ifdef RADIUSD_VERSION_COMMIT
+#define DICT_CACHE_BUILD	RADIUSD_VERSION_STRING " " RADIUSD_VERSION_COMMIT
+#else
+#define DICT_CACHE_BUILD	RADIUSD_VERSION_STRING
+#endif
+
+enum {
+	DICT_CACHE_STAT = 0,
+	DICT_CACHE_VENDORS_BYNAME,
+	DICT_CACHE_VENDORS_BYVALUE,
+	DICT_CACHE_ATTRIBUTES_BYNAME,
+	DICT_CACHE_ATTRIBUTES_BYVALUE,
+	DICT_CACHE_ATTRIBUTES_COMBO,
+	DICT_CACHE_VALUES_BYNAME,
+	DICT_CACHE_VALUES_BYVALUE,
+	DICT_CACHE_NUM_TABLES
+};
+
+typedef struct dict_cache_hdr_t {
+	char		magic[8];
+	uint32_t	version;
+	char		build[32];	//!< Server version which wrote it.
+	uint32_t	layout;		//!< Hash of the structure layouts.
+	uint32_t	byte_order;
+	uint32_t	ptr_size;
+	uint32_t	attr_size;
+	uint32_t	value_size;
+	uint32_t	vendor_size;
+	uint32_t	length;
+	int32_t		max_attr;
+	uint32_t	root_dir;
+	uint32_t	root_file;
+	uint32_t	tables[DICT_CACHE_NUM_TABLES];
+	uint32_t	base_attrs[256];
+} dict_cache_hdr_t;
+
+/*
+ *	The sizes above don't notice fields being re-ordered, or
+ *	changing type to one of the same size.
+ */
+static uint32_t dict_cache_layout(void)
+{
+	size_t layout[] = {
+		sizeof(dict_cache_hdr_t),
+		sizeof(ATTR_FLAGS),
+		offsetof(DICT_ATTR, attr),
+		offsetof(DICT_ATTR, type),
+		offsetof(DICT_ATTR, vendor),
+		offsetof(DICT_ATTR, flags),
+		offsetof(DICT_ATTR, name),
+		offsetof(DICT_VALUE, attr),
+		offsetof(DICT_VALUE, vendor),
+		offsetof(DICT_VALUE, value),
+		offsetof(DICT_VALUE, name),
+		offsetof(DICT_VENDOR, vendorpec),
+		offsetof(DICT_VENDOR, type),
+		offsetof(DICT_VENDOR, length),
+		offsetof(DICT_VENDOR, flags),
+		offsetof(DICT_VENDOR, name)
+	};
+
+	return fr_hash(layout, sizeof(layout));
+}
+
+typedef struct dict_cache_stat_t {
+	int64_t		mtime;
+	char		name[1];
+} dict_cache_stat_t;
+
+/*
+ *	State used while writing the cache.
+ */
+typedef struct dict_cache_ctx_t {
+	uint8_t		*data;
+	size_t		len;
+	size_t		size;
+	fr_hash_table_t	*objects;	/* pointer -> file offset */
+	int		type;		/* DICT_CACHE_* of the table */
+	size_t		table;		/* offset of the table */
+	uint32_t	num;		/* entries written to the table */
+} dict_cache_ctx_t;
+
+typedef struct dict_cache_obj_t {
+	const void	*ptr;
+	uint32_t	offset;
+} dict_cache_obj_t;
+
+static fr_hash_table_t **dict_cache_tables[DICT_CACHE_NUM_TABLES] = {
+	NULL,
+	&vendors_byname,
+	&vendors_byvalue,
+	&attributes_byname,
+	&attributes_byvalue,
+	&attributes_combo,
+	&values_byname,
+	&values_byvalue
+};
+
+/*
+ *	Smallest valid object in each table.
+ */
+static const size_t dict_cache_min_size[DICT_CACHE_NUM_TABLES] = {
+	sizeof(dict_cache_stat_t),
+	sizeof(DICT_VENDOR),
+	sizeof(DICT_VENDOR),
+	sizeof(DICT_ATTR),
+	sizeof(DICT_ATTR),
+	sizeof(DICT_ATTR),
+	sizeof(DICT_VALUE),
+	sizeof(DICT_VALUE)
+};
+
+/*
+ *	Set (or clear) the file used to cache the dictionaries.  It's
+ *	used by the next dict_init() which has to read them.
+ */
+void dict_set_cache(const char *file)
+{
+	free(dict_cache_file);
+	dict_cache_file = NULL;
+
+	if (file && *file) dict_cache_file = strdup(file);
+}
+
+static uint32_t dict_cache_obj_hash(const void *data)
+{
+	const dict_cache_obj_t *obj = data;
+
+	return fr_hash(&obj->ptr, sizeof(obj->ptr));
+}
+
+static int dict_cache_obj_cmp(const void *one, const void *two)
+{
+	const dict_cache_obj_t *a = one;
+	const dict_cache_obj_t *b = two;
+
+	if (a->ptr < b->ptr) return -1;
+	if (a->ptr > b->ptr) return +1;
+	return 0;
+}
+
+/*
+ *	Reserve space at the end of the cache, and return its offset.
+ */
+static uint32_t dict_cache_reserve(dict_cache_ctx_t *ctx, size_t size)
+{
+	size_t offset;
+
+	offset = ctx->len;
+	if ((offset & (DICT_CACHE_ALIGN - 1)) != 0) {
+		offset += DICT_CACHE_ALIGN - (offset & (DICT_CACHE_ALIGN - 1));
+	}
+
+	if ((offset + size) > 0x7fffffff) return 0;
+
+	if ((offset + size) > ctx->size) {
+		uint8_t *data;
+		size_t newsize = ctx->size * 2;
+
+		while (newsize < (offset + size)) newsize *= 2;
+
+		data = realloc(ctx->data, newsize);
+		if (!data) return 0;
+
+		memset(data + ctx->size, 0, newsize - ctx->size);
+		ctx->data = data;
+		ctx->size = newsize;
+	}
+
+	ctx->len = offset + size;
+
+	return offset;
+}
+
+static uint32_t dict_cache_string(dict_cache_ctx_t *ctx, const char *str)
+{
+	uint32_t offset;
+	size_t len = strlen(str) + 1;
+
+	offset = dict_cache_reserve(ctx, len);
+	if (offset) memcpy(ctx->data + offset, str, len);
+
+	return offset;
+}
+
+/*
+ *	Write an object to the cache, unless it's already there.
+ */
+static uint32_t dict_cache_object(dict_cache_ctx_t *ctx, const void *ptr)
+{
+	size_t size, used;
+	dict_cache_obj_t my_obj, *obj;
+
+	my_obj.ptr = ptr;
+	obj = fr_hash_table_finddata(ctx->objects, &my_obj);
+	if (obj) return obj->offset;
+
+	switch (ctx->type) {
+	case DICT_CACHE_VENDORS_BYNAME:
+	case DICT_CACHE_VENDORS_BYVALUE:
+		used = offsetof(DICT_VENDOR, name) +
+			strlen(((const DICT_VENDOR *) ptr)->name) + 1;
+		break;
+
+	case DICT_CACHE_ATTRIBUTES_BYNAME:
+	case DICT_CACHE_ATTRIBUTES_BYVALUE:
+		used = offsetof(DICT_ATTR, name) +
+			strlen(((const DICT_ATTR *) ptr)->name) + 1;
+		break;
+
+		/*
+		 *	The combo-IP copies don't have room for the
+		 *	name.
+		 */
+	case DICT_CACHE_ATTRIBUTES_COMBO:
+		used = sizeof(DICT_ATTR);
+		break;
+
+	case DICT_CACHE_VALUES_BYNAME:
+	case DICT_CACHE_VALUES_BYVALUE:
+		used = offsetof(DICT_VALUE, name) +
+			strlen(((const DICT_VALUE *) ptr)->name) + 1;
+		break;
+
+	default:
+		return 0;
+	}
+
+	size = used;
+	if (size < dict_cache_min_size[ctx->type]) {
+		size = dict_cache_min_size[ctx->type];
+	}
+
+	obj = malloc(sizeof(*obj));
+	if (!obj) return 0;
+
+	obj->ptr = ptr;
+	obj->offset = dict_cache_reserve(ctx, size);
+	if (!obj->offset) {
+		free(obj);
+		return 0;
+	}
+
+	memcpy(ctx->data + obj->offset, ptr, used);
+
+	if (!fr_hash_table_insert(ctx->objects, obj)) {
+		free(obj);
+		return 0;
+	}
+
+	return obj->offset;
+}
+
+static int dict_cache_walk(void *ctx, void *data)
+{
+	dict_cache_ctx_t *this = ctx;
+	uint32_t offset;
+
+	if (this->num >= ((uint32_t *) (this->data + this->table))[0]) {
+		return 1;
+	}
+
+	offset = dict_cache_object(this, data);
+	if (!offset) return 1;
+
+	this->num++;
+	((uint32_t *) (this->data + this->table))[this->num] = offset;
+
+	return 0;
+}
+
+/*
+ *	Write the dictionaries we just parsed to the cache file.
+ *
+ *	Failure isn't an error.  We just parse the text files again
+ *	next time.
+ */
+static void dict_cache_save(const char *dir, const char *fn)
+{
+	int i, fd;
+	size_t len;
+	uint32_t num;
+	ssize_t rcode;
+	char buffer[1024];
+	dict_cache_ctx_t ctx;
+	dict_cache_hdr_t *hdr;
+	dict_stat_t *this;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.size = 65536;
+	ctx.data = malloc(ctx.size);
+	if (!ctx.data) return;
+	memset(ctx.data, 0, ctx.size);
+
+	ctx.objects = fr_hash_table_create(dict_cache_obj_hash,
+					   dict_cache_obj_cmp, free);
+	if (!ctx.objects) goto done;
+
+	/*
+	 *	Reserve the header and all of the tables first, so
+	 *	that the objects follow them.
+	 */
+	ctx.len = sizeof(*hdr);
+
+	for (i = 0; i < DICT_CACHE_NUM_TABLES; i++) {
+		if (i == DICT_CACHE_STAT) {
+			num = 0;
+			for (this = stat_head; this != NULL; this = this->next) {
+				num++;
+			}
+		} else {
+			num = fr_hash_table_num_elements(*dict_cache_tables[i]);
+		}
+
+		ctx.table = dict_cache_reserve(&ctx, (num + 1) * sizeof(uint32_t));
+		if (!ctx.table) goto done;
+
+		((uint32_t *) (ctx.data + ctx.table))[0] = num;
+		((dict_cache_hdr_t *) ctx.data)->tables[i] = ctx.table;
+	}
+
+	for (i = 0; i < DICT_CACHE_NUM_TABLES; i++) {
+		ctx.type = i;
+		ctx.table = ((dict_cache_hdr_t *) ctx.data)->tables[i];
+		ctx.num = 0;
+
+		if (i != DICT_CACHE_STAT) {
+			if (fr_hash_table_walk(*dict_cache_tables[i],
+					       dict_cache_walk, &ctx) != 0) {
+				goto done;
+			}
+		} else for (this = stat_head; this != NULL; this = this->next) {
+			uint32_t offset;
+			dict_cache_stat_t *stat_entry;
+
+			len = offsetof(dict_cache_stat_t, name) +
+				strlen(this->name) + 1;
+			if (len < sizeof(*stat_entry)) len = sizeof(*stat_entry);
+			offset = dict_cache_reserve(&ctx, len);
+			if (!offset) goto done;
+
+			stat_entry = (dict_cache_stat_t *) (ctx.data + offset);
+			stat_entry->mtime = this->mtime;
+			strcpy(stat_entry->name, this->name);
+
+			ctx.num++;
+			((uint32_t *) (ctx.data + ctx.table))[ctx.num] = offset;
+		}
+
+		/*
+		 *	The table was sized before we walked it, so it
+		 *	had better be full.
+		 */
+		if (ctx.num != ((uint32_t *) (ctx.data + ctx.table))[0]) {
+			goto done;
+		}
+	}
+
+	for (i = 0; i < 256; i++) {
+		if (!dict_base_attrs[i]) continue;
+
+		ctx.type = DICT_CACHE_ATTRIBUTES_BYVALUE;
+		num = dict_cache_object(&ctx, dict_base_attrs[i]);
+		if (!num) goto done;
+
+		((dict_cache_hdr_t *) ctx.data)->base_attrs[i] = num;
+	}
+
+	/*
+	 *	The strings go last, so that the file ends with a NUL.
+	 */
+	num = dict_cache_string(&ctx, dir);
+	if (!num) goto done;
+	((dict_cache_hdr_t *) ctx.data)->root_dir = num;
+
+	num = dict_cache_string(&ctx, fn);
+	if (!num) goto done;
+	hdr = (dict_cache_hdr_t *) ctx.data;
+	hdr->root_file = num;
+
+	memcpy(hdr->magic, DICT_CACHE_MAGIC, sizeof(hdr->magic));
+	hdr->version = DICT_CACHE_VERSION;
+	strlcpy(hdr->build, DICT_CACHE_BUILD, sizeof(hdr->build));
+	hdr->layout = dict_cache_layout();
+	hdr->byte_order = 0x01020304;
+	hdr->ptr_size = sizeof(void *);
+	hdr->attr_size = sizeof(DICT_ATTR);
+	hdr->value_size = sizeof(DICT_VALUE);
+	hdr->vendor_size = sizeof(DICT_VENDOR);
+	hdr->length = ctx.len;
+	hdr->max_attr = max_attr;
+
+	/*
+	 *	Write a temporary file, and rename it into place.
+	 *	Anyone who has the old one mapped keeps using it.
+	 */
+	snprintf(buffer, sizeof(buffer), "%s.%u", dict_cache_file,
+		 (unsigned int) getpid());
+
+	fd = open(buffer, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+	if (fd < 0) goto done;
+
+	len = 0;
+	while (len < ctx.len) {
+		rcode = write(fd, ctx.data + len, ctx.len - len);
+		if (rcode < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+		len += rcode;
+	}
+
+	if ((close(fd) < 0) || (len < ctx.len) ||
+	    (rename(buffer, dict_cache_file) < 0)) {
+		unlink(buffer);
+	}
+
+done:
+	fr_hash_table_free(ctx.objects);
+	free(ctx.data);
+}
+
+/*
+ *	Return a table from the cache, if it fits in the file.
+ */
+static const uint32_t *dict_cache_table(const uint8_t *map, size_t len,
+					uint32_t offset)
+{
+	const uint32_t *table;
+
+	if ((offset < sizeof(dict_cache_hdr_t)) ||
+	    ((offset & (sizeof(uint32_t) - 1)) != 0) ||
+	    ((offset + sizeof(uint32_t)) > len)) {
+		return NULL;
+	}
+
+	table = (const uint32_t *) (map + offset);
+	if (table[0] > ((len - offset) / sizeof(uint32_t)) - 1) return NULL;
+
+	return table;
+}
+
+/*
+ *	Return an object from the cache, if it fits in the file.
+ */
+static void *dict_cache_ptr(uint8_t *map, size_t len, uint32_t offset,
+			    size_t size)
+{
+	if ((offset < sizeof(dict_cache_hdr_t)) ||
+	    ((offset & (DICT_CACHE_ALIGN - 1)) != 0) ||
+	    (size > len) || (offset > (len - size))) {
+		return NULL;
+	}
+
+	return map + offset;
+}
+
+/*
+ *	Load the dictionaries from the cache file, if none of the
+ *	files it was built from has changed since.
+ */
+static int dict_cache_load(const char *dir, const char *fn)
+{
+	int i, fd;
+	uint32_t j;
+	uint8_t *map;
+	size_t len;
+	struct stat buf;
+	const char *str;
+	const uint32_t *table;
+	const dict_cache_hdr_t *hdr;
+
+	fd = open(dict_cache_file, O_RDONLY);
+	if (fd < 0) return -1;
+
+	if ((fstat(fd, &buf) < 0) ||
+	    !S_ISREG(buf.st_mode) ||
+#ifdef S_IWOTH
+	    ((buf.st_mode & S_IWOTH) != 0) ||
+#endif
+	    (buf.st_size < (off_t) sizeof(*hdr)) ||
+	    (buf.st_size > 0x7fffffff)) {
+		close(fd);
+		return -1;
+	}
+	len = buf.st_size;
+
+	/*
+	 *	Private, so that changes to the entries (e.g. new
+	 *	flags) don't go back to the file.
+	 */
+	map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) return -1;
+
+	dict_cache_map = map;
+	dict_cache_len = len;
+
+	hdr = (const dict_cache_hdr_t *) map;
+	if ((memcmp(hdr->magic, DICT_CACHE_MAGIC, sizeof(hdr->magic)) != 0) ||
+	    (hdr->version != DICT_CACHE_VERSION) ||
+	    (strncmp(hdr->build, DICT_CACHE_BUILD, sizeof(hdr->build)) != 0) ||
+	    (hdr->layout != dict_cache_layout()) ||
+	    (hdr->byte_order != 0x01020304) ||
+	    (hdr->ptr_size != sizeof(void *)) ||
+	    (hdr->attr_size != sizeof(DICT_ATTR)) ||
+	    (hdr->value_size != sizeof(DICT_VALUE)) ||
+	    (hdr->vendor_size != sizeof(DICT_VENDOR)) ||
+	    (hdr->length != len) ||
+	    (map[len - 1] != '\0')) {
+		return -1;
+	}
+
+	/*
+	 *	The file ends with a string, so none of the names can
+	 *	run off the end of the map.
+	 */
+
+	/*
+	 *	It must have been built from the same root
+	 *	dictionary.
+	 */
+	str = dict_cache_ptr(map, len, hdr->root_dir, 1);
+	if (!str || (strcmp(str, dir) != 0)) return -1;
+
+	str = dict_cache_ptr(map, len, hdr->root_file, 1);
+	if (!str || (strcmp(str, fn) != 0)) return -1;
+
+	/*
+	 *	And none of the dictionaries can have changed.  This
+	 *	also fills in the stat list, for the next HUP.
+	 */
+	table = dict_cache_table(map, len, hdr->tables[DICT_CACHE_STAT]);
+	if (!table || (table[0] == 0)) return -1;
+
+	for (j = 1; j <= table[0]; j++) {
+		const dict_cache_stat_t *stat_entry;
+
+		stat_entry = dict_cache_ptr(map, len, table[j],
+					    sizeof(*stat_entry));
+		if (!stat_entry) return -1;
+
+		if (stat(stat_entry->name, &buf) < 0) return -1;
+
+		if ((int64_t) buf.st_mtime != stat_entry->mtime) return -1;
+
+		dict_stat_add(stat_entry->name, &buf);
+	}
+
+	if (dict_tables_create() < 0) return -1;
+
+	for (i = 0; i < DICT_CACHE_NUM_TABLES; i++) {
+		void *ptr;
+
+		if (i == DICT_CACHE_STAT) continue;
+
+		table = dict_cache_table(map, len, hdr->tables[i]);
+		if (!table) return -1;
+
+		for (j = 1; j <= table[0]; j++) {
+			ptr = dict_cache_ptr(map, len, table[j],
+					     dict_cache_min_size[i]);
+			if (!ptr) return -1;
+
+			if (!fr_hash_table_insert(*dict_cache_tables[i], ptr)) {
+				return -1;
+			}
+		}
+	}
+
+	for (i = 0; i < 256; i++) {
+		if (!hdr->base_attrs[i]) continue;
+
+		dict_base_attrs[i] = dict_cache_ptr(map, len,
+						    hdr->base_attrs[i],
+						    sizeof(DICT_ATTR));
+		if (!dict_base_attrs[i]) return -1;
+	}
+
+	if (hdr->max_attr > max_attr) max_attr = hdr->max_attr;
+
+	return 0;
+}
+
+/*
+ *	Initialize the directory, then fix the attr member of
+ *	all attributes.
+ */
+int dict_init(const char *dir, const char *fn)
+{
+	/*
+	 *	Check if we need to change anything.  If not, don't do
+	 *	anything.
+	 */
+	if (dict_stat_check(dir, fn)) {
+		return 0;
+	}
+
+	/*
+	 *	Free the dictionaries, and the stat cache.
+	 */
+	dict_free();
+
+	/*
+	 *	Use the pre-compiled dictionaries if they're still
+	 *	current.  Otherwise, throw away anything we loaded
+	 *	from them, and parse the text files.
+	 */
+	if (dict_cache_file) {
+		if (dict_cache_load(dir, fn) == 0) {
+			stat_root_dir = strdup(dir);
+			stat_root_file = strdup(fn);
+			goto done;
+		}
+		dict_free();
+	}
+
+	stat_root_dir = strdup(dir);
+	stat_root_file = strdup(fn);
+
+	if (dict_tables_create() < 0) {
+		return -1;
+	}
+
 	value_fixup = NULL;	/* just to be safe. */
 
 	if (my_dict_init(dir, fn, NULL, 0) < 0)
@@ -2382,6 +3042,11 @@ int dict_init(const char *dir, const char *fn)
 		}
 	}
 
+	if (dict_cache_file) {
+		dict_cache_save(dir, fn);
+	}
+
+done:
 	/*
 	 *	Walk over all of the hash tables to ensure they're
 	 *	initialized.  We do this because the threads may perform
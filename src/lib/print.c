@@ -461,10 +461,15 @@ int vp_prints_value_json(char *buffer, size_t bufsize, const VALUE_PAIR *vp)
 
 		default:
 			/* -1 to account for trailing double quote */
-			s = bufsize - ((p - buffer) - 1);
+			s = bufsize - ((p - buffer) + 1);
 			
+			/*
+			 *	vp_prints_value returns 0 if the value
+			 *	doesn't fit.  None of these types print
+			 *	as an empty string.
+			 */
 			len = vp_prints_value(p, s, vp, 0);
-			if (len >= (s - 1)) return -1;
+			if ((len == 0) || (len >= (s - 1))) return -1;
 			
 			p += len;
 			break;
@@ -0,0 +1,258 @@
+/*
+ * regex.c	Per-thread cache of compiled regular expressions.
+ *
+ * Version:	$Id$
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ *  Copyright 2013  The FreeRADIUS server project
+ */
+
+#include <freeradius-devel/ident.h>
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+
+#ifdef HAVE_PCREPOSIX_H
+#define WITH_REGEX
+#  include	<pcreposix.h>
+#else
+#ifdef HAVE_REGEX_H
+#define WITH_REGEX
+#  include	<regex.h>
+#endif
+#endif
+
+#ifdef WITH_REGEX
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+/*
+ *	Patterns in check items, users files and policies are
+ *	compared against every request.  Rather than compiling them
+ *	each time, each thread keeps the most recently used ones.
+ */
+#define FR_REGEX_CACHE_SIZE (256)
+
+typedef struct fr_regex_entry_t {
+	struct fr_regex_entry_t	*prev;
+	struct fr_regex_entry_t	*next;
+	uint32_t		hash;
+	int			cflags;
+	char			*pattern;
+	regex_t			reg;
+} fr_regex_entry_t;
+
+typedef struct fr_regex_cache_t {
+	fr_hash_table_t		*ht;
+	fr_regex_entry_t	*head;	/* most recently used */
+	fr_regex_entry_t	*tail;	/* least recently used */
+} fr_regex_cache_t;
+
+static uint32_t regex_entry_hash(const void *data)
+{
+	return ((const fr_regex_entry_t *) data)->hash;
+}
+
+static int regex_entry_cmp(const void *one, const void *two)
+{
+	const fr_regex_entry_t *a = one;
+	const fr_regex_entry_t *b = two;
+
+	if (a->cflags != b->cflags) return a->cflags - b->cflags;
+
+	return strcmp(a->pattern, b->pattern);
+}
+
+static void regex_entry_free(void *data)
+{
+	fr_regex_entry_t *entry = data;
+
+	regfree(&entry->reg);
+	free(entry->pattern);
+	free(entry);
+}
+
+static void regex_cache_free(void *data)
+{
+	fr_regex_cache_t *cache = data;
+
+	fr_hash_table_free(cache->ht);
+	free(cache);
+}
+
+static void regex_unlink(fr_regex_cache_t *cache, fr_regex_entry_t *entry)
+{
+	if (entry->prev) {
+		entry->prev->next = entry->next;
+	} else {
+		cache->head = entry->next;
+	}
+
+	if (entry->next) {
+		entry->next->prev = entry->prev;
+	} else {
+		cache->tail = entry->prev;
+	}
+
+	entry->prev = entry->next = NULL;
+}
+
+static void regex_push(fr_regex_cache_t *cache, fr_regex_entry_t *entry)
+{
+	entry->prev = NULL;
+	entry->next = cache->head;
+	if (cache->head) cache->head->prev = entry;
+	cache->head = entry;
+	if (!cache->tail) cache->tail = entry;
+}
+
+#ifdef HAVE_PTHREAD_H
+static pthread_key_t  fr_regex_key;
+static pthread_once_t fr_regex_once = PTHREAD_ONCE_INIT;
+
+static void fr_regex_make_key(void)
+{
+	pthread_key_create(&fr_regex_key, regex_cache_free);
+}
+#else
+static fr_regex_cache_t *fr_regex_cache = NULL;
+#endif
+
+static fr_regex_cache_t *regex_cache_get(void)
+{
+	fr_regex_cache_t *cache;
+
+#ifdef HAVE_PTHREAD_H
+	pthread_once(&fr_regex_once, fr_regex_make_key);
+
+	cache = pthread_getspecific(fr_regex_key);
+#else
+	cache = fr_regex_cache;
+#endif
+	if (cache) return cache;
+
+	cache = malloc(sizeof(*cache));
+	if (!cache) return NULL;
+	memset(cache, 0, sizeof(*cache));
+
+	cache->ht = fr_hash_table_create(regex_entry_hash, regex_entry_cmp,
+					 regex_entry_free);
+	if (!cache->ht) {
+		free(cache);
+		return NULL;
+	}
+
+#ifdef HAVE_PTHREAD_H
+	pthread_setspecific(fr_regex_key, cache);
+#else
+	fr_regex_cache = cache;
+#endif
+
+	return cache;
+}
+
+/** Find or compile a regular expression
+ *
+ * The result is a regex_t owned by the calling thread's cache.  It
+ * stays valid until another FR_REGEX_CACHE_SIZE patterns have been
+ * compiled by the same thread, so it should be used straight away.
+ * The caller must not regfree() it.
+ * The return type is "void *" so that this header doesn't have to pick
+ * between pcreposix.h and regex.h for the caller.
+ *
+ * @param[in] pattern to compile.
+ * @param[in] cflags passed to regcomp().
+ * @param[out] errbuf where the regcomp() error is written on failure.
+ * @param[in] errlen size of errbuf.
+ * @return a regex_t, or NULL if the pattern is invalid.
+ */
+void *fr_regcomp_cached(const char *pattern, int cflags,
+			char *errbuf, size_t errlen)
+{
+	int rcode;
+	fr_regex_cache_t *cache;
+	fr_regex_entry_t my_entry, *entry;
+
+	cache = regex_cache_get();
+	if (!cache) {
+		strlcpy(errbuf, "Out of memory", errlen);
+		return NULL;
+	}
+
+	memcpy(&my_entry.pattern, &pattern, sizeof(my_entry.pattern));
+	my_entry.cflags = cflags;
+	my_entry.hash = fr_hash_update(&cflags, sizeof(cflags),
+				       fr_hash_string(pattern));
+
+	entry = fr_hash_table_finddata(cache->ht, &my_entry);
+	if (entry) {
+		if (cache->head != entry) {
+			regex_unlink(cache, entry);
+			regex_push(cache, entry);
+		}
+		return &entry->reg;
+	}
+
+	entry = malloc(sizeof(*entry));
+	if (!entry) {
+		strlcpy(errbuf, "Out of memory", errlen);
+		return NULL;
+	}
+	memset(entry, 0, sizeof(*entry));
+
+	rcode = regcomp(&entry->reg, pattern, cflags);
+	if (rcode != 0) {
+		regerror(rcode, &entry->reg, errbuf, errlen);
+		free(entry);
+		return NULL;
+	}
+
+	entry->pattern = strdup(pattern);
+	entry->cflags = cflags;
+	entry->hash = my_entry.hash;
+
+	if (!entry->pattern ||
+	    !fr_hash_table_insert(cache->ht, entry)) {
+		regex_entry_free(entry);
+		strlcpy(errbuf, "Out of memory", errlen);
+		return NULL;
+	}
+	regex_push(cache, entry);
+
+	/*
+	 *	Throw away the least recently used one.
+	 */
+	if (fr_hash_table_num_elements(cache->ht) > FR_REGEX_CACHE_SIZE) {
+		fr_regex_entry_t *old = cache->tail;
+
+		regex_unlink(cache, old);
+		fr_hash_table_delete(cache->ht, old);
+	}
+
+	return &entry->reg;
+}
+
+#else  /* WITH_REGEX */
+
+void *fr_regcomp_cached(UNUSED const char *pattern, UNUSED int cflags,
+			char *errbuf, size_t errlen)
+{
+	strlcpy(errbuf, "Regular expressions are not supported", errlen);
+	return NULL;
+}
+#endif /* WITH_REGEX */
@@ -1816,17 +1816,11 @@ VALUE_PAIR *pairmake(const char *attribute, const char *value, FR_TOKEN op)
 
 		pairbasicfree(vp);
 		
-		if (1) {
-			int compare;
-			regex_t reg;
-			
-			compare = regcomp(&reg, value, REG_EXTENDED);
-			if (compare != 0) {
-				regerror(compare, &reg, buffer, sizeof(buffer));
-				fr_strerror_printf("Illegal regular expression in attribute: %s: %s",
+		if (!fr_regcomp_cached(value, REG_EXTENDED,
+				       buffer, sizeof(buffer))) {
+			fr_strerror_printf("Illegal regular expression in attribute: %s: %s",
 					   attribute, buffer);
-				return NULL;
-			}
+			return NULL;
 		}
 
 		return pairmake_xlat(attribute, value, op);
@@ -2198,13 +2192,12 @@ int paircmp(VALUE_PAIR *one, VALUE_PAIR *two)
 		return -1;
 #else
 		{
-			regex_t reg;
+			regex_t *reg;
 			char buffer[MAX_STRING_LEN * 4 + 1];
 
-			compare = regcomp(&reg, one->vp_strvalue,
-					  REG_EXTENDED);
-			if (compare != 0) {
-				regerror(compare, &reg, buffer, sizeof(buffer));
+			reg = fr_regcomp_cached(one->vp_strvalue, REG_EXTENDED,
+						buffer, sizeof(buffer));
+			if (!reg) {
 				fr_strerror_printf("Illegal regular expression in attribute: %s: %s",
 					   one->name, buffer);
 				return -1;
@@ -2216,9 +2209,8 @@ int paircmp(VALUE_PAIR *one, VALUE_PAIR *two)
 			 *	Don't care about substring matches,
 			 *	oh well...
 			 */
-			compare = regexec(&reg, buffer, 0, NULL, 0);
+			compare = regexec(reg, buffer, 0, NULL, 0);
 
-			regfree(&reg);
 			if (one->op == T_OP_REG_EQ) return (compare == 0);
 			return (compare != 0);
 		}
@@ -108,6 +108,17 @@ void client_free(RADCLIENT *client)
 	free(client->client_server);
 #endif
 
+#ifdef WITH_STATS
+	radius_stats_free(&client->auth);
+#ifdef WITH_ACCOUNTING
+	radius_stats_free(&client->acct);
+#endif
+#ifdef WITH_COA
+	radius_stats_free(&client->coa);
+	radius_stats_free(&client->dsc);
+#endif
+#endif
+
 	free(client);
 }
 
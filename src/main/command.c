@@ -566,6 +566,84 @@ static int command_show_module_flags(rad_listen_t *listener, int argc, char *arg
 }
 
 
+static const char *elapsed_names[8] = {
+	"1us", "10us", "100us", "1ms", "10ms", "100ms", "1s", "10s"
+};
+
+static int command_show_pool(rad_listen_t *listener, int argc, char *argv[])
+{
+	int i;
+	fr_connection_pool_stats_t stats;
+
+	if (argc != 1) {
+		cprintf(listener, "ERROR: No pool name was given\n");
+		return 0;
+	}
+
+	if (!fr_connection_pool_stats(argv[0], &stats)) {
+		cprintf(listener, "ERROR: No connection pool \"%s\"\n",
+			argv[0]);
+		return 0;
+	}
+
+	cprintf(listener, "\tconnections\t%d\n", stats.num);
+	cprintf(listener, "\tactive\t\t%d\n", stats.active);
+	cprintf(listener, "\tmax\t\t%d\n", stats.max);
+	cprintf(listener, "\topened\t\t%u\n", stats.opened);
+	cprintf(listener, "\tfailed\t\t%u\n", stats.failed);
+	cprintf(listener, "\tclosed\t\t%u\n", stats.closed);
+	cprintf(listener, "\treconnected\t%u\n", stats.reconnected);
+	cprintf(listener, "\tat_max\t\t%u\n", stats.at_max);
+	cprintf(listener, "\treserved\t%u\n", stats.reserved);
+
+	for (i = 0; i < 8; i++) {
+		cprintf(listener, "\tacquire.%s\t%u\n",
+			elapsed_names[i], stats.acquire_time[i]);
+	}
+	for (i = 0; i < 8; i++) {
+		cprintf(listener, "\thold.%s\t%u\n",
+			elapsed_names[i], stats.hold_time[i]);
+	}
+
+	return 1;		/* success */
+}
+
+#ifdef WITH_TLS
+static int command_show_tls(rad_listen_t *listener, UNUSED int argc, UNUSED char *argv[])
+{
+	int i, n;
+	CONF_SECTION *cs;
+	fr_tls_handshake_stats_t stats;
+
+	for (n = 0; tls_handshake_stats(n, &cs, &stats); n++) {
+		const char *name1 = cf_section_name1(cs);
+		const char *name2 = cf_section_name2(cs);
+
+		if (name2) {
+			cprintf(listener, "%s %s {\n", name1, name2);
+		} else {
+			cprintf(listener, "%s {\n", name1);
+		}
+
+		cprintf(listener, "\tactive\t\t%d\n", stats.active);
+		cprintf(listener, "\tmax_active\t%d\n", stats.max_active);
+		cprintf(listener, "\tstarted\t\t%u\n", stats.started);
+		cprintf(listener, "\trejected\t%u\n", stats.rejected);
+		cprintf(listener, "\tqueue\t\tnone\n");
+		cprintf(listener, "\tsteps\t\t%u\n", stats.steps);
+
+		for (i = 0; i < 8; i++) {
+			cprintf(listener, "\tstep.%s\t%u\n",
+				elapsed_names[i], stats.step_time[i]);
+		}
+
+		cprintf(listener, "}\n");
+	}
+
+	return 1;		/* success */
+}
+#endif
+
 /*
  *	Show all loaded modules
  */
@@ -1453,6 +1531,14 @@ static fr_command_table_t command_table_show[] = {
 	{ "module", FR_READ,
 	  "show module <command> - do sub-command of module",
 	  NULL, command_table_show_module },
+	{ "pool", FR_READ,
+	  "show pool <name> - show connection pool statistics for given pool (usually the module name)",
+	  command_show_pool, NULL },
+#ifdef WITH_TLS
+	{ "tls", FR_READ,
+	  "show tls - show TLS handshake statistics",
+	  command_show_tls, NULL },
+#endif
 	{ "uptime", FR_READ,
 	  "show uptime - shows time at which server started",
 	  command_uptime, NULL },
@@ -1589,10 +1675,6 @@ static int command_set_module_status(rad_listen_t *listener, int argc, char *arg
 }
 
 #ifdef WITH_STATS
-static const char *elapsed_names[8] = {
-	"1us", "10us", "100us", "1ms", "10ms", "100ms", "1s", "10s"
-};
-
 #undef PU
 #ifdef WITH_STATS_64BIT
 #ifdef PRIu64
@@ -1612,6 +1694,10 @@ static int command_print_stats(rad_listen_t *listener, fr_stats_t *stats,
 			       int auth, int server)
 {
 	int i;
+	fr_stats_t sum;
+
+	radius_stats_get(stats, &sum);
+	stats = &sum;
 
 	cprintf(listener, "\trequests\t" PU "\n", stats->total_requests);
 	cprintf(listener, "\tresponses\t" PU "\n", stats->total_responses);
@@ -1853,6 +1939,62 @@ static int command_stats_socket(rad_listen_t *listener, int argc, char *argv[])
 
 	return command_print_stats(listener, &sock->stats, auth, 0);
 }
+
+static void command_print_timing(rad_listen_t *listener, const char *name,
+				 const fr_stats_timing_t *timing)
+{
+	int i;
+
+	cprintf(listener, "\t%s.count\t" PU "\n", name, timing->count);
+	cprintf(listener, "\t%s.usec\t%" PRIu64 "\n", name, timing->usec);
+	for (i = 0; i < 8; i++) {
+		cprintf(listener, "\t%s.%s\t" PU "\n",
+			name, elapsed_names[i], timing->elapsed[i]);
+	}
+}
+
+static int command_stats_module(rad_listen_t *listener, int argc, char *argv[])
+{
+	int i;
+	fr_stats_timing_t timing[RLM_COMPONENT_COUNT];
+
+	if (argc != 1) {
+		cprintf(listener, "ERROR: No module name was given\n");
+		return 0;
+	}
+
+	if (!radius_stats_module_get(argv[0], timing)) {
+		cprintf(listener, "ERROR: No such module \"%s\"\n", argv[0]);
+		return 0;
+	}
+
+	/*
+	 *	Only print the sections the module was called from.
+	 */
+	for (i = 0; i < RLM_COMPONENT_COUNT; i++) {
+		if (!timing[i].count) continue;
+
+		command_print_timing(listener, section_type_value[i].section,
+				     &timing[i]);
+	}
+
+	return 1;
+}
+
+static int command_stats_latency(rad_listen_t *listener, UNUSED int argc, UNUSED char *argv[])
+{
+	fr_stats_timing_t timing;
+
+	radius_stats_latency_get(FR_STATS_LATENCY_QUEUE, &timing);
+	command_print_timing(listener, "queue", &timing);
+
+#ifdef WITH_PROXY
+	radius_stats_latency_get(FR_STATS_LATENCY_PROXY, &timing);
+	command_print_timing(listener, "proxy", &timing);
+#endif
+
+	return 1;
+}
 #endif	/* WITH_STATS */
 
 
@@ -2009,6 +2151,14 @@ static fr_command_table_t command_table_stats[] = {
 	  command_stats_home_server, NULL },
 #endif
 
+	{ "latency", FR_READ,
+	  "stats latency - show how long requests wait for a thread, and for home servers",
+	  command_stats_latency, NULL },
+
+	{ "module", FR_READ,
+	  "stats module <name> - show how long the calls to a module take",
+	  command_stats_module, NULL },
+
 	{ "socket", FR_READ,
 	  "stats socket <ipaddr> <port> "
 #ifdef WITH_TCP
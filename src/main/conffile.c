@@ -1038,23 +1038,30 @@ int cf_item_parse(CONF_SECTION *cs, const char *name,
 		*q = value ? strdup(value) : NULL;
 
 		/*
-		 *	And now we "stat" the file.
-		 *
-		 *	FIXME: This appears to leak memory on exit,
-		 *	and we don't use this information.  So it's
-		 *	commented out for now.
+		 *	And now we "stat" the file.  A HUP uses this
+		 *	to see if the module has to be re-loaded.  See
+		 *	cf_section_cmp().
 		 */
-		if (0 && *q) {
+		if (*q && cs) {
 			struct stat buf;
 
 			if (stat(*q, &buf) == 0) {
 				time_t *mtime;
+				CONF_DATA *cd;
+
+				cd = cf_data_find_internal(cs, *q,
+							   PW_TYPE_FILENAME);
+				if (cd) {
+					*(time_t *) cd->data = buf.st_mtime;
+					break;
+				}
 
 				mtime = rad_malloc(sizeof(*mtime));
 				*mtime = buf.st_mtime;
-				/* FIXME: error? */
-				cf_data_add_internal(cs, *q, mtime, free,
-						     PW_TYPE_FILENAME);
+				if (cf_data_add_internal(cs, *q, mtime, free,
+							 PW_TYPE_FILENAME) < 0) {
+					free(mtime);
+				}
 			}
 		}
 		break;
@@ -2477,75 +2484,6 @@ int cf_data_add(CONF_SECTION *cs, const char *name,
 	return cf_data_add_internal(cs, name, data, data_free, 0);
 }
 
-#if 0
-/*
- *	Copy CONF_DATA from src to dst
- */
-static void cf_section_copy_data(CONF_SECTION *s, CONF_SECTION *d)
-{
-
-	CONF_ITEM *cd, *next, **last;
-
-	/*
-	 *	Don't check if s->data_tree is NULL.  It's child
-	 *	sections may have data, even if this section doesn't.
-	 */
-
-	rad_assert(d->data_tree == NULL);
-	d->data_tree = s->data_tree;
-	s->data_tree = NULL;
-
-	/*
-	 *	Walk through src, moving CONF_ITEM_DATA
-	 *	to dst, by hand.
-	 */
-	last = &(s->children);
-	for (cd = s->children; cd != NULL; cd = next) {
-		next = cd->next;
-
-		/*
-		 *	Recursively copy data from child sections.
-		 */
-		if (cd->type == CONF_ITEM_SECTION) {
-			CONF_SECTION *s1, *d1;
-
-			s1 = cf_itemtosection(cd);
-			d1 = cf_section_sub_find_name2(d, s1->name1, s1->name2);
-			if (d1) {
-				cf_section_copy_data(s1, d1);
-			}
-			last = &(cd->next);
-			continue;
-		}
-
-		/*
-		 *	Not conf data, remember last ptr.
-		 */
-		if (cd->type != CONF_ITEM_DATA) {
-			last = &(cd->next);
-			continue;
-		}
-
-		/*
-		 *	Remove it from the src list
-		 */
-		*last = cd->next;
-		cd->next = NULL;
-
-		/*
-		 *	Add it to the dst list
-		 */
-		if (!d->children) {
-			rad_assert(d->tail == NULL);
-			d->children = cd;
-		} else {
-			rad_assert(d->tail != NULL);
-			d->tail->next = cd;
-		}
-		d->tail = cd;
-	}
-}
-
 /*
  *	For a CONF_DATA element, stat the filename, if necessary.
  */
@@ -2568,9 +2506,11 @@ static int filename_stat(void *context, void *data)
 
 /*
  *	Compare two CONF_SECTIONS.  The items MUST be in the same
- *	order.
+ *	order.  Returns 1 if they're the same, and none of the files
+ *	named by PW_TYPE_FILENAME items in "a" has changed since "a"
+ *	was parsed.  Returns 0 otherwise.
  */
-static int cf_section_cmp(CONF_SECTION *a, CONF_SECTION *b)
+int cf_section_cmp(CONF_SECTION *a, CONF_SECTION *b)
 {
 	CONF_ITEM *ca = a->children;
 	CONF_ITEM *cb = b->children;
@@ -2609,6 +2549,12 @@ static int cf_section_cmp(CONF_SECTION *a, CONF_SECTION *b)
 			CONF_SECTION *sa = cf_itemtosection(ca);
 			CONF_SECTION *sb = cf_itemtosection(cb);
 
+			if ((strcmp(sa->name1, sb->name1) != 0) ||
+			    (!sa->name2 != !sb->name2) ||
+			    (sa->name2 && (strcmp(sa->name2, sb->name2) != 0))) {
+				return 0;
+			}
+
 			if (!cf_section_cmp(sa, sb)) return 0;
 			goto next;
 		}
@@ -2622,7 +2568,8 @@ static int cf_section_cmp(CONF_SECTION *a, CONF_SECTION *b)
 		 *	Different attr and/or value, Exit.
 		 */
 		if ((strcmp(pa->attr, pb->attr) != 0) ||
-		    (strcmp(pa->value, pb->value) != 0)) return 0;
+		    (!pa->value != !pb->value) ||
+		    (pa->value && (strcmp(pa->value, pb->value) != 0))) return 0;
 
 
 		/*
@@ -2648,6 +2595,75 @@ static int cf_section_cmp(CONF_SECTION *a, CONF_SECTION *b)
 }
 
 
+#if 0
+/*
+ *	Copy CONF_DATA from src to dst
+ */
+static void cf_section_copy_data(CONF_SECTION *s, CONF_SECTION *d)
+{
+
+	CONF_ITEM *cd, *next, **last;
+
+	/*
+	 *	Don't check if s->data_tree is NULL.  It's child
+	 *	sections may have data, even if this section doesn't.
+	 */
+
+	rad_assert(d->data_tree == NULL);
+	d->data_tree = s->data_tree;
+	s->data_tree = NULL;
+
+	/*
+	 *	Walk through src, moving CONF_ITEM_DATA
+	 *	to dst, by hand.
+	 */
+	last = &(s->children);
+	for (cd = s->children; cd != NULL; cd = next) {
+		next = cd->next;
+
+		/*
+		 *	Recursively copy data from child sections.
+		 */
+		if (cd->type == CONF_ITEM_SECTION) {
+			CONF_SECTION *s1, *d1;
+
+			s1 = cf_itemtosection(cd);
+			d1 = cf_section_sub_find_name2(d, s1->name1, s1->name2);
+			if (d1) {
+				cf_section_copy_data(s1, d1);
+			}
+			last = &(cd->next);
+			continue;
+		}
+
+		/*
+		 *	Not conf data, remember last ptr.
+		 */
+		if (cd->type != CONF_ITEM_DATA) {
+			last = &(cd->next);
+			continue;
+		}
+
+		/*
+		 *	Remove it from the src list
+		 */
+		*last = cd->next;
+		cd->next = NULL;
+
+		/*
+		 *	Add it to the dst list
+		 */
+		if (!d->children) {
+			rad_assert(d->tail == NULL);
+			d->children = cd;
+		} else {
+			rad_assert(d->tail != NULL);
+			d->tail->next = cd;
+		}
+		d->tail = cd;
+	}
+}
+
 /*
  *	Migrate CONF_DATA from one section to another.
  */
@@ -27,6 +27,7 @@
 RCSID("$Id$")
 
 #include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/modules.h>
 
 #include <freeradius-devel/connection.h>
 
@@ -50,6 +51,8 @@ struct fr_connection {
 	time_t		start;		//!< Time connection was created.
 	time_t		last_used;	//!< Last time the connection was
 					//!< reserved.
+	struct timeval	reserved;	//!< When the connection was last
+					//!< reserved, for hold time stats.
 					
 	int		num_uses;	//!< Number of times the connection
 					//!< has been reserved.
@@ -117,11 +120,24 @@ struct fr_connection_pool_t {
 					//!< connections.
 
 	fr_connection_t	*head;		//!< Start of the connection list.
+					//!< Idle connections are kept at the
+					//!< head, most recently released first,
+					//!< and reserved ones at the tail.
 	fr_connection_t *tail;		//!< End of the connection list.
+
+	fr_hash_table_t	*handles;	//!< Connections indexed by the handle
+					//!< the module uses, so release doesn't
+					//!< have to walk the list.
 					
 	int		spawning;	//!< Whether we are currently attempting
 					//!< to spawn a new connection.
 
+	fr_connection_pool_stats_t stats; //!< Counters and histograms,
+					//!< protected by the mutex.
+	char		*name;		//!< Name used to find the pool's
+					//!< statistics.
+	fr_connection_pool_t *next;	//!< Next pool in the global list.
+
 #ifdef HAVE_PTHREAD_H
 	pthread_mutex_t	mutex;		//!< Mutex used to keep consistent state
 					//!< when making modifications in 
@@ -152,6 +168,15 @@ struct fr_connection_pool_t {
 #define pthread_mutex_unlock(_x)
 #endif
 
+/*
+ *	All of the pools, so that their statistics can be found
+ *	by radmin and Status-Server.
+ */
+static fr_connection_pool_t *pool_list = NULL;
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t pool_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
 static const CONF_PARSER connection_config[] = {
 	{ "start",    PW_TYPE_INTEGER, offsetof(fr_connection_pool_t, start),
 	  0, "5" },
@@ -228,6 +253,88 @@ static void fr_connection_link(fr_connection_pool_t *pool,
 }
 
 
+/** Record how long an operation took
+ *
+ * Updates a histogram using the same buckets as the request statistics,
+ * and a running total in microseconds.
+ *
+ * @note Must be called with the mutex held.
+ *
+ * @param[in,out] histogram to update.
+ * @param[in,out] total to add the elapsed time to.
+ * @param[in] start of the operation.
+ * @param[in] end of the operation.
+ */
+static void fr_connection_time(uint32_t *histogram, uint64_t *total,
+			       const struct timeval *start,
+			       const struct timeval *end)
+{
+	int i;
+	uint64_t delay;
+
+	i = radius_stats_bucket(start, end, &delay);
+	if (i < 0) return;
+
+	*total += delay;
+	histogram[i]++;
+}
+
+/** Adds a connection to the end of the connection list
+ *
+ * @note Must be called with the mutex held.
+ *
+ * @param[in,out] pool to modify.
+ * @param[in] this Connection to add.
+ */
+static void fr_connection_link_tail(fr_connection_pool_t *pool,
+				    fr_connection_t *this)
+{
+	rad_assert(pool != NULL);
+	rad_assert(this != NULL);
+	rad_assert(pool->head != this);
+	rad_assert(pool->tail != this);
+
+	if (pool->tail) pool->tail->next = this;
+	this->prev = pool->tail;
+	this->next = NULL;
+	pool->tail = this;
+	if (!pool->head) {
+		rad_assert(this->prev == NULL);
+		pool->head = this;
+	} else {
+		rad_assert(this->prev != NULL);
+	}
+}
+
+/** Hash a connection by its handle
+ *
+ * @param[in] data fr_connection_t to hash.
+ * @return hash of the connection handle pointer.
+ */
+static uint32_t fr_connection_hash(const void *data)
+{
+	const fr_connection_t *this = data;
+
+	return fr_hash(&this->connection, sizeof(this->connection));
+}
+
+/** Compare two connections by their handles
+ *
+ * @param[in] one first fr_connection_t.
+ * @param[in] two second fr_connection_t.
+ * @return 0 if both connections wrap the same handle.
+ */
+static int fr_connection_cmp(const void *one, const void *two)
+{
+	const fr_connection_t *a = one;
+	const fr_connection_t *b = two;
+
+	if (a->connection < b->connection) return -1;
+	if (a->connection > b->connection) return +1;
+
+	return 0;
+}
+
 /** Spawns a new connection
  *
  * Spawns a new connection using the create callback, and returns it for
@@ -315,7 +422,11 @@ static fr_connection_t *fr_connection_spawn(fr_connection_pool_t *pool,
 		       
 		pool->last_failed = now;
 		free(this);
-		pool->spawning = FALSE; /* atomic, so no lock is needed */
+
+		pthread_mutex_lock(&pool->mutex);
+		pool->stats.failed++;
+		pool->spawning = FALSE;
+		pthread_mutex_unlock(&pool->mutex);
 		return NULL;
 	}
 	
@@ -334,7 +445,9 @@ static fr_connection_t *fr_connection_spawn(fr_connection_pool_t *pool,
 	this->number = pool->count++;
 	this->last_used = now;
 	fr_connection_link(pool, this);
+	fr_hash_table_insert(pool->handles, this);
 	pool->num++;
+	pool->stats.opened++;
 	pool->spawning = FALSE;
 	pool->last_spawned = time(NULL);
 
@@ -393,7 +506,9 @@ int fr_connection_add(fr_connection_pool_t *pool, void *conn)
 	this->number = pool->count++;
 	this->last_used = time(NULL);
 	fr_connection_link(pool, this);
+	fr_hash_table_insert(pool->handles, this);
 	pool->num++;
+	pool->stats.opened++;
 
 	pthread_mutex_unlock(&pool->mutex);
 
@@ -422,16 +537,17 @@ static void fr_connection_close(fr_connection_pool_t *pool,
 	rad_assert(this->in_use == FALSE);
 
 	fr_connection_unlink(pool, this);
+	fr_hash_table_yank(pool->handles, this);
 	pool->delete(pool->ctx, this->connection);
 	rad_assert(pool->num > 0);
 	pool->num--;
+	pool->stats.closed++;
 	free(this);
 }
 
 /** Find a connection handle in the connection list
  *
- * Walks over the list of connections searching for a specified connection
- * handle and returns the first connection that contains that pointer.
+ * Looks up the connection which wraps the specified handle.
  * 
  * @note Will lock mutex and only release mutex if connection handle
  * is not found, so will usually return will mutex held.
@@ -444,20 +560,16 @@ static void fr_connection_close(fr_connection_pool_t *pool,
  */
 static fr_connection_t *fr_connection_find(fr_connection_pool_t *pool, void *conn)
 {
-	fr_connection_t *this;
+	fr_connection_t my_conn, *this;
 
 	if (!pool || !conn) return NULL;
 
+	my_conn.connection = conn;
+
 	pthread_mutex_lock(&pool->mutex);
 
-	/*
-	 *	FIXME: This loop could be avoided if we passed a 'void
-	 *	**connection' instead.  We could use "offsetof" in
-	 *	order to find top of the parent structure.
-	 */
-	for (this = pool->head; this != NULL; this = this->next) {
-		if (this->connection == conn) return this;
-	}
+	this = fr_hash_table_finddata(pool->handles, &my_conn);
+	if (this) return this;
 
 	pthread_mutex_unlock(&pool->mutex);
 	return NULL;
@@ -513,11 +625,21 @@ int fr_connection_del(fr_connection_pool_t *pool, void *conn)
 void fr_connection_pool_delete(fr_connection_pool_t *pool)
 {
 	fr_connection_t *this, *next;
+	fr_connection_pool_t **last;
 
 	if (!pool) return;
 
 	DEBUG("%s: Removing connection pool", pool->log_prefix);
 
+	pthread_mutex_lock(&pool_list_mutex);
+	for (last = &pool_list; *last != NULL; last = &(*last)->next) {
+		if (*last == pool) {
+			*last = pool->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&pool_list_mutex);
+
 	pthread_mutex_lock(&pool->mutex);
 
 	for (this = pool->head; this != NULL; this = next) {
@@ -543,7 +665,9 @@ void fr_connection_pool_delete(fr_connection_pool_t *pool)
 		cf_section_parse_free(pool->cs, pool);
 	}
 	
+	fr_hash_table_free(pool->handles);
 	free(pool->log_prefix);
+	free(pool->name);
 	free(pool);
 }
 
@@ -571,6 +695,7 @@ fr_connection_pool_t *fr_connection_pool_init(CONF_SECTION *parent,
 					      fr_connection_delete_t d)
 {
 	int i, lp_len;
+	int unlocked = FALSE;
 	fr_connection_pool_t *pool;
 	fr_connection_t *this;
 	CONF_SECTION *modules;
@@ -594,6 +719,13 @@ fr_connection_pool_t *fr_connection_pool_init(CONF_SECTION *parent,
 
 	pool->head = pool->tail = NULL;
 
+	pool->handles = fr_hash_table_create(fr_connection_hash,
+					     fr_connection_cmp, NULL);
+	if (!pool->handles) {
+		free(pool);
+		return NULL;
+	}
+
 #ifdef HAVE_PTHREAD_H
 	pthread_mutex_init(&pool->mutex, NULL);
 #endif
@@ -612,11 +744,13 @@ fr_connection_pool_t *fr_connection_pool_init(CONF_SECTION *parent,
 			pool->log_prefix = rad_malloc(lp_len);
 			snprintf(pool->log_prefix, lp_len, LOG_PREFIX, cs_name1,
 				 cs_name2);
+			pool->name = strdup(cs_name2);
 		}
 	} else {		/* not a module configuration */
 		cs_name1 = cf_section_name1(parent);
 
 		pool->log_prefix = strdup(cs_name1);
+		pool->name = strdup(cs_name1);
 	}
 	
 	DEBUG("%s: Initialising connection pool", pool->log_prefix);
@@ -653,16 +787,35 @@ fr_connection_pool_t *fr_connection_pool_init(CONF_SECTION *parent,
 	 *	not to.
 	 */
 	for (i = 0; i < pool->start; i++) {
+		/*
+		 *	The first connection may initialise the client
+		 *	library, so it's opened as usual.  Other
+		 *	modules can be instantiated while we open the
+		 *	rest.
+		 */
+		if (i == 1) {
+			module_instantiate_unlock();
+			unlocked = TRUE;
+		}
+
 		this = fr_connection_spawn(pool, now);	
 		if (!this) {
+			if (unlocked) module_instantiate_lock();
 		error:
 			fr_connection_pool_delete(pool);
 			return NULL;
 		}
 	}
 
+	if (unlocked) module_instantiate_lock();
+
 	if (pool->trigger) exec_trigger(NULL, pool->cs, "start", TRUE);
 
+	pthread_mutex_lock(&pool_list_mutex);
+	pool->next = pool_list;
+	pool_list = pool;
+	pthread_mutex_unlock(&pool_list_mutex);
+
 	return pool;
 }
 
@@ -833,17 +986,17 @@ int fr_connection_check(fr_connection_pool_t *pool, void *conn)
 	if (!pool) return 1;
 
 	now = time(NULL);
-	pthread_mutex_lock(&pool->mutex);
 
-	if (!conn) return fr_connection_pool_check(pool);
-
-	for (this = pool->head; this != NULL; this = this->next) {
-		if (this->connection == conn) {
-			ret = fr_connection_manage(pool, conn, now);
-			break;
-		}
+	if (!conn) {
+		pthread_mutex_lock(&pool->mutex);
+		return fr_connection_pool_check(pool);
 	}
 
+	this = fr_connection_find(pool, conn);
+	if (!this) return 1;
+
+	ret = fr_connection_manage(pool, this, now);
+
 	pthread_mutex_unlock(&pool->mutex);
 
 	return ret;
@@ -855,6 +1008,10 @@ int fr_connection_check(fr_connection_pool_t *pool, void *conn)
  * found, will mark it as in in use increment the number of active connections
  * and return the connection handle.
  *
+ * Idle connections are kept at the head of the connection list, so this is
+ * a constant time operation, and the most recently released connection
+ * (the one most likely to still be warm) is used first.
+ *
  * If no free connections are found will attempt to spawn a new one, conditional
  * on a connection spawning not already being in progress, and not being at the
  * 'max' connection limit.
@@ -869,18 +1026,18 @@ int fr_connection_check(fr_connection_pool_t *pool, void *conn)
 void *fr_connection_get(fr_connection_pool_t *pool)
 {
 	time_t now;
-	fr_connection_t *this, *next;
+	struct timeval when;
+	fr_connection_t *this;
 
 	if (!pool) return NULL;
 
+	gettimeofday(&when, NULL);
+
 	pthread_mutex_lock(&pool->mutex);
 
-	now = time(NULL);
-	for (this = pool->head; this != NULL; this = next) {
-		next = this->next;
-
-		if (!this->in_use) goto do_return;
-	}
+	now = when.tv_sec;
+	this = pool->head;
+	if (this && !this->in_use) goto do_return;
 
 	if (pool->num == pool->max) {
 		int complain = FALSE;
@@ -892,6 +1049,7 @@ void *fr_connection_get(fr_connection_pool_t *pool)
 			complain = TRUE;
 			pool->last_at_max = now;
 		}
+		pool->stats.at_max++;
 		
 		pthread_mutex_unlock(&pool->mutex);
 		
@@ -909,11 +1067,25 @@ void *fr_connection_get(fr_connection_pool_t *pool)
 	pthread_mutex_lock(&pool->mutex);
 
 do_return:
+	/*
+	 *	Move it to the tail of the list, behind all of the
+	 *	idle connections.
+	 */
+	if (this != pool->tail) {
+		fr_connection_unlink(pool, this);
+		fr_connection_link_tail(pool, this);
+	}
+
 	pool->active++;
 	this->num_uses++;
 	this->last_used = now;
 	this->in_use = TRUE;
 
+	gettimeofday(&this->reserved, NULL);
+	pool->stats.reserved++;
+	fr_connection_time(pool->stats.acquire_time, &pool->stats.acquire_usec,
+			   &when, &this->reserved);
+
 	pthread_mutex_unlock(&pool->mutex);
 	
 	DEBUG("%s: Reserved connection (%i)", pool->log_prefix, this->number);
@@ -932,6 +1104,7 @@ do_return:
  */
 void fr_connection_release(fr_connection_pool_t *pool, void *conn)
 {
+	struct timeval now;
 	fr_connection_t *this;
 
 	this = fr_connection_find(pool, conn);
@@ -939,6 +1112,10 @@ void fr_connection_release(fr_connection_pool_t *pool, void *conn)
 
 	rad_assert(this->in_use == TRUE);
 	this->in_use = FALSE;
+
+	gettimeofday(&now, NULL);
+	fr_connection_time(pool->stats.hold_time, &pool->stats.hold_usec,
+			   &this->reserved, &now);
 	
 	/*
 	 *	Put it at the head of the list, so
@@ -1003,6 +1180,8 @@ void *fr_connection_reconnect(fr_connection_pool_t *pool, void *conn)
 	rad_assert(this->in_use == TRUE);
 	
 	DEBUG("%s: Reconnecting (%i)", pool->log_prefix, conn_number);
+
+	pool->stats.reconnected++;
 	
 	new_conn = pool->create(pool->ctx);
 	if (!new_conn) {
@@ -1037,8 +1216,71 @@ void *fr_connection_reconnect(fr_connection_pool_t *pool, void *conn)
 		return NULL;
 	}
 	
+	fr_hash_table_yank(pool->handles, this);
 	pool->delete(pool->ctx, conn);
 	this->connection = new_conn;
+	fr_hash_table_insert(pool->handles, this);
 	pthread_mutex_unlock(&pool->mutex);
 	return new_conn;
 }
+
+/** Set the name used to find a pool's statistics
+ *
+ * Pools are named after the module instance which created them.  A
+ * module with more than one pool should give each of them a name of
+ * its own.
+ *
+ * @param[in] pool to name.
+ * @param[in] name to give it.
+ */
+void fr_connection_pool_set_name(fr_connection_pool_t *pool, const char *name)
+{
+	char *copy;
+
+	copy = strdup(name);
+	if (!copy) return;
+
+	pthread_mutex_lock(&pool_list_mutex);
+	free(pool->name);
+	pool->name = copy;
+	pthread_mutex_unlock(&pool_list_mutex);
+}
+
+/** Get the statistics for a connection pool
+ *
+ * Finds the connection pool with the given name, and takes a snapshot
+ * of its counters.  If there is more than one with that name (e.g.
+ * just after a HUP), the newest one is used.
+ *
+ * @param[in] name of the pool, usually the name of the module
+ *	instance.
+ * @param[out] stats where to write the counters.
+ * @return 0 if there is no such pool, else 1.
+ */
+int fr_connection_pool_stats(const char *name,
+			     fr_connection_pool_stats_t *stats)
+{
+	fr_connection_pool_t *pool;
+
+	pthread_mutex_lock(&pool_list_mutex);
+
+	for (pool = pool_list; pool != NULL; pool = pool->next) {
+		if (pool->name && (strcmp(pool->name, name) == 0)) break;
+	}
+
+	if (!pool) {
+		pthread_mutex_unlock(&pool_list_mutex);
+		return 0;
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+	*stats = pool->stats;
+	stats->num = pool->num;
+	stats->active = pool->active;
+	stats->max = pool->max;
+	pthread_mutex_unlock(&pool->mutex);
+
+	pthread_mutex_unlock(&pool_list_mutex);
+
+	return 1;
+}
@@ -204,292 +204,215 @@ static const FR_NAME_NUMBER modreturn_table[] = {
 
 
 /*
- *	*presult is "did comparison match or not"
+ *	A condition, compiled when the configuration is loaded.
+ *
+ *	A group is a list of children, each of which is joined to the
+ *	previous one by "&&" or "||".  They are evaluated left to
+ *	right, with no precedence: evaluation stops at the first "&&"
+ *	with a false result, or "||" with a true one.
  */
-static int radius_do_cmp(REQUEST *request, int *presult,
-			 FR_TOKEN lt, const char *pleft, FR_TOKEN token,
-			 FR_TOKEN rt, const char *pright,
-			 int cflags, int modreturn)
-{
-	int result;
-	uint32_t lint, rint;
-	VALUE_PAIR *vp = NULL;
+typedef enum cond_type_t {
+	COND_TYPE_GROUP = 0,
+	COND_TYPE_CMP
+} cond_type_t;
+
+typedef enum cond_op_t {
+	COND_OP_NONE = 0,
+	COND_OP_AND,
+	COND_OP_OR
+} cond_op_t;
+
+struct fr_cond_t {
+	cond_type_t		type;
+	cond_op_t		op;		//!< Joins us to the previous
+						//!< sibling.
+	int			invert;
+	fr_cond_t		*next;
+	fr_cond_t		*children;	//!< For groups.
+
+	/*
+	 *	For comparisons.
+	 */
+	char			*text;		//!< For debug messages.
+	FR_TOKEN		lt;
+	char			*left;
+	FR_TOKEN		token;
+	FR_TOKEN		rt;
+	char			*right;
+
+	int			rcode;		//!< Module return code,
+						//!< or -1.
+	int			is_attr;	//!< Left is an attribute.
+	value_pair_tmpl_t	vpt;
+	const DICT_ATTR		*cmp_da;	//!< For paircompare
+						//!< callbacks.
+	VALUE_PAIR		*rvp;		//!< Pre-parsed right value.
+
 #ifdef HAVE_REGEX_H
-	char buffer[8192];
-#else
-	cflags = cflags;	/* -Wunused */
+	int			cflags;
+	int			regex_compiled;
+	regex_t			reg;
 #endif
+};
 
-	rt = rt;		/* -Wunused */
+/*
+ *	Resolve a bare word to an attribute or list.  Unlike
+ *	radius_parse_attr(), this doesn't complain about words which
+ *	aren't attributes, as they're just strings.
+ */
+static int cond_parse_attr(const char *name, value_pair_tmpl_t *vpt)
+{
+	const char *p = name;
 
-	if (lt == T_BARE_WORD) {
-		/*
-		 *	Maybe check the last return code.
-		 */
-		if (token == T_OP_CMP_TRUE) {
-			int isreturn;
+	memset(vpt, 0, sizeof(*vpt));
+	vpt->name = name;
 
-			/*
-			 *	Looks like a return code, treat is as such.
-			 */
-			isreturn = fr_str2int(modreturn_table, pleft, -1);
-			if (isreturn != -1) {
-				*presult = (modreturn == isreturn);
-				return TRUE;
-			}
-		}
+	vpt->request = radius_request_name(&p, REQUEST_CURRENT);
+	if (vpt->request == REQUEST_UNKNOWN) return -1;
 
-		/*
-		 *	Bare words on the left can be attribute names.
-		 */
-		if (!(radius_get_vp(request, pleft, &vp) < 0)) {
-			VALUE_PAIR myvp;
+	vpt->list = radius_list_name(&p, PAIR_LIST_REQUEST);
+	if (vpt->list == PAIR_LIST_UNKNOWN) return -1;
 
-			/*
-			 *	VP exists, and that's all we're looking for.
-			 */
-			if (token == T_OP_CMP_TRUE) {
-				*presult = (vp != NULL);
-				return TRUE;
-			}
+	if (*p == '\0') {
+		vpt->type = VPT_TYPE_LIST;
+		return 0;
+	}
 
-			if (!vp) {
-				const DICT_ATTR *da;
-				
-				/*
-				 *	The attribute on the LHS may
-				 *	have been a dynamically
-				 *	registered callback.  i.e. it
-				 *	doesn't exist as a VALUE_PAIR.
-				 *	If so, try looking for it.
-				 */
-				da = dict_attrbyname(pleft);
-				if (da && (da->vendor == 0) && radius_find_compare(da->attr)) {
-					VALUE_PAIR *check = pairmake(pleft, pright, token);
-					*presult = (radius_callback_compare(request, NULL, check, NULL, NULL) == 0);
-					RDEBUG3("  Callback returns %d",
-						*presult);
-					pairfree(&check);
-					return TRUE;
-				}
-				
-				RDEBUG2("    (Attribute %s was not found)",
-				       pleft);
-				*presult = 0;
-				return TRUE;
-			}
+	vpt->da = dict_attrbyname(p);
+	if (!vpt->da) return -1;
 
-#ifdef HAVE_REGEX_H
-			/*
-			 * 	Regex comparisons treat everything as
-			 *	strings.
-			 */
-			if ((token == T_OP_REG_EQ) ||
-			    (token == T_OP_REG_NE)) {
-				vp_prints_value(buffer, sizeof(buffer), vp, 0);
-				pleft = buffer;
-				goto do_checks;
-			}
-#endif
+	vpt->type = VPT_TYPE_ATTR;
+	return 0;
+}
 
-			memcpy(&myvp, vp, sizeof(myvp));
-			if (!pairparsevalue(&myvp, pright)) {
-				RDEBUG2("Failed parsing \"%s\": %s",
-				       pright, fr_strerror());
-				return FALSE;
-			}
+static VALUE_PAIR *cond_find_vp(REQUEST *request, const value_pair_tmpl_t *vpt)
+{
+	VALUE_PAIR **vps;
 
-			myvp.op = token;
-			*presult = paircmp(&myvp, vp);
-			RDEBUG3("  paircmp -> %d", *presult);
-			return TRUE;
-		} /* else it's not a VP in a list */
-	}
+	if (radius_request(&request, vpt->request) < 0) return NULL;
+
+	vps = radius_list(request, vpt->list);
+	if (!vps) return NULL;
+
+	if (vpt->type == VPT_TYPE_LIST) return *vps;
+
+	return pairfind(*vps, vpt->da->attr, vpt->da->vendor, TAG_ANY);
+}
 
+void radius_cond_free(fr_cond_t **pcond)
+{
+	fr_cond_t *c, *next;
+
+	for (c = *pcond; c != NULL; c = next) {
+		next = c->next;
+
+		radius_cond_free(&c->children);
+
+		free(c->text);
+		free(c->left);
+		free(c->right);
+		pairfree(&c->rvp);
 #ifdef HAVE_REGEX_H
-	do_checks:
+		if (c->regex_compiled) regfree(&c->reg);
 #endif
-	switch (token) {
-	case T_OP_GE:
-	case T_OP_GT:
-	case T_OP_LE:
-	case T_OP_LT:
-		if (!all_digits(pright)) {
-			RDEBUG2("    (Right field is not a number at: %s)", pright);
-			return FALSE;
-		}
-		rint = strtoul(pright, NULL, 0);
-		if (!all_digits(pleft)) {
-			RDEBUG2("    (Left field is not a number at: %s)", pleft);
-			return FALSE;
-		}
-		lint = strtoul(pleft, NULL, 0);
-		break;
-		
-	default:
-		lint = rint = 0;  /* quiet the compiler */
-		break;
+		free(c);
 	}
-	
-	switch (token) {
-	case T_OP_CMP_TRUE:
-		/*
-		 *	Check for truth or falsehood.
-		 */
-		if (all_digits(pleft)) {
-			lint = strtoul(pleft, NULL, 0);
-			result = (lint != 0);
-			
-		} else {
-			result = (*pleft != '\0');
-		}
-		break;
-		
 
-	case T_OP_CMP_EQ:
-		result = (strcmp(pleft, pright) == 0);
-		break;
-		
-	case T_OP_NE:
-		result = (strcmp(pleft, pright) != 0);
-		break;
-		
-	case T_OP_GE:
-		result = (lint >= rint);
-		break;
-		
-	case T_OP_GT:
-		result = (lint > rint);
-		break;
-		
-	case T_OP_LE:
-		result = (lint <= rint);
-		break;
-		
-	case T_OP_LT:
-		result = (lint < rint);
-		break;
+	*pcond = NULL;
+}
 
-#ifdef HAVE_REGEX_H
-	case T_OP_REG_EQ: {
-		int i, compare;
-		regex_t reg;
-		regmatch_t rxmatch[REQUEST_MAX_REGEX + 1];
-		
+/*
+ *	Pre-process the operands of a comparison.
+ */
+static int cond_compile_cmp(fr_cond_t *c)
+{
+	c->rcode = -1;
+
+	if (c->lt == T_BARE_WORD) {
 		/*
-		 *	Include substring matches.
+		 *	Maybe check the last return code.
 		 */
-		compare = regcomp(&reg, pright, cflags);
-		if (compare != 0) {
-			if (debug_flag) {
-				char errbuf[128];
-
-				regerror(compare, &reg, errbuf, sizeof(errbuf));
-				DEBUG("ERROR: Failed compiling regular expression: %s", errbuf);
-			}
-			return FALSE;
+		if (c->token == T_OP_CMP_TRUE) {
+			c->rcode = fr_str2int(modreturn_table, c->left, -1);
+			if (c->rcode != -1) return TRUE;
 		}
 
-		compare = regexec(&reg, pleft,
-				  REQUEST_MAX_REGEX + 1,
-				  rxmatch, 0);
-		regfree(&reg);
-		
 		/*
-		 *	Add new %{0}, %{1}, etc.
+		 *	Bare words on the left can be attribute names.
 		 */
-		if (compare == 0) for (i = 0; i <= REQUEST_MAX_REGEX; i++) {
-			char *r;
-
-			free(request_data_get(request, request,
-					      REQUEST_DATA_REGEX | i));
-
-			/*
-			 *	No %{i}, skip it.
-			 *	We MAY have %{2} without %{1}.
-			 */
-			if (rxmatch[i].rm_so == -1) continue;
-			
-			/*
-			 *	Copy substring into allocated buffer
-			 */
-			r = rad_malloc(rxmatch[i].rm_eo -rxmatch[i].rm_so + 1);
-			memcpy(r, pleft + rxmatch[i].rm_so,
-			       rxmatch[i].rm_eo - rxmatch[i].rm_so);
-			r[rxmatch[i].rm_eo - rxmatch[i].rm_so] = '\0';
-
-			request_data_add(request, request,
-					 REQUEST_DATA_REGEX | i,
-					 r, free);
+		if (cond_parse_attr(c->left, &c->vpt) == 0) {
+			c->is_attr = TRUE;
+			c->cmp_da = dict_attrbyname(c->left);
 		}
-		result = (compare == 0);
 	}
-		break;
-		
-	case T_OP_REG_NE: {
+
+#ifdef HAVE_REGEX_H
+	if ((c->token == T_OP_REG_EQ) ||
+	    (c->token == T_OP_REG_NE)) {
 		int compare;
-		regex_t reg;
-		regmatch_t rxmatch[REQUEST_MAX_REGEX + 1];
-		
+
 		/*
-		 *	Include substring matches.
+		 *	Regexes which are expanded at run time have to
+		 *	be compiled at run time.
 		 */
-		compare = regcomp(&reg, pright, cflags);
+		if (strchr(c->right, '%')) return TRUE;
+
+		compare = regcomp(&c->reg, c->right, c->cflags);
 		if (compare != 0) {
-			if (debug_flag) {
-				char errbuf[128];
+			char errbuf[128];
 
-				regerror(compare, &reg, errbuf, sizeof(errbuf));
-				DEBUG("ERROR: Failed compiling regular expression: %s", errbuf);
-			}
+			regerror(compare, &c->reg, errbuf, sizeof(errbuf));
+			radlog(L_ERR, "Failed compiling regular expression \"%s\": %s",
+			       c->right, errbuf);
 			return FALSE;
 		}
-
-		compare = regexec(&reg, pleft,
-				  REQUEST_MAX_REGEX + 1,
-				  rxmatch, 0);
-		regfree(&reg);
-		
-		result = (compare != 0);
+		c->regex_compiled = TRUE;
+		return TRUE;
 	}
-		break;
 #endif
-		
-	default:
-		DEBUG("ERROR: Comparison operator %s is not supported",
-		      fr_token_name(token));
-		result = FALSE;
-		break;
+
+	/*
+	 *	Parse literal values for attribute comparisons now,
+	 *	rather than for every request.  If the value doesn't
+	 *	parse, we leave it to be reported at run time.
+	 */
+	if (c->is_attr && (c->vpt.type == VPT_TYPE_ATTR) &&
+	    (c->token != T_OP_CMP_TRUE) &&
+	    ((c->rt == T_BARE_WORD) ||
+	     (c->rt == T_SINGLE_QUOTED_STRING) ||
+	     ((c->rt == T_DOUBLE_QUOTED_STRING) && !strchr(c->right, '%')))) {
+		c->rvp = pairalloc(c->vpt.da);
+		if (c->rvp && !pairparsevalue(c->rvp, c->right)) {
+			pairfree(&c->rvp);
+		}
+		if (c->rvp) c->rvp->op = c->token;
 	}
-	
-	*presult = result;
+
 	return TRUE;
 }
 
-
-int radius_evaluate_condition(REQUEST *request, int modreturn, int depth,
-			      const char **ptr, int evaluate_it, int *presult)
+static fr_cond_t *cond_parse(const char **ptr, int depth)
 {
 	int found_condition = FALSE;
-	int result = TRUE;
 	int invert = FALSE;
-	int evaluate_next_condition = evaluate_it;
+	cond_op_t op = COND_OP_NONE;
 	const char *p;
 	const char *q, *start;
 	FR_TOKEN token, lt, rt;
 	char left[1024], right[1024], comp[4];
-	const char *pleft, *pright;
-	char  xleft[1024], xright[1024];
+	fr_cond_t *group, *c, **tail;
 	int cflags = 0;
-	
+
 	if (!ptr || !*ptr || (depth >= 64)) {
 		radlog(L_ERR, "Internal sanity check failed in evaluate condition");
-		return FALSE;
+		return NULL;
 	}
 
-	/*
-	 *	Horrible parser.
-	 */
+	group = rad_malloc(sizeof(*group));
+	memset(group, 0, sizeof(*group));
+	group->type = COND_TYPE_GROUP;
+	tail = &group->children;
+
 	p =  *ptr;
 	while (*p) {
 		while ((*p == ' ') || (*p == '\t')) p++;
@@ -498,14 +421,7 @@ int radius_evaluate_condition(REQUEST *request, int modreturn, int depth,
 		 *	! EXPR
 		 */
 		if (!found_condition && (*p == '!')) {
-			/*
-			 *	Don't change the results if we're not
-			 *	evaluating the condition.
-			 */
-			if (evaluate_next_condition) {
-				RDEBUG4(">>> INVERT");
-				invert = TRUE;
-			}
+			invert = TRUE;
 			p++;
 
 			while ((*p == ' ') || (*p == '\t')) p++;
@@ -517,41 +433,26 @@ int radius_evaluate_condition(REQUEST *request, int modreturn, int depth,
 		if (!found_condition && (*p == '(')) {
 			const char *end = p + 1;
 
-			/*
-			 *	Evaluate the condition, bailing out on
-			 *	parse error.
-			 */
-			RDEBUG4(">>> RECURSING WITH ... %s", end);
-			if (!radius_evaluate_condition(request, modreturn,
-						       depth + 1, &end,
-						       evaluate_next_condition,
-						       &result)) {
-				return FALSE;
-			}
+			c = cond_parse(&end, depth + 1);
+			if (!c) goto error;
 
-			if (invert) {
-				if (evaluate_next_condition) {
-					RDEBUG2("%.*s Converting !%s -> %s",
-						depth, filler,
-						(result != FALSE) ? "TRUE" : "FALSE",
-						(result == FALSE) ? "TRUE" : "FALSE");
-					result = (result == FALSE);
-				}
-				invert = FALSE;
-			}
+			c->invert = invert;
+			c->op = op;
+			*tail = c;
+			tail = &c->next;
+			invert = FALSE;
 
 			/*
 			 *	Start from the end of the previous
 			 *	condition
 			 */
 			p = end;
-			RDEBUG4(">>> AFTER RECURSION ... %s", end);
 
 			while ((*p == ' ') || (*p == '\t')) p++;
 
 			if (!*p) {
 				radlog(L_ERR, "No closing brace");
-				return FALSE;
+				goto error;
 			}
 
 			if (*p == ')') p++; /* eat closing brace */
@@ -574,42 +475,24 @@ int radius_evaluate_condition(REQUEST *request, int modreturn, int depth,
 		 *	|| EXPR
 		 */
 		if (found_condition) {
-			/*
-			 *	(A && B) means "evaluate B
-			 *	only if A was true"
-			 */
 			if ((p[0] == '&') && (p[1] == '&')) {
-				if (!result) evaluate_next_condition = FALSE;
+				op = COND_OP_AND;
 				p += 2;
 				found_condition = FALSE;
 				continue; /* go back to the start */
 			}
 
-			/*
-			 *	(A || B) means "evaluate B
-			 *	only if A was false"
-			 */
 			if ((p[0] == '|') && (p[1] == '|')) {
-				if (result) evaluate_next_condition = FALSE;
+				op = COND_OP_OR;
 				p += 2;
 				found_condition = FALSE;
 				continue;
 			}
 
-			/*
-			 *	It must be:
-			 *
-			 *	WORD
-			 *	WORD1 op WORD2
-			 */
-		}
-
-		if (found_condition) {
 			radlog(L_ERR, "Consecutive conditions at %s", p);
-			return FALSE;
+			goto error;
 		}
 
-		RDEBUG4(">>> LOOKING AT %s", p);
 		start = p;
 
 		/*
@@ -617,7 +500,7 @@ int radius_evaluate_condition(REQUEST *request, int modreturn, int depth,
 		 */
 		if ((p[0] == '%') && (p[1] == '{')) {
 			radlog(L_ERR, "Bare %%{...} is invalid in condition at: %s", p);
-			return FALSE;
+			goto error;
 		}
 
 		/*
@@ -629,18 +512,7 @@ int radius_evaluate_condition(REQUEST *request, int modreturn, int depth,
 		    (lt != T_SINGLE_QUOTED_STRING) &&
 		    (lt != T_BACK_QUOTED_STRING)) {
 			radlog(L_ERR, "Expected string or numbers at: %s", p);
-			return FALSE;
-		}
-
-		pleft = left;
-		if (evaluate_next_condition) {
-			pleft = expand_string(xleft, sizeof(xleft), request,
-					      lt, left);
-			if (!pleft) {
-				radlog(L_ERR, "Failed expanding string at: %s",
-				       left);
-				return FALSE;
-			}
+			goto error;
 		}
 
 		/*
@@ -667,14 +539,13 @@ int radius_evaluate_condition(REQUEST *request, int modreturn, int depth,
 		 *	||
 		 *
 		 *	Then WORD is just a test for existence.
-		 *	Remember that and skip ahead.
 		 */
 		if (!*q || (*q == ')') ||
 		    ((q[0] == '&') && (q[1] == '&')) ||
 		    ((q[0] == '|') && (q[1] == '|'))) {
 			token = T_OP_CMP_TRUE;
 			rt = T_OP_INVALID;
-			pright = NULL;
+			right[0] = '\0';
 			goto do_cmp;
 		}
 
@@ -687,7 +558,7 @@ int radius_evaluate_condition(REQUEST *request, int modreturn, int depth,
 		if ((token < T_OP_NE) || (token > T_OP_CMP_EQ) ||
 		    (token == T_OP_CMP_TRUE)) {
 			radlog(L_ERR, "Expected comparison at: %s", comp);
-			return FALSE;
+			goto error;
 		}
 		
 		/*
@@ -695,7 +566,7 @@ int radius_evaluate_condition(REQUEST *request, int modreturn, int depth,
 		 */
 		if ((p[0] == '%') && (p[1] == '{')) {
 			radlog(L_ERR, "Bare %%{...} is invalid in condition at: %s", p);
-			return FALSE;
+			goto error;
 		}
 		
 		/*
@@ -707,7 +578,7 @@ int radius_evaluate_condition(REQUEST *request, int modreturn, int depth,
 			rt = getregex(&p, right, sizeof(right), &cflags);
 			if (rt != T_DOUBLE_QUOTED_STRING) {
 				radlog(L_ERR, "Expected regular expression at: %s", p);
-				return FALSE;
+				goto error;
 			}
 		} else
 #endif
@@ -718,70 +589,439 @@ int radius_evaluate_condition(REQUEST *request, int modreturn, int depth,
 		    (rt != T_SINGLE_QUOTED_STRING) &&
 		    (rt != T_BACK_QUOTED_STRING)) {
 			radlog(L_ERR, "Expected string or numbers at: %s", p);
+			goto error;
+		}
+		
+	do_cmp:
+		c = rad_malloc(sizeof(*c));
+		memset(c, 0, sizeof(*c));
+		c->type = COND_TYPE_CMP;
+		c->op = op;
+		c->invert = invert;
+		*tail = c;
+		tail = &c->next;
+		invert = FALSE;
+
+		c->text = rad_malloc((p - start) + 1);
+		memcpy(c->text, start, p - start);
+		c->text[p - start] = '\0';
+
+		c->lt = lt;
+		c->left = strdup(left);
+		c->token = token;
+		c->rt = rt;
+		if (rt != T_OP_INVALID) c->right = strdup(right);
+#ifdef HAVE_REGEX_H
+		c->cflags = cflags;
+#endif
+
+		if (!cond_compile_cmp(c)) goto error;
+
+		found_condition = TRUE;
+	} /* loop over the input condition */
+
+	if (!found_condition) {
+		radlog(L_ERR, "Syntax error.  Expected condition at %s", p);
+	error:
+		radius_cond_free(&group);
+		return NULL;
+	}
+
+	*ptr = p;
+	return group;
+}
+
+/** Compile a condition
+ *
+ * Parses an "if" or "elsif" condition into a tree, resolving
+ * attribute names, and pre-parsing values and regular expressions
+ * where they don't need to be expanded at run time.
+ *
+ * @param[in,out] ptr to the condition.  Updated to point to the end
+ *	of the condition.
+ * @return the condition (free with radius_cond_free), or NULL on
+ *	parse error.
+ */
+fr_cond_t *radius_cond_compile(const char **ptr)
+{
+	return cond_parse(ptr, 0);
+}
+
+/*
+ *	*presult is "did comparison match or not"
+ */
+static int cond_do_cmp(REQUEST *request, int modreturn, const fr_cond_t *c,
+		       const char *pleft, const char *pright, int *presult)
+{
+	int result;
+	uint32_t lint, rint;
+	VALUE_PAIR *vp = NULL;
+	FR_TOKEN token = c->token;
+	const value_pair_tmpl_t *vpt = NULL;
+	value_pair_tmpl_t late;
+	const DICT_ATTR *cmp_da = NULL;
+#ifdef HAVE_REGEX_H
+	char buffer[8192];
+#endif
+
+	if (c->rcode != -1) {
+		*presult = (modreturn == c->rcode);
+		return TRUE;
+	}
+
+	if (c->is_attr) {
+		vpt = &c->vpt;
+		cmp_da = c->cmp_da;
+
+	} else if ((c->lt == T_BARE_WORD) &&
+		   (cond_parse_attr(c->left, &late) == 0)) {
+		/*
+		 *	Registered after the condition was compiled,
+		 *	e.g. by a module instantiated later on.
+		 */
+		vpt = &late;
+		cmp_da = dict_attrbyname(c->left);
+	}
+
+	if (vpt) {
+		VALUE_PAIR myvp;
+
+		vp = cond_find_vp(request, vpt);
+
+		/*
+		 *	VP exists, and that's all we're looking for.
+		 */
+		if (token == T_OP_CMP_TRUE) {
+			*presult = (vp != NULL);
+			return TRUE;
+		}
+
+		if (!vp) {
+			/*
+			 *	The attribute on the LHS may
+			 *	have been a dynamically
+			 *	registered callback.  i.e. it
+			 *	doesn't exist as a VALUE_PAIR.
+			 *	If so, try looking for it.
+			 */
+			if (cmp_da && (cmp_da->vendor == 0) &&
+			    radius_find_compare(cmp_da->attr)) {
+				VALUE_PAIR *check = pairmake(c->left, pright, token);
+				*presult = (radius_callback_compare(request, NULL, check, NULL, NULL) == 0);
+				RDEBUG3("  Callback returns %d",
+					*presult);
+				pairfree(&check);
+				return TRUE;
+			}
+
+			RDEBUG2("    (Attribute %s was not found)",
+			       c->left);
+			*presult = 0;
+			return TRUE;
+		}
+
+#ifdef HAVE_REGEX_H
+		/*
+		 * 	Regex comparisons treat everything as
+		 *	strings.
+		 */
+		if ((token == T_OP_REG_EQ) ||
+		    (token == T_OP_REG_NE)) {
+			vp_prints_value(buffer, sizeof(buffer), vp, 0);
+			pleft = buffer;
+			goto do_checks;
+		}
+#endif
+
+		if (c->rvp && (c->rvp->type == vp->type)) {
+			*presult = paircmp(c->rvp, vp);
+			RDEBUG3("  paircmp -> %d", *presult);
+			return TRUE;
+		}
+
+		memcpy(&myvp, vp, sizeof(myvp));
+		if (!pairparsevalue(&myvp, pright)) {
+			RDEBUG2("Failed parsing \"%s\": %s",
+			       pright, fr_strerror());
 			return FALSE;
 		}
+
+		myvp.op = token;
+		*presult = paircmp(&myvp, vp);
+		RDEBUG3("  paircmp -> %d", *presult);
+		return TRUE;
+	}
+
+#ifdef HAVE_REGEX_H
+	do_checks:
+#endif
+	switch (token) {
+	case T_OP_GE:
+	case T_OP_GT:
+	case T_OP_LE:
+	case T_OP_LT:
+		if (!all_digits(pright)) {
+			RDEBUG2("    (Right field is not a number at: %s)", pright);
+			return FALSE;
+		}
+		rint = strtoul(pright, NULL, 0);
+		if (!all_digits(pleft)) {
+			RDEBUG2("    (Left field is not a number at: %s)", pleft);
+			return FALSE;
+		}
+		lint = strtoul(pleft, NULL, 0);
+		break;
 		
-		pright = right;
-		if (evaluate_next_condition) {
-			pright = expand_string(xright, sizeof(xright), request,
-					       rt, right);
-			if (!pright) {
-				radlog(L_ERR, "Failed expanding string at: %s",
-				       right);
+	default:
+		lint = rint = 0;  /* quiet the compiler */
+		break;
+	}
+	
+	switch (token) {
+	case T_OP_CMP_TRUE:
+		/*
+		 *	Check for truth or falsehood.
+		 */
+		if (all_digits(pleft)) {
+			lint = strtoul(pleft, NULL, 0);
+			result = (lint != 0);
+			
+		} else {
+			result = (*pleft != '\0');
+		}
+		break;
+		
+
+	case T_OP_CMP_EQ:
+		result = (strcmp(pleft, pright) == 0);
+		break;
+		
+	case T_OP_NE:
+		result = (strcmp(pleft, pright) != 0);
+		break;
+		
+	case T_OP_GE:
+		result = (lint >= rint);
+		break;
+		
+	case T_OP_GT:
+		result = (lint > rint);
+		break;
+		
+	case T_OP_LE:
+		result = (lint <= rint);
+		break;
+		
+	case T_OP_LT:
+		result = (lint < rint);
+		break;
+
+#ifdef HAVE_REGEX_H
+	case T_OP_REG_EQ:
+	case T_OP_REG_NE: {
+		int i, compare;
+		const regex_t *reg;
+		regmatch_t rxmatch[REQUEST_MAX_REGEX + 1];
+		
+		/*
+		 *	Include substring matches.
+		 */
+		if (c->regex_compiled) {
+			reg = &c->reg;
+		} else {
+			char errbuf[128];
+
+			reg = fr_regcomp_cached(pright, c->cflags,
+						errbuf, sizeof(errbuf));
+			if (!reg) {
+				DEBUG("ERROR: Failed compiling regular expression: %s", errbuf);
 				return FALSE;
 			}
 		}
+
+		compare = regexec(reg, pleft,
+				  REQUEST_MAX_REGEX + 1,
+				  rxmatch, 0);
+
+		if (token == T_OP_REG_NE) {
+			result = (compare != 0);
+			break;
+		}
 		
-		RDEBUG4(">>> %d:%s %d %d:%s",
-		       lt, pleft, token, rt, pright);
-		
-	do_cmp:
-		if (evaluate_next_condition) {
+		/*
+		 *	Add new %{0}, %{1}, etc.
+		 */
+		if (compare == 0) for (i = 0; i <= REQUEST_MAX_REGEX; i++) {
+			char *r;
+
+			free(request_data_get(request, request,
+					      REQUEST_DATA_REGEX | i));
+
+			/*
+			 *	No %{i}, skip it.
+			 *	We MAY have %{2} without %{1}.
+			 */
+			if (rxmatch[i].rm_so == -1) continue;
+			
 			/*
-			 *	More parse errors.
+			 *	Copy substring into allocated buffer
 			 */
-			if (!radius_do_cmp(request, &result, lt, pleft, token,
-					   rt, pright, cflags, modreturn)) {
+			r = rad_malloc(rxmatch[i].rm_eo -rxmatch[i].rm_so + 1);
+			memcpy(r, pleft + rxmatch[i].rm_so,
+			       rxmatch[i].rm_eo - rxmatch[i].rm_so);
+			r[rxmatch[i].rm_eo - rxmatch[i].rm_so] = '\0';
+
+			request_data_add(request, request,
+					 REQUEST_DATA_REGEX | i,
+					 r, free);
+		}
+		result = (compare == 0);
+	}
+		break;
+#endif
+		
+	default:
+		DEBUG("ERROR: Comparison operator %s is not supported",
+		      fr_token_name(token));
+		result = FALSE;
+		break;
+	}
+	
+	*presult = result;
+	return TRUE;
+}
+
+/*
+ *	Print the parts of a condition which weren't evaluated.
+ */
+static void cond_skip(REQUEST *request, int depth, const fr_cond_t *c)
+{
+	for (; c != NULL; c = c->next) {
+		if (c->type == COND_TYPE_GROUP) {
+			cond_skip(request, depth + 1, c->children);
+			continue;
+		}
+
+		RDEBUG2("%.*s Skipping %s(%s)",
+		       depth, filler,
+		       c->invert ? "!" : "", c->text);
+	}
+}
+
+static int cond_evaluate(REQUEST *request, int modreturn, int depth,
+			 const fr_cond_t *group, int *presult)
+{
+	int result = TRUE;
+	const fr_cond_t *c;
+	const char *pleft, *pright;
+	char  xleft[1024], xright[1024];
+
+	for (c = group->children; c != NULL; c = c->next) {
+		/*
+		 *	(A && B) means "evaluate B only if A was true"
+		 *	(A || B) means "evaluate B only if A was false"
+		 */
+		if (((c->op == COND_OP_AND) && !result) ||
+		    ((c->op == COND_OP_OR) && result)) {
+			if (request && request->radlog) {
+				cond_skip(request, depth, c);
+			}
+			break;
+		}
+
+		if (c->type == COND_TYPE_GROUP) {
+			if (!cond_evaluate(request, modreturn, depth + 1,
+					   c, &result)) {
 				return FALSE;
 			}
-			RDEBUG4(">>> Comparison returned %d", result);
 
-			if (invert) {
-				RDEBUG4(">>> INVERTING result");
+			if (c->invert) {
+				RDEBUG2("%.*s Converting !%s -> %s",
+					depth, filler,
+					(result != FALSE) ? "TRUE" : "FALSE",
+					(result == FALSE) ? "TRUE" : "FALSE");
 				result = (result == FALSE);
 			}
+			continue;
+		}
 
-			RDEBUG2("%.*s Evaluating %s(%.*s) -> %s",
-			       depth, filler,
-			       invert ? "!" : "", p - start, start,
-			       (result != FALSE) ? "TRUE" : "FALSE");
+		pleft = c->left;
+		if (!c->is_attr) {
+			pleft = expand_string(xleft, sizeof(xleft), request,
+					      c->lt, c->left);
+			if (!pleft) {
+				radlog(L_ERR, "Failed expanding string at: %s",
+				       c->left);
+				return FALSE;
+			}
+		}
 
-			invert = FALSE;
-			RDEBUG4(">>> GOT result %d", result);
+		pright = c->right;
+		if (c->right && !c->rvp) {
+			pright = expand_string(xright, sizeof(xright), request,
+					       c->rt, c->right);
+			if (!pright) {
+				radlog(L_ERR, "Failed expanding string at: %s",
+				       c->right);
+				return FALSE;
+			}
+		}
 
-			/*
-			 *	Not evaluating it.  We may be just
-			 *	parsing it.
-			 */
-		} else if (request) {
-			RDEBUG2("%.*s Skipping %s(%.*s)",
-			       depth, filler,
-			       invert ? "!" : "", p - start, start);
+		/*
+		 *	More parse errors.
+		 */
+		if (!cond_do_cmp(request, modreturn, c, pleft, pright,
+				 &result)) {
+			return FALSE;
 		}
 
-		found_condition = TRUE;
-	} /* loop over the input condition */
+		if (c->invert) result = (result == FALSE);
 
-	if (!found_condition) {
-		radlog(L_ERR, "Syntax error.  Expected condition at %s", p);
-		return FALSE;
+		RDEBUG2("%.*s Evaluating %s(%s) -> %s",
+		       depth, filler,
+		       c->invert ? "!" : "", c->text,
+		       (result != FALSE) ? "TRUE" : "FALSE");
 	}
 
-	RDEBUG4(">>> AT EOL -> %d", result);
-	*ptr = p;
-	if (evaluate_it) *presult = result;
+	*presult = result;
 	return TRUE;
 }
+
+/** Evaluate a compiled condition
+ *
+ * @param[in] request the current request.
+ * @param[in] modreturn the return code of the previous module.
+ * @param[in] cond from radius_cond_compile.
+ * @param[out] presult whether or not the condition matched.
+ * @return TRUE if the condition was evaluated, FALSE on error.
+ */
+int radius_cond_evaluate(REQUEST *request, int modreturn,
+			 const fr_cond_t *cond, int *presult)
+{
+	return cond_evaluate(request, modreturn, 0, cond, presult);
+}
+
+/*
+ *	Parse, and optionally evaluate, a condition which is only
+ *	used once.
+ */
+int radius_evaluate_condition(REQUEST *request, int modreturn, int depth,
+			      const char **ptr, int evaluate_it, int *presult)
+{
+	int rcode = TRUE;
+	fr_cond_t *cond;
+
+	cond = cond_parse(ptr, depth);
+	if (!cond) return FALSE;
+
+	if (evaluate_it) {
+		rcode = cond_evaluate(request, modreturn, depth, cond, presult);
+	}
+
+	radius_cond_free(&cond);
+
+	return rcode;
+}
 #endif
 
 
@@ -29,6 +29,7 @@ RCSID("$Id$")
 #include <freeradius-devel/rad_assert.h>
 
 #include <sys/stat.h>
+#include <sys/mman.h>
 
 #include <ctype.h>
 #include <fcntl.h>
@@ -280,6 +281,586 @@ parse_again:
 }
 
 
+/*
+ *	Compiled users files.
+ *
+ *	"radusers" reads a users file with pairlist_read(), and writes
+ *	the entries to a file which is mmap()ed by the server.  The
+ *	names are in a hash table in the file, and the attributes are
+ *	stored in a compact binary form.  They are turned back into
+ *	VALUE_PAIRs only when the name is looked up.  Opening the file
+ *	costs almost nothing, and all processes which map it share
+ *	the same pages.
+ *
+ *	The file is in host byte order, and depends on the layout of
+ *	ATTR_FLAGS, so it should be compiled on the machine which
+ *	uses it.
+ */
+#define PAIR_DB_MAGIC	"FRUSERS\n"
+#define PAIR_DB_VERSION	(1)
+#define PAIR_DB_ALIGN	(4)
+#define PAIR_DB_MAX	(0x7fffffff)
+
+typedef struct pair_db_hdr_t {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	byte_order;
+	uint32_t	flags_size;
+	uint32_t	length;		/* of the whole file */
+	uint32_t	num_names;
+	uint32_t	num_buckets;	/* a power of 2 */
+	uint32_t	buckets;	/* offset of the hash table */
+} pair_db_hdr_t;
+
+/*
+ *	Followed by the name, and then "num_entries" entries.
+ */
+typedef struct pair_db_name_t {
+	uint32_t	next;		/* next name in the bucket */
+	uint32_t	hash;
+	uint32_t	num_entries;
+	uint32_t	name_len;	/* including the trailing NUL */
+} pair_db_name_t;
+
+/*
+ *	Followed by "num_check" and then "num_reply" attributes.
+ */
+typedef struct pair_db_entry_t {
+	uint32_t	order;
+	uint32_t	lineno;
+	uint32_t	num_check;
+	uint32_t	num_reply;
+} pair_db_entry_t;
+
+/*
+ *	Followed by "length" bytes of data.
+ */
+typedef struct pair_db_vp_t {
+	uint32_t	attribute;
+	uint32_t	vendor;
+	uint8_t		type;
+	uint8_t		op;
+	uint16_t	length;
+	ATTR_FLAGS	flags;
+} pair_db_vp_t;
+
+struct pair_db_t {
+	uint8_t		*map;
+	size_t		length;
+};
+
+typedef struct pair_db_ctx_t {
+	uint8_t		*data;
+	size_t		len;
+	size_t		size;
+} pair_db_ctx_t;
+
+typedef struct pair_db_group_t {
+	const char	*name;
+	uint32_t	index;
+} pair_db_group_t;
+
+typedef struct pair_db_item_t {
+	PAIR_LIST	*pl;
+	uint32_t	group;
+	uint32_t	order;
+} pair_db_item_t;
+
+static size_t pair_db_size(size_t len)
+{
+	if ((len & (PAIR_DB_ALIGN - 1)) != 0) {
+		len += PAIR_DB_ALIGN - (len & (PAIR_DB_ALIGN - 1));
+	}
+
+	return len;
+}
+
+static uint32_t pair_db_reserve(pair_db_ctx_t *ctx, size_t size)
+{
+	size_t offset;
+
+	offset = pair_db_size(ctx->len);
+
+	if ((offset + size) > PAIR_DB_MAX) return 0;
+
+	if ((offset + size) > ctx->size) {
+		uint8_t *data;
+		size_t newsize = ctx->size * 2;
+
+		while (newsize < (offset + size)) newsize *= 2;
+
+		data = realloc(ctx->data, newsize);
+		if (!data) return 0;
+
+		memset(data + ctx->size, 0, newsize - ctx->size);
+		ctx->data = data;
+		ctx->size = newsize;
+	}
+
+	ctx->len = offset + size;
+
+	return offset;
+}
+
+static int pair_db_vps(pair_db_ctx_t *ctx, VALUE_PAIR *vps, uint32_t *num)
+{
+	size_t length;
+	uint32_t offset;
+	VALUE_PAIR *vp;
+	pair_db_vp_t *dv;
+
+	for (vp = vps; vp != NULL; vp = vp->next) {
+		/*
+		 *	Dynamic values (and regexes) have length 0,
+		 *	and the unexpanded string in vp_strvalue.
+		 */
+		if (vp->flags.do_xlat) {
+			length = strlen(vp->vp_strvalue) + 1;
+		} else {
+			length = vp->length;
+		}
+
+		if ((vp->type == PW_TYPE_TLV) ||
+		    (length > sizeof(vp->data))) {
+			radlog(L_ERR, "Cannot compile attribute %s",
+			       vp->name);
+			return -1;
+		}
+
+		offset = pair_db_reserve(ctx, sizeof(*dv) + length);
+		if (!offset) {
+			radlog(L_ERR, "Compiled file is too large");
+			return -1;
+		}
+
+		dv = (pair_db_vp_t *) (ctx->data + offset);
+		dv->attribute = vp->attribute;
+		dv->vendor = vp->vendor;
+		dv->type = vp->type;
+		dv->op = vp->op;
+		dv->length = length;
+		dv->flags = vp->flags;
+		memcpy(dv + 1, &vp->data, length);
+
+		(*num)++;
+	}
+
+	return 0;
+}
+
+static uint32_t pair_db_group_hash(const void *data)
+{
+	return fr_hash_string(((const pair_db_group_t *) data)->name);
+}
+
+static int pair_db_group_cmp(const void *one, const void *two)
+{
+	const pair_db_group_t *a = one;
+	const pair_db_group_t *b = two;
+
+	return strcmp(a->name, b->name);
+}
+
+static int pair_db_item_cmp(const void *one, const void *two)
+{
+	const pair_db_item_t *a = one;
+	const pair_db_item_t *b = two;
+
+	if (a->group < b->group) return -1;
+	if (a->group > b->group) return +1;
+
+	if (a->order < b->order) return -1;
+	if (a->order > b->order) return +1;
+
+	return 0;
+}
+
+/** Write a PAIR_LIST to a compiled users file
+ *
+ * The file is written under a temporary name, and renamed into
+ * place, so that anyone who has the old one mapped keeps using it.
+ *
+ * @param[in] file to write.
+ * @param[in] list of entries, as returned by pairlist_read().
+ * @return 0 on success, -1 on error.
+ */
+int pairlist_compile(const char *file, PAIR_LIST *list)
+{
+	int fd, rcode = -1;
+	size_t len;
+	ssize_t wrote;
+	uint32_t i, num, num_groups, num_check, num_reply;
+	uint32_t offset, name_offset, bucket, *buckets;
+	char buffer[8192];
+	PAIR_LIST *pl;
+	pair_db_ctx_t ctx;
+	pair_db_hdr_t *hdr;
+	pair_db_name_t *dn;
+	pair_db_entry_t *de;
+	pair_db_group_t *groups = NULL, *group, my_group;
+	pair_db_item_t *items = NULL;
+	fr_hash_table_t *ht = NULL;
+
+	memset(&ctx, 0, sizeof(ctx));
+
+	num = 0;
+	for (pl = list; pl != NULL; pl = pl->next) num++;
+
+	groups = malloc((num + 1) * sizeof(*groups));
+	items = malloc((num + 1) * sizeof(*items));
+	ht = fr_hash_table_create(pair_db_group_hash, pair_db_group_cmp,
+				  NULL);
+	ctx.size = 65536;
+	ctx.data = malloc(ctx.size);
+	if (!groups || !items || !ht || !ctx.data) {
+		radlog(L_ERR, "Out of memory");
+		goto done;
+	}
+	memset(ctx.data, 0, ctx.size);
+
+	/*
+	 *	Number the names in the order they first appear, and
+	 *	sort the entries by name.  The entries for each name
+	 *	stay in file order.
+	 */
+	num_groups = 0;
+	for (pl = list, i = 0; pl != NULL; pl = pl->next, i++) {
+		my_group.name = pl->name;
+		group = fr_hash_table_finddata(ht, &my_group);
+		if (!group) {
+			group = &groups[num_groups];
+			group->name = pl->name;
+			group->index = num_groups++;
+			if (!fr_hash_table_insert(ht, group)) {
+				radlog(L_ERR, "Out of memory");
+				goto done;
+			}
+		}
+
+		items[i].pl = pl;
+		items[i].group = group->index;
+		items[i].order = i;
+	}
+
+	qsort(items, num, sizeof(*items), pair_db_item_cmp);
+
+	ctx.len = sizeof(*hdr);
+	hdr = (pair_db_hdr_t *) ctx.data;
+	hdr->num_names = num_groups;
+	hdr->num_buckets = 1;
+	while (hdr->num_buckets < num_groups) hdr->num_buckets <<= 1;
+
+	offset = pair_db_reserve(&ctx, hdr->num_buckets * sizeof(uint32_t));
+	if (!offset) goto too_large;
+	((pair_db_hdr_t *) ctx.data)->buckets = offset;
+
+	name_offset = 0;
+	for (i = 0; i < num; i++) {
+		pl = items[i].pl;
+
+		/*
+		 *	The first entry for a name.  Write the name,
+		 *	and add it to the hash table.
+		 */
+		if ((i == 0) || (items[i].group != items[i - 1].group)) {
+			len = strlen(pl->name) + 1;
+
+			name_offset = pair_db_reserve(&ctx, sizeof(*dn) + len);
+			if (!name_offset) goto too_large;
+
+			hdr = (pair_db_hdr_t *) ctx.data;
+			buckets = (uint32_t *) (ctx.data + hdr->buckets);
+			dn = (pair_db_name_t *) (ctx.data + name_offset);
+			dn->hash = fr_hash_string(pl->name);
+			dn->name_len = len;
+			memcpy(dn + 1, pl->name, len);
+
+			bucket = dn->hash & (hdr->num_buckets - 1);
+			dn->next = buckets[bucket];
+			buckets[bucket] = name_offset;
+		}
+
+		offset = pair_db_reserve(&ctx, sizeof(*de));
+		if (!offset) goto too_large;
+
+		num_check = num_reply = 0;
+		if ((pair_db_vps(&ctx, pl->check, &num_check) < 0) ||
+		    (pair_db_vps(&ctx, pl->reply, &num_reply) < 0)) {
+			goto done;
+		}
+
+		de = (pair_db_entry_t *) (ctx.data + offset);
+		de->order = items[i].order;
+		de->lineno = pl->lineno;
+		de->num_check = num_check;
+		de->num_reply = num_reply;
+
+		((pair_db_name_t *) (ctx.data + name_offset))->num_entries++;
+	}
+
+	hdr = (pair_db_hdr_t *) ctx.data;
+	memcpy(hdr->magic, PAIR_DB_MAGIC, sizeof(hdr->magic));
+	hdr->version = PAIR_DB_VERSION;
+	hdr->byte_order = 0x01020304;
+	hdr->flags_size = sizeof(ATTR_FLAGS);
+	hdr->length = ctx.len;
+
+	snprintf(buffer, sizeof(buffer), "%s.%u", file,
+		 (unsigned int) getpid());
+
+	fd = open(buffer, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+	if (fd < 0) {
+		radlog(L_ERR, "Failed creating %s: %s",
+		       buffer, strerror(errno));
+		goto done;
+	}
+
+	len = 0;
+	while (len < ctx.len) {
+		wrote = write(fd, ctx.data + len, ctx.len - len);
+		if (wrote < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+		len += wrote;
+	}
+
+	if ((close(fd) < 0) || (len < ctx.len) ||
+	    (rename(buffer, file) < 0)) {
+		radlog(L_ERR, "Failed writing %s: %s",
+		       file, strerror(errno));
+		unlink(buffer);
+		goto done;
+	}
+
+	rcode = 0;
+	goto done;
+
+too_large:
+	radlog(L_ERR, "Compiled file is too large");
+
+done:
+	fr_hash_table_free(ht);
+	free(groups);
+	free(items);
+	free(ctx.data);
+
+	return rcode;
+}
+
+/** Open a compiled users file
+ *
+ * @param[in] file to open.
+ * @param[out] pdb where the handle is written.
+ * @return 1 if the file was opened, 0 if it isn't a compiled users
+ *	file, or -1 if it is one, but it can't be used.
+ */
+int pairlist_db_open(const char *file, PAIR_DB **pdb)
+{
+	int fd;
+	uint8_t *map;
+	size_t len;
+	struct stat buf;
+	char magic[sizeof(PAIR_DB_MAGIC) - 1];
+	const pair_db_hdr_t *hdr;
+
+	/*
+	 *	Anything which doesn't start with the magic is left to
+	 *	pairlist_read(), including the error messages.
+	 */
+	fd = open(file, O_RDONLY);
+	if (fd < 0) return 0;
+
+	if ((read(fd, magic, sizeof(magic)) != sizeof(magic)) ||
+	    (memcmp(magic, PAIR_DB_MAGIC, sizeof(magic)) != 0)) {
+		close(fd);
+		return 0;
+	}
+
+	if ((fstat(fd, &buf) < 0) ||
+	    (buf.st_size < (off_t) sizeof(*hdr)) ||
+	    (buf.st_size > PAIR_DB_MAX)) {
+		close(fd);
+		radlog(L_ERR, "%s is not a valid compiled users file",
+		       file);
+		return -1;
+	}
+	len = buf.st_size;
+
+	map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		radlog(L_ERR, "Failed mapping %s: %s",
+		       file, strerror(errno));
+		return -1;
+	}
+
+	hdr = (const pair_db_hdr_t *) map;
+	if ((hdr->version != PAIR_DB_VERSION) ||
+	    (hdr->byte_order != 0x01020304) ||
+	    (hdr->flags_size != sizeof(ATTR_FLAGS))) {
+		munmap(map, len);
+		radlog(L_ERR, "%s was compiled by a different version of the server, or on a different system",
+		       file);
+		return -1;
+	}
+
+	if ((hdr->length != len) ||
+	    (hdr->num_buckets == 0) ||
+	    ((hdr->num_buckets & (hdr->num_buckets - 1)) != 0) ||
+	    (hdr->buckets < sizeof(*hdr)) ||
+	    (hdr->num_buckets > ((len - hdr->buckets) / sizeof(uint32_t)))) {
+		munmap(map, len);
+		radlog(L_ERR, "%s is not a valid compiled users file",
+		       file);
+		return -1;
+	}
+
+	*pdb = rad_malloc(sizeof(**pdb));
+	(*pdb)->map = map;
+	(*pdb)->length = len;
+
+	return 1;
+}
+
+void pairlist_db_close(PAIR_DB **pdb)
+{
+	if (!pdb || !*pdb) return;
+
+	munmap((*pdb)->map, (*pdb)->length);
+	free(*pdb);
+	*pdb = NULL;
+}
+
+/*
+ *	Turn "num" attributes at "*poffset" back into VALUE_PAIRs.
+ */
+static int pair_db_decode(PAIR_DB *db, size_t *poffset, uint32_t num,
+			  VALUE_PAIR **vps)
+{
+	int is_unknown;
+	size_t offset = *poffset;
+	VALUE_PAIR *vp, **tail = vps;
+	const pair_db_vp_t *dv;
+
+	while (num-- > 0) {
+		if ((offset + sizeof(*dv)) > db->length) return -1;
+
+		dv = (const pair_db_vp_t *) (db->map + offset);
+		if ((dv->length > sizeof(vp->data)) ||
+		    ((offset + sizeof(*dv) + dv->length) > db->length)) {
+			return -1;
+		}
+
+		if (dv->flags.do_xlat &&
+		    ((dv->length == 0) ||
+		     (((const uint8_t *) (dv + 1))[dv->length - 1] != '\0'))) {
+			return -1;
+		}
+
+		vp = paircreate(dv->attribute, dv->vendor, dv->type);
+		if (!vp) return -1;
+
+		/*
+		 *	paircreate() decides how the name is
+		 *	allocated, so it also decides "is_unknown".
+		 */
+		is_unknown = vp->flags.is_unknown;
+		vp->flags = dv->flags;
+		vp->flags.is_unknown = is_unknown;
+		vp->type = dv->type;
+		vp->op = dv->op;
+		vp->length = vp->flags.do_xlat ? 0 : dv->length;
+		memcpy(&vp->data, dv + 1, dv->length);
+
+		*tail = vp;
+		tail = &(vp->next);
+
+		offset = pair_db_size(offset + sizeof(*dv) + dv->length);
+	}
+
+	*poffset = offset;
+	return 0;
+}
+
+/** Look up a name in a compiled users file
+ *
+ * @param[in] db opened with pairlist_db_open().
+ * @param[in] name to look up.
+ * @return the entries for the name, in file order, or NULL if there
+ *	are none.  The caller frees them with pairlist_free().
+ */
+PAIR_LIST *pairlist_db_find(PAIR_DB *db, const char *name)
+{
+	uint32_t i, hash, offset, num_names;
+	size_t name_len, entry;
+	const pair_db_hdr_t *hdr = (const pair_db_hdr_t *) db->map;
+	const pair_db_name_t *dn;
+	const pair_db_entry_t *de;
+	PAIR_LIST *pl = NULL, *t, **last = &pl;
+
+	hash = fr_hash_string(name);
+	name_len = strlen(name) + 1;
+
+	/*
+	 *	A chain can't be longer than the number of names, so a
+	 *	longer one has a loop in it.
+	 */
+	num_names = 0;
+	offset = ((const uint32_t *) (db->map + hdr->buckets))[hash & (hdr->num_buckets - 1)];
+	while (offset != 0) {
+		if (num_names++ >= hdr->num_names) goto corrupt;
+
+		if ((offset + sizeof(*dn)) > db->length) goto corrupt;
+
+		dn = (const pair_db_name_t *) (db->map + offset);
+		if ((dn->name_len == 0) ||
+		    ((offset + sizeof(*dn) + dn->name_len) > db->length) ||
+		    (db->map[offset + sizeof(*dn) + dn->name_len - 1] != '\0')) {
+			goto corrupt;
+		}
+
+		if ((dn->hash == hash) && (dn->name_len == name_len) &&
+		    (memcmp(dn + 1, name, name_len) == 0)) break;
+
+		offset = dn->next;
+	}
+	if (!offset) return NULL;
+
+	entry = pair_db_size(offset + sizeof(*dn) + dn->name_len);
+
+	for (i = 0; i < dn->num_entries; i++) {
+		if ((entry + sizeof(*de)) > db->length) goto corrupt;
+
+		de = (const pair_db_entry_t *) (db->map + entry);
+
+		t = rad_malloc(sizeof(*t) + name_len);
+		memset(t, 0, sizeof(*t));
+		t->name = (char *) (t + 1);
+		memcpy(t + 1, name, name_len);
+		t->lineno = de->lineno;
+		t->order = de->order;
+
+		*last = t;
+		last = &(t->next);
+
+		entry += sizeof(*de);
+		if ((pair_db_decode(db, &entry, de->num_check, &t->check) < 0) ||
+		    (pair_db_decode(db, &entry, de->num_reply, &t->reply) < 0)) {
+			goto corrupt;
+		}
+	}
+
+	return pl;
+
+corrupt:
+	radlog(L_ERR, "Compiled users file is corrupt, or out of memory, looking up %s",
+	       name);
+	pairlist_free(&pl);
+	return NULL;
+}
+
+
 /*
  *	Debug code.
  */
@@ -1357,7 +1357,7 @@ static int stats_socket_recv(rad_listen_t *listener)
 		return 0;
 	}
 
-	FR_STATS_TYPE_INC(client->auth.total_requests);
+	FR_STATS_TYPE_INC(client->auth, total_requests);
 
 	/*
 	 *	We only understand Status-Server on this socket.
@@ -1424,7 +1424,7 @@ static int auth_socket_recv(rad_listen_t *listener)
 		return 0;
 	}
 
-	FR_STATS_TYPE_INC(client->auth.total_requests);
+	FR_STATS_TYPE_INC(client->auth, total_requests);
 
 	/*
 	 *	Some sanity checks, based on the packet code.
@@ -1505,7 +1505,7 @@ static int acct_socket_recv(rad_listen_t *listener)
 		return 0;
 	}
 
-	FR_STATS_TYPE_INC(client->acct.total_requests);
+	FR_STATS_TYPE_INC(client->acct, total_requests);
 
 	/*
 	 *	Some sanity checks, based on the packet code.
@@ -3123,6 +3123,9 @@ void listen_free(rad_listen_t **head)
 #endif	/* WITH_TCP */
 
 		free(this->data);
+#ifdef WITH_STATS
+		radius_stats_free(&this->stats);
+#endif
 		free(this);
 
 		this = next;
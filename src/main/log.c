@@ -32,10 +32,19 @@ RCSID("$Id$")
 #include <sys/stat.h>
 #endif
 
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+
 #ifdef HAVE_SYSLOG_H
 #	include <syslog.h>
 #endif
 
+#ifdef HAVE_PTHREAD_H
+#	include <pthread.h>
+#	include <sys/uio.h>
+#endif
+
 /*
  * Logging facility names
  */
@@ -51,6 +60,566 @@ static const FR_NAME_NUMBER levels[] = {
 
 int log_dates_utc = 0;
 
+#if defined(HAVE_PTHREAD_H) && defined(__GNUC__)
+#define WITH_ASYNC_LOG
+#endif
+
+/*
+ *	Per-thread logging state.  The timestamp is only re-formatted
+ *	when the second changes.
+ */
+typedef struct log_thread_t {
+	time_t			when;
+	int			utc;
+	char			stamp[64];
+#ifdef WITH_ASYNC_LOG
+	struct log_ring_t	*ring;
+#endif
+} log_thread_t;
+
+#ifdef WITH_ASYNC_LOG
+/*
+ *	Asynchronous logging.
+ *
+ *	Each thread appends its messages to its own ring buffer, and
+ *	one writer thread empties all of them.  There is exactly one
+ *	producer and one consumer per ring, so the only
+ *	synchronization needed is a memory barrier around the "head"
+ *	and "tail" updates.  The mutex is only taken to add a ring,
+ *	and to wake up the writer when it's asleep.
+ */
+#define LOG_RING_SIZE	(65536)
+#define LOG_ALIGN(_x)	(((_x) + 7) & ~((size_t) 7))
+#define LOG_IOV_MAX	(64)
+#define LOG_FILES_MAX	(64)
+
+/*
+ *	Files named by "requests" are kept open for this many seconds,
+ *	so that they can still be rotated.
+ */
+#define LOG_FILE_TTL	(1)
+
+typedef enum log_record_type_t {
+	LOG_RECORD_PAD = 0,	/* skip to the start of the ring */
+	LOG_RECORD_MAIN,	/* radius.log */
+	LOG_RECORD_FILE		/* name is in the record */
+} log_record_type_t;
+
+typedef struct log_record_t {
+	uint32_t		length;	/* header + name + message */
+	uint16_t		type;
+	uint16_t		name_len;
+} log_record_t;
+
+typedef struct log_ring_t {
+	struct log_ring_t	*next;
+	volatile size_t		head;		/* written by the thread */
+	volatile size_t		tail;		/* written by the writer */
+	volatile int		closed;		/* the thread has exited */
+	volatile unsigned int	dropped;	/* written by the thread */
+	unsigned int		reported;	/* written by the writer */
+	uint8_t			data[LOG_RING_SIZE];
+} log_ring_t;
+
+typedef struct log_file_t {
+	char			*name;
+	uint32_t		hash;
+	int			fd;
+	time_t			opened;
+} log_file_t;
+
+static volatile int	log_async = FALSE;
+static volatile int	log_writer_sleeping = FALSE;
+static int		log_writer_stop = FALSE;
+static pthread_t	log_writer_id;
+static pthread_mutex_t	log_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	log_cond = PTHREAD_COND_INITIALIZER;
+static log_ring_t	*log_rings = NULL;
+
+/*
+ *	Only used by the writer thread.
+ */
+static log_file_t	log_files[LOG_FILES_MAX];
+static int		log_batch_fd = -1;
+static int		log_batch_count = 0;
+static struct iovec	log_batch[LOG_IOV_MAX];
+#endif
+
+#ifdef HAVE_PTHREAD_H
+static pthread_key_t	log_thread_key;
+static pthread_once_t	log_thread_once = PTHREAD_ONCE_INIT;
+
+static void log_thread_free(void *data)
+{
+	log_thread_t *thread = data;
+
+#ifdef WITH_ASYNC_LOG
+	/*
+	 *	The writer frees the ring once it's empty.
+	 */
+	if (thread->ring) {
+		__sync_synchronize();
+		thread->ring->closed = TRUE;
+	}
+#endif
+	free(thread);
+}
+
+static void log_make_key(void)
+{
+	pthread_key_create(&log_thread_key, log_thread_free);
+}
+#else
+static log_thread_t *log_thread = NULL;
+#endif
+
+static log_thread_t *log_thread_get(void)
+{
+	log_thread_t *thread;
+
+#ifdef HAVE_PTHREAD_H
+	pthread_once(&log_thread_once, log_make_key);
+
+	thread = pthread_getspecific(log_thread_key);
+#else
+	thread = log_thread;
+#endif
+	if (thread) return thread;
+
+	thread = malloc(sizeof(*thread));
+	if (!thread) return NULL;
+	memset(thread, 0, sizeof(*thread));
+
+#ifdef HAVE_PTHREAD_H
+	pthread_setspecific(log_thread_key, thread);
+#else
+	log_thread = thread;
+#endif
+
+	return thread;
+}
+
+/*
+ *	Write "Wed Oct 19 01:58:00 2013 " to the buffer.
+ */
+static void log_timestamp(char *buffer, size_t bufsize, int utc)
+{
+	char *p;
+	time_t now;
+	log_thread_t *thread;
+
+	now = time(NULL);
+
+	thread = log_thread_get();
+	if (thread && (thread->when == now) && (thread->utc == utc)) {
+		strlcpy(buffer, thread->stamp, bufsize);
+		return;
+	}
+
+#ifdef HAVE_GMTIME_R
+	if (utc) {
+		struct tm tm;
+
+		gmtime_r(&now, &tm);
+		asctime_r(&tm, buffer);
+	} else
+#endif
+		CTIME_R(&now, buffer, bufsize);
+
+	p = strrchr(buffer, '\n');
+	if (p) {
+		p[0] = ' ';
+		p[1] = '\0';
+	}
+
+	if (thread) {
+		thread->when = now;
+		thread->utc = utc;
+		strlcpy(thread->stamp, buffer, sizeof(thread->stamp));
+	}
+}
+
+#ifdef WITH_ASYNC_LOG
+static int log_rings_pending(void)
+{
+	log_ring_t *ring;
+
+	for (ring = log_rings; ring != NULL; ring = ring->next) {
+		if (ring->head != ring->tail) return TRUE;
+	}
+
+	return FALSE;
+}
+
+static void log_batch_flush(void)
+{
+	if (log_batch_count > 0) {
+		writev(log_batch_fd, log_batch, log_batch_count);
+	}
+
+	log_batch_fd = -1;
+	log_batch_count = 0;
+}
+
+static void log_batch_add(int fd, void *data, size_t len)
+{
+	if ((fd != log_batch_fd) || (log_batch_count == LOG_IOV_MAX)) {
+		log_batch_flush();
+		log_batch_fd = fd;
+	}
+
+	log_batch[log_batch_count].iov_base = data;
+	log_batch[log_batch_count].iov_len = len;
+	log_batch_count++;
+}
+
+static void log_file_close(log_file_t *file)
+{
+	close(file->fd);
+	free(file->name);
+	memset(file, 0, sizeof(*file));
+}
+
+/*
+ *	Find or open a "requests" file.
+ */
+static int log_file_open(const char *name)
+{
+	int i, fd;
+	uint32_t hash;
+	char *p;
+	log_file_t *file = NULL;
+	char buffer[8192];
+
+	hash = fr_hash_string(name);
+
+	for (i = 0; i < LOG_FILES_MAX; i++) {
+		if (!log_files[i].name) {
+			if (!file) file = &log_files[i];
+			continue;
+		}
+
+		if ((log_files[i].hash == hash) &&
+		    (strcmp(log_files[i].name, name) == 0)) {
+			return log_files[i].fd;
+		}
+
+		if (!file || (file->name &&
+			      (log_files[i].opened < file->opened))) {
+			file = &log_files[i];
+		}
+	}
+
+	strlcpy(buffer, name, sizeof(buffer));
+	p = strrchr(buffer, FR_DIR_SEP);
+	if (p) {
+		*p = '\0';
+		if (rad_mkdir(buffer, S_IRWXU) < 0) return -1;
+	}
+
+	fd = open(name, O_WRONLY | O_APPEND | O_CREAT, 0666);
+	if (fd < 0) return -1;
+
+	log_batch_flush();
+	if (file->name) log_file_close(file);
+
+	file->name = strdup(name);
+	if (!file->name) {
+		close(fd);
+		return -1;
+	}
+	file->hash = hash;
+	file->fd = fd;
+	file->opened = time(NULL);
+
+	return fd;
+}
+
+static void log_files_expire(time_t now)
+{
+	int i;
+
+	for (i = 0; i < LOG_FILES_MAX; i++) {
+		if (log_files[i].name &&
+		    ((log_files[i].opened + LOG_FILE_TTL) <= now)) {
+			log_file_close(&log_files[i]);
+		}
+	}
+}
+
+/*
+ *	Write everything in one ring.
+ */
+static int log_ring_drain(log_ring_t *ring)
+{
+	int fd;
+	size_t head, tail;
+	log_record_t *rec;
+	char *name;
+
+	head = ring->head;
+	__sync_synchronize();
+
+	tail = ring->tail;
+	if (head == tail) return 0;
+
+	while (tail != head) {
+		rec = (log_record_t *) (ring->data + (tail & (LOG_RING_SIZE - 1)));
+		tail += LOG_ALIGN(rec->length);
+
+		if (rec->type == LOG_RECORD_PAD) continue;
+
+		name = (char *) (rec + 1);
+		if (rec->type == LOG_RECORD_FILE) {
+			fd = log_file_open(name);
+		} else {
+			fd = mainconfig.radlog_fd;
+		}
+		if (fd < 0) continue;
+
+		log_batch_add(fd, name + rec->name_len,
+			      rec->length - sizeof(*rec) - rec->name_len);
+	}
+	log_batch_flush();
+
+	__sync_synchronize();
+	ring->tail = tail;
+
+	return 1;
+}
+
+/*
+ *	Write everything, and free the rings of threads which
+ *	have exited.  Called with the mutex held.
+ */
+static int log_rings_drain(void)
+{
+	int count = 0;
+	log_ring_t *ring, **last;
+
+	last = &log_rings;
+	while ((ring = *last) != NULL) {
+		int closed = ring->closed;
+
+		__sync_synchronize();
+		count += log_ring_drain(ring);
+
+		if (closed) {
+			*last = ring->next;
+			free(ring);
+			continue;
+		}
+
+		last = &(ring->next);
+	}
+
+	return count;
+}
+
+static void *log_writer(UNUSED void *arg)
+{
+	int count;
+	unsigned int dropped;
+	time_t now, last = 0;
+	log_ring_t *ring;
+	struct timespec when;
+
+	while (1) {
+		pthread_mutex_lock(&log_mutex);
+		count = log_rings_drain();
+
+		if (!count) {
+			if (log_writer_stop) {
+				pthread_mutex_unlock(&log_mutex);
+				break;
+			}
+
+			/*
+			 *	Tell the other threads to wake us up,
+			 *	and check once more in case one of
+			 *	them didn't see it.
+			 */
+			log_writer_sleeping = TRUE;
+			__sync_synchronize();
+
+			if (!log_rings_pending()) {
+				when.tv_sec = time(NULL) + 1;
+				when.tv_nsec = 0;
+				pthread_cond_timedwait(&log_cond, &log_mutex,
+						       &when);
+			}
+			log_writer_sleeping = FALSE;
+		}
+
+		now = time(NULL);
+		if (now == last) {
+			pthread_mutex_unlock(&log_mutex);
+			continue;
+		}
+		last = now;
+
+		log_files_expire(now);
+
+		dropped = 0;
+		for (ring = log_rings; ring != NULL; ring = ring->next) {
+			unsigned int total = ring->dropped;
+
+			dropped += total - ring->reported;
+			ring->reported = total;
+		}
+		pthread_mutex_unlock(&log_mutex);
+
+		if (dropped) {
+			radlog(L_ERR, "Dropped %u log messages: the log buffers are full",
+			       dropped);
+		}
+	}
+
+	log_files_expire(time(NULL) + LOG_FILE_TTL);
+
+	return NULL;
+}
+
+static void log_async_fork(void)
+{
+	log_async = FALSE;
+}
+
+/*
+ *	Queue a message for the writer thread.  Returns FALSE if the
+ *	caller should write it itself.
+ */
+static int log_async_write(const char *name, const char *msg, size_t msg_len)
+{
+	size_t name_len, len, size, head, offset, pad;
+	log_thread_t *thread;
+	log_ring_t *ring;
+	log_record_t *rec;
+
+	if (!log_async) return FALSE;
+
+	thread = log_thread_get();
+	if (!thread) return FALSE;
+
+	name_len = name ? strlen(name) + 1 : 0;
+	len = sizeof(*rec) + name_len + msg_len;
+	size = LOG_ALIGN(len);
+	if (size > (LOG_RING_SIZE / 4)) return FALSE;
+
+	ring = thread->ring;
+	if (!ring) {
+		ring = malloc(sizeof(*ring));
+		if (!ring) return FALSE;
+		memset(ring, 0, sizeof(*ring));
+
+		pthread_mutex_lock(&log_mutex);
+		ring->next = log_rings;
+		log_rings = ring;
+		pthread_mutex_unlock(&log_mutex);
+
+		thread->ring = ring;
+	}
+
+	head = ring->head;
+	offset = head & (LOG_RING_SIZE - 1);
+	pad = 0;
+	if ((LOG_RING_SIZE - offset) < size) pad = LOG_RING_SIZE - offset;
+
+	if ((head + pad + size - ring->tail) > LOG_RING_SIZE) {
+		ring->dropped++;
+		return TRUE;
+	}
+	__sync_synchronize();
+
+	if (pad) {
+		rec = (log_record_t *) (ring->data + offset);
+		rec->length = pad;
+		rec->type = LOG_RECORD_PAD;
+		rec->name_len = 0;
+		head += pad;
+		offset = 0;
+	}
+
+	rec = (log_record_t *) (ring->data + offset);
+	rec->length = len;
+	rec->type = name ? LOG_RECORD_FILE : LOG_RECORD_MAIN;
+	rec->name_len = name_len;
+	if (name) memcpy(rec + 1, name, name_len);
+	memcpy(((uint8_t *) (rec + 1)) + name_len, msg, msg_len);
+
+	__sync_synchronize();
+	ring->head = head + size;
+	__sync_synchronize();
+
+	if (log_writer_sleeping) {
+		pthread_mutex_lock(&log_mutex);
+		pthread_cond_signal(&log_cond);
+		pthread_mutex_unlock(&log_mutex);
+	}
+
+	return TRUE;
+}
+#endif	/* WITH_ASYNC_LOG */
+
+/** Start writing log messages from a separate thread
+ *
+ * Messages for radius.log and the "requests" files are written by
+ * the new thread until radlog_async_stop() is called.  Syslog is
+ * still written to directly.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int radlog_async_start(void)
+{
+#ifdef WITH_ASYNC_LOG
+	int rcode;
+	static int registered = FALSE;
+
+	if (log_async) return 0;
+
+	log_writer_stop = FALSE;
+	rcode = pthread_create(&log_writer_id, NULL, log_writer, NULL);
+	if (rcode != 0) {
+		radlog(L_ERR, "Failed creating log thread: %s",
+		       strerror(rcode));
+		return -1;
+	}
+
+	/*
+	 *	Child processes have no writer thread.
+	 */
+	if (!registered) {
+		pthread_atfork(NULL, NULL, log_async_fork);
+		registered = TRUE;
+	}
+
+	log_async = TRUE;
+	return 0;
+#else
+	radlog(L_ERR, "Asynchronous logging is not supported on this system");
+	return -1;
+#endif
+}
+
+/** Write any queued messages, and stop the log thread
+ *
+ */
+void radlog_async_stop(void)
+{
+#ifdef WITH_ASYNC_LOG
+	if (!log_async) return;
+
+	log_async = FALSE;
+
+	pthread_mutex_lock(&log_mutex);
+	log_writer_stop = TRUE;
+	pthread_cond_signal(&log_cond);
+	pthread_mutex_unlock(&log_mutex);
+
+	pthread_join(log_writer_id, NULL);
+#endif
+}
+
 
 /*
  *	Log the message to the logfile. Include the severity and
@@ -93,10 +662,8 @@ int vradlog(int lvl, const char *fmt, va_list ap)
 	if ((myconfig->radlog_dest != RADLOG_SYSLOG) &&
 	    (debug_flag != 1) && (debug_flag != 2)) {
 		const char *s;
-		time_t timeval;
 
-		timeval = time(NULL);
-		CTIME_R(&timeval, buffer + len, sizeof(buffer) - len - 1);
+		log_timestamp(buffer + len, sizeof(buffer) - len - 1, FALSE);
 
 		s = fr_int2str(levels, (lvl & ~L_CONS), ": ");
 
@@ -149,6 +716,9 @@ int vradlog(int lvl, const char *fmt, va_list ap)
 	case RADLOG_FILES:
 	case RADLOG_STDOUT:
 	case RADLOG_STDERR:
+#ifdef WITH_ASYNC_LOG
+		if (log_async_write(NULL, buffer, strlen(buffer))) break;
+#endif
 		write(myconfig->radlog_fd, buffer, strlen(buffer));
 		break;
 
@@ -209,8 +779,10 @@ void radlog_request(int lvl, int priority, REQUEST *request, const char *msg, ..
 	FILE *fp = NULL;
 	va_list ap;
 	char buffer[8192];
+	char name[8192];
 
 	va_start(ap, msg);
+	name[0] = '\0';
 
 	/*
 	 *	Debug messages get treated specially.
@@ -259,6 +831,17 @@ void radlog_request(int lvl, int priority, REQUEST *request, const char *msg, ..
 		radius_xlat(buffer, sizeof(buffer), filename,
 			    request, NULL, NULL); /* FIXME: escape chars! */
 		request->radlog = rl;
+
+#ifdef WITH_ASYNC_LOG
+		/*
+		 *	The log thread creates the directory, and
+		 *	keeps the file open.
+		 */
+		if (log_async) {
+			strlcpy(name, buffer, sizeof(name));
+			goto format;
+		}
+#endif
 		
 		p = strrchr(buffer, FR_DIR_SEP);
 		if (p) {
@@ -275,28 +858,14 @@ void radlog_request(int lvl, int priority, REQUEST *request, const char *msg, ..
 		fp = fopen(buffer, "a");
 	}
 
+#ifdef WITH_ASYNC_LOG
+format:
+#endif
 	/*
 	 *	Print timestamps to the file.
 	 */
-	if (fp) {
-		char *s;
-		time_t timeval;
-		timeval = time(NULL);
-
-#ifdef HAVE_GMTIME_R
-		if (log_dates_utc) {
-			struct tm utc;
-			gmtime_r(&timeval, &utc);
-			asctime_r(&utc, buffer + len);
-		} else
-#endif
-			CTIME_R(&timeval, buffer + len, sizeof(buffer) - len - 1);
-		
-		s = strrchr(buffer, '\n');
-		if (s) {
-			s[0] = ' ';
-			s[1] = '\0';
-		}
+	if (fp || name[0]) {
+		log_timestamp(buffer, sizeof(buffer), log_dates_utc);
 		
 		strcat(buffer, fr_int2str(levels, (lvl & ~L_CONS), ": "));
 		len = strlen(buffer);
@@ -307,6 +876,21 @@ void radlog_request(int lvl, int priority, REQUEST *request, const char *msg, ..
 		len = strlen(buffer);
 	}
 	vsnprintf(buffer + len, sizeof(buffer) - len, msg, ap);
+
+#ifdef WITH_ASYNC_LOG
+	if (name[0]) {
+		char line[8192 + 16];
+
+		snprintf(line, sizeof(line), "(%u) %s\n",
+			 request->number, buffer);
+		if (log_async_write(name, line, strlen(line))) {
+			va_end(ap);
+			return;
+		}
+
+		fp = fopen(name, "a");
+	}
+#endif
 	
 	if (!fp) {
 		if (request) {
@@ -206,6 +206,8 @@ static const CONF_PARSER log_config_nodest[] = {
 
 	{ "use_utc", PW_TYPE_BOOLEAN, 0, &log_dates_utc, NULL },
 
+	{ "async", PW_TYPE_BOOLEAN, 0, &mainconfig.log_async, "no" },
+
 	{ NULL, -1, 0, NULL, NULL }
 };
 
@@ -241,6 +243,12 @@ static const CONF_PARSER server_config[] = {
 
 	{ "debug_level", PW_TYPE_INTEGER, 0, &mainconfig.debug_level, "0"},
 
+	{ "instantiate_threads", PW_TYPE_INTEGER, 0, &mainconfig.instantiate_threads, "0"},
+
+#ifdef WITH_STATS
+	{ "module_timing", PW_TYPE_BOOLEAN, 0, &mainconfig.module_timing, "no"},
+#endif
+
 #ifdef WITH_PROXY
 	{ "proxy_requests", PW_TYPE_BOOLEAN, 0, &mainconfig.proxy_requests, "yes" },
 #endif
@@ -883,6 +891,10 @@ int read_mainconfig(int reload)
 	if (cp) p = cf_pair_value(cp);
 	if (!p) p = radius_dir;
 	DEBUG2("including dictionary file %s/%s", p, RADIUS_DICTIONARY);
+
+	cp = cf_pair_find(cs, "dictionary_cache");
+	dict_set_cache(cp ? cf_pair_value(cp) : NULL);
+
 	if (dict_init(p, RADIUS_DICTIONARY) != 0) {
 		radlog(L_ERR, "Errors reading dictionary: %s",
 				fr_strerror());
@@ -999,6 +1011,7 @@ int free_mainconfig(void)
 	realms_free();
 	listen_free(&mainconfig.listen);
 	dict_free();
+	dict_set_cache(NULL);
 
 	return 0;
 }
@@ -1068,6 +1081,14 @@ void hup_mainconfig(void)
 	 */
 	hup_logfile();
 
+#ifdef WITH_TLS
+	/*
+	 *	Modules using TLS may not be re-loaded, so tell them
+	 *	to rotate the session ticket keys.
+	 */
+	tls_ticket_keys_rotate();
+#endif
+
 	radlog(L_INFO, "HUP - loading modules");
 
 	/*
@@ -69,6 +69,7 @@ typedef struct {
 	modcallable *children;
 	CONF_SECTION *cs;
 	VALUE_PAIR *vps;
+	fr_cond_t *cond;	/* for "if" and "elsif" */
 } modgroup;
 
 typedef struct {
@@ -277,6 +278,9 @@ static int call_modsingle(int component, modsingle *sp, REQUEST *request)
 {
 	int myresult;
 	int blocked;
+#ifdef WITH_STATS
+	struct timeval start, end;
+#endif
 
 	rad_assert(request != NULL);
 
@@ -295,6 +299,10 @@ static int call_modsingle(int component, modsingle *sp, REQUEST *request)
 		goto fail;
 	}
 
+#ifdef WITH_STATS
+	gettimeofday(&start, NULL);
+#endif
+
 	safe_lock(sp->modinst);
 
 	/*
@@ -308,6 +316,35 @@ static int call_modsingle(int component, modsingle *sp, REQUEST *request)
 	request->module = "";
 	safe_unlock(sp->modinst);
 
+#ifdef WITH_STATS
+	gettimeofday(&end, NULL);
+	radius_stats_module(sp->modinst->stats_index, component,
+			    &start, &end);
+
+	/*
+	 *	e.g. Module-Timing += "files.authorize 12us"
+	 */
+	if (mainconfig.module_timing) {
+		int len;
+		long usec;
+		VALUE_PAIR *vp;
+
+		usec = ((end.tv_sec - start.tv_sec) * 1000000) +
+			(end.tv_usec - start.tv_usec);
+		if (usec < 0) usec = 0;
+
+		vp = radius_paircreate(request, &request->config_items,
+				       PW_MODULE_TIMING, 0, PW_TYPE_STRING);
+		len = snprintf(vp->vp_strvalue, sizeof(vp->vp_strvalue),
+			       "%s.%s %ldus", sp->modinst->name,
+			       comp2str[component], usec);
+		if ((len < 0) || ((size_t) len >= sizeof(vp->vp_strvalue))) {
+			len = strlen(vp->vp_strvalue);
+		}
+		vp->length = len;
+	}
+#endif
+
 	/*
 	 *	Wasn't blocked, and now is.  Complain!
 	 */
@@ -458,15 +495,15 @@ int modcall(int component, modcallable *c, REQUEST *request)
 		 */
 		if ((child->type == MOD_IF) || (child->type == MOD_ELSIF)) {
 			int condition = TRUE;
-			const char *p = child->name;
+			modgroup *g = mod_callabletogroup(child);
 
 			RDEBUG2("%.*s? %s %s",
 			       stack.pointer + 1, modcall_spaces,
 			       (child->type == MOD_IF) ? "if" : "elsif",
 			       child->name);
 
-			if (radius_evaluate_condition(request, myresult,
-						      0, &p, TRUE, &condition)) {
+			if (radius_cond_evaluate(request, myresult,
+						 g->cond, &condition)) {
 				RDEBUG2("%.*s? %s %s -> %s",
 				       stack.pointer + 1, modcall_spaces,
 				       (child->type == MOD_IF) ? "if" : "elsif",
@@ -1791,7 +1828,7 @@ static modcallable *do_compile_modsingle(modcallable *parent,
 					 const char **modname)
 {
 #ifdef WITH_UNLANG
-	int result;
+	modgroup *g;
 #endif
 	const char *modrefname;
 	modsingle *single;
@@ -1878,8 +1915,14 @@ static modcallable *do_compile_modsingle(modcallable *parent,
 			if (!csingle) return NULL;
 			csingle->type = MOD_IF;
 
-			if (!radius_evaluate_condition(NULL, 0, 0, modname,
-						       FALSE, &result)) {
+			/*
+			 *	Parse the condition once, here, rather
+			 *	than for every request.
+			 */
+			g = mod_callabletogroup(csingle);
+			g->cond = radius_cond_compile(modname);
+			if (!g->cond) {
+				cf_log_err(ci, "Failed parsing condition '%s'", name2);
 				modcallable_free(&csingle);
 				return NULL;
 			}
@@ -1907,8 +1950,14 @@ static modcallable *do_compile_modsingle(modcallable *parent,
 			if (!csingle) return NULL;
 			csingle->type = MOD_ELSIF;
 
-			if (!radius_evaluate_condition(NULL, 0, 0, modname,
-						       FALSE, &result)) {
+			/*
+			 *	Parse the condition once, here, rather
+			 *	than for every request.
+			 */
+			g = mod_callabletogroup(csingle);
+			g->cond = radius_cond_compile(modname);
+			if (!g->cond) {
+				cf_log_err(ci, "Failed parsing condition '%s'", name2);
 				modcallable_free(&csingle);
 				return NULL;
 			}
@@ -2438,6 +2487,9 @@ void modcallable_free(modcallable **pc)
 			modcallable_free(&loop);
 		}
 		pairfree(&g->vps);
+#ifdef WITH_UNLANG
+		if (g->cond) radius_cond_free(&g->cond);
+#endif
 	}
 	free(c);
 	*pc = NULL;
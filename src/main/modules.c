@@ -59,6 +59,25 @@ static rbtree_t *module_tree = NULL;
 
 static rbtree_t *instance_tree = NULL;
 
+#ifdef HAVE_PTHREAD_H
+/*
+ *	For instantiating modules in parallel.  See
+ *	instantiate_parallel().
+ */
+static pthread_mutex_t	instantiate_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	instantiate_cond = PTHREAD_COND_INITIALIZER;
+static rbtree_t		*instantiate_pending = NULL;
+static CONF_SECTION	*instantiate_modules = NULL;
+static CONF_SECTION	**instantiate_list = NULL;
+static int		instantiate_num = 0;
+static int		instantiate_max = 0;
+static CONF_SECTION	**instantiate_seen = NULL;
+static int		instantiate_num_seen = 0;
+static int		instantiate_max_seen = 0;
+static int		instantiate_next = 0;
+static int		instantiate_failed = FALSE;
+#endif
+
 struct fr_module_hup_t {
 	module_instance_t	*mi;
 	time_t			when;
@@ -578,6 +597,56 @@ static module_entry_t *linkto_module(const char *module_name,
 	return node;
 }
 
+#ifdef HAVE_PTHREAD_H
+/*
+ *	Tell other instantiation threads that a module is being
+ *	instantiated, so they wait for it instead of doing it again.
+ */
+static void instantiate_begin(module_instance_t *node)
+{
+	if (!instantiate_pending) return;
+
+	rbtree_insert(instantiate_pending, node);
+}
+
+static void instantiate_end(module_instance_t *node)
+{
+	if (!instantiate_pending) return;
+
+	rbtree_deletebydata(instantiate_pending, node);
+	pthread_cond_broadcast(&instantiate_cond);
+}
+#else
+#define instantiate_begin(_x)
+#define instantiate_end(_x)
+#endif
+
+/** Let other modules be instantiated while this one blocks
+ *
+ * Module instantiate() functions register xlats, comparisons and
+ * dictionary attributes in tables which aren't locked.  So when
+ * modules are being instantiated in parallel, only one thread runs
+ * module code at a time.  A module which is about to block for a
+ * long time, doing something which is safe to do concurrently with
+ * another module's instantiate(), calls this first, and
+ * module_instantiate_lock() afterwards.
+ *
+ * Outside of parallel instantiation, both are no-ops.
+ */
+void module_instantiate_unlock(void)
+{
+#ifdef HAVE_PTHREAD_H
+	if (instantiate_pending) pthread_mutex_unlock(&instantiate_mutex);
+#endif
+}
+
+void module_instantiate_lock(void)
+{
+#ifdef HAVE_PTHREAD_H
+	if (instantiate_pending) pthread_mutex_lock(&instantiate_mutex);
+#endif
+}
+
 /*
  *	Find a module instance.
  */
@@ -619,6 +688,23 @@ module_instance_t *find_module_instance(CONF_SECTION *modules,
 	node = rbtree_finddata(instance_tree, &myNode);
 	if (node) return node;
 
+#ifdef HAVE_PTHREAD_H
+	/*
+	 *	Another thread is instantiating it.  Wait for that to
+	 *	finish, so that a module which depends on this one
+	 *	gets the finished instance.
+	 */
+	if (instantiate_pending) {
+		while (rbtree_finddata(instantiate_pending, &myNode)) {
+			pthread_cond_wait(&instantiate_cond,
+					  &instantiate_mutex);
+		}
+
+		node = rbtree_finddata(instance_tree, &myNode);
+		if (node) return node;
+	}
+#endif
+
 	if (!do_link) return NULL;
 
 	name1 = cf_section_name1(cs);
@@ -631,6 +717,10 @@ module_instance_t *find_module_instance(CONF_SECTION *modules,
 
 	node->insthandle = NULL;
 	node->cs = cs;
+	strlcpy(node->name, instname, sizeof(node->name));
+#ifdef WITH_STATS
+	node->stats_index = radius_stats_module_index(instname);
+#endif
 
 	/*
 	 *	Names in the "modules" section aren't prefixed
@@ -667,20 +757,25 @@ module_instance_t *find_module_instance(CONF_SECTION *modules,
 	 *	Call the module's instantiation routine.
 	 */
 	if ((node->entry->module->instantiate) &&
-	    (!check_config || check_config_safe) &&
-	    ((node->entry->module->instantiate)(cs, &node->insthandle) < 0)) {
-		cf_log_err(cf_sectiontoitem(cs),
-			   "Instantiation failed for module \"%s\"",
-			   instname);
-		free(node);
-		return NULL;
+	    (!check_config || check_config_safe)) {
+		int rcode;
+
+		instantiate_begin(node);
+		rcode = (node->entry->module->instantiate)(cs, &node->insthandle);
+		if (rcode < 0) {
+			instantiate_end(node);
+			cf_log_err(cf_sectiontoitem(cs),
+				   "Instantiation failed for module \"%s\"",
+				   instname);
+			free(node);
+			return NULL;
+		}
 	}
 
 	/*
 	 *	We're done.  Fill in the rest of the data structure,
 	 *	and link it to the module instance list.
 	 */
-	strlcpy(node->name, instname, sizeof(node->name));
 
 #ifdef HAVE_PTHREAD_H
 	/*
@@ -703,6 +798,7 @@ module_instance_t *find_module_instance(CONF_SECTION *modules,
 
 #endif
 	rbtree_insert(instance_tree, node);
+	instantiate_end(node);
 
 	return node;
 }
@@ -1383,6 +1479,12 @@ int module_hup_module(CONF_SECTION *cs, module_instance_t *node, time_t when)
 
 	module_instance_free_old(cs, node, when);
 
+	/*
+	 *	Remember which configuration the new instance came
+	 *	from, so the next HUP can tell if it's changed.
+	 */
+	node->cs = cs;
+
 	/*
 	 *	Save the old instance handle for later deletion.
 	 */
@@ -1436,6 +1538,22 @@ int module_hup(CONF_SECTION *modules)
 		strlcpy(myNode.name, instname, sizeof(myNode.name));
 		node = rbtree_finddata(instance_tree, &myNode);
 
+		/*
+		 *	Modules which say they only read files named
+		 *	in their configuration needn't be re-loaded if
+		 *	neither it nor those files have changed.  We
+		 *	can't tell if other files, e.g. ones which are
+		 *	$INCLUDEd by a "users" file, have changed.
+		 *	"radmin hup <module>" always re-loads it.
+		 */
+		if (node &&
+		    ((node->entry->module->type & RLM_TYPE_HUP_CHANGED) != 0) &&
+		    cf_section_cmp(node->cs, cs)) {
+			DEBUG2(" Module: Not reloading unchanged module \"%s\"",
+			       node->name);
+			continue;
+		}
+
 		module_hup_module(cs, node, when);
 	}
 
@@ -1443,6 +1561,225 @@ int module_hup(CONF_SECTION *modules)
 }
 
 
+#ifdef HAVE_PTHREAD_H
+/*
+ *	Add a section to a list, unless it's already there.
+ *	Returns 1 if it was added.
+ */
+static int instantiate_append(CONF_SECTION ***list, int *num, int *max,
+			      CONF_SECTION *cs)
+{
+	int i;
+
+	for (i = 0; i < *num; i++) {
+		if ((*list)[i] == cs) return 0;
+	}
+
+	if (*num == *max) {
+		*max = (*max == 0) ? 64 : (*max * 2);
+		*list = realloc(*list, *max * sizeof(**list));
+		if (!*list) {
+			radlog(L_ERR, "Out of memory");
+			exit(1);
+		}
+	}
+
+	(*list)[(*num)++] = cs;
+	return 1;
+}
+
+/*
+ *	Find the modules which are used by a section that is
+ *	compiled.  They are the bare words which are the name of a
+ *	module configuration.  Bare words which name a policy, or a
+ *	virtual module in the "instantiate" section, are followed in
+ *	the same way.  Policies which nothing calls are never
+ *	compiled, so their modules are left alone.
+ */
+static void instantiate_find(CONF_SECTION *config, CONF_SECTION *modules,
+			     CONF_SECTION *cs)
+{
+	int i;
+	char *p;
+	CONF_ITEM *ci;
+	CONF_SECTION *subcs, *policy;
+	const char *name;
+	char buffer[256];
+
+	if (!cs) return;
+
+	if (!instantiate_append(&instantiate_seen, &instantiate_num_seen,
+				&instantiate_max_seen, cs)) return;
+
+	for (ci = cf_item_find_next(cs, NULL);
+	     ci != NULL;
+	     ci = cf_item_find_next(cs, ci)) {
+		if (cf_item_is_section(ci)) {
+			instantiate_find(config, modules, cf_itemtosection(ci));
+			continue;
+		}
+
+		if (!cf_item_is_pair(ci)) continue;
+
+		if (cf_pair_value(cf_itemtopair(ci)) != NULL) continue;
+
+		/*
+		 *	"-foo" and "foo.authorize" are also "foo".
+		 */
+		name = cf_pair_attr(cf_itemtopair(ci));
+		if (*name == '-') name++;
+
+		subcs = cf_section_sub_find(config, "instantiate");
+		if (subcs) {
+			instantiate_find(config, modules,
+					 cf_section_sub_find_name2(subcs, NULL, name));
+		}
+
+		policy = cf_section_sub_find(config, "policy");
+		if (policy) {
+			instantiate_find(config, modules,
+					 cf_section_sub_find_name2(policy, NULL, name));
+
+			for (i = 0; i < RLM_COMPONENT_COUNT; i++) {
+				snprintf(buffer, sizeof(buffer), "%s.%s", name,
+					 section_type_value[i].section);
+				instantiate_find(config, modules,
+						 cf_section_sub_find_name2(policy, NULL, buffer));
+			}
+		}
+
+		strlcpy(buffer, name, sizeof(buffer));
+		p = strchr(buffer, '.');
+		if (p) *p = '\0';
+
+		subcs = cf_section_sub_find_name2(modules, NULL, buffer);
+		if (!subcs) continue;
+
+		instantiate_append(&instantiate_list, &instantiate_num,
+				   &instantiate_max, subcs);
+	}
+}
+
+static void *instantiate_thread(UNUSED void *arg)
+{
+	CONF_SECTION *cs;
+	const char *name;
+
+	pthread_mutex_lock(&instantiate_mutex);
+
+	while (!instantiate_failed &&
+	       (instantiate_next < instantiate_num)) {
+		cs = instantiate_list[instantiate_next++];
+
+		name = cf_section_name2(cs);
+		if (!name) name = cf_section_name1(cs);
+
+		if (!find_module_instance(instantiate_modules, name, 1)) {
+			instantiate_failed = TRUE;
+		}
+	}
+
+	pthread_mutex_unlock(&instantiate_mutex);
+
+	return NULL;
+}
+
+/*
+ *	Instantiate the modules used by the configuration, using a
+ *	pool of threads.  Modules which were already instantiated
+ *	from the "instantiate" section are skipped.  A module which
+ *	needs another one that is still being instantiated waits for
+ *	it, in find_module_instance().
+ */
+static int instantiate_parallel(CONF_SECTION *config, CONF_SECTION *modules,
+				int num_threads)
+{
+	int i, rcode, num_started;
+	CONF_SECTION *cs;
+	pthread_t *threads;
+
+	if (num_threads > 64) num_threads = 64;
+
+	instantiate_num = instantiate_next = instantiate_max = 0;
+	instantiate_num_seen = instantiate_max_seen = 0;
+
+	/*
+	 *	Only walk the sections which are compiled: the virtual
+	 *	servers, or the old-style sections at the top level
+	 *	if there is no default server.
+	 */
+	for (cs = cf_subsection_find_next(config, NULL, "server");
+	     cs != NULL;
+	     cs = cf_subsection_find_next(config, cs, "server")) {
+		instantiate_find(config, modules, cs);
+	}
+
+	if (!cf_section_find_name2(cf_subsection_find_next(config, NULL,
+							   "server"),
+				   "server", NULL)) {
+		for (i = 0; i < RLM_COMPONENT_COUNT; i++) {
+			instantiate_find(config, modules,
+					 cf_section_sub_find(config,
+							     section_type_value[i].section));
+		}
+	}
+
+	free(instantiate_seen);
+	instantiate_seen = NULL;
+
+	if (instantiate_num == 0) return 0;
+
+	instantiate_pending = rbtree_create(module_instance_cmp, NULL, 0);
+	if (!instantiate_pending) {
+		radlog(L_ERR, "Failed to initialize modules\n");
+		free(instantiate_list);
+		instantiate_list = NULL;
+		return -1;
+	}
+
+	instantiate_modules = modules;
+	instantiate_failed = FALSE;
+
+	if (num_threads > instantiate_num) num_threads = instantiate_num;
+
+	DEBUG2("%s: Instantiating %d modules with %d threads",
+	       mainconfig.name, instantiate_num, num_threads);
+
+	threads = rad_malloc(num_threads * sizeof(*threads));
+
+	for (num_started = 0; num_started < num_threads; num_started++) {
+		rcode = pthread_create(&threads[num_started], NULL,
+				       instantiate_thread, NULL);
+		if (rcode != 0) {
+			radlog(L_ERR, "Failed creating thread to instantiate modules: %s",
+			       strerror(rcode));
+			break;
+		}
+	}
+
+	/*
+	 *	No threads, do it ourselves.
+	 */
+	if (num_started == 0) instantiate_thread(NULL);
+
+	for (i = 0; i < num_started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	free(threads);
+
+	rbtree_free(instantiate_pending);
+	instantiate_pending = NULL;
+	instantiate_modules = NULL;
+	free(instantiate_list);
+	instantiate_list = NULL;
+	instantiate_num = instantiate_next = 0;
+
+	if (instantiate_failed) return -1;
+
+	return 0;
+}
+#endif
+
 /*
  *	Parse the module config sections, and load
  *	and call each module's init() function.
@@ -1612,6 +1949,20 @@ int setup_modules(int reload, CONF_SECTION *config)
 		cf_log_info(cs, " }");
 	} /* if there's an 'instantiate' section. */
 
+#ifdef HAVE_PTHREAD_H
+	/*
+	 *	Instantiate the other modules up front, in parallel,
+	 *	instead of one by one as the virtual servers are
+	 *	loaded.
+	 */
+	if (modules && !check_config &&
+	    (mainconfig.instantiate_threads > 1) &&
+	    (instantiate_parallel(config, modules,
+				  mainconfig.instantiate_threads) < 0)) {
+		return -1;
+	}
+#endif
+
 	/*
 	 *	Loop over the listeners, figuring out which sections
 	 *	to load.
@@ -1961,6 +1961,9 @@ int request_proxy_reply(RADIUS_PACKET *packet)
 	request->home_server->stats.last_packet = packet->timestamp.tv_sec;
 	request->proxy_listener->stats.last_packet = packet->timestamp.tv_sec;
 
+	radius_stats_latency(FR_STATS_LATENCY_PROXY,
+			     &request->proxy->timestamp, &packet->timestamp);
+
 	if (request->proxy->code == PW_AUTHENTICATION_REQUEST) {
 		proxy_auth_stats.last_packet = packet->timestamp.tv_sec;
 #ifdef WITH_ACCOUNTING
@@ -2369,7 +2372,7 @@ static int request_proxy(REQUEST *request, int retransmit)
 #ifdef HAVE_PTHREAD_H
 	request->child_pid = NO_SUCH_CHILD_PID;
 #endif
-	FR_STATS_TYPE_INC(request->home_server->stats.total_requests);
+	FR_STATS_TYPE_INC(request->home_server->stats, total_requests);
 	request->proxy_listener->send(request->proxy_listener,
 				      request);
 	return 1;
@@ -2886,7 +2889,7 @@ STATE_MACHINE_DECL(proxy_wait_for_reply)
 
 		rad_assert(request->proxy_listener != NULL);;
 		DEBUG_PACKET(request, request->proxy, 1);
-		FR_STATS_TYPE_INC(home->stats.total_requests);
+		FR_STATS_TYPE_INC(home->stats, total_requests);
 		home->last_packet_sent = now.tv_sec;
 		request->proxy_listener->send(request->proxy_listener,
 					      request);
@@ -2937,15 +2940,15 @@ STATE_MACHINE_DECL(proxy_wait_for_reply)
 			mark_home_server_zombie(home);
 		}
 
-		FR_STATS_TYPE_INC(home->stats.total_timeouts);
+		FR_STATS_TYPE_INC(home->stats, total_timeouts);
 		if (home->type == HOME_TYPE_AUTH) {
-			if (request->proxy_listener) FR_STATS_TYPE_INC(request->proxy_listener->stats.total_timeouts);
-			FR_STATS_TYPE_INC(proxy_auth_stats.total_timeouts);
+			if (request->proxy_listener) FR_STATS_TYPE_INC(request->proxy_listener->stats, total_timeouts);
+			FR_STATS_TYPE_INC(proxy_auth_stats, total_timeouts);
 		}
 #ifdef WITH_ACCT
 		else if (home->type == HOME_TYPE_ACCT) {
-			if (request->proxy_listener) FR_STATS_TYPE_INC(request->proxy_listener->stats.total_timeouts);
-			FR_STATS_TYPE_INC(proxy_acct_stats.total_timeouts);
+			if (request->proxy_listener) FR_STATS_TYPE_INC(request->proxy_listener->stats, total_timeouts);
+			FR_STATS_TYPE_INC(proxy_acct_stats, total_timeouts);
 		}
 #endif
 
@@ -3200,7 +3203,7 @@ static void request_coa_originate(REQUEST *request)
 #endif
 	coa->child_state = REQUEST_ACTIVE;
 	rad_assert(coa->proxy_reply == NULL);
-	FR_STATS_TYPE_INC(coa->home_server->stats.total_requests);
+	FR_STATS_TYPE_INC(coa->home_server->stats, total_requests);
 	coa->home_server->last_packet_sent = coa->proxy->timestamp.tv_sec;
 	coa->proxy_listener->send(coa->proxy_listener, coa);
 }
@@ -3332,7 +3335,7 @@ static void request_coa_timer(REQUEST *request)
 
 	request->num_coa_requests++; /* is NOT reset by code 3 lines above! */
 
-	FR_STATS_TYPE_INC(request->home_server->stats.total_requests);
+	FR_STATS_TYPE_INC(request->home_server->stats, total_requests);
 
 	/*
 	 *	Status servers don't count as real packets sent.
@@ -420,6 +420,16 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	/*
+	 *	In debugging mode, messages are also printed
+	 *	directly to stdout, so they have to be written in
+	 *	order.
+	 */
+	if (mainconfig.log_async && !debug_flag &&
+	    (radlog_async_start() < 0)) {
+		exit(1);
+	}
+
 	exec_trigger(NULL, NULL, "server.start", FALSE);
 
 	/*
@@ -476,6 +486,8 @@ int main(int argc, char *argv[])
 	
 	xlat_free();		/* modules may have xlat's */
 
+	radlog_async_stop();
+
 	/*
 	 *	Free the configuration items.
 	 */
@@ -0,0 +1,113 @@
+/*
+ * radusers.c	Compile a "users" file for rlm_files.
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2013  The FreeRADIUS server project
+ */
+
+#include <freeradius-devel/ident.h>
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/radpaths.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+/*
+ *	Globals, for log.c and files.c to use.
+ */
+int debug_flag = 0;
+struct main_config_t mainconfig;
+char *request_log_file = NULL;
+char *debug_log_file = NULL;
+
+size_t radius_xlat(char *out, UNUSED int outlen, UNUSED const char *fmt,
+		   UNUSED REQUEST *request,
+		   UNUSED RADIUS_ESCAPE_STRING func, UNUSED void *arg)
+{
+	*out = 0;
+	return 0;
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "Usage: radusers [-d raddb] [-x] input output\n");
+	fprintf(stderr, "Compile a users file, so that rlm_files can use it without reading it into memory.\n");
+	fprintf(stderr, "  -d raddb    Set the directory containing the dictionary (default %s).\n",
+		RADDBDIR);
+	fprintf(stderr, "  -x          Print more information about what is being done.\n");
+	fprintf(stderr, "  input       The users file to compile.\n");
+	fprintf(stderr, "  output      The compiled file to write.\n");
+
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int c, num;
+	const char *raddb_dir = RADDBDIR;
+	PAIR_LIST *list, *pl;
+
+	while ((c = getopt(argc, argv, "d:hx")) != EOF) switch(c) {
+		case 'd':
+			raddb_dir = optarg;
+			break;
+		case 'x':
+			debug_flag++;
+			fr_debug_flag++;
+			break;
+		case 'h':
+		default:
+			usage();
+	}
+	argc -= (optind - 1);
+	argv += (optind - 1);
+
+	if (argc != 3) usage();
+
+	memset(&mainconfig, 0, sizeof(mainconfig));
+	mainconfig.radlog_dest = RADLOG_STDERR;
+	mainconfig.radlog_fd = STDERR_FILENO;
+
+	if (dict_init(raddb_dir, RADIUS_DICTIONARY) < 0) {
+		fr_perror("radusers");
+		exit(1);
+	}
+
+	list = NULL;
+	if (pairlist_read(argv[1], &list, 1) < 0) {
+		exit(1);
+	}
+
+	if (pairlist_compile(argv[2], list) < 0) {
+		pairlist_free(&list);
+		exit(1);
+	}
+
+	num = 0;
+	for (pl = list; pl != NULL; pl = pl->next) num++;
+
+	DEBUG("Compiled %d entries from %s to %s", num, argv[1], argv[2]);
+
+	pairlist_free(&list);
+	dict_free();
+
+	return 0;
+}
@@ -0,0 +1,5 @@
+TARGET		:= radusers
+SOURCES		:= radusers.c files.c log.c util.c
+
+TGT_PREREQS	:= libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
@@ -132,6 +132,9 @@ static void home_server_free(void *data)
 {
 	home_server *home = data;
 
+#ifdef WITH_STATS
+	radius_stats_free(&home->stats);
+#endif
 	free(home);
 }
 
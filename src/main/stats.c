@@ -25,8 +25,36 @@
 RCSID("$Id$")
 
 #include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/modpriv.h>
 #include <freeradius-devel/rad_assert.h>
 
+/*
+ *	Find the histogram bucket for the time between "start" and
+ *	"end".  The buckets are decades, from "less than 10us" (0) to
+ *	"10s or more" (7), the same as for "elapsed".  Returns -1 if
+ *	"end" is before "start".
+ */
+int radius_stats_bucket(const struct timeval *start,
+			const struct timeval *end, uint64_t *usec)
+{
+	int i;
+	uint64_t delay, cmp;
+
+	if (end->tv_sec < start->tv_sec) return -1;
+
+	delay = ((uint64_t) (end->tv_sec - start->tv_sec) * 1000000) +
+		end->tv_usec - start->tv_usec;
+	if (usec) *usec = delay;
+
+	cmp = 10;
+	for (i = 0; i < 7; i++) {
+		if (delay < cmp) return i;
+		cmp *= 10;
+	}
+
+	return 7;
+}
+
 #ifdef WITH_STATS
 
 #define USEC (1000000)
@@ -90,6 +118,8 @@ static void stats_time(fr_stats_t *stats, struct timeval *start,
 	if ((start->tv_sec == 0) || (end->tv_sec == 0) ||
 	    (end->tv_sec < start->tv_sec)) return;
 
+	stats = radius_stats_local(stats);
+
 	tv_sub(end, start, &diff);
 
 	if (diff.tv_sec >= 10) {
@@ -128,26 +158,26 @@ void request_stats_final(REQUEST *request)
 	    (request->listener->type != RAD_LISTEN_AUTH)) return;
 
 #undef INC_AUTH
-#define INC_AUTH(_x) radius_auth_stats._x++;request->listener->stats._x++;request->client->auth._x++;
+#define INC_AUTH(_x) radius_stats_local(&radius_auth_stats)->_x++;radius_stats_local(&request->listener->stats)->_x++;radius_stats_local(&request->client->auth)->_x++;
 
 
 #undef INC_ACCT
 #ifdef WITH_ACCOUNTING
-#define INC_ACCT(_x) radius_acct_stats._x++;request->listener->stats._x++;request->client->acct._x++
+#define INC_ACCT(_x) radius_stats_local(&radius_acct_stats)->_x++;radius_stats_local(&request->listener->stats)->_x++;radius_stats_local(&request->client->acct)->_x++
 #else
 #define INC_ACCT(_x)
 #endif
 
 #undef INC_COA
 #ifdef WITH_COA
-#define INC_COA(_x) radius_coa_stats._x++;request->listener->stats._x++;request->client->coa._x++
+#define INC_COA(_x) radius_stats_local(&radius_coa_stats)->_x++;radius_stats_local(&request->listener->stats)->_x++;radius_stats_local(&request->client->coa)->_x++
 #else
 #define INC_COA(_x)
 #endif
 
 #undef INC_DSC
 #ifdef WITH_DSC
-#define INC_DSC(_x) radius_dsc_stats._x++;request->listener->stats._x++;request->client->dsc._x++
+#define INC_DSC(_x) radius_stats_local(&radius_dsc_stats)->_x++;radius_stats_local(&request->listener->stats)->_x++;radius_stats_local(&request->client->dsc)->_x++
 #else
 #define INC_DSC(_x)
 #endif
@@ -158,7 +188,8 @@ void request_stats_final(REQUEST *request)
 	 *	Note that we do NOT do this in a child thread.
 	 *	Instead, we update the stats when a request is
 	 *	deleted, because only the main server thread calls
-	 *	this function, which makes it thread-safe.
+	 *	this function.  The counters are the main thread's
+	 *	own, so they don't contend with the child threads.
 	 */
 	if (request->reply) switch (request->reply->code) {
 	case PW_AUTHENTICATION_ACK:
@@ -258,16 +289,16 @@ void request_stats_final(REQUEST *request)
 
 	switch (request->proxy->code) {
 	case PW_AUTHENTICATION_REQUEST:
-		proxy_auth_stats.total_requests += request->num_proxied_requests;
-		request->proxy_listener->stats.total_requests += request->num_proxied_requests;
-		request->home_server->stats.total_requests += request->num_proxied_requests;
+		radius_stats_local(&proxy_auth_stats)->total_requests += request->num_proxied_requests;
+		radius_stats_local(&request->proxy_listener->stats)->total_requests += request->num_proxied_requests;
+		radius_stats_local(&request->home_server->stats)->total_requests += request->num_proxied_requests;
 		break;
 
 #ifdef WITH_ACCOUNTING
 	case PW_ACCOUNTING_REQUEST:
-		proxy_acct_stats.total_requests++;
-		request->proxy_listener->stats.total_requests += request->num_proxied_requests;
-		request->home_server->stats.total_requests += request->num_proxied_requests;
+		radius_stats_local(&proxy_acct_stats)->total_requests++;
+		radius_stats_local(&request->proxy_listener->stats)->total_requests += request->num_proxied_requests;
+		radius_stats_local(&request->home_server->stats)->total_requests += request->num_proxied_requests;
 		break;
 #endif
 
@@ -278,7 +309,7 @@ void request_stats_final(REQUEST *request)
 	if (!request->proxy_reply) goto done;	/* simplifies formatting */
 
 #undef INC
-#define INC(_x) proxy_auth_stats._x += request->num_proxied_responses; request->proxy_listener->stats._x += request->num_proxied_responses; request->home_server->stats._x += request->num_proxied_responses;
+#define INC(_x) radius_stats_local(&proxy_auth_stats)->_x += request->num_proxied_responses; radius_stats_local(&request->proxy_listener->stats)->_x += request->num_proxied_responses; radius_stats_local(&request->home_server->stats)->_x += request->num_proxied_responses;
 
 	switch (request->proxy_reply->code) {
 	case PW_AUTHENTICATION_ACK:
@@ -303,9 +334,9 @@ void request_stats_final(REQUEST *request)
 
 #ifdef WITH_ACCOUNTING
 	case PW_ACCOUNTING_RESPONSE:
-		proxy_acct_stats.total_responses++;
-		request->proxy_listener->stats.total_responses++;
-		request->home_server->stats.total_responses++;
+		radius_stats_local(&proxy_acct_stats)->total_responses++;
+		radius_stats_local(&request->proxy_listener->stats)->total_responses++;
+		radius_stats_local(&request->home_server->stats)->total_responses++;
 		stats_time(&proxy_acct_stats,
 			   &request->proxy->timestamp,
 			   &request->proxy_reply->timestamp);
@@ -316,9 +347,9 @@ void request_stats_final(REQUEST *request)
 #endif
 
 	default:
-		proxy_auth_stats.total_unknown_types++;
-		request->proxy_listener->stats.total_unknown_types++;
-		request->home_server->stats.total_unknown_types++;
+		radius_stats_local(&proxy_auth_stats)->total_unknown_types++;
+		radius_stats_local(&request->proxy_listener->stats)->total_unknown_types++;
+		radius_stats_local(&request->home_server->stats)->total_unknown_types++;
 		break;
 	}
 
@@ -427,12 +458,28 @@ static fr_stats2vp client_acctvp[] = {
 };
 #endif
 
+/*
+ *	Connection pools
+ */
+static fr_stats2vp poolvp[] = {
+	{ 189, offsetof(fr_connection_pool_stats_t, opened) },
+	{ 190, offsetof(fr_connection_pool_stats_t, failed) },
+	{ 191, offsetof(fr_connection_pool_stats_t, closed) },
+	{ 192, offsetof(fr_connection_pool_stats_t, reconnected) },
+	{ 193, offsetof(fr_connection_pool_stats_t, at_max) },
+	{ 194, offsetof(fr_connection_pool_stats_t, reserved) },
+	{ 0, 0 }
+};
+
 static void request_stats_addvp(REQUEST *request,
 				fr_stats2vp *table, fr_stats_t *stats)
 {
 	int i;
 	fr_uint_t counter;
 	VALUE_PAIR *vp;
+	fr_stats_t sum;
+
+	radius_stats_get(stats, &sum);
 
 	for (i = 0; table[i].attribute != 0; i++) {
 		vp = radius_paircreate(request, &request->reply->vps,
@@ -440,12 +487,73 @@ static void request_stats_addvp(REQUEST *request,
 				       PW_TYPE_INTEGER);
 		if (!vp) continue;
 
-		counter = *(fr_uint_t *) (((uint8_t *) stats) + table[i].offset);
+		counter = *(fr_uint_t *) (((uint8_t *) &sum) + table[i].offset);
 		vp->vp_integer = counter;
 	}
 }
 
 
+static void request_stats_pool(REQUEST *request)
+{
+	int i;
+	VALUE_PAIR *vp;
+	fr_connection_pool_stats_t stats;
+
+	vp = pairfind(request->packet->vps, 186, VENDORPEC_FREERADIUS, TAG_ANY);
+	if (!vp) return;
+
+	if (!fr_connection_pool_stats(vp->vp_strvalue, &stats)) return;
+
+	/*
+	 *	Echo back the module name, along with the statistics.
+	 */
+	pairadd(&request->reply->vps, paircopyvp(vp));
+
+	vp = radius_paircreate(request, &request->reply->vps,
+			       187, VENDORPEC_FREERADIUS, PW_TYPE_INTEGER);
+	if (vp) vp->vp_integer = stats.num;
+
+	vp = radius_paircreate(request, &request->reply->vps,
+			       188, VENDORPEC_FREERADIUS, PW_TYPE_INTEGER);
+	if (vp) vp->vp_integer = stats.active;
+
+	for (i = 0; poolvp[i].attribute != 0; i++) {
+		vp = radius_paircreate(request, &request->reply->vps,
+				       poolvp[i].attribute, VENDORPEC_FREERADIUS,
+				       PW_TYPE_INTEGER);
+		if (!vp) continue;
+
+		vp->vp_integer = *(uint32_t *) (((uint8_t *) &stats) + poolvp[i].offset);
+	}
+
+	/*
+	 *	The histograms, one attribute per bucket.
+	 */
+	for (i = 0; i < 8; i++) {
+		vp = radius_paircreate(request, &request->reply->vps,
+				       197 + i, VENDORPEC_FREERADIUS,
+				       PW_TYPE_INTEGER);
+		if (vp) vp->vp_integer = stats.acquire_time[i];
+	}
+
+	for (i = 0; i < 8; i++) {
+		vp = radius_paircreate(request, &request->reply->vps,
+				       205 + i, VENDORPEC_FREERADIUS,
+				       PW_TYPE_INTEGER);
+		if (vp) vp->vp_integer = stats.hold_time[i];
+	}
+
+	if (!stats.reserved) return;
+
+	vp = radius_paircreate(request, &request->reply->vps,
+			       195, VENDORPEC_FREERADIUS, PW_TYPE_INTEGER);
+	if (vp) vp->vp_integer = stats.acquire_usec / stats.reserved;
+
+	vp = radius_paircreate(request, &request->reply->vps,
+			       196, VENDORPEC_FREERADIUS, PW_TYPE_INTEGER);
+	if (vp) vp->vp_integer = stats.hold_usec / stats.reserved;
+}
+
 void request_stats_reply(REQUEST *request)
 {
 	VALUE_PAIR *flag, *vp;
@@ -533,6 +641,13 @@ void request_stats_reply(REQUEST *request)
 #endif
 	}
 
+	/*
+	 *	For a particular module's connection pool.
+	 */
+	if ((flag->vp_integer & 0x100) != 0) {
+		request_stats_pool(request);
+	}
+
 	/*
 	 *	For a particular client.
 	 */
@@ -858,4 +973,570 @@ void radius_stats_ema(fr_stats_ema_t *ema,
 #endif	
 }
 
+/*
+ *	Packet counters, latency of module calls, of the thread queue,
+ *	and of proxied requests.
+ *
+ *	Each thread adds to its own counters, so recording a packet or
+ *	a time needs no lock, and doesn't write to memory shared with
+ *	other threads.  The counters are summed when they are read.
+ *	The mutex protects the list of threads, the module names, the
+ *	counters of threads which have exited, and any change to the
+ *	table of packet counters.
+ *
+ *	The packet counters are kept in a small hash table, keyed by
+ *	the address of the global, listener, client or home server
+ *	counters which they shadow.  When a thread exits, its counts
+ *	are added to those shared counters.
+ */
+#define STATS_CACHE_LINE (64)
+
+typedef struct stats_local_t {
+	fr_stats_t		*key;
+	fr_stats_t		stats;
+} stats_local_t;
+
+typedef struct stats_thread_t {
+	struct stats_thread_t	*next;
+	void			*raw;
+	int			num_modules;
+	fr_stats_timing_t	*modules; /* num_modules * RLM_COMPONENT_COUNT */
+	void			*modules_raw;
+	fr_stats_timing_t	latency[FR_STATS_LATENCY_COUNT];
+	int			num_local; /* including deleted entries */
+	int			max_local; /* power of 2 */
+	stats_local_t		*local;
+	void			*local_raw;
+} stats_thread_t;
+
+/*
+ *	Marks an entry whose counters have been freed.
+ */
+static fr_stats_t	stats_deleted;
+
+static int		stats_num_modules = 0;
+static int		stats_max_modules = 0;
+static char		**stats_module_names = NULL;
+
+static stats_thread_t	*stats_threads = NULL;
+static stats_thread_t	stats_retired;
+
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t	stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t	stats_thread_key;
+static pthread_once_t	stats_thread_once = PTHREAD_ONCE_INIT;
+
+#define STATS_LOCK	pthread_mutex_lock(&stats_mutex)
+#define STATS_UNLOCK	pthread_mutex_unlock(&stats_mutex)
+#else
+static stats_thread_t	*stats_thread = NULL;
+
+#define STATS_LOCK
+#define STATS_UNLOCK
+#endif
+
+static void stats_timing_add(fr_stats_timing_t *timing,
+			     const struct timeval *start,
+			     const struct timeval *end)
+{
+	int i;
+	uint64_t delay;
+
+	i = radius_stats_bucket(start, end, &delay);
+	if (i < 0) return;
+
+	timing->count++;
+	timing->usec += delay;
+	timing->elapsed[i]++;
+}
+
+static void stats_timing_sum(fr_stats_timing_t *out,
+			     const fr_stats_timing_t *in)
+{
+	int i;
+
+	out->count += in->count;
+	out->usec += in->usec;
+	for (i = 0; i < 8; i++) {
+		out->elapsed[i] += in->elapsed[i];
+	}
+}
+
+/*
+ *	Allocate zeroed memory which starts and ends on a cache line,
+ *	so that it doesn't share one with memory used by another
+ *	thread.  "raw" is what should be passed to free().
+ */
+static void *stats_alloc(size_t size, void **raw)
+{
+	uint8_t *p;
+
+	size = (size + STATS_CACHE_LINE - 1) & ~((size_t) STATS_CACHE_LINE - 1);
+
+	p = malloc(size + STATS_CACHE_LINE);
+	if (!p) return NULL;
+	*raw = p;
+
+	p += (STATS_CACHE_LINE - (((uintptr_t) p) & (STATS_CACHE_LINE - 1))) &
+		(STATS_CACHE_LINE - 1);
+	memset(p, 0, size);
+
+	return p;
+}
+
+/*
+ *	Add the counters in "in" to "out".  "last_packet" is written
+ *	by the main thread directly to the shared counters, so it is
+ *	left alone.
+ */
+static void stats_sum(fr_stats_t *out, const fr_stats_t *in)
+{
+	int i;
+
+	out->total_requests += in->total_requests;
+	out->total_invalid_requests += in->total_invalid_requests;
+	out->total_dup_requests += in->total_dup_requests;
+	out->total_responses += in->total_responses;
+	out->total_access_accepts += in->total_access_accepts;
+	out->total_access_rejects += in->total_access_rejects;
+	out->total_access_challenges += in->total_access_challenges;
+	out->total_malformed_requests += in->total_malformed_requests;
+	out->total_bad_authenticators += in->total_bad_authenticators;
+	out->total_packets_dropped += in->total_packets_dropped;
+	out->total_no_records += in->total_no_records;
+	out->total_unknown_types += in->total_unknown_types;
+	out->total_timeouts += in->total_timeouts;
+	for (i = 0; i < 8; i++) {
+		out->elapsed[i] += in->elapsed[i];
+	}
+}
+
+static uint32_t stats_local_hash(const fr_stats_t *key)
+{
+	uintptr_t hash = (uintptr_t) key;
+
+	return ((uint32_t) (hash >> 4)) * 2654435761U;
+}
+
+/*
+ *	Find a thread's counters for "key".  The thread may do this
+ *	without the mutex, as only it adds entries.  Anyone else has
+ *	to hold the mutex.
+ */
+static stats_local_t *stats_local_find(stats_thread_t *thread,
+				       const fr_stats_t *key)
+{
+	uint32_t i, mask;
+
+	if (!thread->max_local) return NULL;
+
+	mask = thread->max_local - 1;
+	for (i = stats_local_hash(key) & mask;
+	     thread->local[i].key != NULL;
+	     i = (i + 1) & mask) {
+		if (thread->local[i].key == key) return &thread->local[i];
+	}
+
+	return NULL;
+}
+
+/*
+ *	Add counters for "key" to a thread.  Called by the thread
+ *	itself, with the mutex held.  The table is kept no more than
+ *	half full, and deleted entries are dropped when it is
+ *	rebuilt.
+ */
+static stats_local_t *stats_local_insert(stats_thread_t *thread,
+					 fr_stats_t *key)
+{
+	uint32_t i, mask;
+
+	if (((thread->num_local + 1) * 2) > thread->max_local) {
+		int j, live, max;
+		void *raw;
+		stats_local_t *local, *old;
+
+		live = 0;
+		for (j = 0; j < thread->max_local; j++) {
+			if (thread->local[j].key &&
+			    (thread->local[j].key != &stats_deleted)) live++;
+		}
+
+		max = 16;
+		while (max < ((live + 1) * 4)) max *= 2;
+
+		local = stats_alloc(max * sizeof(*local), &raw);
+		if (!local) return NULL;
+
+		old = thread->local;
+		mask = max - 1;
+		for (j = 0; j < thread->max_local; j++) {
+			if (!old[j].key || (old[j].key == &stats_deleted)) continue;
+
+			for (i = stats_local_hash(old[j].key) & mask;
+			     local[i].key != NULL;
+			     i = (i + 1) & mask) {
+				/* nothing */
+			}
+			local[i] = old[j];
+		}
+
+		free(thread->local_raw);
+		thread->local = local;
+		thread->local_raw = raw;
+		thread->max_local = max;
+		thread->num_local = live;
+	}
+
+	mask = thread->max_local - 1;
+	for (i = stats_local_hash(key) & mask;
+	     thread->local[i].key != NULL;
+	     i = (i + 1) & mask) {
+		/* nothing */
+	}
+
+	memset(&thread->local[i].stats, 0, sizeof(thread->local[i].stats));
+	thread->local[i].key = key;
+	thread->num_local++;
+
+	return &thread->local[i];
+}
+
+/*
+ *	Make room for "num" modules.  Called with the mutex held, as
+ *	the counters may be being read.
+ */
+static int stats_thread_grow(stats_thread_t *thread, int num)
+{
+	void *raw;
+	fr_stats_timing_t *modules;
+
+	if (num <= thread->num_modules) return 0;
+
+	modules = stats_alloc(num * RLM_COMPONENT_COUNT * sizeof(*modules),
+			      &raw);
+	if (!modules) return -1;
+
+	if (thread->modules) {
+		memcpy(modules, thread->modules,
+		       thread->num_modules * RLM_COMPONENT_COUNT * sizeof(*modules));
+		free(thread->modules_raw);
+	}
+
+	thread->modules = modules;
+	thread->modules_raw = raw;
+	thread->num_modules = num;
+
+	return 0;
+}
+
+static void stats_thread_free(void *data)
+{
+	int i;
+	stats_thread_t *thread = data;
+	stats_thread_t **last;
+
+	STATS_LOCK;
+	for (last = &stats_threads; *last != NULL; last = &((*last)->next)) {
+		if (*last == thread) {
+			*last = thread->next;
+			break;
+		}
+	}
+
+	/*
+	 *	Keep the counts of threads which have exited.
+	 */
+	stats_thread_grow(&stats_retired, thread->num_modules);
+	for (i = 0; i < thread->num_modules * RLM_COMPONENT_COUNT; i++) {
+		if (i >= (stats_retired.num_modules * RLM_COMPONENT_COUNT)) break;
+
+		stats_timing_sum(&stats_retired.modules[i], &thread->modules[i]);
+	}
+	for (i = 0; i < FR_STATS_LATENCY_COUNT; i++) {
+		stats_timing_sum(&stats_retired.latency[i], &thread->latency[i]);
+	}
+	for (i = 0; i < thread->max_local; i++) {
+		if (!thread->local[i].key ||
+		    (thread->local[i].key == &stats_deleted)) continue;
+
+		stats_sum(thread->local[i].key, &thread->local[i].stats);
+	}
+	STATS_UNLOCK;
+
+	free(thread->local_raw);
+	free(thread->modules_raw);
+	free(thread->raw);
+}
+
+#ifdef HAVE_PTHREAD_H
+static void stats_make_key(void)
+{
+	pthread_key_create(&stats_thread_key, stats_thread_free);
+}
+#endif
+
+static stats_thread_t *stats_thread_get(void)
+{
+	void *raw;
+	stats_thread_t *thread;
+
+#ifdef HAVE_PTHREAD_H
+	pthread_once(&stats_thread_once, stats_make_key);
+
+	thread = pthread_getspecific(stats_thread_key);
+#else
+	thread = stats_thread;
+#endif
+	if (thread) return thread;
+
+	thread = stats_alloc(sizeof(*thread), &raw);
+	if (!thread) return NULL;
+	thread->raw = raw;
+
+	STATS_LOCK;
+	thread->next = stats_threads;
+	stats_threads = thread;
+	STATS_UNLOCK;
+
+#ifdef HAVE_PTHREAD_H
+	pthread_setspecific(stats_thread_key, thread);
+#else
+	stats_thread = thread;
+#endif
+
+	return thread;
+}
+
+/** Get the index used to record the latency of a module
+ *
+ * Module instances with the same name share the same index, so the
+ * statistics are kept across a HUP.
+ *
+ * @param[in] name of the module instance.
+ * @return the index, or -1 on error.
+ */
+int radius_stats_module_index(const char *name)
+{
+	int i;
+
+	STATS_LOCK;
+	for (i = 0; i < stats_num_modules; i++) {
+		if (strcmp(stats_module_names[i], name) == 0) {
+			STATS_UNLOCK;
+			return i;
+		}
+	}
+
+	if (stats_num_modules == stats_max_modules) {
+		int max;
+		char **names;
+
+		max = stats_max_modules ? (stats_max_modules * 2) : 32;
+		names = realloc(stats_module_names, max * sizeof(*names));
+		if (!names) {
+			STATS_UNLOCK;
+			return -1;
+		}
+		stats_module_names = names;
+		stats_max_modules = max;
+	}
+
+	stats_module_names[i] = strdup(name);
+	if (!stats_module_names[i]) {
+		STATS_UNLOCK;
+		return -1;
+	}
+	stats_num_modules++;
+	STATS_UNLOCK;
+
+	return i;
+}
+
+/** Record the time taken by one call to a module
+ *
+ * @param[in] index from radius_stats_module_index().
+ * @param[in] component which was called.
+ * @param[in] start of the call.
+ * @param[in] end of the call.
+ */
+void radius_stats_module(int index, int component,
+			 const struct timeval *start,
+			 const struct timeval *end)
+{
+	stats_thread_t *thread;
+
+	if ((index < 0) || (component < 0) ||
+	    (component >= RLM_COMPONENT_COUNT)) return;
+
+	thread = stats_thread_get();
+	if (!thread) return;
+
+	if (index >= thread->num_modules) {
+		int rcode;
+
+		STATS_LOCK;
+		rcode = stats_thread_grow(thread, stats_num_modules);
+		STATS_UNLOCK;
+		if ((rcode < 0) || (index >= thread->num_modules)) return;
+	}
+
+	stats_timing_add(&thread->modules[(index * RLM_COMPONENT_COUNT) + component],
+			 start, end);
+}
+
+/** Record the time a request spent waiting
+ *
+ * @param[in] which delay this is.
+ * @param[in] start of the wait.
+ * @param[in] end of the wait.
+ */
+void radius_stats_latency(fr_stats_latency_t which,
+			  const struct timeval *start,
+			  const struct timeval *end)
+{
+	stats_thread_t *thread;
+
+	if ((which < 0) || (which >= FR_STATS_LATENCY_COUNT)) return;
+
+	if ((start->tv_sec == 0) || (end->tv_sec == 0)) return;
+
+	thread = stats_thread_get();
+	if (!thread) return;
+
+	stats_timing_add(&thread->latency[which], start, end);
+}
+
+/** Get the latency of the calls to a module
+ *
+ * @param[in] name of the module instance.
+ * @param[out] timing RLM_COMPONENT_COUNT entries, one per component,
+ *	summed over all threads.
+ * @return 1 if the module was found, 0 otherwise.
+ */
+int radius_stats_module_get(const char *name, fr_stats_timing_t *timing)
+{
+	int i, index;
+	stats_thread_t *thread;
+
+	memset(timing, 0, RLM_COMPONENT_COUNT * sizeof(timing[0]));
+
+	STATS_LOCK;
+	for (index = 0; index < stats_num_modules; index++) {
+		if (strcmp(stats_module_names[index], name) == 0) break;
+	}
+
+	if (index == stats_num_modules) {
+		STATS_UNLOCK;
+		return 0;
+	}
+
+	for (thread = stats_threads; thread != NULL; thread = thread->next) {
+		if (index >= thread->num_modules) continue;
+
+		for (i = 0; i < RLM_COMPONENT_COUNT; i++) {
+			stats_timing_sum(&timing[i],
+					 &thread->modules[(index * RLM_COMPONENT_COUNT) + i]);
+		}
+	}
+
+	if (index < stats_retired.num_modules) {
+		for (i = 0; i < RLM_COMPONENT_COUNT; i++) {
+			stats_timing_sum(&timing[i],
+					 &stats_retired.modules[(index * RLM_COMPONENT_COUNT) + i]);
+		}
+	}
+	STATS_UNLOCK;
+
+	return 1;
+}
+
+/** Get the time requests spent waiting
+ *
+ * @param[in] which delay to get.
+ * @param[out] timing summed over all threads.
+ */
+void radius_stats_latency_get(fr_stats_latency_t which,
+			      fr_stats_timing_t *timing)
+{
+	stats_thread_t *thread;
+
+	memset(timing, 0, sizeof(*timing));
+
+	if ((which < 0) || (which >= FR_STATS_LATENCY_COUNT)) return;
+
+	STATS_LOCK;
+	for (thread = stats_threads; thread != NULL; thread = thread->next) {
+		stats_timing_sum(timing, &thread->latency[which]);
+	}
+	stats_timing_sum(timing, &stats_retired.latency[which]);
+	STATS_UNLOCK;
+}
+
+/** Get the counters which this thread should update instead of "stats"
+ *
+ * The first call for a set of counters takes the mutex.  Later calls
+ * don't.
+ *
+ * @param[in] stats the shared counters, for the server, a listener,
+ *	a client or a home server.
+ * @return the counters for this thread, or "stats" if there was no
+ *	memory for them.
+ */
+fr_stats_t *radius_stats_local(fr_stats_t *stats)
+{
+	stats_thread_t *thread;
+	stats_local_t *local;
+
+	thread = stats_thread_get();
+	if (!thread) return stats;
+
+	local = stats_local_find(thread, stats);
+	if (local) return &local->stats;
+
+	STATS_LOCK;
+	local = stats_local_insert(thread, stats);
+	STATS_UNLOCK;
+	if (!local) return stats;
+
+	return &local->stats;
+}
+
+/** Get a copy of counters, including the counts from every thread
+ *
+ * @param[in] stats the shared counters.
+ * @param[out] out where the totals are written.
+ */
+void radius_stats_get(const fr_stats_t *stats, fr_stats_t *out)
+{
+	stats_thread_t *thread;
+	stats_local_t *local;
+
+	STATS_LOCK;
+	memcpy(out, stats, sizeof(*out));
+
+	for (thread = stats_threads; thread != NULL; thread = thread->next) {
+		local = stats_local_find(thread, stats);
+		if (local) stats_sum(out, &local->stats);
+	}
+	STATS_UNLOCK;
+}
+
+/** Forget the per-thread counters for "stats", which is about to be freed
+ *
+ * @param[in] stats the shared counters.
+ */
+void radius_stats_free(const fr_stats_t *stats)
+{
+	stats_thread_t *thread;
+	stats_local_t *local;
+
+	STATS_LOCK;
+	for (thread = stats_threads; thread != NULL; thread = thread->next) {
+		local = stats_local_find(thread, stats);
+		if (local) local->key = &stats_deleted;
+	}
+	STATS_UNLOCK;
+}
+
 #endif /* WITH_STATS */
@@ -391,6 +391,10 @@ int request_enqueue(REQUEST *request)
 	request->component = "<core>";
 	request->module = "<queue>";
 
+#ifdef WITH_STATS
+	gettimeofday(&request->queued, NULL);
+#endif
+
 	/*
 	 *	Push the request onto the appropriate fifo for that
 	 */
@@ -541,6 +545,16 @@ static int request_dequeue(REQUEST **prequest)
 		       request->number, fr_packet_codes[request->packet->code], (int) blocked);
 	}
 
+#ifdef WITH_STATS
+	{
+		struct timeval now;
+
+		gettimeofday(&now, NULL);
+		radius_stats_latency(FR_STATS_LATENCY_QUEUE,
+				     &request->queued, &now);
+	}
+#endif
+
 	return 1;
 }
 
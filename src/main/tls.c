@@ -41,6 +41,8 @@ RCSID("$Id$")
 #include <utime.h>
 #endif
 
+#include <sys/mman.h>
+
 #ifdef WITH_TLS
 #ifdef HAVE_OPENSSL_RAND_H
 #include <openssl/rand.h>
@@ -50,6 +52,9 @@ RCSID("$Id$")
 #include <openssl/ocsp.h>
 #endif
 
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
 static void tls_server_conf_free(fr_tls_server_conf_t *conf);
 
 /* record */
@@ -337,6 +342,122 @@ static int int_ssl_check(REQUEST *request, SSL *s, int ret, const char *text)
 	return 1;
 }
 
+/*
+ *	Limit the number of handshakes which are in progress at the
+ *	same time.  The crypto in a full handshake is expensive, and a
+ *	burst of new sessions would otherwise use all of the CPU,
+ *	starving the cheap requests.  Only new handshakes are refused:
+ *	once one has been admitted, its remaining steps always go
+ *	through, so the work already done is not thrown away.  There
+ *	is no queue.  A refused handshake is rejected at once, rather
+ *	than tying up a worker thread while it waits.
+ */
+static fr_tls_server_conf_t *handshake_conf_list = NULL;
+
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t handshake_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define HANDSHAKE_LOCK pthread_mutex_lock(&handshake_mutex)
+#define HANDSHAKE_UNLOCK pthread_mutex_unlock(&handshake_mutex)
+#else
+#define HANDSHAKE_LOCK
+#define HANDSHAKE_UNLOCK
+#endif
+
+static int handshake_admit(REQUEST *request, fr_tls_server_conf_t *conf,
+			   tls_session_t *ssn)
+{
+	fr_tls_handshake_stats_t *stats = &conf->handshake_stats;
+
+	HANDSHAKE_LOCK;
+
+	if ((conf->max_handshakes > 0) &&
+	    (stats->active >= conf->max_handshakes)) {
+		stats->rejected++;
+		HANDSHAKE_UNLOCK;
+
+		RDEBUG("Too many TLS handshakes in progress, rejecting this one");
+		return 0;
+	}
+
+	stats->active++;
+	stats->started++;
+	if (stats->active > stats->max_active) {
+		stats->max_active = stats->active;
+	}
+
+	HANDSHAKE_UNLOCK;
+
+	ssn->handshake_admitted = 1;
+	return 1;
+}
+
+/*
+ *	Called when the handshake has finished, or the session is
+ *	going away without finishing it.
+ */
+static void handshake_release(tls_session_t *ssn)
+{
+	fr_tls_server_conf_t *conf;
+
+	if (!ssn->handshake_admitted) return;
+	ssn->handshake_admitted = 0;
+
+	conf = (fr_tls_server_conf_t *)SSL_get_ex_data(ssn->ssl, FR_TLS_EX_INDEX_CONF);
+	if (!conf) return;
+
+	HANDSHAKE_LOCK;
+	conf->handshake_stats.active--;
+	HANDSHAKE_UNLOCK;
+}
+
+static void handshake_step(fr_tls_server_conf_t *conf,
+			   const struct timeval *start)
+{
+	int i;
+	uint64_t delay;
+	struct timeval now;
+	fr_tls_handshake_stats_t *stats = &conf->handshake_stats;
+
+	gettimeofday(&now, NULL);
+	i = radius_stats_bucket(start, &now, &delay);
+
+	HANDSHAKE_LOCK;
+
+	stats->steps++;
+	if (i >= 0) {
+		stats->step_usec += delay;
+		stats->step_time[i]++;
+	}
+
+	HANDSHAKE_UNLOCK;
+}
+
+/*
+ *	Return a snapshot of the handshake counters for the n'th TLS
+ *	server configuration, or 0 if there are no more.
+ */
+int tls_handshake_stats(int n, CONF_SECTION **cs,
+			fr_tls_handshake_stats_t *stats)
+{
+	fr_tls_server_conf_t *conf;
+
+	HANDSHAKE_LOCK;
+	for (conf = handshake_conf_list; conf != NULL; conf = conf->handshake_next) {
+		if (n-- == 0) break;
+	}
+
+	if (!conf) {
+		HANDSHAKE_UNLOCK;
+		return 0;
+	}
+
+	*cs = conf->cs;
+	memcpy(stats, &conf->handshake_stats, sizeof(*stats));
+	HANDSHAKE_UNLOCK;
+
+	return 1;
+}
+
 /*
  * We are the server, we always get the dirty data
  * (Handshake data is also considered as dirty data)
@@ -353,6 +474,21 @@ static int int_ssl_check(REQUEST *request, SSL *s, int ret, const char *text)
 int tls_handshake_recv(REQUEST *request, tls_session_t *ssn)
 {
 	int err;
+	struct timeval start;
+	fr_tls_server_conf_t *conf;
+
+	conf = (fr_tls_server_conf_t *)SSL_get_ex_data(ssn->ssl, FR_TLS_EX_INDEX_CONF);
+	if (conf && SSL_is_init_finished(ssn->ssl)) conf = NULL;
+
+	/*
+	 *	Decide whether to start a new handshake before giving
+	 *	its data to OpenSSL.
+	 */
+	if (conf && !ssn->handshake_admitted && SSL_in_before(ssn->ssl) &&
+	    !handshake_admit(request, conf, ssn)) {
+		record_init(&ssn->dirty_in);
+		return 0;
+	}
 
 	err = BIO_write(ssn->into_ssl, ssn->dirty_in.data, ssn->dirty_in.used);
 	if (err != (int) ssn->dirty_in.used) {
@@ -363,8 +499,16 @@ int tls_handshake_recv(REQUEST *request, tls_session_t *ssn)
 	}
 	record_init(&ssn->dirty_in);
 
+	if (conf) gettimeofday(&start, NULL);
+
 	err = SSL_read(ssn->ssl, ssn->clean_out.data + ssn->clean_out.used,
 		       sizeof(ssn->clean_out.data) - ssn->clean_out.used);
+
+	if (conf) {
+		handshake_step(conf, &start);
+		if (SSL_is_init_finished(ssn->ssl)) handshake_release(ssn);
+	}
+
 	if (err > 0) {
 		ssn->clean_out.used += err;
 		return 1;
@@ -472,10 +616,13 @@ void session_init(tls_session_t *ssn)
 	ssn->length_flag = 0;
 	ssn->opaque = NULL;
 	ssn->free_opaque = NULL;
+	ssn->handshake_admitted = 0;
 }
 
 void session_close(tls_session_t *ssn)
 {	
+	if (ssn->ssl) handshake_release(ssn);
+
 	SSL_set_quiet_shutdown(ssn->ssl, 1);
 	SSL_shutdown(ssn->ssl);
 
@@ -765,6 +912,14 @@ static CONF_PARSER cache_config[] = {
 	  offsetof(fr_tls_server_conf_t, session_id_name), NULL, NULL},
 	{ "persist_dir", PW_TYPE_STRING_PTR,
 	  offsetof(fr_tls_server_conf_t, session_cache_path), NULL, NULL},
+	{ "file", PW_TYPE_STRING_PTR,
+	  offsetof(fr_tls_server_conf_t, session_cache_file), NULL, NULL},
+	{ "tickets", PW_TYPE_BOOLEAN,
+	  offsetof(fr_tls_server_conf_t, session_tickets), NULL, "no" },
+	{ "ticket_key_file", PW_TYPE_STRING_PTR,
+	  offsetof(fr_tls_server_conf_t, ticket_key_file), NULL, NULL},
+	{ "ticket_key_lifetime", PW_TYPE_INTEGER,
+	  offsetof(fr_tls_server_conf_t, ticket_key_lifetime), NULL, "12" },
 	{ NULL, -1, 0, NULL, NULL }           /* end the list */
 };
 
@@ -845,6 +1000,8 @@ static CONF_PARSER tls_server_config[] = {
 	  offsetof(fr_tls_server_conf_t, make_cert_command), NULL, NULL},
 	{ "require_client_cert", PW_TYPE_BOOLEAN,
 	  offsetof(fr_tls_server_conf_t, require_client_cert), NULL, NULL },
+	{ "max_handshakes", PW_TYPE_INTEGER,
+	  offsetof(fr_tls_server_conf_t, max_handshakes), NULL, "0" },
 
 #if OPENSSL_VERSION_NUMBER >= 0x0090800fL
 #ifndef OPENSSL_NO_ECDH
@@ -980,6 +1137,872 @@ static int FR_TLS_EX_INDEX_VPS = -1;
  */
 #define MAX_SESSION_SIZE (256)
 
+/*
+ *	Session cache in a memory-mapped file.
+ *
+ *	The file is a fixed-size hash table of "max_entries" slots,
+ *	keyed by session ID, with linear probing over a small window.
+ *	Each slot holds the ASN.1 encoded session, followed by the
+ *	cached VPs in a simple binary format.  Entries expire after
+ *	"lifetime" hours.  When every slot in the window is live, the
+ *	one closest to expiry is overwritten.
+ *
+ *	Within the server, readers share a read lock, and writers
+ *	take the write lock.  Writers also lock the file header, so
+ *	that several servers can share one file.  Each slot has a
+ *	generation counter which is odd while the slot is being
+ *	written, so that a reader in another process can detect a
+ *	torn read.
+ */
+#define TLS_CACHE_MAGIC		(0x66726331)
+#define TLS_CACHE_DATA_LEN	(8192)
+#define TLS_CACHE_PROBES	(8)
+
+typedef struct tls_cache_hdr_t {
+	uint32_t	magic;
+	uint32_t	num_slots;
+	uint32_t	slot_size;
+	uint32_t	reserved;
+} tls_cache_hdr_t;
+
+typedef struct tls_cache_slot_t {
+	volatile uint32_t gen;
+	uint32_t	expires;
+	uint16_t	sess_len;
+	uint16_t	vps_len;
+	uint8_t		id_len;
+	uint8_t		id[SSL_MAX_SSL_SESSION_ID_LENGTH];
+	uint8_t		data[TLS_CACHE_DATA_LEN];
+} tls_cache_slot_t;
+
+struct fr_tls_cache_t {
+	int		fd;
+	size_t		len;
+	uint32_t	num_slots;	//!< What we mapped, not what the
+					//!< header says now.
+	tls_cache_hdr_t	*hdr;
+	tls_cache_slot_t *slots;
+#ifdef HAVE_PTHREAD_H
+	pthread_rwlock_t lock;
+#endif
+};
+
+#ifdef HAVE_PTHREAD_H
+#define CACHE_RDLOCK(_c) pthread_rwlock_rdlock(&(_c)->lock)
+#define CACHE_WRLOCK(_c) pthread_rwlock_wrlock(&(_c)->lock)
+#define CACHE_UNLOCK(_c) pthread_rwlock_unlock(&(_c)->lock)
+#else
+#define CACHE_RDLOCK(_c)
+#define CACHE_WRLOCK(_c)
+#define CACHE_UNLOCK(_c)
+#endif
+
+static void tls_cache_close(fr_tls_cache_t *cache)
+{
+	if (!cache) return;
+
+	if (cache->hdr) munmap(cache->hdr, cache->len);
+	if (cache->fd >= 0) close(cache->fd);
+#ifdef HAVE_PTHREAD_H
+	pthread_rwlock_destroy(&cache->lock);
+#endif
+	free(cache);
+}
+
+/*
+ *	Map the file, if it has the layout we expect.
+ */
+static int tls_cache_map(fr_tls_cache_t *cache)
+{
+	struct stat st;
+
+	if ((fstat(cache->fd, &st) < 0) ||
+	    ((size_t) st.st_size != cache->len)) return -1;
+
+	cache->hdr = mmap(NULL, cache->len, PROT_READ | PROT_WRITE,
+			  MAP_SHARED, cache->fd, 0);
+	if (cache->hdr == MAP_FAILED) {
+		cache->hdr = NULL;
+		return -1;
+	}
+	cache->slots = (tls_cache_slot_t *) (cache->hdr + 1);
+
+	if ((cache->hdr->magic != TLS_CACHE_MAGIC) ||
+	    (cache->hdr->num_slots != cache->num_slots) ||
+	    (cache->hdr->slot_size != sizeof(tls_cache_slot_t))) {
+		munmap(cache->hdr, cache->len);
+		cache->hdr = NULL;
+		cache->slots = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ *	Create a new, empty, file, and move it into place.  Other
+ *	servers may have the old file mapped, so it's never truncated
+ *	or re-initialised.  They keep using the old one until they're
+ *	restarted.
+ */
+static int tls_cache_create(fr_tls_cache_t *cache, const char *filename)
+{
+	int fd;
+	tls_cache_hdr_t hdr;
+	char tmp[1024];
+
+	snprintf(tmp, sizeof(tmp), "%s.%u", filename, (unsigned int) getpid());
+
+	fd = open(tmp, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0) {
+		radlog(L_ERR, "Failed creating TLS session cache %s: %s",
+		       tmp, strerror(errno));
+		return -1;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = TLS_CACHE_MAGIC;
+	hdr.num_slots = cache->num_slots;
+	hdr.slot_size = sizeof(tls_cache_slot_t);
+
+	if ((ftruncate(fd, cache->len) < 0) ||
+	    (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) ||
+	    (rename(tmp, filename) < 0)) {
+		radlog(L_ERR, "Failed creating TLS session cache %s: %s",
+		       filename, strerror(errno));
+		close(fd);
+		unlink(tmp);
+		return -1;
+	}
+
+	cache->fd = fd;
+	return 0;
+}
+
+static fr_tls_cache_t *tls_cache_open(const char *filename, int num_slots)
+{
+	fr_tls_cache_t *cache;
+
+	if (num_slots <= 0) num_slots = 255;
+
+	cache = rad_malloc(sizeof(*cache));
+	memset(cache, 0, sizeof(*cache));
+	cache->num_slots = num_slots;
+	cache->len = sizeof(tls_cache_hdr_t) +
+		num_slots * sizeof(tls_cache_slot_t);
+
+#ifdef HAVE_PTHREAD_H
+	pthread_rwlock_init(&cache->lock, NULL);
+#endif
+
+	cache->fd = open(filename, O_RDWR);
+	if (cache->fd >= 0) {
+		if (tls_cache_map(cache) == 0) goto done;
+
+		radlog(L_INFO, "TLS session cache %s has a different layout, replacing it",
+		       filename);
+		close(cache->fd);
+		cache->fd = -1;
+
+	} else if (errno != ENOENT) {
+		radlog(L_ERR, "Failed opening TLS session cache %s: %s",
+		       filename, strerror(errno));
+		goto error;
+	}
+
+	if (tls_cache_create(cache, filename) < 0) goto error;
+
+	if (tls_cache_map(cache) < 0) {
+		radlog(L_ERR, "Failed mapping TLS session cache %s: %s",
+		       filename, strerror(errno));
+		goto error;
+	}
+
+done:
+	DEBUG2("  SSL: Using session cache %s with %d entries",
+	       filename, num_slots);
+	return cache;
+
+error:
+	tls_cache_close(cache);
+	return NULL;
+}
+
+static uint32_t tls_cache_hash(const fr_tls_cache_t *cache,
+			       const uint8_t *id, size_t id_len)
+{
+	return fr_hash(id, id_len) % cache->num_slots;
+}
+
+/*
+ *	Serialize VPs as (attribute, vendor, length, data) tuples.
+ *	If any VP can't be encoded, the session isn't cached at all,
+ *	as it would be resumed without all of its attributes.
+ */
+static ssize_t tls_cache_vps2data(VALUE_PAIR *vps, uint8_t *out,
+				  size_t outlen)
+{
+	ssize_t len;
+	uint8_t *p = out;
+	uint32_t lvalue;
+	VALUE_PAIR *vp;
+
+	for (vp = vps; vp != NULL; vp = vp->next) {
+		if (((size_t) (p - out) + 10 > outlen) ||
+		    (vp->length > (outlen - (p - out) - 10))) {
+			DEBUG2("  SSL: Session VPs are too large to cache");
+			return -1;
+		}
+
+		len = rad_vp2data(vp, p + 10,
+				  outlen - (p - out) - 10);
+		if ((len < 0) || (len > 65535)) {
+			radlog(L_ERR, "  SSL: Failed encoding %s for the session cache: %s",
+			       vp->name, fr_strerror());
+			return -1;
+		}
+
+		lvalue = htonl(vp->attribute);
+		memcpy(p, &lvalue, 4);
+		lvalue = htonl(vp->vendor);
+		memcpy(p + 4, &lvalue, 4);
+		p[8] = (len >> 8) & 0xff;
+		p[9] = len & 0xff;
+		p += 10 + len;
+	}
+
+	return p - out;
+}
+
+static VALUE_PAIR *tls_cache_data2vps(const uint8_t *data, size_t len)
+{
+	const uint8_t *p = data, *end = data + len;
+	uint32_t attribute, vendor;
+	size_t vp_len;
+	VALUE_PAIR *head = NULL, **tail = &head, *vp;
+
+	while ((p + 10) <= end) {
+		memcpy(&attribute, p, 4);
+		memcpy(&vendor, p + 4, 4);
+		vp_len = (p[8] << 8) | p[9];
+		p += 10;
+
+		if ((p + vp_len) > end) break;
+
+		vp = NULL;
+		if (rad_data2vp(ntohl(attribute), ntohl(vendor),
+				p, vp_len, &vp) < 0) {
+			pairfree(&head);
+			return NULL;
+		}
+
+		if (vp) {
+			*tail = vp;
+			while (*tail) tail = &(*tail)->next;
+		}
+		p += vp_len;
+	}
+
+	return head;
+}
+
+/*
+ *	Write an entry.  "data" holds "sess_len" bytes of ASN.1
+ *	encoded session, followed by "vps_len" bytes of VPs.
+ */
+static void tls_cache_write(fr_tls_cache_t *cache,
+			    const uint8_t *id, size_t id_len,
+			    const uint8_t *data, size_t sess_len,
+			    size_t vps_len, time_t now, int lifetime)
+{
+	int i;
+	uint32_t hash;
+	tls_cache_slot_t *slot, *victim = NULL;
+
+	CACHE_WRLOCK(cache);
+	rad_lockfd(cache->fd, sizeof(tls_cache_hdr_t));
+
+	/*
+	 *	Re-use a slot with the same ID, or an empty or
+	 *	expired one.  If there are none, evict the entry
+	 *	which would have expired first.
+	 */
+	hash = tls_cache_hash(cache, id, id_len);
+	for (i = 0; i < TLS_CACHE_PROBES; i++) {
+		slot = &cache->slots[(hash + i) % cache->num_slots];
+
+		if ((slot->id_len == id_len) &&
+		    (memcmp(slot->id, id, id_len) == 0)) {
+			victim = slot;
+			break;
+		}
+
+		if (!slot->id_len || (slot->expires < now)) {
+			if (!victim || victim->id_len) victim = slot;
+			continue;
+		}
+
+		if (!victim ||
+		    (victim->id_len && (slot->expires < victim->expires))) {
+			victim = slot;
+		}
+	}
+
+	victim->gen++;
+	victim->expires = now + lifetime;
+	victim->id_len = id_len;
+	memcpy(victim->id, id, id_len);
+	victim->sess_len = sess_len;
+	victim->vps_len = vps_len;
+	memcpy(victim->data, data, sess_len + vps_len);
+	victim->gen++;
+
+	rad_unlockfd(cache->fd, sizeof(tls_cache_hdr_t));
+	CACHE_UNLOCK(cache);
+}
+
+static int tls_cache_store(fr_tls_cache_t *cache, SSL_SESSION *sess,
+			   VALUE_PAIR *vps, time_t now, int lifetime)
+{
+	int blob_len;
+	ssize_t vps_len;
+	unsigned char *p;
+	uint8_t data[TLS_CACHE_DATA_LEN];
+
+	if (sess->session_id_length > SSL_MAX_SSL_SESSION_ID_LENGTH) return -1;
+
+	/*
+	 *	Sessions resumed from tickets have no ID.
+	 */
+	if (!sess->session_id_length) return 0;
+
+	blob_len = i2d_SSL_SESSION(sess, NULL);
+	if ((blob_len < 1) || (blob_len > TLS_CACHE_DATA_LEN)) {
+		DEBUG2("  SSL: Session is too large to cache (%d)", blob_len);
+		return -1;
+	}
+
+	p = data;
+	if (i2d_SSL_SESSION(sess, &p) != blob_len) return -1;
+
+	vps_len = tls_cache_vps2data(vps, data + blob_len,
+				     sizeof(data) - blob_len);
+	if (vps_len < 0) return -1;
+
+	tls_cache_write(cache, sess->session_id, sess->session_id_length,
+			data, blob_len, vps_len, now, lifetime);
+	return 0;
+}
+
+/*
+ *	Read an entry into "data", which must be TLS_CACHE_DATA_LEN
+ *	bytes long.
+ */
+static int tls_cache_read(fr_tls_cache_t *cache,
+			  const uint8_t *id, size_t id_len, time_t now,
+			  uint8_t *data, size_t *sess_len, size_t *vps_len)
+{
+	int i, rcode = -1;
+	uint32_t gen, hash;
+	tls_cache_slot_t *slot;
+
+	if (id_len > SSL_MAX_SSL_SESSION_ID_LENGTH) return -1;
+
+	CACHE_RDLOCK(cache);
+
+	hash = tls_cache_hash(cache, id, id_len);
+	for (i = 0; i < TLS_CACHE_PROBES; i++) {
+		slot = &cache->slots[(hash + i) % cache->num_slots];
+
+		gen = slot->gen;
+		if ((gen & 0x01) != 0) continue;
+
+		if ((slot->id_len != id_len) ||
+		    (memcmp(slot->id, id, id_len) != 0)) continue;
+
+		if (slot->expires < now) break;
+
+		*sess_len = slot->sess_len;
+		*vps_len = slot->vps_len;
+		if ((*sess_len + *vps_len) > TLS_CACHE_DATA_LEN) break;
+
+		memcpy(data, slot->data, *sess_len + *vps_len);
+
+		/*
+		 *	Written to by another server while we were
+		 *	reading it.
+		 */
+		if (slot->gen == gen) rcode = 0;
+		break;
+	}
+
+	CACHE_UNLOCK(cache);
+
+	return rcode;
+}
+
+static SSL_SESSION *tls_cache_fetch(fr_tls_cache_t *cache,
+				    const uint8_t *id, size_t id_len,
+				    time_t now, VALUE_PAIR **vps)
+{
+	size_t sess_len, vps_len;
+	const unsigned char *p;
+	SSL_SESSION *sess;
+	uint8_t data[TLS_CACHE_DATA_LEN];
+
+	if (tls_cache_read(cache, id, id_len, now, data,
+			   &sess_len, &vps_len) < 0) return NULL;
+
+	if (!sess_len) return NULL;
+
+	p = data;
+	sess = d2i_SSL_SESSION(NULL, &p, sess_len);
+	if (!sess) return NULL;
+
+	*vps = tls_cache_data2vps(data + sess_len, vps_len);
+	return sess;
+}
+
+static void tls_cache_delete(fr_tls_cache_t *cache,
+			     const uint8_t *id, size_t id_len)
+{
+	int i;
+	uint32_t hash;
+	tls_cache_slot_t *slot;
+
+	if (id_len > SSL_MAX_SSL_SESSION_ID_LENGTH) return;
+
+	CACHE_WRLOCK(cache);
+	rad_lockfd(cache->fd, sizeof(tls_cache_hdr_t));
+
+	hash = tls_cache_hash(cache, id, id_len);
+	for (i = 0; i < TLS_CACHE_PROBES; i++) {
+		slot = &cache->slots[(hash + i) % cache->num_slots];
+
+		if ((slot->id_len != id_len) ||
+		    (memcmp(slot->id, id, id_len) != 0)) continue;
+
+		slot->gen++;
+		slot->id_len = 0;
+		slot->expires = 0;
+		slot->gen++;
+		break;
+	}
+
+	rad_unlockfd(cache->fd, sizeof(tls_cache_hdr_t));
+	CACHE_UNLOCK(cache);
+}
+
+/*
+ *	Session tickets (RFC 5077).
+ *
+ *	The first key is used to encrypt new tickets, and all of the
+ *	keys are accepted for decryption.  Tickets encrypted with an
+ *	older key are renewed.
+ *
+ *	If "ticket_key_file" is set, the keys are read from it, as
+ *	one or more 48 byte records of key name, HMAC secret and AES
+ *	key, current key first.  The file is re-read when it changes,
+ *	so that a farm of servers can share and rotate the keys.
+ *	Otherwise the keys are random, and a new one is generated
+ *	every "ticket_key_lifetime" hours.  A HUP forces a re-read, or
+ *	a new key.
+ *
+ *	The ticket can't carry the VPs which tls_success() needs on
+ *	resumption.  OpenSSL 1.1.1 has ticket "appdata" for that, but
+ *	the rest of this file uses structure internals which 1.1 hides.
+ *	So the VPs are kept in the cache "file" instead, keyed by the
+ *	IV of the ticket.  If they can't be found, the ticket is
+ *	ignored, and a full handshake is done.  When a ticket under an
+ *	older key is renewed, the VPs are moved to the IV of the new
+ *	ticket.
+ */
+#define TLS_TICKET_MAX_KEYS	(4)
+
+typedef struct tls_ticket_key_t {
+	uint8_t		name[16];
+	uint8_t		hmac[16];
+	uint8_t		aes[16];
+} tls_ticket_key_t;
+
+struct fr_tls_ticket_keys_t {
+	fr_tls_ticket_keys_t *next;
+	const char	*filename;
+	int		lifetime;
+	int		rotate;
+	time_t		created;
+	time_t		mtime;
+	time_t		last_checked;
+	int		num_keys;
+	tls_ticket_key_t keys[TLS_TICKET_MAX_KEYS];
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_t	mutex;
+#endif
+};
+
+#ifdef HAVE_PTHREAD_H
+#define KEYS_LOCK(_k) pthread_mutex_lock(&(_k)->mutex)
+#define KEYS_UNLOCK(_k) pthread_mutex_unlock(&(_k)->mutex)
+#else
+#define KEYS_LOCK(_k)
+#define KEYS_UNLOCK(_k)
+#endif
+
+/*
+ *	All of the ticket keys, so that a HUP can find them.  Modules
+ *	may be instantiated in parallel, so the list has its own lock.
+ */
+static fr_tls_ticket_keys_t *ticket_keys_list = NULL;
+
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t ticket_keys_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define KEYS_LIST_LOCK pthread_mutex_lock(&ticket_keys_mutex)
+#define KEYS_LIST_UNLOCK pthread_mutex_unlock(&ticket_keys_mutex)
+#else
+#define KEYS_LIST_LOCK
+#define KEYS_LIST_UNLOCK
+#endif
+
+static void tls_ticket_keys_free(fr_tls_ticket_keys_t *keys)
+{
+	fr_tls_ticket_keys_t **last;
+
+	if (!keys) return;
+
+	KEYS_LIST_LOCK;
+	for (last = &ticket_keys_list; *last != NULL; last = &(*last)->next) {
+		if (*last == keys) {
+			*last = keys->next;
+			break;
+		}
+	}
+	KEYS_LIST_UNLOCK;
+
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_destroy(&keys->mutex);
+#endif
+	memset(keys, 0, sizeof(*keys));
+	free(keys);
+}
+
+/*
+ *	Re-read the ticket keys, or generate new ones, on HUP.
+ */
+void tls_ticket_keys_rotate(void)
+{
+	fr_tls_ticket_keys_t *keys;
+
+	KEYS_LIST_LOCK;
+	for (keys = ticket_keys_list; keys != NULL; keys = keys->next) {
+		KEYS_LOCK(keys);
+		keys->rotate = 1;
+		KEYS_UNLOCK(keys);
+	}
+	KEYS_LIST_UNLOCK;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x10000000L
+static int tls_ticket_keys_load(fr_tls_ticket_keys_t *keys, time_t now)
+{
+	int fd;
+	ssize_t len;
+	struct stat st;
+	tls_ticket_key_t buffer[TLS_TICKET_MAX_KEYS];
+
+	keys->rotate = 0;
+
+	if (!keys->filename) {
+		memmove(&keys->keys[1], &keys->keys[0],
+			sizeof(keys->keys[0]) * (TLS_TICKET_MAX_KEYS - 1));
+		if (RAND_bytes((unsigned char *) &keys->keys[0],
+			       sizeof(keys->keys[0])) != 1) {
+			radlog(L_ERR, "Failed generating session ticket key");
+			return -1;
+		}
+		if (keys->num_keys < TLS_TICKET_MAX_KEYS) keys->num_keys++;
+		keys->created = now;
+
+		DEBUG2("  SSL: Generated new session ticket key");
+		return 0;
+	}
+
+	fd = open(keys->filename, O_RDONLY);
+	if (fd < 0) {
+		radlog(L_ERR, "Failed opening session ticket keys %s: %s",
+		       keys->filename, strerror(errno));
+		return -1;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		radlog(L_ERR, "Failed reading session ticket keys %s: %s",
+		       keys->filename, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	len = read(fd, buffer, sizeof(buffer));
+	close(fd);
+
+	if ((len <= 0) || ((len % sizeof(buffer[0])) != 0)) {
+		radlog(L_ERR, "Session ticket keys %s must contain one or more %d byte keys",
+		       keys->filename, (int) sizeof(buffer[0]));
+		return -1;
+	}
+
+	memcpy(keys->keys, buffer, len);
+	keys->num_keys = len / sizeof(buffer[0]);
+	keys->mtime = st.st_mtime;
+
+	DEBUG2("  SSL: Loaded %d session ticket keys from %s",
+	       keys->num_keys, keys->filename);
+	return 0;
+}
+
+/*
+ *	Called with the keys locked.
+ */
+static void tls_ticket_keys_check(fr_tls_ticket_keys_t *keys, time_t now)
+{
+	struct stat st;
+
+	if (keys->rotate) {
+		tls_ticket_keys_load(keys, now);
+		return;
+	}
+
+	if (!keys->filename) {
+		if ((now - keys->created) >= (keys->lifetime * 3600)) {
+			tls_ticket_keys_load(keys, now);
+		}
+		return;
+	}
+
+	if (keys->last_checked == now) return;
+	keys->last_checked = now;
+
+	if ((stat(keys->filename, &st) == 0) && (st.st_mtime != keys->mtime)) {
+		tls_ticket_keys_load(keys, now);
+	}
+}
+
+static fr_tls_ticket_keys_t *tls_ticket_keys_init(fr_tls_server_conf_t *conf)
+{
+	fr_tls_ticket_keys_t *keys;
+
+	keys = rad_malloc(sizeof(*keys));
+	memset(keys, 0, sizeof(*keys));
+
+	keys->filename = conf->ticket_key_file;
+	keys->lifetime = conf->ticket_key_lifetime;
+	if (keys->lifetime <= 0) keys->lifetime = 12;
+
+	if (tls_ticket_keys_load(keys, time(NULL)) < 0) {
+		free(keys);
+		return NULL;
+	}
+
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_init(&keys->mutex, NULL);
+#endif
+
+	KEYS_LIST_LOCK;
+	keys->next = ticket_keys_list;
+	ticket_keys_list = keys;
+	KEYS_LIST_UNLOCK;
+
+	return keys;
+}
+
+/*
+ *	The IV of the ticket which was issued, or which was used to
+ *	resume the session, and for resumption, the VPs which were
+ *	found for it.  If that ticket was renewed, "old_iv" is where
+ *	the VPs were found, and "iv" is the new ticket.
+ */
+typedef struct tls_ticket_ref_t {
+	uint8_t		iv[16];
+	uint8_t		old_iv[16];
+	int		renewed;
+	VALUE_PAIR	*vps;
+} tls_ticket_ref_t;
+
+/* index we use to store the ticket reference
+ * needs to be dynamic so we can supply a "free" function
+ */
+static int FR_TLS_EX_INDEX_TICKET = -1;
+
+static void ssl_free_ticket_ref(UNUSED void *parent, void *data_ptr,
+				UNUSED CRYPTO_EX_DATA *ad, UNUSED int idx,
+				UNUSED long argl, UNUSED void *argp)
+{
+	tls_ticket_ref_t *ref = data_ptr;
+
+	if (!ref) return;
+
+	pairfree(&ref->vps);
+	free(ref);
+}
+
+static tls_ticket_ref_t *tls_ticket_ref(SSL *ssl)
+{
+	tls_ticket_ref_t *ref;
+
+	ref = SSL_get_ex_data(ssl, FR_TLS_EX_INDEX_TICKET);
+	if (!ref) {
+		ref = rad_malloc(sizeof(*ref));
+		memset(ref, 0, sizeof(*ref));
+		SSL_set_ex_data(ssl, FR_TLS_EX_INDEX_TICKET, ref);
+	}
+
+	return ref;
+}
+
+/*
+ *	Called from tls_success(), once the VPs are known.
+ */
+static void tls_ticket_store_vps(SSL *ssl, fr_tls_server_conf_t *conf,
+				 VALUE_PAIR *vps, time_t now)
+{
+	ssize_t len;
+	tls_ticket_ref_t *ref;
+	uint8_t data[TLS_CACHE_DATA_LEN];
+
+	if (!conf->session_cache) return;
+
+	ref = SSL_get_ex_data(ssl, FR_TLS_EX_INDEX_TICKET);
+	if (!ref) return;
+
+	len = tls_cache_vps2data(vps, data, sizeof(data));
+	if (len <= 0) return;
+
+	tls_cache_write(conf->session_cache, ref->iv, sizeof(ref->iv),
+			data, 0, len, now, conf->session_timeout * 3600);
+}
+
+/*
+ *	Called from tls_success() on resumption.  If the ticket was
+ *	renewed, the VPs are moved to the new one, so that clients
+ *	move to the current key.
+ */
+static void tls_ticket_renew_vps(SSL *ssl, fr_tls_server_conf_t *conf,
+				 VALUE_PAIR *vps, time_t now)
+{
+	tls_ticket_ref_t *ref;
+
+	ref = SSL_get_ex_data(ssl, FR_TLS_EX_INDEX_TICKET);
+	if (!ref || !ref->renewed) return;
+
+	tls_ticket_store_vps(ssl, conf, vps, now);
+	tls_cache_delete(conf->session_cache, ref->old_iv,
+			 sizeof(ref->old_iv));
+	ref->renewed = FALSE;
+}
+
+/*
+ *	Called from tls_success() on resumption, if the session has
+ *	no VPs.
+ */
+static VALUE_PAIR *tls_ticket_fetch_vps(SSL *ssl)
+{
+	VALUE_PAIR *vps;
+	tls_ticket_ref_t *ref;
+
+	ref = SSL_get_ex_data(ssl, FR_TLS_EX_INDEX_TICKET);
+	if (!ref) return NULL;
+
+	vps = ref->vps;
+	ref->vps = NULL;
+
+	return vps;
+}
+
+static int cbtls_ticket_key(SSL *ssl, unsigned char key_name[16],
+			    unsigned char *iv, EVP_CIPHER_CTX *ectx,
+			    HMAC_CTX *hctx, int enc)
+{
+	int i, rcode = 0;
+	fr_tls_server_conf_t *conf;
+	fr_tls_ticket_keys_t *keys;
+	tls_ticket_key_t key;
+	tls_ticket_ref_t *ref;
+
+	conf = (fr_tls_server_conf_t *)SSL_get_ex_data(ssl, FR_TLS_EX_INDEX_CONF);
+	if (!conf || !conf->ticket_keys) return -1;
+	keys = conf->ticket_keys;
+
+	KEYS_LOCK(keys);
+	tls_ticket_keys_check(keys, time(NULL));
+
+	if (enc) {
+		memcpy(&key, &keys->keys[0], sizeof(key));
+		rcode = 1;
+	} else {
+		for (i = 0; i < keys->num_keys; i++) {
+			if (memcmp(key_name, keys->keys[i].name, 16) != 0) continue;
+
+			memcpy(&key, &keys->keys[i], sizeof(key));
+			rcode = (i == 0) ? 1 : 2;
+			break;
+		}
+	}
+	KEYS_UNLOCK(keys);
+
+	/*
+	 *	Unknown key: do a full handshake.
+	 */
+	if (!rcode) {
+		DEBUG2("  SSL: Session ticket key not found");
+		return 0;
+	}
+
+	ref = tls_ticket_ref(ssl);
+
+	if (!enc) {
+		size_t sess_len, vps_len;
+		uint8_t data[TLS_CACHE_DATA_LEN];
+
+		if (!conf->session_cache ||
+		    (tls_cache_read(conf->session_cache, iv, 16,
+				    time(NULL), data, &sess_len, &vps_len) < 0) ||
+		    sess_len || !vps_len) {
+			DEBUG2("  SSL: No cached VPs for session ticket");
+			memset(&key, 0, sizeof(key));
+			return 0;
+		}
+
+		pairfree(&ref->vps);
+		ref->vps = tls_cache_data2vps(data, vps_len);
+		if (!ref->vps) {
+			memset(&key, 0, sizeof(key));
+			return 0;
+		}
+		memcpy(ref->iv, iv, sizeof(ref->iv));
+	}
+
+	if (enc) {
+		if (RAND_bytes(iv, EVP_MAX_IV_LENGTH) != 1) return -1;
+		memcpy(key_name, key.name, 16);
+		EVP_EncryptInit_ex(ectx, EVP_aes_128_cbc(), NULL, key.aes, iv);
+
+		/*
+		 *	Renewing a ticket we've just decrypted.
+		 */
+		if (ref->vps) {
+			memcpy(ref->old_iv, ref->iv, sizeof(ref->old_iv));
+			ref->renewed = TRUE;
+		}
+		memcpy(ref->iv, iv, sizeof(ref->iv));
+	} else {
+		EVP_DecryptInit_ex(ectx, EVP_aes_128_cbc(), NULL, key.aes, iv);
+	}
+	HMAC_Init_ex(hctx, key.hmac, sizeof(key.hmac), EVP_sha256(), NULL);
+
+	memset(&key, 0, sizeof(key));
+	return rcode;
+}
+
+#endif	/* OPENSSL_VERSION_NUMBER >= 0x10000000L */
+
 static void cbtls_remove_session(SSL_CTX *ctx, SSL_SESSION *sess)
 {
 	size_t size;
@@ -993,7 +2016,11 @@ static void cbtls_remove_session(SSL_CTX *ctx, SSL_SESSION *sess)
 
         DEBUG2("  SSL: Removing session %s from the cache", buffer);
 	conf = (fr_tls_server_conf_t *)SSL_CTX_get_app_data(ctx);
-	if (conf && conf->session_cache_path) {
+	if (conf && conf->session_cache) {
+		tls_cache_delete(conf->session_cache, sess->session_id,
+				 sess->session_id_length);
+
+	} else if (conf && conf->session_cache_path) {
 		int rv;
 		char filename[256];
 
@@ -1029,8 +2056,12 @@ static int cbtls_new_session(SSL *ssl, SSL_SESSION *sess)
 
 	DEBUG2("  SSL: adding session %s to cache", buffer);
 
+	/*
+	 *	Sessions are written to the cache file by tls_success(),
+	 *	once we have the VPs to go with them.
+	 */
 	conf = (fr_tls_server_conf_t *)SSL_get_ex_data(ssl, FR_TLS_EX_INDEX_CONF);
-	if (conf && conf->session_cache_path) {
+	if (conf && !conf->session_cache && conf->session_cache_path) {
 		int fd, rv, todo, blob_len;
 		char filename[256];
 		unsigned char *p;
@@ -1109,7 +2140,28 @@ static SSL_SESSION *cbtls_get_session(SSL *ssl,
         DEBUG2("  SSL: Client requested cached session %s", buffer);
 
 	conf = (fr_tls_server_conf_t *)SSL_get_ex_data(ssl, FR_TLS_EX_INDEX_CONF);
-	if (conf && conf->session_cache_path) {
+	if (conf && conf->session_cache) {
+		VALUE_PAIR *vps = NULL;
+
+		sess = tls_cache_fetch(conf->session_cache, data, len,
+				       time(NULL), &vps);
+		if (!sess) {
+			DEBUG2("  SSL: No cached session %s", buffer);
+			goto err;
+		}
+
+		/* not safe to resume a session w/o VPs */
+		if (!vps) {
+			DEBUG2("  SSL: could not load cached VPs for session %s", buffer);
+			SSL_SESSION_free(sess);
+			sess = NULL;
+			goto err;
+		}
+
+		SSL_SESSION_set_ex_data(sess, FR_TLS_EX_INDEX_VPS, vps);
+		DEBUG2("  SSL: Successfully restored session %s", buffer);
+
+	} else if (conf && conf->session_cache_path) {
 		int rv, fd, todo;
 		char filename[256];
 		unsigned char *p;
@@ -2083,7 +3135,7 @@ post_ca:
 	ctx_options |= SSL_OP_NO_SSLv2;
 	ctx_options |= SSL_OP_NO_SSLv3;
 #ifdef SSL_OP_NO_TICKET
-	ctx_options |= SSL_OP_NO_TICKET ;
+	if (!conf->session_tickets) ctx_options |= SSL_OP_NO_TICKET;
 #endif
 
 	/*
@@ -2231,6 +3283,25 @@ post_ca:
 		 */
 		SSL_CTX_sess_set_cache_size(ctx, conf->session_cache_size);
 
+		if (conf->session_tickets) {
+#if OPENSSL_VERSION_NUMBER >= 0x10000000L
+			if (!conf->session_cache_file) {
+				radlog(L_ERR, "rlm_eap_tls: Session tickets require the cache \"file\"");
+				return NULL;
+			}
+
+			if (FR_TLS_EX_INDEX_TICKET < 0)
+				FR_TLS_EX_INDEX_TICKET = SSL_get_ex_new_index(0, NULL, NULL, NULL, ssl_free_ticket_ref);
+			conf->ticket_keys = tls_ticket_keys_init(conf);
+			if (!conf->ticket_keys) return NULL;
+
+			SSL_CTX_set_tlsext_ticket_key_cb(ctx, cbtls_ticket_key);
+#else
+			radlog(L_ERR, "rlm_eap_tls: Session tickets require OpenSSL 1.0.0 or later");
+			return NULL;
+#endif
+		}
+
 	} else {
 		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
 	}
@@ -2247,12 +3318,26 @@ post_ca:
  */
 static void tls_server_conf_free(fr_tls_server_conf_t *conf)
 {
+	fr_tls_server_conf_t **last;
+
 	if (!conf) return;
 
+	HANDSHAKE_LOCK;
+	for (last = &handshake_conf_list; *last != NULL; last = &(*last)->handshake_next) {
+		if (*last == conf) {
+			*last = conf->handshake_next;
+			break;
+		}
+	}
+	HANDSHAKE_UNLOCK;
+
 	if (conf->cs) cf_section_parse_free(conf->cs, conf);
 
 	if (conf->ctx) SSL_CTX_free(conf->ctx);
 
+	tls_cache_close(conf->session_cache);
+	tls_ticket_keys_free(conf->ticket_keys);
+
 #ifdef HAVE_OPENSSL_OCSP_H
 	if (conf->ocsp_store) X509_STORE_free(conf->ocsp_store);
 	conf->ocsp_store = NULL;
@@ -2333,6 +3418,21 @@ fr_tls_server_conf_t *tls_server_conf_parse(CONF_SECTION *cs)
 		goto error;
 	}
 
+	if (conf->session_cache_enable && conf->session_cache_file) {
+		if (!conf->session_id_name) {
+			radlog(L_ERR, "You MUST set the cache \"name\" in order to use the cache \"file\"");
+			goto error;
+		}
+
+		if (conf->session_cache_path) {
+			radlog(L_INFO, "WARNING: Ignoring cache \"persist_dir\", as the cache \"file\" is set");
+		}
+
+		conf->session_cache = tls_cache_open(conf->session_cache_file,
+						     conf->session_cache_size);
+		if (!conf->session_cache) goto error;
+	}
+
 #ifdef HAVE_OPENSSL_OCSP_H
 	/*
 	 * 	Initialize OCSP Revocation Store
@@ -2363,6 +3463,14 @@ fr_tls_server_conf_t *tls_server_conf_parse(CONF_SECTION *cs)
 		goto error;
 	}
 
+	/*
+	 *	Make the handshake counters visible to "show tls".
+	 */
+	HANDSHAKE_LOCK;
+	conf->handshake_next = handshake_conf_list;
+	handshake_conf_list = conf;
+	HANDSHAKE_UNLOCK;
+
 	/*
 	 *	Cache conf in cs in case we're asked to parse this again.
 	 */
@@ -2489,7 +3597,21 @@ int tls_success(tls_session_t *ssn, REQUEST *request)
 			RDEBUG2("Saving session %s vps %p in the cache", buffer, vps);
 			SSL_SESSION_set_ex_data(ssn->ssl->session,
 						FR_TLS_EX_INDEX_VPS, vps);
-			if (conf->session_cache_path) {
+			if (conf->session_cache) {
+				if (tls_cache_store(conf->session_cache,
+						    ssn->ssl->session, vps,
+						    request->timestamp,
+						    conf->session_timeout * 3600) < 0) {
+					RDEBUG("WARNING: Not caching session %s in the cache file", buffer);
+				}
+#if OPENSSL_VERSION_NUMBER >= 0x10000000L
+				if (conf->session_tickets) {
+					tls_ticket_store_vps(ssn->ssl, conf, vps,
+							     request->timestamp);
+				}
+#endif
+
+			} else if (conf->session_cache_path) {
 				/* write the VPs to the cache file */
 				char filename[256], buf[1024];
 				FILE *vp_file;
@@ -2533,6 +3655,17 @@ int tls_success(tls_session_t *ssn, REQUEST *request)
 	       
 		vps = SSL_SESSION_get_ex_data(ssn->ssl->session,
 					     FR_TLS_EX_INDEX_VPS);
+#if OPENSSL_VERSION_NUMBER >= 0x10000000L
+		if (!vps && conf->session_tickets) {
+			vps = tls_ticket_fetch_vps(ssn->ssl);
+			if (vps) SSL_SESSION_set_ex_data(ssn->ssl->session,
+							 FR_TLS_EX_INDEX_VPS, vps);
+		}
+		if (vps && conf->session_tickets) {
+			tls_ticket_renew_vps(ssn->ssl, conf, vps,
+					     request->timestamp);
+		}
+#endif
 		if (!vps) {
 			RDEBUG("WARNING: No information in cached session %s", buffer);
 			return -1;
@@ -2558,7 +3691,7 @@ int tls_success(tls_session_t *ssn, REQUEST *request)
 				}
 			}
 
-			if (conf->session_cache_path) {
+			if (!conf->session_cache && conf->session_cache_path) {
 				/* "touch" the cached session/vp file */
 				char filename[256];
 
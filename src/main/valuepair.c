@@ -121,27 +121,23 @@ int radius_compare_vps(REQUEST *request, VALUE_PAIR *check, VALUE_PAIR *vp)
 #ifdef HAVE_REGEX_H
 	if (check->op == T_OP_REG_EQ) {
 		int i, compare;
-		regex_t reg;
+		regex_t *reg;
 		char value[1024];
 		regmatch_t rxmatch[REQUEST_MAX_REGEX + 1];
 
-		vp_prints_value(value, sizeof(value), vp, -1);
-
 		/*
 		 *	Include substring matches.
 		 */
-		compare = regcomp(&reg, check->vp_strvalue, REG_EXTENDED);
-		if (compare != 0) {
-			char buffer[256];
-			regerror(compare, &reg, buffer, sizeof(buffer));
-
+		reg = fr_regcomp_cached(check->vp_strvalue, REG_EXTENDED,
+					value, sizeof(value));
+		if (!reg) {
 			RDEBUG("Invalid regular expression %s: %s",
-			       check->vp_strvalue, buffer);
+			       check->vp_strvalue, value);
 			return -1;
 		}
-		compare = regexec(&reg, value,  REQUEST_MAX_REGEX + 1,
+		vp_prints_value(value, sizeof(value), vp, -1);
+		compare = regexec(reg, value,  REQUEST_MAX_REGEX + 1,
 				  rxmatch, 0);
-		regfree(&reg);
 
 		/*
 		 *	Add %{0}, %{1}, etc.
@@ -196,28 +192,23 @@ int radius_compare_vps(REQUEST *request, VALUE_PAIR *check, VALUE_PAIR *vp)
 
 	if (check->op == T_OP_REG_NE) {
 		int compare;
-		regex_t reg;
+		regex_t *reg;
 		char value[1024];
 		regmatch_t rxmatch[REQUEST_MAX_REGEX + 1];
 
-		vp_prints_value(value, sizeof(value), vp, -1);
-
 		/*
 		 *	Include substring matches.
 		 */
-		compare = regcomp(&reg, (char *)check->vp_strvalue,
-				  REG_EXTENDED);
-		if (compare != 0) {
-			char buffer[256];
-			regerror(compare, &reg, buffer, sizeof(buffer));
-
+		reg = fr_regcomp_cached(check->vp_strvalue, REG_EXTENDED,
+					value, sizeof(value));
+		if (!reg) {
 			RDEBUG("Invalid regular expression %s: %s",
-			       check->vp_strvalue, buffer);
+			       check->vp_strvalue, value);
 			return -1;
 		}
-		compare = regexec(&reg, value,  REQUEST_MAX_REGEX + 1,
+		vp_prints_value(value, sizeof(value), vp, -1);
+		compare = regexec(reg, value,  REQUEST_MAX_REGEX + 1,
 				  rxmatch, 0);
-		regfree(&reg);
 
 		if (compare != 0) return 0;
 		return -1;
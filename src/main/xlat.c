@@ -109,69 +109,87 @@ static int valuepair2str(char * out,int outlen,VALUE_PAIR * pair, int type)
 }
 
 /*
- *	Dynamically translate for check:, request:, reply:, etc.
+ *	Find the list and packet used by check:, request:, reply:, etc.
  */
-static size_t xlat_packet(void *instance, REQUEST *request,
-			  const char *fmt, char *out, size_t outlen)
+static int xlat_packet_list(void *instance, REQUEST *request,
+			    VALUE_PAIR **vps, RADIUS_PACKET **packet)
 {
-	const DICT_ATTR	*da;
-	VALUE_PAIR	*vp;
-	VALUE_PAIR	*vps = NULL;
-	RADIUS_PACKET	*packet = NULL;
+	*vps = NULL;
+	*packet = NULL;
 
 	switch (*(int*) instance) {
 	case 0:
-		vps = request->config_items;
+		*vps = request->config_items;
 		break;
 
 	case 1:
-		vps = request->packet->vps;
-		packet = request->packet;
+		*vps = request->packet->vps;
+		*packet = request->packet;
 		break;
 
 	case 2:
-		vps = request->reply->vps;
-		packet = request->reply;
+		*vps = request->reply->vps;
+		*packet = request->reply;
 		break;
 
 	case 3:
 #ifdef WITH_PROXY
-		if (request->proxy) vps = request->proxy->vps;
-		packet = request->proxy;
+		if (request->proxy) *vps = request->proxy->vps;
+		*packet = request->proxy;
 #endif
 		break;
 
 	case 4:
 #ifdef WITH_PROXY
-		if (request->proxy_reply) vps = request->proxy_reply->vps;
-		packet = request->proxy_reply;
+		if (request->proxy_reply) *vps = request->proxy_reply->vps;
+		*packet = request->proxy_reply;
 #endif
 		break;
 
 	case 5:
 		if (request->parent) {
-			vps = request->parent->packet->vps;
-			packet = request->parent->packet;
+			*vps = request->parent->packet->vps;
+			*packet = request->parent->packet;
 		}
 		break;
 			
 	case 6:
 		if (request->parent && request->parent->reply) {
-			vps = request->parent->reply->vps;
-			packet = request->parent->reply;
+			*vps = request->parent->reply->vps;
+			*packet = request->parent->reply;
 		}
 		break;
 			
 	case 7:
 		if (request->parent) {
-			vps = request->parent->config_items;
+			*vps = request->parent->config_items;
 		}
 		break;
 			
 	default:		/* WTF? */
-		return 0;
+		return -1;
 	}
 
+	return 0;
+}
+
+static size_t xlat_packet_attr(REQUEST *request, VALUE_PAIR *vps,
+			       RADIUS_PACKET *packet, const DICT_ATTR *da,
+			       char *out, size_t outlen);
+
+/*
+ *	Dynamically translate for check:, request:, reply:, etc.
+ */
+static size_t xlat_packet(void *instance, REQUEST *request,
+			  const char *fmt, char *out, size_t outlen)
+{
+	const DICT_ATTR	*da;
+	VALUE_PAIR	*vp;
+	VALUE_PAIR	*vps;
+	RADIUS_PACKET	*packet;
+
+	if (xlat_packet_list(instance, request, &vps, &packet) < 0) return 0;
+
 	/*
 	 *	The "format" string is the attribute name.
 	 */
@@ -329,6 +347,19 @@ static size_t xlat_packet(void *instance, REQUEST *request,
 		return valuepair2str(out, outlen, vp, da->type);
 	}
 
+	return xlat_packet_attr(request, vps, packet, da, out, outlen);
+}
+
+/*
+ *	Print a known attribute from a list.  This is also called
+ *	directly for attribute references in compiled expansions.
+ */
+static size_t xlat_packet_attr(REQUEST *request, VALUE_PAIR *vps,
+			       RADIUS_PACKET *packet, const DICT_ATTR *da,
+			       char *out, size_t outlen)
+{
+	VALUE_PAIR	*vp;
+
 	vp = pairfind(vps, da->attr, da->vendor, TAG_ANY);
 	if (!vp) {
 		/*
@@ -764,12 +795,17 @@ static int xlat_cmp(const void *a, const void *b)
  */
 static xlat_t *xlat_find(const char *module)
 {
-	xlat_t my_xlat;
+	xlat_t my_xlat, *c;
+
+	if (!xlat_root) return NULL;
 
 	strlcpy(my_xlat.module, module, sizeof(my_xlat.module));
 	my_xlat.length = strlen(my_xlat.module);
 
-	return rbtree_finddata(xlat_root, &my_xlat);
+	c = rbtree_finddata(xlat_root, &my_xlat);
+	if (c && !c->do_xlat) return NULL; /* unregistered */
+
+	return c;
 }
 
 
@@ -928,7 +964,13 @@ void xlat_unregister(const char *module, RAD_XLAT_FUNC func, void *instance)
 
 	if (c->instance != instance) return;
 
-	rbtree_deletebydata(xlat_root, c);
+	/*
+	 *	Compiled expansions may hold a pointer to this entry,
+	 *	so it stays in the tree until xlat_free().  A later
+	 *	xlat_register() with the same name re-uses it.
+	 */
+	c->do_xlat = NULL;
+	c->instance = NULL;
 }
 
 /** De-register all xlat functions, used mainly for debugging.
@@ -940,6 +982,71 @@ void xlat_free(void)
 }
 
 
+/** Call an xlat function, escaping its output and optionally printing its length
+ *
+ * @param[in] c xlat function to call.
+ * @param[in] da if not NULL, the attribute to print from the list selected
+ *	by c, without going through c->do_xlat().
+ * @param[in] xlat_str argument for the xlat function.
+ * @param[in] do_length print the length of the output instead of the output.
+ * @param[out] q buffer for output.
+ * @param[in] freespace remaining in output buffer.
+ * @param[in] request Current server request.
+ * @param[in] func Optional function to escape output.
+ * @param[in] funcarg pointer to pass to escape function.
+ * @return the number of characters written.
+ */
+static int xlat_call(const xlat_t *c, const DICT_ATTR *da,
+		     const char *xlat_str, int do_length,
+		     char *q, int freespace, REQUEST *request,
+		     RADIUS_ESCAPE_STRING func, void *funcarg)
+{
+	int retlen;
+	char tmpbuf[8192];
+	char *out = q;
+	size_t outlen = freespace;
+
+	if (!c->internal) RDEBUG3("radius_xlat: Running registered xlat function of module %s for string \'%s\'",
+				  c->module, xlat_str);
+
+	/* xlat to a temporary buffer, then escape */
+	if (func) {
+		out = tmpbuf;
+		outlen = sizeof(tmpbuf);
+	}
+
+	if (da) {
+		VALUE_PAIR *vps;
+		RADIUS_PACKET *packet;
+
+		if (xlat_packet_list(c->instance, request, &vps, &packet) < 0) {
+			retlen = 0;
+		} else {
+			retlen = xlat_packet_attr(request, vps, packet, da,
+						  out, outlen);
+		}
+	} else {
+		retlen = c->do_xlat(c->instance, request, xlat_str,
+				    out, outlen);
+	}
+
+	if (func && (retlen > 0)) {
+		retlen = func(request, q, freespace, tmpbuf, funcarg);
+		if (retlen > 0) {
+			RDEBUG2("\tescape: \'%s\' -> \'%s\'", tmpbuf, q);
+		} else if (retlen < 0) {
+			RDEBUG2("String escape failed");
+		}
+	}
+
+	if ((retlen > 0) && do_length) {
+		snprintf(q, freespace, "%d", retlen);
+		retlen = strlen(q);
+	}
+
+	return retlen;
+}
+
 /** Decode an attribute name into a string
  *
  * This expands the various formats:
@@ -1166,30 +1273,9 @@ do_xlat:
 		return -1;
 	}
 
-	if (!c->internal) RDEBUG3("radius_xlat: Running registered xlat function of module %s for string \'%s\'",
-				  c->module, xlat_str);
-	if (func) {
-		/* xlat to a temporary buffer, then escape */
-		char tmpbuf[8192];
-		retlen = c->do_xlat(c->instance, request, xlat_str, tmpbuf, sizeof(tmpbuf));
-		if (retlen > 0) {
-			retlen = func(request, q, freespace, tmpbuf, funcarg);
-			if (retlen > 0) {
-				RDEBUG2("\tescape: \'%s\' -> \'%s\'", tmpbuf, q);
-			} else if (retlen < 0) {
-				RDEBUG2("String escape failed");
-			}
-		}
-	} else {
-		retlen = c->do_xlat(c->instance, request, xlat_str, q, freespace);
-	}
-	if (retlen > 0) {
-		if (do_length) {
-			snprintf(q, freespace, "%d", retlen);
-			retlen = strlen(q);
-		}
-		
-	} else if (next) {
+	retlen = xlat_call(c, NULL, xlat_str, do_length, q, freespace,
+			   request, func, funcarg);
+	if ((retlen <= 0) && next) {
 		/*
 		 *	Expand the second bit.
 		 */
@@ -1203,6 +1289,139 @@ done:
 	return 0;
 }
 
+/** Expand a single character variable such as %d or %t
+ *
+ * @param[in] c the character after the '%'.
+ * @param[out] q buffer for output.
+ * @param[in] freespace remaining in output buffer.
+ * @param[in] request current request.
+ * @return the number of characters written.
+ */
+static int xlat_percent(char c, char *q, int freespace, REQUEST *request)
+{
+	int len;
+	char *start = q;
+	char *nl;
+	VALUE_PAIR *tmp;
+	struct tm *TM, s_TM;
+	char tmpdt[40]; /* For temporary storing of dates */
+
+	switch (c) {
+	case 'd': /* request day */
+		TM = localtime_r(&request->timestamp, &s_TM);
+		len = strftime(tmpdt, sizeof(tmpdt), "%d", TM);
+		if (len > 0) {
+			strlcpy(q, tmpdt, freespace);
+			q += strlen(q);
+		}
+		break;
+	case 'l': /* request timestamp */
+		snprintf(tmpdt, sizeof(tmpdt), "%lu",
+			 (unsigned long) request->timestamp);
+		strlcpy(q,tmpdt,freespace);
+		q += strlen(q);
+		break;
+	case 'm': /* request month */
+		TM = localtime_r(&request->timestamp, &s_TM);
+		len = strftime(tmpdt, sizeof(tmpdt), "%m", TM);
+		if (len > 0) {
+			strlcpy(q, tmpdt, freespace);
+			q += strlen(q);
+		}
+		break;
+	case 't': /* request timestamp */
+		CTIME_R(&request->timestamp, tmpdt, sizeof(tmpdt));
+		nl = strchr(tmpdt, '\n');
+		if (nl) *nl = '\0';
+		strlcpy(q, tmpdt, freespace);
+		q += strlen(q);
+		break;
+	case 'C': /* ClientName */
+		strlcpy(q,request->client->shortname,freespace);
+		q += strlen(q);
+		break;
+	case 'D': /* request date */
+		TM = localtime_r(&request->timestamp, &s_TM);
+		len = strftime(tmpdt, sizeof(tmpdt), "%Y%m%d", TM);
+		if (len > 0) {
+			strlcpy(q, tmpdt, freespace);
+			q += strlen(q);
+		}
+		break;
+	case 'G': /* request minute */
+		TM = localtime_r(&request->timestamp, &s_TM);
+		len = strftime(tmpdt, sizeof(tmpdt), "%M", TM);
+		if (len > 0) {
+			strlcpy(q, tmpdt, freespace);
+			q += strlen(q);
+		}
+		break;
+	case 'H': /* request hour */
+		TM = localtime_r(&request->timestamp, &s_TM);
+		len = strftime(tmpdt, sizeof(tmpdt), "%H", TM);
+		if (len > 0) {
+			strlcpy(q, tmpdt, freespace);
+			q += strlen(q);
+		}
+		break;
+	case 'I': /* Request ID */
+		snprintf(tmpdt, sizeof(tmpdt), "%i", request->packet->id);
+		strlcpy(q, tmpdt, freespace);
+		q += strlen(q);
+		break;
+	case 'S': /* request timestamp in SQL format*/
+		TM = localtime_r(&request->timestamp, &s_TM);
+		len = strftime(tmpdt, sizeof(tmpdt), "%Y-%m-%d %H:%M:%S", TM);
+		if (len > 0) {
+			strlcpy(q, tmpdt, freespace);
+			q += strlen(q);
+		}
+		break;
+	case 'T': /* request timestamp */
+		TM = localtime_r(&request->timestamp, &s_TM);
+		len = strftime(tmpdt, sizeof(tmpdt), "%Y-%m-%d-%H.%M.%S.000000", TM);
+		if (len > 0) {
+			strlcpy(q, tmpdt, freespace);
+			q += strlen(q);
+		}
+		break;
+	case 'V': /* Request-Authenticator */
+		strlcpy(q,"Verified",freespace);
+		q += strlen(q);
+		break;
+	case 'Y': /* request year */
+		TM = localtime_r(&request->timestamp, &s_TM);
+		len = strftime(tmpdt, sizeof(tmpdt), "%Y", TM);
+		if (len > 0) {
+			strlcpy(q, tmpdt, freespace);
+			q += strlen(q);
+		}
+		break;
+	case 'Z': /* Full request pairs except password */
+		tmp = request->packet->vps;
+		while (tmp && (freespace > 3)) {
+			if (tmp->attribute != PW_USER_PASSWORD) {
+				*q++ = '\t';
+				len = vp_prints(q, freespace - 2, tmp);
+				q += len;
+				freespace -= (len + 2);
+				*q++ = '\n';
+			}
+			tmp = tmp->next;
+		}
+		break;
+	default:
+		RDEBUG2("WARNING: Unknown variable '%%%c': See 'doc/variables.txt'", c);
+		if (freespace > 2) {
+			*q++ = '%';
+			*q++ = c;
+		}
+		break;
+	}
+
+	return q - start;
+}
+
 /** Replace %whatever in a string.
  *
  * See 'doc/variables.txt' for more information.
@@ -1219,13 +1438,9 @@ size_t radius_xlat(char *out, int outlen, const char *fmt,
 		   REQUEST *request,
 		   RADIUS_ESCAPE_STRING func, void *funcarg)
 {
-	int c, len, freespace;
+	int c, freespace;
 	const char *p;
 	char *q;
-	char *nl;
-	VALUE_PAIR *tmp;
-	struct tm *TM, s_TM;
-	char tmpdt[40]; /* For temporary storing of dates */
 
 	/*
 	 *	Catch bad modules.
@@ -1288,135 +1503,430 @@ size_t radius_xlat(char *out, int outlen, const char *fmt,
 			case '%':
 				*q++ = *p++;
 				break;
-			case 'd': /* request day */
-				TM = localtime_r(&request->timestamp, &s_TM);
-				len = strftime(tmpdt, sizeof(tmpdt), "%d", TM);
-				if (len > 0) {
-					strlcpy(q, tmpdt, freespace);
-					q += strlen(q);
-				}
-				p++;
-				break;
-			case 'l': /* request timestamp */
-				snprintf(tmpdt, sizeof(tmpdt), "%lu",
-					 (unsigned long) request->timestamp);
-				strlcpy(q,tmpdt,freespace);
-				q += strlen(q);
-				p++;
-				break;
-			case 'm': /* request month */
-				TM = localtime_r(&request->timestamp, &s_TM);
-				len = strftime(tmpdt, sizeof(tmpdt), "%m", TM);
-				if (len > 0) {
-					strlcpy(q, tmpdt, freespace);
-					q += strlen(q);
-				}
-				p++;
-				break;
-			case 't': /* request timestamp */
-				CTIME_R(&request->timestamp, tmpdt, sizeof(tmpdt));
-				nl = strchr(tmpdt, '\n');
-				if (nl) *nl = '\0';
-				strlcpy(q, tmpdt, freespace);
-				q += strlen(q);
-				p++;
-				break;
-			case 'C': /* ClientName */
-				strlcpy(q,request->client->shortname,freespace);
-				q += strlen(q);
-				p++;
-				break;
-			case 'D': /* request date */
-				TM = localtime_r(&request->timestamp, &s_TM);
-				len = strftime(tmpdt, sizeof(tmpdt), "%Y%m%d", TM);
-				if (len > 0) {
-					strlcpy(q, tmpdt, freespace);
-					q += strlen(q);
-				}
-				p++;
+			default:
+				q += xlat_percent(*p++, q, freespace, request);
 				break;
-			case 'G': /* request minute */
-				TM = localtime_r(&request->timestamp, &s_TM);
-				len = strftime(tmpdt, sizeof(tmpdt), "%M", TM);
-				if (len > 0) {
-					strlcpy(q, tmpdt, freespace);
-					q += strlen(q);
-				}
-				p++;
+		}
+	}
+	*q = '\0';
+
+	RDEBUG2("\texpand: '%s' -> '%s'", fmt, out);
+
+	return strlen(out);
+}
+
+/*
+ *	Compiled expansions.
+ *
+ *	The format string is parsed once, into a list of literal
+ *	text, single character variables, and %{...} references.
+ *	The references are bound to the xlat function, and where
+ *	possible to the dictionary attribute, so that expanding
+ *	them doesn't need to re-parse the string, or to look
+ *	anything up by name.
+ */
+typedef enum xlat_node_type_t {
+	XLAT_LITERAL = 0,	/* copied as-is */
+	XLAT_PERCENT,		/* %d, %t, etc. */
+	XLAT_FUNC,		/* %{Attribute}, %{list:Attribute}, %{module:string} */
+	XLAT_ALTERNATE,		/* %{%{foo}:-%{bar}} */
+	XLAT_VIRTUAL		/* anything else, decoded when expanded */
+} xlat_node_type_t;
+
+typedef struct xlat_node_t {
+	struct xlat_node_t	*next;
+	xlat_node_type_t	type;
+	char			*text;		/* literal, xlat argument, or %{...} */
+	size_t			len;		/* of a literal */
+	char			percent;
+	int			do_length;	/* %{#...} */
+	const xlat_t		*xlat;
+	const DICT_ATTR		*da;		/* if xlat is a packet list */
+	xlat_exp_t		*first;		/* alternation */
+	xlat_exp_t		*second;	/* NULL if text is a literal */
+} xlat_node_t;
+
+struct xlat_exp_t {
+	char			*fmt;
+	xlat_node_t		*head;
+};
+
+static xlat_node_t *xlat_node_alloc(xlat_node_type_t type)
+{
+	xlat_node_t *node;
+
+	node = rad_malloc(sizeof(*node));
+	memset(node, 0, sizeof(*node));
+	node->type = type;
+
+	return node;
+}
+
+static char *xlat_strndup(const char *in, size_t len)
+{
+	char *out;
+
+	out = rad_malloc(len + 1);
+	memcpy(out, in, len);
+	out[len] = '\0';
+
+	return out;
+}
+
+/** Compile one %{...} reference
+ *
+ * The parsing here follows decode_attribute().  Anything which can't
+ * be resolved now, or which decode_attribute() would complain about,
+ * is left as an XLAT_VIRTUAL node, so that it behaves exactly as it
+ * did before.
+ *
+ * @param[in,out] from the start of the reference, updated to point
+ *	to the text after it.
+ * @return the new node.
+ */
+static xlat_node_t *xlat_compile_attribute(const char **from)
+{
+	int		do_length = 0;
+	const char	*module_name, *xlat_str;
+	const char	*start = *from;
+	char		*p, *l;
+	int		varlen;
+	const xlat_t	*c;
+	const DICT_ATTR	*da = NULL;
+	xlat_node_t	*node;
+	char		buffer[8192];
+
+	varlen = rad_copy_variable(buffer, *from);
+	if (varlen < 0) {
+		/*
+		 *	Badly formatted.  It will fail when expanded,
+		 *	along with the rest of the string.
+		 */
+		varlen = strlen(start);
+		*from += varlen;
+		goto do_virtual;
+	}
+	*from += varlen;
+
+	p = buffer;
+	p[varlen - 1] = '\0';
+	p += 2;
+	if (*p == '#') {
+		p++;
+		do_length = 1;
+	}
+
+	/*
+	 *	%{%{foo}:-%{bar}}
+	 */
+	if ((p[0] == '%') && (p[1] == '{')) {
+		int len1, len2;
+		int expand2 = FALSE;
+
+		len1 = rad_copy_variable(buffer, p);
+		if ((len1 < 0) || !p[len1] ||
+		    (p[len1] != ':') || (p[len1 + 1] != '-')) {
+			goto do_virtual;
+		}
+
+		p += len1 + 2;
+		l = buffer + len1 + 1;
+
+		if ((p[0] == '%') && (p[1] == '{')) {
+			len2 = rad_copy_variable(l, p);
+			if (len2 < 0) goto do_virtual;
+			expand2 = TRUE;
+
+		} else if ((p[0] == '"') || p[0] == '\'') {
+			const char *str = p;
+
+			getstring(&str, l, strlen(l));
+
+		} else {
+			l = p;
+		}
+
+		node = xlat_node_alloc(XLAT_ALTERNATE);
+		node->first = radius_xlat_compile(buffer);
+		if (expand2) {
+			node->second = radius_xlat_compile(l);
+		} else {
+			node->text = strdup(l);
+		}
+		return node;
+	}
+
+	module_name = NULL;
+	for (l = p; *l != '\0'; l++) {
+		if (*l == ':') {
+			module_name = p;
+			*l = '\0';
+			p = l + 1;
+			break;
+		}
+
+		if ((*l == ' ') || (*l == '\t')) break;
+	}
+
+	if (!module_name) {
+		xlat_str = p;
+		if (isdigit(*p) && !p[1]) { /* regex 0..8 */
+			module_name = xlat_str;
+		}
+
+	} else {
+		/*
+		 *	The deprecated %{foo:-bar} prints a warning
+		 *	each time it's expanded.  Leave it alone.
+		 */
+		if (*p == '-') goto do_virtual;
+
+		xlat_str = p;
+	}
+
+	/*
+	 *	Bare attribute names are looked up in the request.
+	 *	Modules which haven't been loaded yet are looked up
+	 *	when the string is expanded.
+	 */
+	if (!module_name) {
+		c = xlat_find(xlat_str);
+		if (!c) {
+			da = dict_attrbyname(xlat_str);
+			if (!da) goto do_virtual;
+
+			c = xlat_find("request");
+		}
+	} else {
+		c = xlat_find(module_name);
+		if (c && (c->do_xlat == xlat_packet)) {
+			da = dict_attrbyname(xlat_str);
+		}
+	}
+	if (!c) goto do_virtual;
+
+	node = xlat_node_alloc(XLAT_FUNC);
+	node->xlat = c;
+	node->da = da;
+	node->text = strdup(xlat_str);
+	node->do_length = do_length;
+	return node;
+
+do_virtual:
+	node = xlat_node_alloc(XLAT_VIRTUAL);
+	node->text = xlat_strndup(start, varlen);
+	return node;
+}
+
+/** Compile a string for later expansion with radius_xlat_exp()
+ *
+ * @param[in] fmt string to compile.
+ * @return the compiled string, or NULL if fmt was NULL.
+ */
+xlat_exp_t *radius_xlat_compile(const char *fmt)
+{
+	int		c;
+	const char	*p;
+	char		*lit, *q;
+	xlat_exp_t	*exp;
+	xlat_node_t	*node, **tail;
+
+	if (!fmt) return NULL;
+
+	exp = rad_malloc(sizeof(*exp));
+	memset(exp, 0, sizeof(*exp));
+	exp->fmt = strdup(fmt);
+	tail = &exp->head;
+
+	/*
+	 *	Literal text is never longer than the input.
+	 */
+	lit = q = rad_malloc(strlen(fmt) + 1);
+
+#define FLUSH_LITERAL do { \
+	if (q != lit) { \
+		node = xlat_node_alloc(XLAT_LITERAL); \
+		node->len = q - lit; \
+		node->text = xlat_strndup(lit, node->len); \
+		*tail = node; \
+		tail = &node->next; \
+		q = lit; \
+	} } while (0)
+
+	p = fmt;
+	while (*p) {
+		c = *p;
+
+		if ((c != '%') && (c != '$') && (c != '\\')) {
+			*q++ = *p++;
+			continue;
+		}
+
+		/*
+		 *	The same rules as radius_xlat().
+		 */
+		if (*++p == '\0') {
+			*q++ = c;
+			break;
+		}
+
+		if (c == '\\') {
+			switch(*p) {
+			case '\\':
+				*q++ = *p;
 				break;
-			case 'H': /* request hour */
-				TM = localtime_r(&request->timestamp, &s_TM);
-				len = strftime(tmpdt, sizeof(tmpdt), "%H", TM);
-				if (len > 0) {
-					strlcpy(q, tmpdt, freespace);
-					q += strlen(q);
-				}
-				p++;
+			case 't':
+				*q++ = '\t';
 				break;
-			case 'I': /* Request ID */
-				snprintf(tmpdt, sizeof(tmpdt), "%i", request->packet->id);
-				strlcpy(q, tmpdt, freespace);
-				q += strlen(q);
-				p++;
+			case 'n':
+				*q++ = '\n';
 				break;
-			case 'S': /* request timestamp in SQL format*/
-				TM = localtime_r(&request->timestamp, &s_TM);
-				len = strftime(tmpdt, sizeof(tmpdt), "%Y-%m-%d %H:%M:%S", TM);
-				if (len > 0) {
-					strlcpy(q, tmpdt, freespace);
-					q += strlen(q);
-				}
-				p++;
+			default:
+				*q++ = c;
+				*q++ = *p;
 				break;
-			case 'T': /* request timestamp */
-				TM = localtime_r(&request->timestamp, &s_TM);
-				len = strftime(tmpdt, sizeof(tmpdt), "%Y-%m-%d-%H.%M.%S.000000", TM);
-				if (len > 0) {
-					strlcpy(q, tmpdt, freespace);
-					q += strlen(q);
-				}
-				p++;
+			}
+			p++;
+			continue;
+		}
+
+		if (c != '%') continue;	/* '$' is swallowed */
+
+		if (*p == '%') {
+			*q++ = *p++;
+			continue;
+		}
+
+		FLUSH_LITERAL;
+
+		if (*p == '{') {
+			p--;
+			node = xlat_compile_attribute(&p);
+		} else {
+			node = xlat_node_alloc(XLAT_PERCENT);
+			node->percent = *p++;
+		}
+		*tail = node;
+		tail = &node->next;
+	}
+	FLUSH_LITERAL;
+#undef FLUSH_LITERAL
+
+	free(lit);
+
+	return exp;
+}
+
+/** Free a compiled string
+ *
+ * @param[in,out] pexp the compiled string, set to NULL on return.
+ */
+void radius_xlat_exp_free(xlat_exp_t **pexp)
+{
+	xlat_node_t *node, *next;
+
+	if (!pexp || !*pexp) return;
+
+	for (node = (*pexp)->head; node != NULL; node = next) {
+		next = node->next;
+
+		radius_xlat_exp_free(&node->first);
+		radius_xlat_exp_free(&node->second);
+		free(node->text);
+		free(node);
+	}
+
+	free((*pexp)->fmt);
+	free(*pexp);
+	*pexp = NULL;
+}
+
+/** Expand a string compiled with radius_xlat_compile()
+ *
+ * The output is the same as radius_xlat() would produce for the
+ * original string.
+ *
+ * @param[out] out output buffer.
+ * @param[in] outlen size of output buffer.
+ * @param[in] exp compiled string to expand.
+ * @param[in] request current request.
+ * @param[in] func function to escape final value e.g. SQL quoting.
+ * @param[in] funcarg pointer to pass to escape function.
+ * @return length of string written.
+ */
+size_t radius_xlat_exp(char *out, int outlen, const xlat_exp_t *exp,
+		       REQUEST *request,
+		       RADIUS_ESCAPE_STRING func, void *funcarg)
+{
+	int freespace, retlen;
+	size_t len;
+	const char *p;
+	char *q;
+	const xlat_node_t *node;
+
+	if (!exp || !out || !request) return 0;
+
+	q = out;
+	for (node = exp->head; node != NULL; node = node->next) {
+		freespace = outlen - (q - out);
+		if (freespace <= 1) break;
+
+		switch (node->type) {
+		case XLAT_LITERAL:
+			len = node->len;
+			if (len > (size_t) (freespace - 1)) len = freespace - 1;
+			memcpy(q, node->text, len);
+			q += len;
+			break;
+
+		case XLAT_PERCENT:
+			q += xlat_percent(node->percent, q, freespace, request);
+			break;
+
+		case XLAT_FUNC:
+			/*
+			 *	The module was unloaded.
+			 */
+			if (!node->xlat->do_xlat) {
+				RDEBUG2("WARNING: Unknown module \"%s\" in string expansion \"%s\"",
+					node->xlat->module, exp->fmt);
+				return 0;
+			}
+
+			retlen = xlat_call(node->xlat, node->da, node->text,
+					   node->do_length, q, freespace,
+					   request, func, funcarg);
+			if (retlen > 0) q += retlen;
+			break;
+
+		case XLAT_ALTERNATE:
+			retlen = radius_xlat_exp(q, freespace, node->first,
+						 request, func, funcarg);
+			if (retlen) {
+				q += retlen;
 				break;
-			case 'V': /* Request-Authenticator */
-				strlcpy(q,"Verified",freespace);
+			}
+
+			RDEBUG2("\t... expanding second conditional");
+			if (node->second) {
+				q += radius_xlat_exp(q, freespace, node->second,
+						     request, func, funcarg);
+			} else {
+				strlcpy(q, node->text, freespace);
 				q += strlen(q);
-				p++;
-				break;
-			case 'Y': /* request year */
-				TM = localtime_r(&request->timestamp, &s_TM);
-				len = strftime(tmpdt, sizeof(tmpdt), "%Y", TM);
-				if (len > 0) {
-					strlcpy(q, tmpdt, freespace);
-					q += strlen(q);
-				}
-				p++;
-				break;
-			case 'Z': /* Full request pairs except password */
-				tmp = request->packet->vps;
-				while (tmp && (freespace > 3)) {
-					if (tmp->attribute != PW_USER_PASSWORD) {
-						*q++ = '\t';
-						len = vp_prints(q, freespace - 2, tmp);
-						q += len;
-						freespace -= (len + 2);
-						*q++ = '\n';
-					}
-					tmp = tmp->next;
-				}
-				p++;
-				break;
-			default:
-				RDEBUG2("WARNING: Unknown variable '%%%c': See 'doc/variables.txt'", *p);
-				if (freespace > 2) {
-					*q++ = '%';
-					*q++ = *p++;
-				}
-				break;
+			}
+			break;
+
+		case XLAT_VIRTUAL:
+			p = node->text;
+			if (decode_attribute(&p, &q, freespace, request,
+					     func, funcarg) < 0) return 0;
+			break;
 		}
 	}
 	*q = '\0';
 
-	RDEBUG2("\texpand: '%s' -> '%s'", fmt, out);
+	RDEBUG2("\texpand: '%s' -> '%s'", exp->fmt, out);
 
 	return strlen(out);
 }
@@ -27,9 +27,13 @@ RCSID("$Id$")
 #include <freeradius-devel/radiusd.h>
 #include <freeradius-devel/modules.h>
 
+#ifdef HAVE_PCREPOSIX_H
+#	include <pcreposix.h>
+#else
 #ifdef HAVE_REGEX_H
 #	include <regex.h>
 #endif
+#endif
 
 #define RLM_REGEX_INPACKET 0
 #define RLM_REGEX_INCONFIG 1
@@ -161,7 +165,7 @@ static rlm_rcode_t do_attr_rewrite(void *instance, REQUEST *request)
 	rlm_rcode_t rcode = RLM_MODULE_NOOP;
 	VALUE_PAIR *attr_vp = NULL;
 	VALUE_PAIR *tmp = NULL;
-	regex_t preg;
+	regex_t *preg;
 	regmatch_t pmatch[9];
 	int cflags = 0;
 	int err = 0;
@@ -284,8 +288,8 @@ do_again:
 			return rcode;
 		}
 
-		if ((err = regcomp(&preg,search_STR,cflags))) {
-			regerror(err, &preg, err_msg, MAX_STRING_LEN);
+		preg = fr_regcomp_cached(search_STR, cflags, err_msg, sizeof(err_msg));
+		if (!preg) {
 			DEBUG2("%s: regcomp() returned error: %s", data->name,err_msg);
 			return rcode;
 		}
@@ -302,18 +306,16 @@ do_again:
 		counter = 0;
 
 		for ( i = 0 ;i < (unsigned)data->num_matches; i++) {
-			err = regexec(&preg, ptr2, REQUEST_MAX_REGEX, pmatch, 0);
+			err = regexec(preg, ptr2, REQUEST_MAX_REGEX, pmatch, 0);
 			if (err == REG_NOMATCH) {
 				if (i == 0) {
 					DEBUG2("%s: Does not match: %s = %s", data->name,
 							data->attribute, attr_vp->vp_strvalue);
-					regfree(&preg);
 					goto to_do_again;
 				} else
 					break;
 			}
 			if (err != 0) {
-				regfree(&preg);
 				radlog(L_ERR, "%s: match failure for attribute %s with value '%s'", data->name,
 						data->attribute, attr_vp->vp_strvalue);
 				return rcode;
@@ -326,7 +328,6 @@ do_again:
 			}
 			counter += len;
 			if (counter >= MAX_STRING_LEN) {
-				regfree(&preg);
 				DEBUG2("%s: Replacement out of limits for attribute %s with value '%s'", data->name,
 						data->attribute, attr_vp->vp_strvalue);
 				return rcode;
@@ -382,7 +383,6 @@ do_again:
 
 			counter += replace_len;
 			if (counter >= MAX_STRING_LEN) {
-				regfree(&preg);
 				DEBUG2("%s: Replacement out of limits for attribute %s with value '%s'", data->name,
 						data->attribute, attr_vp->vp_strvalue);
 				return rcode;
@@ -393,7 +393,6 @@ do_again:
 				*ptr = '\0';
 			}
 		}
-		regfree(&preg);
 		len = strlen(ptr2) + 1;		/* We add the ending NULL */
 		counter += len;
 		if (counter >= MAX_STRING_LEN){
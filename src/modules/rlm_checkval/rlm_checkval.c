@@ -27,9 +27,13 @@ RCSID("$Id$")
 #include <freeradius-devel/radiusd.h>
 #include <freeradius-devel/modules.h>
 
+#ifdef HAVE_PCREPOSIX_H
+#	include <pcreposix.h>
+#else
 #ifdef HAVE_REGEX_H
 #	include <regex.h>
 #endif
+#endif
 #ifndef REG_EXTENDED
 #define REG_EXTENDED (0)
 #endif
@@ -266,22 +270,20 @@ static rlm_rcode_t do_checkval(void *instance, REQUEST *request)
 #ifdef HAVE_REGEX_H
 		if (rcode == RLM_MODULE_REJECT &&
 		    chk_vp->op == T_OP_REG_EQ) {
-			regex_t reg;
-			int err;
+			regex_t *reg;
 			char err_msg[MAX_STRING_LEN];
 
 			DEBUG("rlm_checkval: Doing regex");
-			err = regcomp(&reg, (char *)chk_vp->vp_strvalue, REG_EXTENDED|REG_NOSUB);
-			if (err){
-				regerror(err, &reg,err_msg, MAX_STRING_LEN);
+			reg = fr_regcomp_cached(chk_vp->vp_strvalue, REG_EXTENDED|REG_NOSUB,
+						err_msg, sizeof(err_msg));
+			if (!reg){
 				DEBUG("rlm_checkval: regcomp() returned error: %s", err_msg);
 				return RLM_MODULE_FAIL;
 			}
-			if (regexec(&reg, (char *)item_vp->vp_strvalue,0, NULL, 0) == 0)
+			if (regexec(reg, (char *)item_vp->vp_strvalue,0, NULL, 0) == 0)
 				rcode = RLM_MODULE_OK;
 			else
 				rcode = RLM_MODULE_REJECT;
-			regfree(&reg);
 		}
 #endif
 		tmp = chk_vp->next;
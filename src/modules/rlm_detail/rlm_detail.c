@@ -52,12 +52,14 @@ RCSID("$Id$")
  */
 typedef struct detail_instance {
 	char	*detailfile;	//!< File/path to write to.
+	xlat_exp_t *detailfile_exp; //!< Compiled detailfile.
 	int	detailperm;	//!< Permissions to use for new files.
 	char	*group;		//!< Group to use for new files.
 	
 	int	dirperm;	//!< Directory permissions to use for new files.
 	
 	char	*header;	//!< Header format.
+	xlat_exp_t *header_exp;	//!< Compiled header.
 	int	locking;	//!< Whether the file should be locked.
 	
 	int	log_srcdst;	//!< Add IP src/dst attributes to entries.
@@ -91,6 +93,8 @@ static int detail_detach(void *instance)
 {
         struct detail_instance *inst = instance;
 	if (inst->ht) fr_hash_table_free(inst->ht);
+	radius_xlat_exp_free(&inst->detailfile_exp);
+	radius_xlat_exp_free(&inst->header_exp);
 
         free(inst);
 	return 0;
@@ -128,6 +132,9 @@ static int detail_instantiate(CONF_SECTION *conf, void **instance)
 		return -1;
 	}
 
+	inst->detailfile_exp = radius_xlat_compile(inst->detailfile);
+	inst->header_exp = radius_xlat_compile(inst->header);
+
 	/*
 	 *	Suppress certain attributes.
 	 */
@@ -219,7 +226,7 @@ static rlm_rcode_t do_detail(void *instance, REQUEST *request, RADIUS_PACKET *pa
 	 *	feed it through radius_xlat() to expand the
 	 *	variables.
 	 */
-	if (radius_xlat(buffer, sizeof(buffer), inst->detailfile, request, NULL, NULL) == 0) {
+	if (radius_xlat_exp(buffer, sizeof(buffer), inst->detailfile_exp, request, NULL, NULL) == 0) {
 		radlog_request(L_ERR, 0, request, "rlm_detail: Failed to expand detail file %s",
 		    inst->detailfile);
 	    return RLM_MODULE_FAIL;
@@ -364,7 +371,7 @@ static rlm_rcode_t do_detail(void *instance, REQUEST *request, RADIUS_PACKET *pa
 		return RLM_MODULE_FAIL;
 	}
 
-	if (radius_xlat(timestamp, sizeof(timestamp), inst->header, request, NULL, NULL) == 0) {
+	if (radius_xlat_exp(timestamp, sizeof(timestamp), inst->header_exp, request, NULL, NULL) == 0) {
 		radlog_request(L_ERR, 0, request, "rlm_detail: Unable to expand detail header format %s",
 			inst->header);
 		close(outfd);
@@ -615,7 +622,8 @@ static rlm_rcode_t detail_post_proxy(void *instance, REQUEST *request)
 module_t rlm_detail = {
 	RLM_MODULE_INIT,
 	"detail",
-	RLM_TYPE_THREAD_UNSAFE | RLM_TYPE_CHECK_CONFIG_SAFE | RLM_TYPE_HUP_SAFE,
+	RLM_TYPE_THREAD_UNSAFE | RLM_TYPE_CHECK_CONFIG_SAFE | RLM_TYPE_HUP_SAFE |
+	  RLM_TYPE_HUP_CHANGED,
 	detail_instantiate,		/* instantiation */
 	detail_detach,			/* detach */
 	{
@@ -260,14 +260,33 @@ void eaptype_free(EAP_TYPES *i)
 
 void eaplist_free(rlm_eap_t *inst)
 {
+	int i;
 	EAP_HANDLER *node, *next;
 
-       	for (node = inst->session_head; node != NULL; node = next) {
-		next = node->next;
-		eap_handler_free(inst, node);
+	for (i = 0; i < EAP_SESSION_SHARDS; i++) {
+		eap_session_shard_t *shard = &inst->shards[i];
+
+		for (node = shard->head; node != NULL; node = next) {
+			next = node->next;
+			eap_handler_free(inst, node);
+		}
+
+		shard->head = shard->tail = NULL;
 	}
 
-	inst->session_head = inst->session_tail = NULL;
+	inst->num_sessions = 0;
+}
+
+/*
+ *	Find the shard for a State value.  Bytes 4..6 of the State
+ *	change on every round trip, so we hash only the last half,
+ *	which stays the same for the whole of the EAP conversation.
+ */
+static eap_session_shard_t *eaplist_shard(rlm_eap_t *inst,
+					  const uint8_t *state)
+{
+	return &inst->shards[fr_hash(state + (EAP_STATE_LEN / 2),
+				     EAP_STATE_LEN / 2) % EAP_SESSION_SHARDS];
 }
 
 /*
@@ -287,15 +306,42 @@ static uint32_t eap_rand(fr_randctx *ctx)
 }
 
 
-static EAP_HANDLER *eaplist_delete(rlm_eap_t *inst, REQUEST *request,
-				   EAP_HANDLER *handler)
+/*
+ *	Unlink a handler from a shard.  The shard MUST be locked.
+ */
+static void eaplist_unlink(rlm_eap_t *inst, eap_session_shard_t *shard,
+			   EAP_HANDLER *handler, rbnode_t *node)
+{
+	rbtree_delete(shard->tree, node);
+
+	if (handler->prev) {
+		handler->prev->next = handler->next;
+	} else {
+		shard->head = handler->next;
+	}
+	if (handler->next) {
+		handler->next->prev = handler->prev;
+	} else {
+		shard->tail = handler->prev;
+	}
+	handler->prev = handler->next = NULL;
+
+	PTHREAD_MUTEX_LOCK(&(inst->session_mutex));
+	inst->num_sessions--;
+	PTHREAD_MUTEX_UNLOCK(&(inst->session_mutex));
+}
+
+
+static EAP_HANDLER *eaplist_delete(rlm_eap_t *inst,
+				   eap_session_shard_t *shard,
+				   REQUEST *request, EAP_HANDLER *handler)
 {
 	rbnode_t *node;
 
-	node = rbtree_find(inst->session_tree, handler);
+	node = rbtree_find(shard->tree, handler);
 	if (!node) return NULL;
 
-	handler = rbtree_node2data(inst->session_tree, node);
+	handler = rbtree_node2data(shard->tree, node);
 
 	RDEBUG("Finished EAP session with state "
 	       "0x%02x%02x%02x%02x%02x%02x%02x%02x",
@@ -303,46 +349,38 @@ static EAP_HANDLER *eaplist_delete(rlm_eap_t *inst, REQUEST *request,
 	       handler->state[2], handler->state[3],
 	       handler->state[4], handler->state[5],
 	       handler->state[6], handler->state[7]);
+
 	/*
-	 *	Delete old handler from the tree.
-	 */
-	rbtree_delete(inst->session_tree, node);
-	
-	/*
-	 *	And unsplice it from the linked list.
+	 *	Delete old handler from the tree, and unsplice it
+	 *	from the linked list.
 	 */
-	if (handler->prev) {
-		handler->prev->next = handler->next;
-	} else {
-		inst->session_head = handler->next;
-	}
-	if (handler->next) {
-		handler->next->prev = handler->prev;
-	} else {
-		inst->session_tail = handler->prev;
-	}
-	handler->prev = handler->next = NULL;
+	eaplist_unlink(inst, shard, handler, node);
 
 	return handler;
 }
 
 
-static void eaplist_expire(rlm_eap_t *inst, REQUEST *request, time_t timestamp)
+static void eaplist_expire(rlm_eap_t *inst, eap_session_shard_t *shard,
+			   REQUEST *request, time_t timestamp)
 {
 	int i;
+	rbnode_t *node;
 	EAP_HANDLER *handler;
 
 	/*
-	 *	Check the first few handlers in the list, and delete
-	 *	them if they're too old.  We don't need to check them
-	 *	all, as incoming requests will quickly cause older
-	 *	handlers to be deleted.
-	 *
+	 *	The list is ordered oldest first, so we only need to
+	 *	look at the head.  Stop at the first handler which is
+	 *	still live, and don't delete more than a few at a
+	 *	time, so that the cost is spread across requests.
 	 */
 	for (i = 0; i < 3; i++) {
-		handler = inst->session_head;
+		handler = shard->head;
 		if (!handler) break;
-		
+
+		if ((timestamp - handler->timestamp) <= inst->timer_limit) {
+			break;
+		}
+
 		RDEBUG("Expiring EAP session with state "
 		       "0x%02x%02x%02x%02x%02x%02x%02x%02x",
 		       handler->state[0], handler->state[1],
@@ -350,28 +388,10 @@ static void eaplist_expire(rlm_eap_t *inst, REQUEST *request, time_t timestamp)
 		       handler->state[4], handler->state[5],
 		       handler->state[6], handler->state[7]);
 
-		/*
-		 *	Expire entries from the start of the list.
-		 *	They should be the oldest ones.
-		 */
-		if ((timestamp - handler->timestamp) > inst->timer_limit) {
-			rbnode_t *node;
-			node = rbtree_find(inst->session_tree, handler);
-			rad_assert(node != NULL);
-			rbtree_delete(inst->session_tree, node);
-
-			/*
-			 *	handler == inst->session_head
-			 */
-			inst->session_head = handler->next;
-			if (handler->next) {
-				handler->next->prev = NULL;
-			} else {
-				inst->session_head = NULL;
-				inst->session_tail = NULL;
-			}
-			eap_handler_free(inst, handler);
-		}
+		node = rbtree_find(shard->tree, handler);
+		rad_assert(node != NULL);
+		eaplist_unlink(inst, shard, handler, node);
+		eap_handler_free(inst, handler);
 	}
 }
 
@@ -386,6 +406,7 @@ int eaplist_add(rlm_eap_t *inst, EAP_HANDLER *handler)
 	int		status = 0;
 	VALUE_PAIR	*state;
 	REQUEST		*request = handler->request;
+	eap_session_shard_t *shard;
 
 	rad_assert(handler != NULL);
 	rad_assert(request != NULL);
@@ -408,19 +429,35 @@ int eaplist_add(rlm_eap_t *inst, EAP_HANDLER *handler)
 	handler->eap_id = handler->eap_ds->request->id;
 
 	/*
-	 *	Playing with a data structure shared among threads
-	 *	means that we need a lock, to avoid conflict.
+	 *	The session count is shared by all of the shards.
+	 *	Reserve a slot now, and give it back if the insert
+	 *	fails.
 	 */
 	PTHREAD_MUTEX_LOCK(&(inst->session_mutex));
 
 	/*
 	 *	If we have a DoS attack, discard new sessions.
 	 */
-	if (rbtree_num_elements(inst->session_tree) >= inst->max_sessions) {
+	if (inst->num_sessions >= inst->max_sessions) {
+		int i;
+
+		PTHREAD_MUTEX_UNLOCK(&(inst->session_mutex));
+
+		/*
+		 *	Try to make room for the next one.
+		 */
+		for (i = 0; i < EAP_SESSION_SHARDS; i++) {
+			shard = &inst->shards[i];
+
+			PTHREAD_MUTEX_LOCK(&(shard->mutex));
+			eaplist_expire(inst, shard, request, handler->timestamp);
+			PTHREAD_MUTEX_UNLOCK(&(shard->mutex));
+		}
+
 		status = -1;
-		eaplist_expire(inst, request, handler->timestamp);
 		goto done;
 	}
+	inst->num_sessions++;
 
 	/*
 	 *	Create a unique content for the State variable.
@@ -440,6 +477,8 @@ int eaplist_add(rlm_eap_t *inst, EAP_HANDLER *handler)
 		}		
 	}
 
+	PTHREAD_MUTEX_UNLOCK(&(inst->session_mutex));
+
 	memcpy(state->vp_octets, handler->state, sizeof(handler->state));
 	state->length = EAP_STATE_LEN;
 
@@ -455,10 +494,19 @@ int eaplist_add(rlm_eap_t *inst, EAP_HANDLER *handler)
 	 */
 	memcpy(handler->state, state->vp_octets, sizeof(handler->state));
 
+	/*
+	 *	Playing with a data structure shared among threads
+	 *	means that we need a lock, to avoid conflict.
+	 */
+	shard = eaplist_shard(inst, handler->state);
+	PTHREAD_MUTEX_LOCK(&(shard->mutex));
+
+	eaplist_expire(inst, shard, request, handler->timestamp);
+
 	/*
 	 *	Big-time failure.
 	 */
-	status = rbtree_insert(inst->session_tree, handler);
+	status = rbtree_insert(shard->tree, handler);
 
 	/*
 	 *	Catch Access-Challenge without response.
@@ -475,31 +523,36 @@ int eaplist_add(rlm_eap_t *inst, EAP_HANDLER *handler)
 	if (status) {
 		EAP_HANDLER *prev;
 
-		prev = inst->session_tail;
+		prev = shard->tail;
 		if (prev) {
 			prev->next = handler;
 			handler->prev = prev;
 			handler->next = NULL;
-			inst->session_tail = handler;
+			shard->tail = handler;
 		} else {
-			inst->session_head = inst->session_tail = handler;
+			shard->head = shard->tail = handler;
 			handler->next = handler->prev = NULL;
 		}
+
+		/*
+		 *	We don't need this any more.
+		 */
+		handler->request = NULL;
 	}
 
 	/*
 	 *	Now that we've finished mucking with the list,
 	 *	unlock it.
 	 */
- done:
-
-	/*
-	 *	We don't need this any more.
-	 */
-	if (status > 0) handler->request = NULL;
+	PTHREAD_MUTEX_UNLOCK(&(shard->mutex));
 
-	PTHREAD_MUTEX_UNLOCK(&(inst->session_mutex));
+	if (!status) {
+		PTHREAD_MUTEX_LOCK(&(inst->session_mutex));
+		inst->num_sessions--;
+		PTHREAD_MUTEX_UNLOCK(&(inst->session_mutex));
+	}
 
+ done:
 	if (status <= 0) {
 		pairfree(&state);
 
@@ -547,6 +600,7 @@ EAP_HANDLER *eaplist_find(rlm_eap_t *inst, REQUEST *request,
 {
 	VALUE_PAIR	*state;
 	EAP_HANDLER	*handler, myHandler;
+	eap_session_shard_t *shard;
 
 	/*
 	 *	We key the sessions off of the 'state' attribute, so it
@@ -566,12 +620,13 @@ EAP_HANDLER *eaplist_find(rlm_eap_t *inst, REQUEST *request,
 	 *	Playing with a data structure shared among threads
 	 *	means that we need a lock, to avoid conflict.
 	 */
-	PTHREAD_MUTEX_LOCK(&(inst->session_mutex));
+	shard = eaplist_shard(inst, myHandler.state);
+	PTHREAD_MUTEX_LOCK(&(shard->mutex));
 
-	eaplist_expire(inst, request, request->timestamp);
+	eaplist_expire(inst, shard, request, request->timestamp);
 
-	handler = eaplist_delete(inst, request, &myHandler);
-	PTHREAD_MUTEX_UNLOCK(&(inst->session_mutex));
+	handler = eaplist_delete(inst, shard, request, &myHandler);
+	PTHREAD_MUTEX_UNLOCK(&(shard->mutex));
 
 	/*
 	 *	Might not have been there.
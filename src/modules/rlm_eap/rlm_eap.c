@@ -60,9 +60,16 @@ static int eap_detach(void *instance)
 	if (inst->handler_tree) pthread_mutex_destroy(&(inst->handler_mutex));
 #endif
 
-	rbtree_free(inst->session_tree);
+	for (i = 0; i < EAP_SESSION_SHARDS; i++) {
+		if (!inst->shards[i].tree) continue;
+
+#ifdef HAVE_PTHREAD_H
+		pthread_mutex_destroy(&(inst->shards[i].mutex));
+#endif
+		rbtree_free(inst->shards[i].tree);
+		inst->shards[i].tree = NULL;
+	}
 	if (inst->handler_tree) rbtree_free(inst->handler_tree);
-	inst->session_tree = NULL;
 	eaplist_free(inst);
 
 	for (i = 0; i < PW_EAP_MAX_TYPES; i++) {
@@ -236,11 +243,21 @@ static int eap_instantiate(CONF_SECTION *cs, void **instance)
 	 *	Lookup sessions in the tree.  We don't free them in
 	 *	the tree, as that's taken care of elsewhere...
 	 */
-	inst->session_tree = rbtree_create(eap_handler_cmp, NULL, 0);
-	if (!inst->session_tree) {
-		radlog(L_ERR|L_CONS, "rlm_eap: Cannot initialize tree");
-		eap_detach(inst);
-		return -1;
+	for (i = 0; i < EAP_SESSION_SHARDS; i++) {
+		inst->shards[i].tree = rbtree_create(eap_handler_cmp, NULL, 0);
+		if (!inst->shards[i].tree) {
+			radlog(L_ERR|L_CONS, "rlm_eap: Cannot initialize tree");
+			eap_detach(inst);
+			return -1;
+		}
+
+#ifdef HAVE_PTHREAD_H
+		if (pthread_mutex_init(&(inst->shards[i].mutex), NULL) < 0) {
+			radlog(L_ERR|L_CONS, "rlm_eap: Failed initializing mutex: %s", strerror(errno));
+			eap_detach(inst);
+			return -1;
+		}
+#endif
 	}
 
 	if (fr_debug_flag) {
@@ -42,15 +42,34 @@ typedef struct eap_types_t {
 	void		*type_data;
 } EAP_TYPES;
 
+/*
+ * The sessions are split across a number of shards, keyed by a hash
+ * of the State attribute.  Each shard has its own lock, so that
+ * concurrent EAP conversations don't serialize on one mutex.
+ *
+ * tree = sessions in this shard, in a tree for speed.
+ * head, tail = the same sessions, oldest first, for expiry.
+ */
+#define EAP_SESSION_SHARDS (16)
+
+typedef struct eap_session_shard_t {
+	rbtree_t	*tree;
+	EAP_HANDLER	*head, *tail;
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_t	mutex;
+#endif
+} eap_session_shard_t;
+
 /*
  * This structure contains eap's persistent data.
- * sessions = remembered sessions, in a tree for speed.
+ * shards = remembered sessions.
+ * num_sessions = number of sessions across all of the shards.
  * types = All supported EAP-Types
- * mutex = ensure only one thread is updating the sessions[] struct
+ * session_mutex = protects num_sessions and rand_pool
  */
 typedef struct rlm_eap_t {
-	rbtree_t	*session_tree;
-	EAP_HANDLER	*session_head, *session_tail;
+	eap_session_shard_t shards[EAP_SESSION_SHARDS];
+	int		num_sessions;
 	rbtree_t	*handler_tree; /* for debugging only */
 	EAP_TYPES 	*types[PW_EAP_MAX_TYPES + 1];
 
@@ -30,40 +30,112 @@ RCSID("$Id$")
 #include	<ctype.h>
 #include	<fcntl.h>
 #include	<limits.h>
+#include	<sys/stat.h>
+
+/*
+ *	The contents of one of the files.  Either the entries are in
+ *	a hash table, or the file was compiled by radusers, and the
+ *	entries are read from it as they're needed.
+ */
+typedef struct file_table_t {
+	fr_hash_table_t	*ht;
+	PAIR_DB		*db;
+	PAIR_LIST	*defaults;	/* the DEFAULT entries in "db" */
+	int		refs;		/* requests using it */
+	int		retired;	/* replaced, free when unused */
+} file_table_t;
+
+#ifdef HAVE_PTHREAD_H
+#include	<pthread.h>
+
+/*
+ *	What the file looked like when it was last read.
+ */
+typedef struct file_stamp_t {
+	time_t		mtime;
+	ino_t		ino;
+	off_t		size;
+} file_stamp_t;
+#endif
+
+#define FILE_TABLES_MAX (6)
 
 struct file_instance {
 	char *compat_mode;
+	int reload_interval;
 
 	char *key;
+	xlat_exp_t *key_exp;
 
 	/* autz */
 	char *usersfile;
-	fr_hash_table_t *users;
+	file_table_t *users;
 
 
 	/* authenticate */
 	char *auth_usersfile;
-	fr_hash_table_t *auth_users;
+	file_table_t *auth_users;
 
 	/* preacct */
 	char *acctusersfile;
-	fr_hash_table_t *acctusers;
+	file_table_t *acctusers;
 
 #ifdef WITH_PROXY
 	/* pre-proxy */
 	char *preproxy_usersfile;
-	fr_hash_table_t *preproxy_users;
+	file_table_t *preproxy_users;
 
 	/* post-proxy */
 	char *postproxy_usersfile;
-	fr_hash_table_t *postproxy_users;
+	file_table_t *postproxy_users;
 #endif
 
 	/* post-authenticate */
 	char *postauth_usersfile;
-	fr_hash_table_t *postauth_users;
+	file_table_t *postauth_users;
+
+#ifdef HAVE_PTHREAD_H
+	/*
+	 *	Re-reading the files in the background.
+	 */
+	file_stamp_t	stamp[FILE_TABLES_MAX];
+	pthread_t	reload_thread;
+	pthread_mutex_t	reload_mutex;
+	pthread_cond_t	reload_cond;
+	int		reload_running;
+	int		reload_stop;
+#endif
 };
 
+/*
+ *	The files, and the tables they are read into.
+ */
+static const struct {
+	size_t	filename;
+	size_t	table;
+} file_tables[FILE_TABLES_MAX + 1] = {
+	{ offsetof(struct file_instance, usersfile),
+	  offsetof(struct file_instance, users) },
+	{ offsetof(struct file_instance, acctusersfile),
+	  offsetof(struct file_instance, acctusers) },
+#ifdef WITH_PROXY
+	{ offsetof(struct file_instance, preproxy_usersfile),
+	  offsetof(struct file_instance, preproxy_users) },
+	{ offsetof(struct file_instance, postproxy_usersfile),
+	  offsetof(struct file_instance, postproxy_users) },
+#endif
+	{ offsetof(struct file_instance, auth_usersfile),
+	  offsetof(struct file_instance, auth_users) },
+	{ offsetof(struct file_instance, postauth_usersfile),
+	  offsetof(struct file_instance, postauth_users) },
+	{ 0, 0 }
+};
+
+#define FILE_NAME(_inst, _i) \
+	(*(char **) (((char *) (_inst)) + file_tables[_i].filename))
+#define FILE_TABLE(_inst, _i) \
+	(*(file_table_t **) (((char *) (_inst)) + file_tables[_i].table))
+
 
 /*
  *     See if a VALUE_PAIR list contains Fall-Through = Yes
@@ -95,6 +167,8 @@ static const CONF_PARSER module_config[] = {
 	  offsetof(struct file_instance,compat_mode), NULL, "cistron" },
 	{ "key",	   PW_TYPE_STRING_PTR,
 	  offsetof(struct file_instance,key), NULL, NULL },
+	{ "reload_interval", PW_TYPE_INTEGER,
+	  offsetof(struct file_instance,reload_interval), NULL, "0" },
 	{ NULL, -1, 0, NULL, NULL }
 };
 
@@ -117,6 +191,48 @@ static void my_pairlist_free(void *data)
 	pairlist_free(&pl);
 }
 
+static int pairlist_fixup(UNUSED void *ctx, UNUSED void *data)
+{
+	return 0;
+}
+
+
+/*
+ *	What an '=' in a check item should really be.  They should
+ *	be using '==' for on-the-wire RADIUS attributes, and probably
+ *	':=' for server configuration items.
+ */
+static FR_TOKEN check_item_op(const VALUE_PAIR *vp, int compat_mode)
+{
+	/*
+	 *	Ignore attributes which are set properly.
+	 */
+	if (vp->op != T_OP_EQ) return vp->op;
+
+	/*
+	 *	If it's a vendor attribute, or it's a wire protocol,
+	 *	ensure it has '=='.
+	 */
+	if ((vp->vendor != 0) || (vp->attribute < 0x100)) {
+		return T_OP_CMP_EQ;
+	}
+
+	if (!compat_mode) return vp->op;
+
+	/*
+	 *	Cistron Compatibility mode.
+	 *
+	 *	Non-wire attributes become +=, all others become ==
+	 */
+	if ((vp->attribute >= 0x100) &&
+	    (vp->attribute <= 0xffff) &&
+	    (vp->attribute != PW_HINT) &&
+	    (vp->attribute != PW_HUNTGROUP_NAME)) {
+		return T_OP_ADD;
+	}
+
+	return T_OP_CMP_EQ;
+}
 
 static int getusersfile(const char *filename, fr_hash_table_t **pht,
 			char *compat_mode_str)
@@ -166,63 +282,22 @@ static int getusersfile(const char *filename, fr_hash_table_t **pht,
 			 *	configuration items.
 			 */
 			for (vp = entry->check; vp != NULL; vp = vp->next) {
-				/*
-				 *	Ignore attributes which are set
-				 *	properly.
-				 */
-				if (vp->op != T_OP_EQ) {
-					continue;
-				}
+				FR_TOKEN op;
 
-				/*
-				 *	If it's a vendor attribute,
-				 *	or it's a wire protocol,
-				 *	ensure it has '=='.
-				 */
-				if ((vp->vendor != 0) ||
-						(vp->attribute < 0x100)) {
-					if (!compat_mode) {
-						DEBUG("[%s]:%d WARNING! Changing '%s =' to '%s =='\n\tfor comparing RADIUS attribute in check item list for user %s",
-								filename, entry->lineno,
-								vp->name, vp->name,
-								entry->name);
-					} else {
-						DEBUG("\tChanging '%s =' to '%s =='",
-								vp->name, vp->name);
-					}
-					vp->op = T_OP_CMP_EQ;
-					continue;
-				}
+				op = check_item_op(vp, compat_mode);
+				if (op == vp->op) continue;
 
-				/*
-				 *	Cistron Compatibility mode.
-				 *
-				 *	Re-write selected attributes
-				 *	to be '+=', instead of '='.
-				 *
-				 *	All others get set to '=='
-				 */
-				if (compat_mode) {
-					/*
-					 *	Non-wire attributes become +=
-					 *
-					 *	On the write attributes
-					 *	become ==
-					 */
-					if ((vp->attribute >= 0x100) &&
-							(vp->attribute <= 0xffff) &&
-							(vp->attribute != PW_HINT) &&
-							(vp->attribute != PW_HUNTGROUP_NAME)) {
-						DEBUG("\tChanging '%s =' to '%s +='",
-								vp->name, vp->name);
-						vp->op = T_OP_ADD;
-					} else {
-						DEBUG("\tChanging '%s =' to '%s =='",
-								vp->name, vp->name);
-						vp->op = T_OP_CMP_EQ;
-					}
+				if (!compat_mode) {
+					DEBUG("[%s]:%d WARNING! Changing '%s =' to '%s =='\n\tfor comparing RADIUS attribute in check item list for user %s",
+							filename, entry->lineno,
+							vp->name, vp->name,
+							entry->name);
+				} else {
+					DEBUG("\tChanging '%s =' to '%s %s'",
+							vp->name, vp->name,
+							(op == T_OP_ADD) ? "+=" : "==");
 				}
-
+				vp->op = op;
 			} /* end of loop over check items */
 
 			/*
@@ -311,25 +386,262 @@ static int getusersfile(const char *filename, fr_hash_table_t **pht,
 	}
 
 	fr_hash_table_free(tailht);
+
+	/*
+	 *	Fill in all of the hash buckets now.  Otherwise
+	 *	lookups do it, and lookups may be done by many
+	 *	threads at once.
+	 */
+	fr_hash_table_walk(ht, pairlist_fixup, NULL);
+
 	*pht = ht;
 
 	return 0;
 }
 
+/*
+ *	Entries from a compiled file get the same changes as
+ *	getusersfile() makes, but without the warnings.  radusers
+ *	doesn't print them either, and printing them here would
+ *	repeat them for every lookup.  To see them, load the text
+ *	file in debugging mode.
+ */
+static void file_db_fixup(PAIR_LIST *entry, const char *compat_mode_str)
+{
+	int compat_mode;
+	VALUE_PAIR *vp;
+
+	compat_mode = (strcmp(compat_mode_str, "cistron") == 0);
+	if (!debug_flag && !compat_mode) return;
+
+	for (; entry != NULL; entry = entry->next) {
+		for (vp = entry->check; vp != NULL; vp = vp->next) {
+			vp->op = check_item_op(vp, compat_mode);
+		}
+	}
+}
+
+static void file_table_free(file_table_t **ptable)
+{
+	file_table_t *table = *ptable;
+
+	if (!table) return;
+
+	fr_hash_table_free(table->ht);
+	pairlist_free(&table->defaults);
+	pairlist_db_close(&table->db);
+	free(table);
+	*ptable = NULL;
+}
+
+/*
+ *	Read a users file, or open a compiled one.
+ */
+static int file_table_read(const char *filename, file_table_t **ptable,
+			   char *compat_mode_str)
+{
+	int rcode;
+	file_table_t *table;
+
+	*ptable = NULL;
+	if (!filename) return 0;
+
+	table = rad_malloc(sizeof(*table));
+	memset(table, 0, sizeof(*table));
+
+	rcode = pairlist_db_open(filename, &table->db);
+	if (rcode < 0) {
+		free(table);
+		return -1;
+	}
+
+	/*
+	 *	The DEFAULT entries are checked for every request, so
+	 *	they're decoded once, here.
+	 */
+	if (rcode > 0) {
+		table->defaults = pairlist_db_find(table->db, "DEFAULT");
+		file_db_fixup(table->defaults, compat_mode_str);
+
+		*ptable = table;
+		return 0;
+	}
+
+	if (getusersfile(filename, &table->ht, compat_mode_str) < 0) {
+		free(table);
+		return -1;
+	}
+
+	*ptable = table;
+	return 0;
+}
+
+#ifdef HAVE_PTHREAD_H
+static int file_stamp(const char *filename, file_stamp_t *stamp)
+{
+	struct stat buf;
+
+	if (stat(filename, &buf) < 0) return -1;
+
+	stamp->mtime = buf.st_mtime;
+	stamp->ino = buf.st_ino;
+	stamp->size = buf.st_size;
+
+	return 0;
+}
+
+/*
+ *	Get the current table, and stop it from being freed while
+ *	we're using it.
+ */
+static file_table_t *file_table_get(struct file_instance *inst,
+				    file_table_t **ptable)
+{
+	file_table_t *table;
+
+	if (!inst->reload_running) return *ptable;
+
+	pthread_mutex_lock(&inst->reload_mutex);
+	table = *ptable;
+	if (table) table->refs++;
+	pthread_mutex_unlock(&inst->reload_mutex);
+
+	return table;
+}
+
+/*
+ *	Free the table if it's been replaced, and we're the last
+ *	request using it.
+ */
+static void file_table_release(struct file_instance *inst,
+			       file_table_t *table)
+{
+	int free_it;
+
+	if (!inst->reload_running || !table) return;
+
+	pthread_mutex_lock(&inst->reload_mutex);
+	table->refs--;
+	free_it = (table->retired && (table->refs == 0));
+	pthread_mutex_unlock(&inst->reload_mutex);
+
+	if (free_it) file_table_free(&table);
+}
+
+/*
+ *	Re-read the files which have changed, and swap in the new
+ *	tables.  Only the files named in the configuration are
+ *	checked, not the ones they $INCLUDE.  Requests never wait for this.  They see either the
+ *	old table or the new one, and the old one is freed by the last
+ *	request using it.
+ */
+static void file_reload(struct file_instance *inst)
+{
+	int i, free_it;
+	char *filename;
+	file_stamp_t stamp;
+	file_table_t *table, *old;
+
+	for (i = 0; file_tables[i].filename != 0; i++) {
+		filename = FILE_NAME(inst, i);
+		if (!filename) continue;
+
+		/*
+		 *	It may be in the middle of being replaced.
+		 *	Keep using the old data.
+		 */
+		if (file_stamp(filename, &stamp) < 0) continue;
+
+		if ((stamp.mtime == inst->stamp[i].mtime) &&
+		    (stamp.ino == inst->stamp[i].ino) &&
+		    (stamp.size == inst->stamp[i].size)) continue;
+
+		inst->stamp[i] = stamp;
+
+		radlog(L_INFO, "rlm_files: Re-reading %s", filename);
+
+		if (file_table_read(filename, &table, inst->compat_mode) < 0) {
+			radlog(L_ERR, "rlm_files: Errors reading %s.  Continuing with the old data.",
+			       filename);
+			continue;
+		}
+
+		/*
+		 *	The lock ensures that the new table is
+		 *	written to memory before it's published.
+		 */
+		pthread_mutex_lock(&inst->reload_mutex);
+		old = FILE_TABLE(inst, i);
+		FILE_TABLE(inst, i) = table;
+
+		free_it = FALSE;
+		if (old) {
+			old->retired = TRUE;
+			free_it = (old->refs == 0);
+		}
+		pthread_mutex_unlock(&inst->reload_mutex);
+
+		if (free_it) file_table_free(&old);
+	}
+}
+
+static void *file_reload_thread(void *arg)
+{
+	struct file_instance *inst = arg;
+	struct timespec when;
+
+	pthread_mutex_lock(&inst->reload_mutex);
+
+	while (!inst->reload_stop) {
+		when.tv_sec = time(NULL) + inst->reload_interval;
+		when.tv_nsec = 0;
+		pthread_cond_timedwait(&inst->reload_cond,
+				       &inst->reload_mutex, &when);
+		if (inst->reload_stop) break;
+
+		pthread_mutex_unlock(&inst->reload_mutex);
+		file_reload(inst);
+		pthread_mutex_lock(&inst->reload_mutex);
+	}
+
+	pthread_mutex_unlock(&inst->reload_mutex);
+
+	return NULL;
+}
+#else
+#define file_table_get(_inst, _ptable) (*(_ptable))
+#define file_table_release(_inst, _table)
+#endif
+
 /*
  *	Clean up.
  */
 static int file_detach(void *instance)
 {
 	struct file_instance *inst = instance;
-	fr_hash_table_free(inst->users);
-	fr_hash_table_free(inst->acctusers);
+
+#ifdef HAVE_PTHREAD_H
+	if (inst->reload_running) {
+		pthread_mutex_lock(&inst->reload_mutex);
+		inst->reload_stop = TRUE;
+		pthread_cond_signal(&inst->reload_cond);
+		pthread_mutex_unlock(&inst->reload_mutex);
+
+		pthread_join(inst->reload_thread, NULL);
+		pthread_cond_destroy(&inst->reload_cond);
+		pthread_mutex_destroy(&inst->reload_mutex);
+	}
+#endif
+
+	file_table_free(&inst->users);
+	file_table_free(&inst->acctusers);
 #ifdef WITH_PROXY
-	fr_hash_table_free(inst->preproxy_users);
-	fr_hash_table_free(inst->postproxy_users);
+	file_table_free(&inst->preproxy_users);
+	file_table_free(&inst->postproxy_users);
 #endif
-	fr_hash_table_free(inst->auth_users);
-	fr_hash_table_free(inst->postauth_users);
+	file_table_free(&inst->auth_users);
+	file_table_free(&inst->postauth_users);
+	radius_xlat_exp_free(&inst->key_exp);
 	free(inst);
 	return 0;
 }
@@ -355,14 +667,33 @@ static int file_instantiate(CONF_SECTION *conf, void **instance)
 		return -1;
 	}
 
-	rcode = getusersfile(inst->usersfile, &inst->users, inst->compat_mode);
+	inst->key_exp = radius_xlat_compile(inst->key);
+
+#ifdef HAVE_PTHREAD_H
+	/*
+	 *	Remember what the files looked like before reading
+	 *	them, so that changes made while they're being read
+	 *	are picked up later.
+	 */
+	if (inst->reload_interval > 0) {
+		int i;
+
+		for (i = 0; file_tables[i].filename != 0; i++) {
+			if (!FILE_NAME(inst, i)) continue;
+
+			file_stamp(FILE_NAME(inst, i), &inst->stamp[i]);
+		}
+	}
+#endif
+
+	rcode = file_table_read(inst->usersfile, &inst->users, inst->compat_mode);
 	if (rcode != 0) {
 	  radlog(L_ERR|L_CONS, "Errors reading %s", inst->usersfile);
 		file_detach(inst);
 		return -1;
 	}
 
-	rcode = getusersfile(inst->acctusersfile, &inst->acctusers, inst->compat_mode);
+	rcode = file_table_read(inst->acctusersfile, &inst->acctusers, inst->compat_mode);
 	if (rcode != 0) {
 		radlog(L_ERR|L_CONS, "Errors reading %s", inst->acctusersfile);
 		file_detach(inst);
@@ -373,14 +704,14 @@ static int file_instantiate(CONF_SECTION *conf, void **instance)
 	/*
 	 *  Get the pre-proxy stuff
 	 */
-	rcode = getusersfile(inst->preproxy_usersfile, &inst->preproxy_users, inst->compat_mode);
+	rcode = file_table_read(inst->preproxy_usersfile, &inst->preproxy_users, inst->compat_mode);
 	if (rcode != 0) {
 		radlog(L_ERR|L_CONS, "Errors reading %s", inst->preproxy_usersfile);
 		file_detach(inst);
 		return -1;
 	}
 
-	rcode = getusersfile(inst->postproxy_usersfile, &inst->postproxy_users, inst->compat_mode);
+	rcode = file_table_read(inst->postproxy_usersfile, &inst->postproxy_users, inst->compat_mode);
 	if (rcode != 0) {
 		radlog(L_ERR|L_CONS, "Errors reading %s", inst->postproxy_usersfile);
 		file_detach(inst);
@@ -388,29 +719,55 @@ static int file_instantiate(CONF_SECTION *conf, void **instance)
 	}
 #endif
 
-	rcode = getusersfile(inst->auth_usersfile, &inst->auth_users, inst->compat_mode);
+	rcode = file_table_read(inst->auth_usersfile, &inst->auth_users, inst->compat_mode);
 	if (rcode != 0) {
 		radlog(L_ERR|L_CONS, "Errors reading %s", inst->auth_usersfile);
 		file_detach(inst);
 		return -1;
 	}
 
-	rcode = getusersfile(inst->postauth_usersfile, &inst->postauth_users, inst->compat_mode);
+	rcode = file_table_read(inst->postauth_usersfile, &inst->postauth_users, inst->compat_mode);
 	if (rcode != 0) {
 		radlog(L_ERR|L_CONS, "Errors reading %s", inst->postauth_usersfile);
 		file_detach(inst);
 		return -1;
 	}
 
+	if (inst->reload_interval > 0) {
+#ifdef HAVE_PTHREAD_H
+		pthread_mutex_init(&inst->reload_mutex, NULL);
+		pthread_cond_init(&inst->reload_cond, NULL);
+
+		rcode = pthread_create(&inst->reload_thread, NULL,
+				       file_reload_thread, inst);
+		if (rcode != 0) {
+			radlog(L_ERR, "rlm_files: Failed creating thread to re-read files: %s",
+			       strerror(rcode));
+			pthread_cond_destroy(&inst->reload_cond);
+			pthread_mutex_destroy(&inst->reload_mutex);
+			file_detach(inst);
+			return -1;
+		}
+		inst->reload_running = TRUE;
+#else
+		radlog(L_INFO, "rlm_files: Ignoring reload_interval, as the server was built without threads");
+		inst->reload_interval = 0;
+#endif
+	}
+
 	*instance = inst;
 	return 0;
 }
 
 /*
  *	Common code called by everything below.
+ *
+ *	With "reload_interval", the table may be replaced at any time.
+ *	We hold a reference to the one we started with until we're
+ *	done with it.
  */
 static rlm_rcode_t file_common(struct file_instance *inst, REQUEST *request,
-		       const char *filename, fr_hash_table_t *ht,
+		       const char *filename, file_table_t **ptable,
 		       VALUE_PAIR *request_pairs, VALUE_PAIR **reply_pairs)
 {
 	const char	*name, *match;
@@ -420,7 +777,9 @@ static rlm_rcode_t file_common(struct file_instance *inst, REQUEST *request,
 	const PAIR_LIST	*user_pl, *default_pl;
 	int		found = 0;
 	PAIR_LIST	my_pl;
+	PAIR_LIST	*user_list = NULL;
 	char		buffer[256];
+	file_table_t	*table;
 
 	if (!inst->key) {
 		VALUE_PAIR	*namepair;
@@ -430,20 +789,29 @@ static rlm_rcode_t file_common(struct file_instance *inst, REQUEST *request,
 	} else {
 		int len;
 
-		len = radius_xlat(buffer, sizeof(buffer), inst->key,
-				  request, NULL, NULL);
+		len = radius_xlat_exp(buffer, sizeof(buffer), inst->key_exp,
+				      request, NULL, NULL);
 		if (len) name = buffer;
 		else name = "NONE";
 	}
 
 	config_pairs = &request->config_items;
 
-	if (!ht) return RLM_MODULE_NOOP;
+	table = file_table_get(inst, ptable);
+	if (!table) return RLM_MODULE_NOOP;
 
-	my_pl.name = name;
-	user_pl = fr_hash_table_finddata(ht, &my_pl);
-	my_pl.name = "DEFAULT";
-	default_pl = fr_hash_table_finddata(ht, &my_pl);
+	if (table->db) {
+		user_list = pairlist_db_find(table->db, name);
+		file_db_fixup(user_list, inst->compat_mode);
+
+		user_pl = user_list;
+		default_pl = table->defaults;
+	} else {
+		my_pl.name = name;
+		user_pl = fr_hash_table_finddata(table->ht, &my_pl);
+		my_pl.name = "DEFAULT";
+		default_pl = fr_hash_table_finddata(table->ht, &my_pl);
+	}
 
 	/*
 	 *	Find the entry for the user.
@@ -491,6 +859,9 @@ static rlm_rcode_t file_common(struct file_instance *inst, REQUEST *request,
 		}
 	}
 
+	pairlist_free(&user_list);
+	file_table_release(inst, table);
+
 	/*
 	 *	Remove server internal parameters.
 	 */
@@ -517,7 +888,7 @@ static rlm_rcode_t file_authorize(void *instance, REQUEST *request)
 {
 	struct file_instance *inst = instance;
 
-	return file_common(inst, request, "users", inst->users,
+	return file_common(inst, request, "users", &inst->users,
 			   request->packet->vps, &request->reply->vps);
 }
 
@@ -531,7 +902,7 @@ static rlm_rcode_t file_preacct(void *instance, REQUEST *request)
 {
 	struct file_instance *inst = instance;
 
-	return file_common(inst, request, "acct_users", inst->acctusers,
+	return file_common(inst, request, "acct_users", &inst->acctusers,
 			   request->packet->vps, &request->reply->vps);
 }
 
@@ -541,7 +912,7 @@ static rlm_rcode_t file_preproxy(void *instance, REQUEST *request)
 	struct file_instance *inst = instance;
 
 	return file_common(inst, request, "preproxy_users",
-			   inst->preproxy_users,
+			   &inst->preproxy_users,
 			   request->packet->vps, &request->proxy->vps);
 }
 
@@ -550,7 +921,7 @@ static rlm_rcode_t file_postproxy(void *instance, REQUEST *request)
 	struct file_instance *inst = instance;
 
 	return file_common(inst, request, "postproxy_users",
-			   inst->postproxy_users,
+			   &inst->postproxy_users,
 			   request->proxy_reply->vps, &request->reply->vps);
 }
 #endif
@@ -560,7 +931,7 @@ static rlm_rcode_t file_authenticate(void *instance, REQUEST *request)
 	struct file_instance *inst = instance;
 
 	return file_common(inst, request, "auth_users",
-			   inst->auth_users,
+			   &inst->auth_users,
 			   request->packet->vps, &request->reply->vps);
 }
 
@@ -569,7 +940,7 @@ static rlm_rcode_t file_postauth(void *instance, REQUEST *request)
 	struct file_instance *inst = instance;
 
 	return file_common(inst, request, "postauth_users",
-			   inst->postauth_users,
+			   &inst->postauth_users,
 			   request->packet->vps, &request->reply->vps);
 }
 
@@ -59,6 +59,8 @@ RCSID("$Id$")
  *	a lot cleaner to do so, and a pointer to the structure can
  *	be used as the instance handle.
  */
+typedef struct ippool_lease ippool_lease;
+
 typedef struct rlm_ippool_t {
 	char *session_db;
 	char *ip_index;
@@ -72,6 +74,11 @@ typedef struct rlm_ippool_t {
 	int override;
 	GDBM_FILE gdbm;
 	GDBM_FILE ip;
+	fr_hash_table_t *leases;	/* all session entries, by key */
+	fr_hash_table_t *clis;		/* active entries, by caller id */
+	fr_hash_table_t *busy;		/* inactive entries, by ip still in use */
+	ippool_lease *free_head;	/* inactive entries, oldest first */
+	ippool_lease *free_tail;
 #ifdef HAVE_PTHREAD_H
 	pthread_mutex_t op_mutex;
 #endif
@@ -100,6 +107,27 @@ typedef struct ippool_key {
 	char key[16];
 } ippool_key;
 
+/*
+ *	In-memory index of the session database, so that we don't
+ *	have to walk the whole database to find a free entry, or an
+ *	active entry for a caller id.  It's kept in sync by
+ *	ippool_store() and ippool_delete(), and is only a hint:
+ *	every entry it returns is re-read from the database and
+ *	checked before being used.
+ */
+struct ippool_lease {
+	ippool_key	key;
+	char		cli[32];
+	int		active;
+	int		on_free;
+	int		on_busy;
+	uint32_t	ipaddr;		/* only valid if on_busy */
+	ippool_lease	*free_prev;
+	ippool_lease	*free_next;
+	ippool_lease	*cli_next;	/* other active entries with this cli */
+	ippool_lease	*busy_next;	/* other busy entries with this ip */
+};
+
 /*
  *	A mapping of configuration file names to internal variables.
  *
@@ -122,6 +150,392 @@ static const CONF_PARSER module_config[] = {
   { NULL, -1, 0, NULL, NULL }
 };
 
+static uint32_t lease_hash(const void *data)
+{
+	const ippool_lease *lease = data;
+
+	return fr_hash(lease->key.key, sizeof(lease->key.key));
+}
+
+static int lease_cmp(const void *one, const void *two)
+{
+	const ippool_lease *a = one;
+	const ippool_lease *b = two;
+
+	return memcmp(a->key.key, b->key.key, sizeof(a->key.key));
+}
+
+static uint32_t lease_cli_hash(const void *data)
+{
+	const ippool_lease *lease = data;
+
+	return fr_hash_string(lease->cli);
+}
+
+static int lease_cli_cmp(const void *one, const void *two)
+{
+	const ippool_lease *a = one;
+	const ippool_lease *b = two;
+
+	return strcmp(a->cli, b->cli);
+}
+
+static uint32_t lease_busy_hash(const void *data)
+{
+	const ippool_lease *lease = data;
+
+	return fr_hash(&lease->ipaddr, sizeof(lease->ipaddr));
+}
+
+static int lease_busy_cmp(const void *one, const void *two)
+{
+	const ippool_lease *a = one;
+	const ippool_lease *b = two;
+
+	if (a->ipaddr < b->ipaddr) return -1;
+	if (a->ipaddr > b->ipaddr) return +1;
+	return 0;
+}
+
+/*
+ *	Remove a lease from a chain of leases hanging off of a hash
+ *	table entry.
+ */
+static void ippool_index_chain_remove(fr_hash_table_t *ht, ippool_lease *lease,
+				      size_t offset)
+{
+	ippool_lease *head, *prev, **next;
+
+#define NEXT(_x) ((ippool_lease **) (((char *) (_x)) + offset))
+	head = fr_hash_table_finddata(ht, lease);
+	if (head == lease) {
+		fr_hash_table_yank(ht, lease);
+		if (*NEXT(lease)) {
+			fr_hash_table_insert(ht, *NEXT(lease));
+		}
+	} else if (head) {
+		for (prev = head; *(next = NEXT(prev)) != NULL; prev = *next) {
+			if (*next == lease) {
+				*next = *NEXT(lease);
+				break;
+			}
+		}
+	}
+	*NEXT(lease) = NULL;
+#undef NEXT
+}
+
+/*
+ *	Remove a lease from the free list, the busy table, or the
+ *	caller id table, whichever it's in.
+ */
+static void ippool_index_unlink(rlm_ippool_t *data, ippool_lease *lease)
+{
+	if (lease->on_free) {
+		if (lease->free_prev) {
+			lease->free_prev->free_next = lease->free_next;
+		} else {
+			data->free_head = lease->free_next;
+		}
+		if (lease->free_next) {
+			lease->free_next->free_prev = lease->free_prev;
+		} else {
+			data->free_tail = lease->free_prev;
+		}
+		lease->free_prev = lease->free_next = NULL;
+		lease->on_free = 0;
+	}
+
+	if (lease->on_busy) {
+		ippool_index_chain_remove(data->busy, lease,
+					  offsetof(ippool_lease, busy_next));
+		lease->on_busy = 0;
+	}
+
+	if (!lease->active) return;
+
+	ippool_index_chain_remove(data->clis, lease,
+				  offsetof(ippool_lease, cli_next));
+	lease->active = 0;
+}
+
+/*
+ *	Put an unlinked lease at the tail of the free list.
+ */
+static void ippool_index_free_append(rlm_ippool_t *data, ippool_lease *lease)
+{
+	lease->free_prev = data->free_tail;
+	if (data->free_tail) {
+		data->free_tail->free_next = lease;
+	} else {
+		data->free_head = lease;
+	}
+	data->free_tail = lease;
+	lease->on_free = 1;
+}
+
+/*
+ *	Move an inactive lease whose IP address is still in use by
+ *	another nas/port entry off of the free list, so that we don't
+ *	keep re-checking it on every allocation.
+ */
+static void ippool_index_busy(rlm_ippool_t *data, ippool_lease *lease,
+			      uint32_t ipaddr)
+{
+	ippool_lease *head;
+
+	ippool_index_unlink(data, lease);
+
+	lease->ipaddr = ipaddr;
+	lease->on_busy = 1;
+
+	head = fr_hash_table_finddata(data->busy, lease);
+	if (head) {
+		lease->busy_next = head->busy_next;
+		head->busy_next = lease;
+	} else {
+		fr_hash_table_insert(data->busy, lease);
+	}
+}
+
+/*
+ *	The IP address is no longer in use.  Put the inactive leases
+ *	which were waiting for it back on the free list.
+ */
+static void ippool_index_release(rlm_ippool_t *data, uint32_t ipaddr)
+{
+	ippool_lease my_lease, *lease, *next;
+
+	my_lease.ipaddr = ipaddr;
+	lease = fr_hash_table_finddata(data->busy, &my_lease);
+	if (!lease) return;
+
+	fr_hash_table_yank(data->busy, lease);
+	while (lease) {
+		next = lease->busy_next;
+		lease->busy_next = NULL;
+		lease->on_busy = 0;
+		ippool_index_free_append(data, lease);
+		lease = next;
+	}
+}
+
+/*
+ *	Update the index after a session entry has been written.
+ */
+static void ippool_index_update(rlm_ippool_t *data, const ippool_key *key,
+				const ippool_info *entry)
+{
+	ippool_lease my_lease, *lease, *head;
+
+	memcpy(&my_lease.key, key, sizeof(my_lease.key));
+	lease = fr_hash_table_finddata(data->leases, &my_lease);
+	if (!lease) {
+		lease = rad_malloc(sizeof(*lease));
+		memset(lease, 0, sizeof(*lease));
+		memcpy(&lease->key, key, sizeof(lease->key));
+
+		if (!fr_hash_table_insert(data->leases, lease)) {
+			free(lease);
+			return;
+		}
+	}
+
+	ippool_index_unlink(data, lease);
+
+	if (!entry->active) {
+		ippool_index_free_append(data, lease);
+		return;
+	}
+
+	memcpy(lease->cli, entry->cli, sizeof(lease->cli));
+	lease->cli[sizeof(lease->cli) - 1] = '\0';
+	lease->active = 1;
+
+	head = fr_hash_table_finddata(data->clis, lease);
+	if (head) {
+		lease->cli_next = head->cli_next;
+		head->cli_next = lease;
+	} else {
+		fr_hash_table_insert(data->clis, lease);
+	}
+}
+
+/*
+ *	Update the index after a session entry has been deleted.
+ */
+static void ippool_index_delete(rlm_ippool_t *data, const ippool_key *key)
+{
+	ippool_lease my_lease, *lease;
+
+	memcpy(&my_lease.key, key, sizeof(my_lease.key));
+	lease = fr_hash_table_finddata(data->leases, &my_lease);
+	if (!lease) return;
+
+	ippool_index_unlink(data, lease);
+	fr_hash_table_delete(data->leases, lease);
+}
+
+/*
+ *	Read the entry for an indexed lease from the session database.
+ *	On success, key_datum points to a malloc'd copy of the key,
+ *	just like gdbm_firstkey() would return.
+ */
+static int ippool_index_fetch(rlm_ippool_t *data, const ippool_lease *lease,
+			      datum *key_datum, ippool_info *entry)
+{
+	datum data_datum;
+
+	key_datum->dsize = sizeof(ippool_key);
+	key_datum->dptr = rad_malloc(sizeof(ippool_key));
+	memcpy(key_datum->dptr, &lease->key, sizeof(ippool_key));
+
+	data_datum = gdbm_fetch(data->gdbm, *key_datum);
+	if (!data_datum.dptr) {
+		free(key_datum->dptr);
+		key_datum->dptr = NULL;
+		return 0;
+	}
+
+	memcpy(entry, data_datum.dptr, sizeof(*entry));
+	free(data_datum.dptr);
+
+	return 1;
+}
+
+/*
+ *	Find an active entry with the given caller id, for MPPP.
+ */
+static datum ippool_index_find_cli(rlm_ippool_t *data, const char *cli,
+				   ippool_info *entry)
+{
+	ippool_lease my_lease, *lease;
+	datum key_datum;
+
+	key_datum.dptr = NULL;
+	key_datum.dsize = 0;
+
+	if (strlen(cli) >= sizeof(my_lease.cli)) return key_datum;
+	strlcpy(my_lease.cli, cli, sizeof(my_lease.cli));
+
+	for (lease = fr_hash_table_finddata(data->clis, &my_lease);
+	     lease != NULL;
+	     lease = lease->cli_next) {
+		if (!ippool_index_fetch(data, lease, &key_datum, entry)) continue;
+
+		if (entry->active && (strcmp(entry->cli, cli) == 0)) break;
+
+		free(key_datum.dptr);
+		key_datum.dptr = NULL;
+	}
+
+	return key_datum;
+}
+
+/*
+ *	Find an inactive entry whose IP address isn't still in use by
+ *	another nas/port entry.  Inactive entries are used oldest first.
+ *
+ *	Entries which can't be used are taken off of the free list as
+ *	we go, so that the next allocation doesn't have to skip them
+ *	again.  Entries which have gone away are dropped, entries which
+ *	are really active are moved to the caller id table, and entries
+ *	whose IP address is still in use wait in the busy table until
+ *	ippool_index_release() is called for that IP address.
+ */
+static datum ippool_index_find_free(rlm_ippool_t *data, ippool_info *entry)
+{
+	int num;
+	ippool_lease *lease, *next;
+	datum key_datum, data_datum, tmp;
+
+	key_datum.dptr = NULL;
+	key_datum.dsize = 0;
+
+	for (lease = data->free_head; lease != NULL; lease = next) {
+		next = lease->free_next;
+
+		if (!ippool_index_fetch(data, lease, &key_datum, entry)) {
+			ippool_index_unlink(data, lease);
+			fr_hash_table_delete(data->leases, lease);
+			continue;
+		}
+
+		if (entry->active) {
+			ippool_index_update(data, &lease->key, entry);
+
+		} else {
+			tmp.dptr = (char *) &entry->ipaddr;
+			tmp.dsize = sizeof(uint32_t);
+			data_datum = gdbm_fetch(data->ip, tmp);
+			if (!data_datum.dptr) break;
+
+			memcpy(&num, data_datum.dptr, sizeof(int));
+			free(data_datum.dptr);
+			if (num == 0) break;
+
+			ippool_index_busy(data, lease, entry->ipaddr);
+		}
+
+		free(key_datum.dptr);
+		key_datum.dptr = NULL;
+	}
+
+	return key_datum;
+}
+
+/*
+ *	Build the index from the session database.
+ */
+static void ippool_index_build(rlm_ippool_t *data)
+{
+	ippool_info entry;
+	datum key_datum, data_datum, nextkey;
+
+	key_datum = gdbm_firstkey(data->gdbm);
+	while (key_datum.dptr) {
+		if (key_datum.dsize == sizeof(ippool_key)) {
+			data_datum = gdbm_fetch(data->gdbm, key_datum);
+			if (data_datum.dptr) {
+				memcpy(&entry, data_datum.dptr, sizeof(entry));
+				free(data_datum.dptr);
+				ippool_index_update(data, (ippool_key *) key_datum.dptr,
+						    &entry);
+			}
+		}
+		nextkey = gdbm_nextkey(data->gdbm, key_datum);
+		free(key_datum.dptr);
+		key_datum = nextkey;
+	}
+}
+
+/*
+ *	Write a session entry, and update the index.
+ */
+static int ippool_store(rlm_ippool_t *data, datum key_datum, datum data_datum)
+{
+	int rcode;
+	ippool_info entry;
+
+	rcode = gdbm_store(data->gdbm, key_datum, data_datum, GDBM_REPLACE);
+	if (rcode < 0) return rcode;
+
+	memcpy(&entry, data_datum.dptr, sizeof(entry));
+	ippool_index_update(data, (ippool_key *) key_datum.dptr, &entry);
+
+	return rcode;
+}
+
+/*
+ *	Delete a session entry, and update the index.
+ */
+static int ippool_delete(rlm_ippool_t *data, datum key_datum)
+{
+	ippool_index_delete(data, (ippool_key *) key_datum.dptr);
+
+	return gdbm_delete(data->gdbm, key_datum);
+}
+
 /*
  *	Do any per-module initialization that is separate to each
  *	configured instance of the module.  e.g. set up connections
@@ -259,6 +673,21 @@ static int ippool_instantiate(CONF_SECTION *conf, void **instance)
 	else
 		free(key_datum.dptr);
 
+	data->leases = fr_hash_table_create(lease_hash, lease_cmp, free);
+	data->clis = fr_hash_table_create(lease_cli_hash, lease_cli_cmp, NULL);
+	data->busy = fr_hash_table_create(lease_busy_hash, lease_busy_cmp, NULL);
+	if (!data->leases || !data->clis || !data->busy) {
+		radlog(L_ERR, "rlm_ippool: Failed creating session index");
+		fr_hash_table_free(data->leases);
+		fr_hash_table_free(data->clis);
+		fr_hash_table_free(data->busy);
+		gdbm_close(data->gdbm);
+		gdbm_close(data->ip);
+		free(data);
+		return -1;
+	}
+	ippool_index_build(data);
+
 	/* Add the ip pool name */
 	data->name = NULL;
 	pool_name = cf_section_name2(conf);
@@ -351,7 +780,7 @@ static rlm_rcode_t ippool_accounting(void *instance, REQUEST *request)
 		data_datum.dptr = (char *) &entry;
 		data_datum.dsize = sizeof(ippool_info);
 
-		rcode = gdbm_store(data->gdbm, key_datum, data_datum, GDBM_REPLACE);
+		rcode = ippool_store(data, key_datum, data_datum);
 		if (rcode < 0) {
 			radlog(L_ERR, "rlm_ippool: Failed storing data to %s: %s",
 					data->session_db, gdbm_strerror(gdbm_errno));
@@ -380,13 +809,14 @@ static rlm_rcode_t ippool_accounting(void *instance, REQUEST *request)
 					pthread_mutex_unlock(&data->op_mutex);
 					return RLM_MODULE_FAIL;
 				}
+				if (num == 0) ippool_index_release(data, entry.ipaddr);
 				if (num >0 && entry.extra == 1){
 					/*
 					 * We are doing MPPP and we still have nas/port entries referencing
 					 * this ip. Delete this entry so that eventually we only keep one
 					 * reference to this ip.
 					 */
-					gdbm_delete(data->gdbm,save_datum);
+					ippool_delete(data, save_datum);
 				}
 			}
 		}
@@ -503,7 +933,7 @@ static rlm_rcode_t ippool_postauth(void *instance, REQUEST *request)
 			data_datum.dptr = (char *) &entry;
 			data_datum.dsize = sizeof(ippool_info);
 
-			rcode = gdbm_store(data->gdbm, key_datum, data_datum, GDBM_REPLACE);
+			rcode = ippool_store(data, key_datum, data_datum);
 			if (rcode < 0) {
 				radlog(L_ERR, "rlm_ippool: Failed storing data to %s: %s",
 					data->session_db, gdbm_strerror(gdbm_errno));
@@ -530,13 +960,14 @@ static rlm_rcode_t ippool_postauth(void *instance, REQUEST *request)
 						pthread_mutex_unlock(&data->op_mutex);
 						return RLM_MODULE_FAIL;
 					}
+					if (num == 0) ippool_index_release(data, entry.ipaddr);
 					if (num >0 && entry.extra == 1){
 						/*
 						 * We are doing MPPP and we still have nas/port entries referencing
 						 * this ip. Delete this entry so that eventually we only keep one
 						 * reference to this ip.
 						 */
-						gdbm_delete(data->gdbm,save_datum);
+						ippool_delete(data, save_datum);
 					}
 				}
 			}
@@ -563,34 +994,28 @@ static rlm_rcode_t ippool_postauth(void *instance, REQUEST *request)
 	}
 
 	/*
-	 * Walk through the database searching for an active=0 entry.
+	 * Search for an active=0 entry.
 	 * We search twice. Once to see if we have an active entry with the same callerid
 	 * so that MPPP can work ok and then once again to find a free entry.
+	 * Both searches use the in-memory index.  Only if there are no inactive
+	 * entries do we walk the database, looking for one which has expired.
 	 */
 
 	pthread_mutex_lock(&data->op_mutex);
 
 	key_datum.dptr = NULL;
 	if (cli != NULL){
-		key_datum = gdbm_firstkey(data->gdbm);
-		while(key_datum.dptr){
-			data_datum = gdbm_fetch(data->gdbm, key_datum);
-			if (data_datum.dptr){
-				memcpy(&entry,data_datum.dptr, sizeof(ippool_info));
-				free(data_datum.dptr);
-				/*
-		 		* If we find an entry for the same caller-id with active=1
-		 		* then we use that for multilink (MPPP) to work properly.
-		 		*/
-				if (strcmp(entry.cli,cli) == 0 && entry.active){
-					mppp = 1;
-					break;
-				}
-			}
-			nextkey = gdbm_nextkey(data->gdbm, key_datum);
-			free(key_datum.dptr);
-			key_datum = nextkey;
-		}
+		/*
+		 * If we find an entry for the same caller-id with active=1
+		 * then we use that for multilink (MPPP) to work properly.
+		 */
+		key_datum = ippool_index_find_cli(data, cli, &entry);
+		if (key_datum.dptr) mppp = 1;
+	}
+
+	if (key_datum.dptr == NULL){
+		key_datum = ippool_index_find_free(data, &entry);
+		if (key_datum.dptr) delete = 1;
 	}
 
 	if (key_datum.dptr == NULL){
@@ -674,7 +1099,7 @@ static rlm_rcode_t ippool_postauth(void *instance, REQUEST *request)
 			data_datum_tmp = gdbm_fetch(data->gdbm, key_datum_tmp);
 			if (data_datum_tmp.dptr != NULL){
 
-				rcode = gdbm_store(data->gdbm, key_datum, data_datum_tmp, GDBM_REPLACE);
+				rcode = ippool_store(data, key_datum, data_datum_tmp);
 				free(data_datum_tmp.dptr);
 				if (rcode < 0) {
 					radlog(L_ERR, "rlm_ippool: Failed storing data to %s: %s",
@@ -693,7 +1118,7 @@ static rlm_rcode_t ippool_postauth(void *instance, REQUEST *request)
 		 	  	 * Delete the entry so that we can change the key
 			 	 * All is well. We delete one entry and we add one entry
 		 	 	 */
-				gdbm_delete(data->gdbm, key_datum);
+				ippool_delete(data, key_datum);
 			}
 			else{
 				/*
@@ -736,7 +1161,7 @@ static rlm_rcode_t ippool_postauth(void *instance, REQUEST *request)
 		key_datum.dsize = sizeof(ippool_key);
 
 		DEBUG2("rlm_ippool: Allocating ip to key: '%s'",hex_str);
-		rcode = gdbm_store(data->gdbm, key_datum, data_datum, GDBM_REPLACE);
+		rcode = ippool_store(data, key_datum, data_datum);
 		if (rcode < 0) {
 			radlog(L_ERR, "rlm_ippool: Failed storing data to %s: %s",
 				data->session_db, gdbm_strerror(gdbm_errno));
@@ -799,6 +1224,9 @@ static int ippool_detach(void *instance)
 
 	gdbm_close(data->gdbm);
 	gdbm_close(data->ip);
+	fr_hash_table_free(data->busy);
+	fr_hash_table_free(data->clis);
+	fr_hash_table_free(data->leases);
 	pthread_mutex_destroy(&data->op_mutex);
 
 	free(instance);
@@ -98,6 +98,19 @@ typedef struct {
 	char		*groupname_attr;
 	char		*groupmemb_filter;
 	char		*groupmemb_attr;
+
+	/*
+	 *	Cache of user DNs, xlat results and group checks.
+	 */
+	int		cache_ttl;		//!< Lifetime of positive entries.
+	int		cache_negative_ttl;	//!< Lifetime of negative entries.
+	int		cache_max_entries;
+	fr_hash_table_t	*cache;
+	struct ldap_cache_entry *cache_head;	//!< Oldest entry.
+	struct ldap_cache_entry *cache_tail;
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_t	cache_mutex;
+#endif
 	
 	/*
 	 *	Accounting
@@ -126,6 +139,19 @@ typedef struct {
 	int		timeout;
 	int		is_url;
 
+	/*
+	 *	Connections shared between threads for searches.
+	 */
+	int		pipeline_connections;
+	int		pipeline_depth;
+	struct ldap_conn **shared;
+	int		shared_next;
+	time_t		shared_retry;	//!< Don't reconnect before this time.
+	int		shared_connecting; //!< A thread is replacing a connection.
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_t	shared_mutex;
+#endif
+
 #ifdef WITH_EDIR
  	/*
 	 *	eDir support
@@ -216,6 +242,20 @@ static CONF_PARSER group_config[] = {
 	{ NULL, -1, 0, NULL, NULL }
 };
 
+/*
+ *	Cache configuration
+ */
+static CONF_PARSER cache_config[] = {
+	{"ttl", PW_TYPE_INTEGER,
+	 offsetof(ldap_instance,cache_ttl), NULL, "0"},
+	{"negative_ttl", PW_TYPE_INTEGER,
+	 offsetof(ldap_instance,cache_negative_ttl), NULL, "0"},
+	{"max_entries", PW_TYPE_INTEGER,
+	 offsetof(ldap_instance,cache_max_entries), NULL, "16384"},
+
+	{ NULL, -1, 0, NULL, NULL }
+};
+
 /*
  *	Reference for accounting updates
  */
@@ -255,6 +295,12 @@ static CONF_PARSER option_config[] = {
 	{"timelimit", PW_TYPE_INTEGER,
 	 offsetof(ldap_instance,timelimit), NULL, "20"},
 
+	/* connections shared by concurrent searches */
+	{"pipeline_connections", PW_TYPE_INTEGER,
+	 offsetof(ldap_instance,pipeline_connections), NULL, "0"},
+	{"pipeline_depth", PW_TYPE_INTEGER,
+	 offsetof(ldap_instance,pipeline_depth), NULL, "32"},
+
 #ifdef LDAP_OPT_X_KEEPALIVE_IDLE
 	{"idle", PW_TYPE_INTEGER,
 	 offsetof(ldap_instance,keepalive_idle), NULL, "60"},
@@ -315,6 +361,8 @@ static const CONF_PARSER module_config[] = {
 
 	{ "group", PW_TYPE_SUBSECTION, 0, NULL, (const void *) group_config },
 
+	{ "cache", PW_TYPE_SUBSECTION, 0, NULL, (const void *) cache_config },
+
 	{ "options", PW_TYPE_SUBSECTION, 0, NULL,
 	 (const void *) option_config },
 
@@ -328,6 +376,10 @@ typedef struct ldap_conn {
 	int	rebound;
 	int	referred;
 	ldap_instance *inst;
+
+	int	shared;		//!< Used by many threads for searches.
+	int	outstanding;	//!< Searches in progress on a shared conn.
+	int	dead;		//!< Replaced, close once outstanding is 0.
 } LDAP_CONN;
 
 typedef struct xlat_attrs {
@@ -335,6 +387,22 @@ typedef struct xlat_attrs {
 	const char *attrs[MAX_ATTRMAP];
 } xlat_attrs_t;
 
+typedef struct ldap_cache_entry {
+	char		*key;
+	char		*value;		//!< NULL for negative entries.
+	time_t		expires;
+	struct ldap_cache_entry *prev;
+	struct ldap_cache_entry *next;
+} ldap_cache_entry_t;
+
+#ifdef HAVE_PTHREAD_H
+#define PTHREAD_MUTEX_LOCK pthread_mutex_lock
+#define PTHREAD_MUTEX_UNLOCK pthread_mutex_unlock
+#else
+#define PTHREAD_MUTEX_LOCK(_x)
+#define PTHREAD_MUTEX_UNLOCK(_x)
+#endif
+
 typedef struct rlm_ldap_result {
 	char	**values;
 	int	count;
@@ -345,13 +413,12 @@ typedef struct rlm_ldap_result {
 #define LDAP_PROC_RETRY	-2
 #define LDAP_PROC_REJECT -3
 
-static int process_ldap_errno(ldap_instance *inst, LDAP_CONN **pconn,
-			      const char *operation)
+static LDAP_CONN *ldap_shared_reconnect(ldap_instance *inst,
+					LDAP_CONN *conn);
+
+static int process_ldap_error(ldap_instance *inst, LDAP_CONN **pconn,
+			      const char *operation, int ldap_errno)
 {
-	int	ldap_errno;
-	
-	ldap_get_option((*pconn)->handle, LDAP_OPT_ERROR_NUMBER,
-			&ldap_errno);
 	switch (ldap_errno) {
 	case LDAP_SUCCESS:
 	case LDAP_NO_SUCH_OBJECT:
@@ -359,7 +426,11 @@ static int process_ldap_errno(ldap_instance *inst, LDAP_CONN **pconn,
 
 	case LDAP_SERVER_DOWN:
 	do_reconnect:
-		*pconn = fr_connection_reconnect(inst->pool, *pconn);
+		if ((*pconn)->shared) {
+			*pconn = ldap_shared_reconnect(inst, *pconn);
+		} else {
+			*pconn = fr_connection_reconnect(inst->pool, *pconn);
+		}
 		if (!*pconn) return -1;
 		return LDAP_PROC_RETRY;
 
@@ -405,6 +476,17 @@ static int process_ldap_errno(ldap_instance *inst, LDAP_CONN **pconn,
 	}
 }
 
+static int process_ldap_errno(ldap_instance *inst, LDAP_CONN **pconn,
+			      const char *operation)
+{
+	int	ldap_errno;
+	
+	ldap_get_option((*pconn)->handle, LDAP_OPT_ERROR_NUMBER,
+			&ldap_errno);
+
+	return process_ldap_error(inst, pconn, operation, ldap_errno);
+}
+
 
 static int ldap_bind_wrapper(LDAP_CONN **pconn, const char *user,
 			     const char *password, int retry)
@@ -657,6 +739,9 @@ static void *ldap_conn_create(void *ctx)
 	conn->handle = handle;
 	conn->rebound = FALSE;
 	conn->referred = FALSE;
+	conn->shared = FALSE;
+	conn->outstanding = 0;
+	conn->dead = FALSE;
 
 	module_rcode = ldap_bind_wrapper(&conn, inst->login, inst->password,
 					 FALSE);
@@ -699,6 +784,111 @@ static LDAP_CONN *ldap_get_socket(ldap_instance *inst)
 	return conn;
 }
 
+/** Gets an LDAP socket which will only be used for searches
+ *
+ * If pipelining is enabled, this is the least busy of the shared
+ * connections.  Many threads may have searches outstanding on the
+ * same shared connection, libldap_r matches the results to the
+ * searches by message ID.  If all of the shared connections are at
+ * "pipeline_depth", a connection is taken from the pool instead.
+ */
+static LDAP_CONN *ldap_get_search_socket(ldap_instance *inst)
+{
+	int		i, n, best_n = 0, empty = -1;
+	LDAP_CONN	*conn, *best = NULL;
+
+	if (!inst->shared) return ldap_get_socket(inst);
+
+	PTHREAD_MUTEX_LOCK(&inst->shared_mutex);
+	for (i = 0; i < inst->pipeline_connections; i++) {
+		n = (inst->shared_next + i) % inst->pipeline_connections;
+
+		if (!inst->shared[n]) {
+			if (empty < 0) empty = n;
+			continue;
+		}
+
+		if (!best || (inst->shared[n]->outstanding < best->outstanding)) {
+			best = inst->shared[n];
+			best_n = n;
+		}
+	}
+
+	/*
+	 *	Replace connections which failed, but don't keep
+	 *	trying if the server is down, and only let one thread
+	 *	at a time try.
+	 */
+	if ((empty >= 0) && !inst->shared_connecting &&
+	    (time(NULL) >= inst->shared_retry)) {
+		inst->shared_connecting = TRUE;
+		PTHREAD_MUTEX_UNLOCK(&inst->shared_mutex);
+
+		/*
+		 *	Connecting and binding can take a while.  Don't
+		 *	block the threads using the other connections.
+		 */
+		conn = ldap_conn_create(inst);
+
+		PTHREAD_MUTEX_LOCK(&inst->shared_mutex);
+		inst->shared_connecting = FALSE;
+
+		if (!conn) {
+			inst->shared_retry = time(NULL) + 1;
+
+		} else if (!inst->shared[empty]) {
+			conn->shared = TRUE;
+			inst->shared[empty] = conn;
+			best = conn;
+			best_n = empty;
+
+		} else {
+			PTHREAD_MUTEX_UNLOCK(&inst->shared_mutex);
+			ldap_conn_delete(inst, conn);
+			return ldap_get_search_socket(inst);
+		}
+	}
+
+	if (best && (best->outstanding < inst->pipeline_depth)) {
+		best->outstanding++;
+		inst->shared_next = (best_n + 1) % inst->pipeline_connections;
+	} else {
+		best = NULL;
+	}
+	PTHREAD_MUTEX_UNLOCK(&inst->shared_mutex);
+
+	if (!best) return ldap_get_socket(inst);
+
+	return best;
+}
+
+static void ldap_release_socket(ldap_instance *inst, LDAP_CONN *conn);
+
+/** Replace a shared connection which has failed
+ *
+ * Other threads may still be using the old connection, so it is only
+ * closed when the last of them releases it.
+ */
+static LDAP_CONN *ldap_shared_reconnect(ldap_instance *inst,
+					LDAP_CONN *conn)
+{
+	int i;
+
+	PTHREAD_MUTEX_LOCK(&inst->shared_mutex);
+	for (i = 0; i < inst->pipeline_connections; i++) {
+		if (inst->shared[i] == conn) {
+			inst->shared[i] = NULL;
+			conn->dead = TRUE;
+			break;
+		}
+	}
+	PTHREAD_MUTEX_UNLOCK(&inst->shared_mutex);
+
+	ldap_release_socket(inst, conn);
+
+	return ldap_get_search_socket(inst);
+}
+
 /** Frees an LDAP socket back to the connection pool
  *
  */
@@ -709,6 +899,33 @@ static void ldap_release_socket(ldap_instance *inst, LDAP_CONN *conn)
 	 */
 	if (!conn) return;
 
+	if (conn->shared) {
+		int i, close_it;
+
+		PTHREAD_MUTEX_LOCK(&inst->shared_mutex);
+
+		/*
+		 *	As below, referrals mean the connection is no
+		 *	longer bound to the configured server.
+		 */
+		if (conn->referred && !conn->dead) {
+			for (i = 0; i < inst->pipeline_connections; i++) {
+				if (inst->shared[i] == conn) {
+					inst->shared[i] = NULL;
+					break;
+				}
+			}
+			conn->dead = TRUE;
+		}
+
+		conn->outstanding--;
+		close_it = (conn->dead && (conn->outstanding == 0));
+		PTHREAD_MUTEX_UNLOCK(&inst->shared_mutex);
+
+		if (close_it) ldap_conn_delete(inst, conn);
+		return;
+	}
+
 	/*
 	 *	We chased a referral to another server.
 	 *
@@ -781,6 +998,27 @@ static size_t ldap_escape_func(UNUSED REQUEST *request, char *out,
 	return len;
 }
 
+/** Get the error for a search from its result
+ *
+ * The result code held by the handle belongs to whichever thread last
+ * used it, which may not be us if the connection is shared.
+ */
+static int ldap_result_error(LDAP *handle, LDAPMessage *result)
+{
+	int rcode, ldap_errno;
+
+	rcode = ldap_parse_result(handle, result, &ldap_errno, NULL, NULL,
+				  NULL, NULL, 0);
+	if (rcode != LDAP_SUCCESS) return rcode;
+
+	/*
+	 *	The search worked, but the entry couldn't be decoded.
+	 */
+	if (ldap_errno == LDAP_SUCCESS) return LDAP_DECODING_ERROR;
+
+	return ldap_errno;
+}
+
 /** Do a search and get a response
  *
  */
@@ -789,7 +1027,7 @@ static int perform_search(ldap_instance *inst, REQUEST *request,
 			  int scope, const char *filter, 
 			  const char * const *attrs, LDAPMessage **presult)
 {
-	int		ldap_errno;
+	int		ldap_errno, rcode, msgid;
 	int		count = 0;
 	LDAP_CONN	*conn = *pconn;
 	struct timeval  tv;
@@ -804,9 +1042,10 @@ static int perform_search(ldap_instance *inst, REQUEST *request,
 	*presult = NULL;
 
 	/*
-	 *	Do all searches as the default admin user.
+	 *	Do all searches as the default admin user.  Shared
+	 *	connections are never bound as anyone else.
 	 */
-	if (conn->rebound) {
+	if (!conn->shared && conn->rebound) {
 		ldap_errno = ldap_bind_wrapper(pconn, inst->login,
 					       inst->password, TRUE);
 		if (ldap_errno != RLM_MODULE_OK) {
@@ -824,13 +1063,51 @@ static int perform_search(ldap_instance *inst, REQUEST *request,
 	        search_basedn ? search_basedn : "(null)" ,
 	        filter);
 
+	/*
+	 *	Send the search, and wait for the result with that
+	 *	message ID.  Other threads may be doing the same thing
+	 *	on a shared connection, so the error is taken from the
+	 *	result, and not from the connection handle.
+	 */
 retry:
-	ldap_errno = ldap_search_ext_s(conn->handle, search_basedn, scope,
-				       filter, search_attrs, 0, NULL, NULL,
-				       &tv, 0, presult);
+	ldap_errno = ldap_search_ext(conn->handle, search_basedn, scope,
+				     filter, search_attrs, 0, NULL, NULL,
+				     &tv, 0, &msgid);
+	if (ldap_errno == LDAP_SUCCESS) {
+		rcode = ldap_result(conn->handle, msgid, 1, &tv, presult);
+		if (rcode == 0) {
+			/*
+			 *	Don't leave a late result queued on the
+			 *	connection.
+			 */
+			ldap_abandon_ext(conn->handle, msgid, NULL, NULL);
+			ldap_errno = LDAP_TIMEOUT;
+
+		} else if (rcode < 0) {
+			/*
+			 *	Other threads may have changed the error
+			 *	number of a shared connection since.
+			 */
+			if (conn->shared) {
+				ldap_errno = LDAP_SERVER_DOWN;
+			} else {
+				ldap_get_option(conn->handle,
+						LDAP_OPT_ERROR_NUMBER,
+						&ldap_errno);
+			}
+
+		} else {
+			rcode = ldap_parse_result(conn->handle, *presult,
+						  &ldap_errno, NULL, NULL,
+						  NULL, NULL, 0);
+			if (rcode != LDAP_SUCCESS) ldap_errno = rcode;
+		}
+	}
+
 	if (ldap_errno != LDAP_SUCCESS) {
 		ldap_msgfree(*presult);
-		switch (process_ldap_errno(inst, pconn, "Search"))
+		*presult = NULL;
+		switch (process_ldap_error(inst, pconn, "Search", ldap_errno))
 		{
 			case LDAP_PROC_SUCCESS:
 				break;
@@ -846,7 +1123,7 @@ retry:
 	}
 		
 	count = ldap_count_entries(conn->handle, *presult);
-	if (count == 0) {
+	if (count <= 0) {
 		ldap_msgfree(*presult);
 		RDEBUG("Search returned no results");
 		
@@ -863,6 +1140,144 @@ retry:
 	return 0;
 }
 
+/*
+ *	The cache maps a string key to a string value, or to "nothing"
+ *	for negative entries.  Entries are kept on a list in the order
+ *	they were added, so that when the cache is full, the oldest
+ *	entry is the one which is thrown away.
+ */
+static uint32_t ldap_cache_hash(const void *data)
+{
+	const ldap_cache_entry_t *c = data;
+
+	return fr_hash_string(c->key);
+}
+
+static int ldap_cache_cmp(const void *one, const void *two)
+{
+	const ldap_cache_entry_t *a = one;
+	const ldap_cache_entry_t *b = two;
+
+	return strcmp(a->key, b->key);
+}
+
+/*
+ *	Unlink an entry, and free it.  The caller must hold the mutex.
+ */
+static void ldap_cache_delete(ldap_instance *inst, ldap_cache_entry_t *c)
+{
+	if (c->prev) {
+		c->prev->next = c->next;
+	} else {
+		inst->cache_head = c->next;
+	}
+
+	if (c->next) {
+		c->next->prev = c->prev;
+	} else {
+		inst->cache_tail = c->prev;
+	}
+
+	fr_hash_table_delete(inst->cache, c);
+}
+
+/** Look up a key in the cache
+ *
+ * @return -1 if the key isn't cached, 0 for a negative entry, 1 if
+ *	the value was copied to out, or 2 if the value is too long for
+ *	out.
+ */
+static int ldap_cache_find(ldap_instance *inst, const char *key,
+			   char *out, size_t outlen)
+{
+	int rcode = -1;
+	ldap_cache_entry_t my_c, *c;
+
+	if (!inst->cache) return -1;
+
+	memcpy(&my_c.key, &key, sizeof(my_c.key));
+
+	PTHREAD_MUTEX_LOCK(&inst->cache_mutex);
+	c = fr_hash_table_finddata(inst->cache, &my_c);
+	if (c) {
+		if (c->expires <= time(NULL)) {
+			ldap_cache_delete(inst, c);
+
+		} else if (c->value) {
+			if (strlcpy(out, c->value, outlen) >= outlen) {
+				*out = '\0';
+				rcode = 2;
+			} else {
+				rcode = 1;
+			}
+
+		} else {
+			rcode = 0;
+		}
+	}
+	PTHREAD_MUTEX_UNLOCK(&inst->cache_mutex);
+
+	return rcode;
+}
+
+/** Add an entry to the cache, replacing any existing one
+ *
+ * A NULL value adds a negative entry.
+ */
+static void ldap_cache_add(ldap_instance *inst, const char *key,
+			   const char *value)
+{
+	size_t keylen, len;
+	int ttl;
+	ldap_cache_entry_t *c, *old;
+
+	if (!inst->cache) return;
+
+	ttl = value ? inst->cache_ttl : inst->cache_negative_ttl;
+	if (ttl <= 0) return;
+
+	keylen = strlen(key) + 1;
+	len = value ? strlen(value) + 1 : 0;
+
+	c = rad_malloc(sizeof(*c) + keylen + len);
+	memset(c, 0, sizeof(*c));
+	c->key = (char *) (c + 1);
+	memcpy(c->key, key, keylen);
+	if (value) {
+		c->value = c->key + keylen;
+		memcpy(c->value, value, len);
+	}
+	c->expires = time(NULL) + ttl;
+
+	PTHREAD_MUTEX_LOCK(&inst->cache_mutex);
+	old = fr_hash_table_finddata(inst->cache, c);
+	if (old) ldap_cache_delete(inst, old);
+
+	/*
+	 *	Make room by discarding the oldest entries.
+	 */
+	while (inst->cache_head &&
+	       (fr_hash_table_num_elements(inst->cache) >=
+		inst->cache_max_entries)) {
+		ldap_cache_delete(inst, inst->cache_head);
+	}
+
+	if (!fr_hash_table_insert(inst->cache, c)) {
+		PTHREAD_MUTEX_UNLOCK(&inst->cache_mutex);
+		free(c);
+		return;
+	}
+
+	c->prev = inst->cache_tail;
+	if (inst->cache_tail) {
+		inst->cache_tail->next = c;
+	} else {
+		inst->cache_head = c;
+	}
+	inst->cache_tail = c;
+	PTHREAD_MUTEX_UNLOCK(&inst->cache_mutex);
+}
+
 /** Expand an LDAP URL into a query, and return a string result from that query.
  *
  */
@@ -881,6 +1296,7 @@ static size_t ldap_xlat(void *instance, REQUEST *request, const char *fmt,
 	const char *url;
 	const char **attrs;
 	char buffer[MAX_FILTER_STR_LEN];
+	char key[MAX_FILTER_STR_LEN + 8];
 
 	if (strchr(fmt, '%') != NULL) {
 		if (!radius_xlat(buffer, sizeof(buffer), fmt, request,
@@ -901,6 +1317,21 @@ static size_t ldap_xlat(void *instance, REQUEST *request, const char *fmt,
 		return 0;
 	}
 
+	snprintf(key, sizeof(key), "xlat\n%s", url);
+	rcode = ldap_cache_find(inst, key, out, freespace);
+	if (rcode == 0) {
+		RDEBUG("Search returned not found (cached)");
+		return 0;
+	}
+	if (rcode == 1) {
+		RDEBUG2("Using cached result for \"%s\"", url);
+		return strlen(out);
+	}
+	if (rcode == 2) {
+		RDEBUG("Cached result for \"%s\" is too long", url);
+		return 0;
+	}
+
 	if (ldap_url_parse(url, &ldap_url)){
 		radlog(L_ERR, "rlm_ldap (%s): Parsing LDAP URL failed",
 		       inst->xlat_name);
@@ -932,7 +1363,7 @@ static size_t ldap_xlat(void *instance, REQUEST *request, const char *fmt,
 		goto free_urldesc;
 	}
 
-	conn = ldap_get_socket(inst);
+	conn = ldap_get_search_socket(inst);
 	if (!conn) goto free_urldesc;
 
 	memcpy(&attrs, &ldap_url->lud_attrs, sizeof(attrs));
@@ -943,6 +1374,7 @@ static size_t ldap_xlat(void *instance, REQUEST *request, const char *fmt,
 	if (rcode < 0) {
 		if (rcode == -2) {
 			RDEBUG("Search returned not found", inst->xlat_name);
+			ldap_cache_add(inst, key, NULL);
 			goto free_socket;
 		}
 
@@ -951,8 +1383,7 @@ static size_t ldap_xlat(void *instance, REQUEST *request, const char *fmt,
 
 	entry = ldap_first_entry(conn->handle, result);
 	if (!entry) {
-		ldap_get_option(conn->handle, LDAP_OPT_RESULT_CODE,
-				&ldap_errno);
+		ldap_errno = ldap_result_error(conn->handle, result);
 		radlog(L_ERR, "rlm_ldap (%s): Failed retrieving entry: %s", 
 		       inst->xlat_name,
 		       ldap_err2string(ldap_errno));
@@ -963,12 +1394,16 @@ static size_t ldap_xlat(void *instance, REQUEST *request, const char *fmt,
 	if (!vals) {
 		RDEBUG("No \"%s\" attributes found in specified object",
 		       inst->xlat_name, ldap_url->lud_attrs[0]);
+		ldap_cache_add(inst, key, NULL);
 		goto free_result;
 	}
 
+	ldap_cache_add(inst, key, vals[0]);
+
 	length = strlen(vals[0]);
 	if (length >= freespace){
-
+		RDEBUG("Result for \"%s\" is too long", url);
+		length = 0;
 		goto free_vals;
 	}
 
@@ -987,12 +1422,18 @@ free_urldesc:
 }
 
 
-static char *get_userdn(LDAP_CONN **pconn, REQUEST *request,
-			rlm_rcode_t *module_rcode)
+/** Find the DN of the current user
+ *
+ * Uses the control:LDAP-UserDn attribute, or the cache, if either has
+ * the answer.  Otherwise, searches for the user.  If *pconn is NULL,
+ * a connection is taken from the pool only when a search is needed,
+ * and the caller must release it.
+ */
+static char *get_userdn(ldap_instance *inst, LDAP_CONN **pconn,
+			REQUEST *request, rlm_rcode_t *module_rcode)
 {
 	int		rcode;
 	VALUE_PAIR	*vp;
-	ldap_instance	*inst = (*pconn)->inst;
 	LDAPMessage	*result, *entry;
 	int		ldap_errno;
 	static char	firstattr[] = "uid";
@@ -1000,6 +1441,8 @@ static char *get_userdn(LDAP_CONN **pconn, REQUEST *request,
 	const char	*attrs[] = {firstattr, NULL};
 	char	    	filter[MAX_FILTER_STR_LEN];	
 	char	    	basedn[MAX_FILTER_STR_LEN];	
+	char		key[(MAX_FILTER_STR_LEN * 2) + 8];
+	char		buffer[MAX_FILTER_STR_LEN];
 
 	*module_rcode = RLM_MODULE_FAIL;
 
@@ -1025,19 +1468,37 @@ static char *get_userdn(LDAP_CONN **pconn, REQUEST *request,
 		return NULL;
 	}
 
+	snprintf(key, sizeof(key), "dn\n%s\n%s", basedn, filter);
+	rcode = ldap_cache_find(inst, key, buffer, sizeof(buffer));
+	if (rcode == 0) {
+		RDEBUG("User object not found (cached)");
+		*module_rcode = RLM_MODULE_NOTFOUND;
+		return NULL;
+	}
+
+	if (rcode == 1) {
+		RDEBUG2("Using cached user DN \"%s\"", buffer);
+		goto add_vp;
+	}
+
+	if (!*pconn) {
+		*pconn = ldap_get_search_socket(inst);
+		if (!*pconn) return NULL;
+	}
+
 	rcode = perform_search(inst, request, pconn, basedn, LDAP_SCOPE_SUBTREE,
 			       filter, attrs, &result);
 	if (rcode < 0) {
 		if (rcode == -2) {
 			*module_rcode = RLM_MODULE_NOTFOUND;
+			ldap_cache_add(inst, key, NULL);
 		}
 
 		return NULL;
 	}
 
 	if ((entry = ldap_first_entry((*pconn)->handle, result)) == NULL) {
-		ldap_get_option((*pconn)->handle, LDAP_OPT_RESULT_CODE,
-				&ldap_errno);
+		ldap_errno = ldap_result_error((*pconn)->handle, result);
 		radlog(L_ERR, "rlm_ldap (%s): Failed retrieving entry: %s", 
 		       inst->xlat_name,
 		       ldap_err2string(ldap_errno));
@@ -1046,8 +1507,7 @@ static char *get_userdn(LDAP_CONN **pconn, REQUEST *request,
 	}
 
 	if ((user_dn = ldap_get_dn((*pconn)->handle, entry)) == NULL) {
-		ldap_get_option((*pconn)->handle, LDAP_OPT_RESULT_CODE,
-				&ldap_errno);
+		ldap_errno = ldap_result_error((*pconn)->handle, result);
 		radlog(L_ERR, "rlm_ldap (%s): ldap_get_dn() failed: %s",
 		       inst->xlat_name,
 		       ldap_err2string(ldap_errno));
@@ -1055,35 +1515,33 @@ static char *get_userdn(LDAP_CONN **pconn, REQUEST *request,
 		ldap_msgfree(result);
 		return NULL;
 	}
+	ldap_msgfree(result);
 
-	vp = pairmake("LDAP-UserDn", user_dn, T_OP_EQ);
-	if (!vp) {
-		ldap_memfree(user_dn);
-		ldap_msgfree(result);
-		return NULL;
-	}
+	ldap_cache_add(inst, key, user_dn);
+	strlcpy(buffer, user_dn, sizeof(buffer));
+	ldap_memfree(user_dn);
+
+add_vp:
+	vp = pairmake("LDAP-UserDn", buffer, T_OP_EQ);
+	if (!vp) return NULL;
 	
 	*module_rcode = RLM_MODULE_OK;
 	
 	pairadd(&request->config_items, vp);
-	ldap_memfree(user_dn);
-	ldap_msgfree(result);
 
 	return vp->vp_strvalue;
 }
 
 
-/** Perform LDAP-Group comparison checking
+/** Search the directory to see if a user is a member of a group
  *
+ * @return 0 if the user is a member, 1 if not, or -1 on error.
  */
-static int ldap_groupcmp(void *instance, REQUEST *request,
-			 UNUSED VALUE_PAIR *thing, VALUE_PAIR *check,
-			 UNUSED VALUE_PAIR *check_pairs,
-			 UNUSED VALUE_PAIR **reply_pairs)
+static int ldap_groupcmp_search(ldap_instance *inst, REQUEST *request,
+				LDAP_CONN **pconn, const char *user_dn,
+				VALUE_PAIR *check)
 {
-	ldap_instance   *inst = instance;
 	int		i, rcode, found;
-	rlm_rcode_t	module_rcode;
 	LDAPMessage     *result = NULL;
 	LDAPMessage     *entry = NULL;
 	int		ldap_errno;
@@ -1092,32 +1550,11 @@ static int ldap_groupcmp(void *instance, REQUEST *request,
 	const char	*attrs[] = {firstattr, NULL};
 	char		**vals;
 	const char	*group_attrs[] = {inst->groupmemb_attr, NULL};
-	LDAP_CONN	*conn;
-	char		*user_dn;
 
 	char		gr_filter[MAX_FILTER_STR_LEN];
 	char		filter[MAX_FILTER_STR_LEN];
 	char		basedn[MAX_FILTER_STR_LEN];
 
-	RDEBUG("Searching for user in group \"%s\"", check->vp_strvalue);
-
-	if (check->length == 0) {
-		RDEBUG("Cannot do comparison (group name is empty)");
-		return 1;
-	}
-
-	conn = ldap_get_socket(inst);
-	if (!conn) return 1;
-
-	/*
-	 *	This is used in the default membership filter.
-	 */
-	user_dn = get_userdn(&conn, request, &module_rcode);
-	if (!user_dn) {
-		ldap_release_socket(inst, conn);
-		return 1;
-	}
-
 	if (!inst->groupmemb_filter) goto check_attr;
 
 	if (!radius_xlat(gr_filter, sizeof(gr_filter),
@@ -1125,7 +1562,7 @@ static int ldap_groupcmp(void *instance, REQUEST *request,
 			 NULL)) {
 		radlog(L_ERR, "rlm_ldap (%s): Failed creating group filter",
 		       inst->xlat_name);
-		return 1;
+		return -1;
 	}
 
 	/*
@@ -1148,14 +1585,13 @@ static int ldap_groupcmp(void *instance, REQUEST *request,
 				 request, ldap_escape_func, NULL)) {
 			radlog(L_ERR, "rlm_ldap (%s): Failed creating basedn",
 			       inst->xlat_name);
-			return 1;
+			return -1;
 		}
 	}
 
-	rcode = perform_search(inst, request, &conn, basedn, LDAP_SCOPE_SUBTREE,
+	rcode = perform_search(inst, request, pconn, basedn, LDAP_SCOPE_SUBTREE,
 			       filter, attrs, &result);
 	if (rcode == 0) {
-		ldap_release_socket(inst, conn);
 		ldap_msgfree(result);
 			
 		RDEBUG("User found in group object");
@@ -1163,10 +1599,7 @@ static int ldap_groupcmp(void *instance, REQUEST *request,
 		return 0;
 	}
 
-	if (rcode == -1) {
-		ldap_release_socket(inst, conn);
-		return 1;
-	}
+	if (rcode == -1) return -1;
 
 	/* else the search returned -2, for "not found" */
 
@@ -1176,7 +1609,6 @@ static int ldap_groupcmp(void *instance, REQUEST *request,
 	 *	object attribute.
 	 */
 	if (!inst->groupmemb_attr) {
-		ldap_release_socket(inst, conn);
 		RDEBUG("Group object \"%s\" not found, or user is not a member",
 		       check->vp_strvalue);
 		return 1;
@@ -1188,34 +1620,31 @@ check_attr:
 
 	snprintf(filter ,sizeof(filter), "(objectclass=*)");
 
-	rcode = perform_search(inst, request, &conn, user_dn, LDAP_SCOPE_BASE,
+	rcode = perform_search(inst, request, pconn, user_dn, LDAP_SCOPE_BASE,
 			       filter, group_attrs, &result);
 	if (rcode < 0) {
 		if (rcode == -2) {
 			RDEBUG("Can't check membership attributes, user object "
 			       "not found");
+			return 1;
 		}
-		ldap_release_socket(inst, conn);
-		return 1;
+		return -1;
 	}
 
-	entry = ldap_first_entry(conn->handle, result);
+	entry = ldap_first_entry((*pconn)->handle, result);
 	if (!entry) {
-		ldap_get_option(conn->handle, LDAP_OPT_RESULT_CODE,
-				&ldap_errno);
+		ldap_errno = ldap_result_error((*pconn)->handle, result);
 		radlog(L_ERR, "rlm_ldap (%s): Failed retrieving entry: %s", 
 		       inst->xlat_name,
 		       ldap_err2string(ldap_errno));
 			       
-		ldap_release_socket(inst, conn);
 		ldap_msgfree(result);
-		return 1;
+		return -1;
 	}
 
-	vals = ldap_get_values(conn->handle, entry, inst->groupmemb_attr);
+	vals = ldap_get_values((*pconn)->handle, entry, inst->groupmemb_attr);
 	if (!vals) {
 		RDEBUG("No group membership attribute(s) found in user object");
-		ldap_release_socket(inst, conn);
 		ldap_msgfree(result);
 		return 1;
 	}
@@ -1279,7 +1708,7 @@ check_attr:
 		snprintf(filter,sizeof(filter), "(%s=%s)",
 			 inst->groupname_attr, check->vp_strvalue);
 
-		rcode = perform_search(inst, request, &conn, vals[i],
+		rcode = perform_search(inst, request, pconn, vals[i],
 				       LDAP_SCOPE_BASE, filter, attrs,
 				       &gr_result);
 				       
@@ -1289,8 +1718,7 @@ check_attr:
 		if (rcode == -1) {
 			ldap_value_free(vals);
 			ldap_msgfree(result);
-			ldap_release_socket(inst, conn);
-			return 1;
+			return -1;
 		}
 		
 		/*
@@ -1312,7 +1740,6 @@ check_attr:
 
 	ldap_value_free(vals);
 	ldap_msgfree(result);
-	ldap_release_socket(inst, conn);
 
 	if (!found){
 		RDEBUG("User is not a member of specified group");
@@ -1322,6 +1749,66 @@ check_attr:
 	return 0;
 }
 
+/** Perform LDAP-Group comparison checking
+ *
+ * Both positive and negative results are cached per user DN, so that
+ * repeated checks of the same group do not go to the directory.
+ */
+static int ldap_groupcmp(void *instance, REQUEST *request,
+			 UNUSED VALUE_PAIR *thing, VALUE_PAIR *check,
+			 UNUSED VALUE_PAIR *check_pairs,
+			 UNUSED VALUE_PAIR **reply_pairs)
+{
+	ldap_instance   *inst = instance;
+	int		rcode;
+	rlm_rcode_t	module_rcode;
+	LDAP_CONN	*conn = NULL;
+	char		*user_dn;
+	char		key[(MAX_STRING_LEN * 2) + 8];
+	char		buffer[8];
+
+	RDEBUG("Searching for user in group \"%s\"", check->vp_strvalue);
+
+	if (check->length == 0) {
+		RDEBUG("Cannot do comparison (group name is empty)");
+		return 1;
+	}
+
+	/*
+	 *	This is used in the default membership filter.
+	 */
+	user_dn = get_userdn(inst, &conn, request, &module_rcode);
+	if (!user_dn) {
+		if (conn) ldap_release_socket(inst, conn);
+		return 1;
+	}
+
+	snprintf(key, sizeof(key), "group\n%s\n%s", user_dn,
+		 check->vp_strvalue);
+	rcode = ldap_cache_find(inst, key, buffer, sizeof(buffer));
+	if (rcode >= 0) {
+		if (conn) ldap_release_socket(inst, conn);
+
+		RDEBUG("User is %sa member of group \"%s\" (cached)",
+		       rcode ? "" : "not ", check->vp_strvalue);
+		return rcode ? 0 : 1;
+	}
+
+	if (!conn) {
+		conn = ldap_get_search_socket(inst);
+		if (!conn) return 1;
+	}
+
+	rcode = ldap_groupcmp_search(inst, request, &conn, user_dn, check);
+	ldap_release_socket(inst, conn);
+
+	if (rcode < 0) return 1;
+
+	ldap_cache_add(inst, key, (rcode == 0) ? "1" : NULL);
+
+	return rcode;
+}
+
 /** Detach from the LDAP server and cleanup internal state.
  *
  */
@@ -1333,6 +1820,27 @@ static int ldap_detach(void *instance)
 	if (inst->accounting) free(inst->accounting);
 	
 	fr_connection_pool_delete(inst->pool);
+
+	if (inst->shared) {
+		int i;
+
+		for (i = 0; i < inst->pipeline_connections; i++) {
+			if (inst->shared[i]) {
+				ldap_conn_delete(inst, inst->shared[i]);
+			}
+		}
+		free(inst->shared);
+#ifdef HAVE_PTHREAD_H
+		pthread_mutex_destroy(&inst->shared_mutex);
+#endif
+	}
+
+	if (inst->cache) {
+		fr_hash_table_free(inst->cache);
+#ifdef HAVE_PTHREAD_H
+		pthread_mutex_destroy(&inst->cache_mutex);
+#endif
+	}
 	
 	if (inst->user_map) {
 		radius_mapfree(&inst->user_map);
@@ -1548,6 +2056,23 @@ static int ldap_instantiate(CONF_SECTION * conf, void **instance)
 				     inst);
 	}
 
+	/*
+	 *	The cache is only needed if something can be cached.
+	 */
+	if (((inst->cache_ttl > 0) || (inst->cache_negative_ttl > 0)) &&
+	    (inst->cache_max_entries > 0)) {
+		inst->cache = fr_hash_table_create(ldap_cache_hash,
+						   ldap_cache_cmp, free);
+		if (!inst->cache) {
+			radlog(L_ERR, "rlm_ldap (%s): Failed creating cache",
+			       inst->xlat_name);
+			goto error;
+		}
+#ifdef HAVE_PTHREAD_H
+		pthread_mutex_init(&inst->cache_mutex, NULL);
+#endif
+	}
+
 	xlat_register(inst->xlat_name, ldap_xlat, inst);
 
 	/*
@@ -1561,6 +2086,19 @@ static int ldap_instantiate(CONF_SECTION * conf, void **instance)
 		ldap_detach(inst);
 		return -1;
 	}
+
+	/*
+	 *	Shared connections are opened as they're needed.
+	 */
+	if (inst->pipeline_connections > 0) {
+		if (inst->pipeline_depth < 1) inst->pipeline_depth = 1;
+
+		inst->shared = rad_calloc(inst->pipeline_connections *
+					  sizeof(inst->shared[0]));
+#ifdef HAVE_PTHREAD_H
+		pthread_mutex_init(&inst->shared_mutex, NULL);
+#endif
+	}
 	
 	*instance = inst;
 	return 0;
@@ -1831,8 +2369,7 @@ static void apply_profile(ldap_instance *inst, REQUEST *request,
 
 	entry = ldap_first_entry(handle, result);
 	if (!entry) {
-		ldap_get_option(handle, LDAP_OPT_RESULT_CODE,
-				&ldap_errno);
+		ldap_errno = ldap_result_error(handle, result);
 		radlog(L_ERR, "rlm_ldap (%s): Failed retrieving entry: %s", 
 		       inst->xlat_name,
 		       ldap_err2string(ldap_errno));
@@ -1898,7 +2435,16 @@ static rlm_rcode_t ldap_authorize(void *instance, REQUEST * request)
 	}
 	
 
-	conn = ldap_get_socket(inst);
+	/*
+	 *	eDir binds as the user, so it can't use a shared
+	 *	connection.
+	 */
+#ifdef WITH_EDIR
+	if (inst->edir) {
+		conn = ldap_get_socket(inst);
+	} else
+#endif
+	conn = ldap_get_search_socket(inst);
 	if (!conn) return RLM_MODULE_FAIL;
 	
 	rcode = perform_search(inst, request, &conn, basedn,
@@ -1923,8 +2469,7 @@ static rlm_rcode_t ldap_authorize(void *instance, REQUEST * request)
 
 	entry = ldap_first_entry(conn->handle, result);
 	if (!entry) {
-		ldap_get_option(conn->handle, LDAP_OPT_RESULT_CODE,
-				&ldap_errno);
+		ldap_errno = ldap_result_error(conn->handle, result);
 		radlog(L_ERR, "rlm_ldap (%s): Failed retrieving entry: %s", 
 		       inst->xlat_name,
 		       ldap_err2string(ldap_errno));
@@ -1934,8 +2479,7 @@ static rlm_rcode_t ldap_authorize(void *instance, REQUEST * request)
 
 	user_dn = ldap_get_dn(conn->handle, entry);
 	if (!user_dn) {
-		ldap_get_option(conn->handle, LDAP_OPT_RESULT_CODE,
-				&ldap_errno);
+		ldap_errno = ldap_result_error(conn->handle, result);
 		radlog(L_ERR, "rlm_ldap (%s): ldap_get_dn() failed: %s",
 		       inst->xlat_name,
 		       ldap_err2string(ldap_errno));
@@ -2119,7 +2663,7 @@ static rlm_rcode_t ldap_authenticate(void *instance, REQUEST * request)
 	/*
 	 *	Get the DN by doing a search.
 	 */
-	user_dn = get_userdn(&conn, request, &module_rcode);
+	user_dn = get_userdn(inst, &conn, request, &module_rcode);
 	if (!user_dn) {
 		ldap_release_socket(inst, conn);
 		return module_rcode;
@@ -2364,7 +2908,7 @@ static rlm_rcode_t user_modify(ldap_instance *inst, REQUEST *request,
 		conn->rebound = FALSE;
 	}
 
-	user_dn = get_userdn(&conn, request, &module_rcode);
+	user_dn = get_userdn(inst, &conn, request, &module_rcode);
 	if (!user_dn) {
 		module_rcode = RLM_MODULE_NOTFOUND;
 		goto release;
@@ -64,6 +64,9 @@ typedef struct rlm_linelog_t {
 	char		*group;
 	char		*line;
 	char		*reference;
+	xlat_exp_t	*filename_exp;
+	xlat_exp_t	*line_exp;
+	xlat_exp_t	*reference_exp;
 } rlm_linelog_t;
 
 /*
@@ -96,6 +99,9 @@ static int linelog_detach(void *instance)
 {
 	rlm_linelog_t *inst = instance;
 
+	radius_xlat_exp_free(&inst->filename_exp);
+	radius_xlat_exp_free(&inst->line_exp);
+	radius_xlat_exp_free(&inst->reference_exp);
 	free(inst);
 	return 0;
 }
@@ -155,6 +161,10 @@ static int linelog_instantiate(CONF_SECTION *conf, void **instance)
 		return -1;
 	}
 
+	inst->filename_exp = radius_xlat_compile(inst->filename);
+	inst->line_exp = radius_xlat_compile(inst->line);
+	inst->reference_exp = radius_xlat_compile(inst->reference);
+
 	inst->cs = conf;
 	*instance = inst;
 
@@ -233,6 +243,7 @@ static rlm_rcode_t do_linelog(void *instance, REQUEST *request)
 	char line[1024];
 	rlm_linelog_t *inst = (rlm_linelog_t*) instance;
 	const char *value = inst->line;
+	const xlat_exp_t *exp = inst->line_exp;
 
 #ifdef HAVE_GRP_H
 	gid_t gid;
@@ -244,8 +255,8 @@ static rlm_rcode_t do_linelog(void *instance, REQUEST *request)
 		CONF_ITEM *ci;
 		CONF_PAIR *cp;
 
-		radius_xlat(line + 1, sizeof(line) - 2, inst->reference,
-			    request, linelog_escape_func, NULL);
+		radius_xlat_exp(line + 1, sizeof(line) - 2, inst->reference_exp,
+				request, linelog_escape_func, NULL);
 		line[0] = '.';	/* force to be in current section */
 
 		/*
@@ -275,6 +286,11 @@ static rlm_rcode_t do_linelog(void *instance, REQUEST *request)
 		 *	Value exists, but is empty.  Don't log anything.
 		 */
 		if (!*value) return RLM_MODULE_OK;
+
+		/*
+		 *	Referenced formats aren't compiled.
+		 */
+		exp = NULL;
 	}
 
  do_log:
@@ -282,8 +298,8 @@ static rlm_rcode_t do_linelog(void *instance, REQUEST *request)
 	 *	FIXME: Check length.
 	 */
 	if (strcmp(inst->filename, "syslog") != 0) {
-		radius_xlat(buffer, sizeof(buffer), inst->filename, request,
-			    NULL, NULL);
+		radius_xlat_exp(buffer, sizeof(buffer), inst->filename_exp,
+				request, NULL, NULL);
 		
 		/* check path and eventually create subdirs */
 		p = strrchr(buffer,'/');
@@ -327,8 +343,13 @@ static rlm_rcode_t do_linelog(void *instance, REQUEST *request)
 	/*
 	 *	FIXME: Check length.
 	 */
-	radius_xlat(line, sizeof(line) - 1, value, request,
-		    linelog_escape_func, NULL);
+	if (exp) {
+		radius_xlat_exp(line, sizeof(line) - 1, exp, request,
+				linelog_escape_func, NULL);
+	} else {
+		radius_xlat(line, sizeof(line) - 1, value, request,
+			    linelog_escape_func, NULL);
+	}
 
 	if (fd >= 0) {
 		strcat(line, "\n");
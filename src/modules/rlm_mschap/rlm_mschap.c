@@ -1903,7 +1903,7 @@ static rlm_rcode_t mschap_authenticate(void * instance, REQUEST *request)
 module_t rlm_mschap = {
 	RLM_MODULE_INIT,
 	"MS-CHAP",
-	RLM_TYPE_THREAD_SAFE | RLM_TYPE_HUP_SAFE,		/* type */
+	RLM_TYPE_THREAD_SAFE | RLM_TYPE_HUP_SAFE | RLM_TYPE_HUP_CHANGED, /* type */
 	mschap_instantiate,		/* instantiation */
 	mschap_detach,		/* detach */
 	{
@@ -861,7 +861,8 @@ static int pap_auth_ns_mta_md5(REQUEST *request, VALUE_PAIR *vp, char *fmsg)
 module_t rlm_pap = {
 	RLM_MODULE_INIT,
 	"PAP",
-	RLM_TYPE_CHECK_CONFIG_SAFE | RLM_TYPE_HUP_SAFE,   	/* type */
+	RLM_TYPE_CHECK_CONFIG_SAFE | RLM_TYPE_HUP_SAFE |
+	  RLM_TYPE_HUP_CHANGED,   	/* type */
 	pap_instantiate,		/* instantiation */
 	pap_detach,			/* detach */
 	{
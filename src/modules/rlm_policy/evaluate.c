@@ -26,9 +26,13 @@ RCSID("$Id$")
 
 #include "rlm_policy.h"
 
+#ifdef HAVE_PCREPOSIX_H
+#include <pcreposix.h>
+#else
 #ifdef HAVE_REGEX_H
 #include <regex.h>
 #endif
+#endif
 
 #define debug_evaluate if (0) printf
 
@@ -509,7 +513,8 @@ static int evaluate_condition(policy_state_t *state, const policy_item_t *item)
 	const char *data = NULL;
 	int compare;
 #ifdef HAVE_REGEX_H
-	regex_t reg;
+	regex_t *reg;
+	char errbuf[128];
 #endif
 	char buffer[256];
 	char lhs_buffer[2048];
@@ -667,17 +672,17 @@ static int evaluate_condition(policy_state_t *state, const policy_item_t *item)
 			/*
 			 *	Include substring matches.
 			 */
-			if (regcomp(&reg, this->rhs,
-				    REG_EXTENDED) != 0) {
+			reg = fr_regcomp_cached(this->rhs, REG_EXTENDED,
+						errbuf, sizeof(errbuf));
+			if (!reg) {
 				/* FIXME: print error */
 				return FALSE;
 			}
 			rad_assert(data != NULL);
-			rcode = regexec(&reg, data,
+			rcode = regexec(reg, data,
 					REQUEST_MAX_REGEX + 1,
 					rxmatch, 0);
 			rcode = (rcode == 0);
-			regfree(&reg);
 
 			/*
 			 *	Add %{0}, %{1}, etc.
@@ -733,12 +738,13 @@ static int evaluate_condition(policy_state_t *state, const policy_item_t *item)
 		break;
 
 		case POLICY_LEX_RX_NOT_EQUALS:
-			regcomp(&reg, this->rhs, REG_EXTENDED|REG_NOSUB);
+			reg = fr_regcomp_cached(this->rhs, REG_EXTENDED|REG_NOSUB,
+						errbuf, sizeof(errbuf));
+			if (!reg) return FALSE;
 			rad_assert(data != NULL);
-			rcode = regexec(&reg, data,
+			rcode = regexec(reg, data,
 					0, NULL, 0);
 			rcode = (rcode != 0);
-			regfree(&reg);
 				break;
 #endif /* HAVE_REGEX_H */
 		default:
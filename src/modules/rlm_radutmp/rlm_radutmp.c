@@ -734,7 +734,8 @@ static rlm_rcode_t radutmp_checksimul(void *instance, REQUEST *request)
 module_t rlm_radutmp = {
 	RLM_MODULE_INIT,
 	"radutmp",
-	RLM_TYPE_CHECK_CONFIG_SAFE | RLM_TYPE_HUP_SAFE,   	/* type */
+	RLM_TYPE_CHECK_CONFIG_SAFE | RLM_TYPE_HUP_SAFE |
+	  RLM_TYPE_HUP_CHANGED,   	/* type */
 	radutmp_instantiate,          /* instantiation */
 	radutmp_detach,               /* detach */
 	{
@@ -517,7 +517,8 @@ static int realm_detach(void *instance)
 module_t rlm_realm = {
 	RLM_MODULE_INIT,
 	"realm",
-	RLM_TYPE_CHECK_CONFIG_SAFE | RLM_TYPE_HUP_SAFE,   	/* type */
+	RLM_TYPE_CHECK_CONFIG_SAFE | RLM_TYPE_HUP_SAFE |
+	  RLM_TYPE_HUP_CHANGED,   	/* type */
 	realm_instantiate,	       	/* instantiation */
 	realm_detach,			/* detach */
 	{
@@ -12,7 +12,7 @@
  *   along with this program; if not, write to the Free Software
  *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
  */
- 
+
 /**
  * $Id$
  * @file rlm_redis.c
@@ -28,8 +28,58 @@ RCSID("$Id$")
 #include <freeradius-devel/radiusd.h>
 #include <freeradius-devel/modules.h>
 
+#include <ctype.h>
+
 #include "rlm_redis.h"
 
+#ifdef HAVE_PTHREAD_H
+#define PTHREAD_MUTEX_LOCK pthread_mutex_lock
+#define PTHREAD_MUTEX_UNLOCK pthread_mutex_unlock
+#else
+#define PTHREAD_MUTEX_LOCK(_x)
+#define PTHREAD_MUTEX_UNLOCK(_x)
+#endif
+
+#define REDIS_CLUSTER_SLOTS	16384
+#define REDIS_MAX_REPLICAS	8
+#define REDIS_MAX_REDIRECTS	5
+
+/*
+ *	One server.  When not in cluster mode, there is only one.
+ *
+ *	Nodes are never freed until the module is detached, so
+ *	pointers to them can be used outside of the mutex.
+ */
+struct redis_node_t {
+	REDIS_INST		*inst;
+	char			*hostname;
+	int			port;
+
+	fr_connection_pool_t	*pool;
+	time_t			last_failed;
+
+	/*
+	 *	Only valid for masters, and protected by the mutex.
+	 */
+	int			num_replicas;
+	redis_node_t		*replicas[REDIS_MAX_REPLICAS];
+
+	redis_node_t		*next;
+};
+
+struct redis_cluster_t {
+	redis_node_t		*seed;
+	redis_node_t		*nodes;
+
+	redis_node_t		*slots[REDIS_CLUSTER_SLOTS];
+	time_t			last_refresh;
+	unsigned int		next_replica;
+
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_t		mutex;
+#endif
+};
+
 static const CONF_PARSER module_config[] = {
 	{ "hostname", PW_TYPE_STRING_PTR,
 	  offsetof(REDIS_INST, hostname), NULL, "127.0.0.1"},
@@ -39,10 +89,29 @@ static const CONF_PARSER module_config[] = {
 	  offsetof(REDIS_INST, database), NULL, "0"},
 	{ "password", PW_TYPE_STRING_PTR,
 	  offsetof(REDIS_INST, password), NULL, NULL},
+	{ "cluster", PW_TYPE_BOOLEAN,
+	  offsetof(REDIS_INST, cluster), NULL, "no"},
+	{ "read_replicas", PW_TYPE_BOOLEAN,
+	  offsetof(REDIS_INST, read_replicas), NULL, "no"},
 
 	{ NULL, -1, 0, NULL, NULL} /* end the list */
 };
 
+/*
+ *	Commands which can be sent to a replica.
+ */
+static const char *redis_readonly_commands[] = {
+	"EXISTS", "GET", "GETRANGE", "HEXISTS", "HGET", "HGETALL",
+	"HKEYS", "HLEN", "HMGET", "HVALS", "LINDEX", "LLEN", "LRANGE",
+	"MGET", "SCARD", "SISMEMBER", "SMEMBERS", "SRANDMEMBER",
+	"STRLEN", "TTL", "PTTL", "TYPE", "ZCARD", "ZCOUNT", "ZRANGE",
+	"ZRANGEBYSCORE", "ZRANK", "ZREVRANGE", "ZREVRANK", "ZSCORE",
+	NULL
+};
+
+static int redis_query(REDISSOCK **dissocket_p, REDIS_INST *inst,
+		       char *query, int readonly);
+
 static int redis_delete_conn(UNUSED void *ctx, void *conn)
 {
 	REDISSOCK *dissocket = conn;
@@ -60,13 +129,20 @@ static int redis_delete_conn(UNUSED void *ctx, void *conn)
 
 static void *redis_create_conn(void *ctx)
 {
-	REDIS_INST *inst = ctx;
+	redis_node_t *node = ctx;
+	REDIS_INST *inst = node->inst;
 	REDISSOCK *dissocket = NULL;
 	redisContext *conn;
 	char buffer[1024];
 
-	conn = redisConnect(inst->hostname, inst->port);
-	if (conn->err) return NULL;
+	conn = redisConnect(node->hostname, node->port);
+	if (conn->err) {
+		radlog(L_ERR, "rlm_redis (%s): Failed connecting to %s:%d: %s",
+		       inst->xlat_name, node->hostname, node->port,
+		       conn->errstr);
+		redisFree(conn);
+		return NULL;
+	}
 
 	if (inst->password) {
 		redisReply *reply = NULL;
@@ -98,6 +174,7 @@ static void *redis_create_conn(void *ctx)
 			       inst->xlat_name);
 			goto do_close;
 		}
+		freeReplyObject(reply);
 	}
 
 	if (inst->database) {
@@ -128,6 +205,23 @@ static void *redis_create_conn(void *ctx)
 			       inst->xlat_name);
 			goto do_close;
 		}
+		freeReplyObject(reply);
+	}
+
+	/*
+	 *	Allow reads from replicas.  This is harmless on
+	 *	masters, and the roles may change over time.
+	 */
+	if (inst->read_replicas) {
+		redisReply *reply = NULL;
+
+		reply = redisCommand(conn, "READONLY");
+		if (!reply || (reply->type == REDIS_REPLY_ERROR)) {
+			radlog(L_ERR, "rlm_redis (%s): Failed to run READONLY",
+			       inst->xlat_name);
+			goto do_close;
+		}
+		freeReplyObject(reply);
 	}
 
 	dissocket = rad_malloc(sizeof(*dissocket));
@@ -137,6 +231,476 @@ static void *redis_create_conn(void *ctx)
 	return dissocket;
 }
 
+/*
+ *	CRC16 (XMODEM), as used for the Redis Cluster key slots.
+ */
+static uint16_t redis_crc16(const char *p, size_t len)
+{
+	int i;
+	uint16_t crc = 0;
+
+	while (len-- > 0) {
+		crc ^= ((uint16_t) (uint8_t) *(p++)) << 8;
+
+		for (i = 0; i < 8; i++) {
+			if (crc & 0x8000) {
+				crc = (crc << 1) ^ 0x1021;
+			} else {
+				crc <<= 1;
+			}
+		}
+	}
+
+	return crc;
+}
+
+/*
+ *	Find the slot for a query.  The key is taken to be the first
+ *	argument, and if it contains a {hash tag}, only the tag is
+ *	hashed.
+ *
+ *	Returns -1 if the query has no key.
+ */
+static int redis_query_slot(const char *query)
+{
+	const char *key, *end, *open, *close;
+
+	key = query;
+	while (*key && !isspace((int) *key)) key++;
+	while (*key && isspace((int) *key)) key++;
+	if (!*key) return -1;
+
+	end = key;
+	while (*end && !isspace((int) *end)) end++;
+
+	open = memchr(key, '{', end - key);
+	if (open) {
+		close = memchr(open + 1, '}', end - (open + 1));
+		if (close && (close > (open + 1))) {
+			key = open + 1;
+			end = close;
+		}
+	}
+
+	return redis_crc16(key, end - key) & (REDIS_CLUSTER_SLOTS - 1);
+}
+
+/*
+ *	Whether or not a query can be sent to a replica.
+ */
+static int redis_query_readonly(const char *query)
+{
+	int i;
+	size_t len;
+
+	len = 0;
+	while (query[len] && !isspace((int) query[len])) len++;
+
+	for (i = 0; redis_readonly_commands[i] != NULL; i++) {
+		if ((strlen(redis_readonly_commands[i]) == len) &&
+		    (strncasecmp(query, redis_readonly_commands[i], len) == 0)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ *	Find a node, or add it if we haven't seen it before.
+ *
+ *	Must be called with the mutex held.
+ */
+static redis_node_t *redis_node_find(REDIS_INST *inst, const char *hostname,
+				     int port)
+{
+	redis_node_t *node;
+
+	for (node = inst->cluster_state->nodes; node != NULL; node = node->next) {
+		if ((node->port == port) &&
+		    (strcmp(node->hostname, hostname) == 0)) {
+			return node;
+		}
+	}
+
+	node = rad_malloc(sizeof(*node));
+	memset(node, 0, sizeof(*node));
+	node->inst = inst;
+	node->hostname = strdup(hostname);
+	node->port = port;
+
+	node->next = inst->cluster_state->nodes;
+	inst->cluster_state->nodes = node;
+
+	return node;
+}
+
+/*
+ *	Get the connection pool for a node, creating it if necessary.
+ */
+static fr_connection_pool_t *redis_node_pool(REDIS_INST *inst,
+					     redis_node_t *node)
+{
+	time_t now;
+	char name[256];
+	fr_connection_pool_t *pool, *created;
+
+	now = time(NULL);
+
+	/*
+	 *	Don't hammer nodes which are down.
+	 */
+	PTHREAD_MUTEX_LOCK(&inst->cluster_state->mutex);
+	pool = node->pool;
+	if (pool || (node->last_failed == now)) {
+		PTHREAD_MUTEX_UNLOCK(&inst->cluster_state->mutex);
+		goto done;
+	}
+	PTHREAD_MUTEX_UNLOCK(&inst->cluster_state->mutex);
+
+	/*
+	 *	Opening the initial connections can take a while, so
+	 *	don't block the threads talking to other nodes.
+	 */
+	created = fr_connection_pool_init(inst->cs, node, redis_create_conn,
+					  NULL, redis_delete_conn);
+	if (created) {
+		snprintf(name, sizeof(name), "%s/%s:%d", inst->xlat_name,
+			 node->hostname, node->port);
+		fr_connection_pool_set_name(created, name);
+	}
+
+	PTHREAD_MUTEX_LOCK(&inst->cluster_state->mutex);
+	if (node->pool) {
+		/*
+		 *	Another thread got there first.
+		 */
+		pool = node->pool;
+
+	} else if (!created) {
+		node->last_failed = now;
+
+	} else {
+		node->pool = pool = created;
+		created = NULL;
+	}
+	PTHREAD_MUTEX_UNLOCK(&inst->cluster_state->mutex);
+
+	if (created) fr_connection_pool_delete(created);
+
+ done:
+	if (!pool) {
+		radlog(L_ERR, "rlm_redis (%s): No connections available to %s:%d",
+		       inst->xlat_name, node->hostname, node->port);
+	}
+
+	return pool;
+}
+
+/*
+ *	Re-build the slot map from the output of CLUSTER SLOTS.
+ */
+static int redis_cluster_refresh(REDIS_INST *inst, redisContext *conn,
+				 const char *default_hostname)
+{
+	size_t i, j;
+	int slot, start, end;
+	const char *hostname;
+	redisReply *reply, *range, *addr;
+	redis_node_t *node, *replica;
+
+	reply = redisCommand(conn, "CLUSTER SLOTS");
+	if (!reply || (reply->type != REDIS_REPLY_ARRAY)) {
+		radlog(L_ERR, "rlm_redis (%s): Failed to run CLUSTER SLOTS%s%s",
+		       inst->xlat_name,
+		       (reply && reply->str) ? ": " : "",
+		       (reply && reply->str) ? reply->str : "");
+		if (reply) freeReplyObject(reply);
+		return -1;
+	}
+
+	PTHREAD_MUTEX_LOCK(&inst->cluster_state->mutex);
+	inst->cluster_state->last_refresh = time(NULL);
+
+	for (i = 0; i < reply->elements; i++) {
+		range = reply->element[i];
+
+		if ((range->type != REDIS_REPLY_ARRAY) ||
+		    (range->elements < 3) ||
+		    (range->element[0]->type != REDIS_REPLY_INTEGER) ||
+		    (range->element[1]->type != REDIS_REPLY_INTEGER)) {
+			continue;
+		}
+
+		node = NULL;
+		for (j = 2; j < range->elements; j++) {
+			addr = range->element[j];
+
+			if ((addr->type != REDIS_REPLY_ARRAY) ||
+			    (addr->elements < 2) ||
+			    (addr->element[0]->type != REDIS_REPLY_STRING) ||
+			    (addr->element[1]->type != REDIS_REPLY_INTEGER)) {
+				continue;
+			}
+
+			hostname = addr->element[0]->str;
+			if (!*hostname) hostname = default_hostname;
+
+			/*
+			 *	The first address is the master, the
+			 *	rest are its replicas.
+			 */
+			replica = redis_node_find(inst, hostname,
+						  addr->element[1]->integer);
+			if (!node) {
+				node = replica;
+				node->num_replicas = 0;
+				continue;
+			}
+
+			if (node->num_replicas < REDIS_MAX_REPLICAS) {
+				node->replicas[node->num_replicas++] = replica;
+			}
+		}
+
+		if (!node) continue;
+
+		start = range->element[0]->integer;
+		end = range->element[1]->integer;
+		if (start < 0) start = 0;
+		if (end >= REDIS_CLUSTER_SLOTS) end = REDIS_CLUSTER_SLOTS - 1;
+
+		for (slot = start; slot <= end; slot++) {
+			inst->cluster_state->slots[slot] = node;
+		}
+
+		DEBUG2("rlm_redis (%s): Slots %d-%d are served by %s:%d (%d replicas)",
+		       inst->xlat_name, start, end, node->hostname, node->port,
+		       node->num_replicas);
+	}
+
+	PTHREAD_MUTEX_UNLOCK(&inst->cluster_state->mutex);
+
+	freeReplyObject(reply);
+
+	return 0;
+}
+
+/*
+ *	Find the node to send a query for a slot to.
+ */
+static redis_node_t *redis_cluster_node(REDIS_INST *inst, int slot,
+					int readonly)
+{
+	redis_node_t *node;
+	redis_cluster_t *cluster = inst->cluster_state;
+
+	if (slot < 0) return cluster->seed;
+
+	PTHREAD_MUTEX_LOCK(&cluster->mutex);
+	node = cluster->slots[slot];
+	if (!node) {
+		node = cluster->seed;
+
+	} else if (readonly && (node->num_replicas > 0)) {
+		node = node->replicas[cluster->next_replica++ % node->num_replicas];
+	}
+	PTHREAD_MUTEX_UNLOCK(&cluster->mutex);
+
+	return node;
+}
+
+/*
+ *	Check for a MOVED or ASK redirect.
+ *
+ *	For MOVED, the slot map is updated, and the query is re-routed
+ *	through it.  For ASK, the node to ask is returned in "ask".
+ *
+ *	Returns 1 if the reply was a redirect, in which case it is
+ *	freed, otherwise 0.
+ */
+static int redis_cluster_redirect(REDIS_INST *inst, REDISSOCK *dissocket,
+				  redis_node_t *node, redisReply *reply,
+				  redis_node_t **ask)
+{
+	int moved, refresh, slot;
+	char *p, *q;
+	char hostname[256];
+	size_t len;
+	redis_node_t *target;
+	time_t now;
+
+	if (reply->type != REDIS_REPLY_ERROR) return 0;
+
+	if (strncmp(reply->str, "MOVED ", 6) == 0) {
+		moved = 1;
+		p = reply->str + 6;
+
+	} else if (strncmp(reply->str, "ASK ", 4) == 0) {
+		moved = 0;
+		p = reply->str + 4;
+
+	} else {
+		return 0;
+	}
+
+	slot = strtol(p, &q, 10);
+	if ((q == p) || (*q != ' ') ||
+	    (slot < 0) || (slot >= REDIS_CLUSTER_SLOTS)) {
+		return 0;
+	}
+	q++;
+
+	p = strrchr(q, ':');
+	if (!p) return 0;
+
+	len = p - q;
+	if (len >= sizeof(hostname)) return 0;
+	memcpy(hostname, q, len);
+	hostname[len] = '\0';
+
+	DEBUG2("rlm_redis (%s): %s", inst->xlat_name, reply->str);
+
+	refresh = 0;
+
+	PTHREAD_MUTEX_LOCK(&inst->cluster_state->mutex);
+	target = redis_node_find(inst, len ? hostname : node->hostname,
+				 atoi(p + 1));
+
+	/*
+	 *	If a slot has moved, the others probably have, too.
+	 *	Re-read the slot map, but not more than once a
+	 *	second.
+	 */
+	if (moved) {
+		inst->cluster_state->slots[slot] = target;
+
+		now = time(NULL);
+		if (inst->cluster_state->last_refresh != now) {
+			inst->cluster_state->last_refresh = now;
+			refresh = 1;
+		}
+	}
+	PTHREAD_MUTEX_UNLOCK(&inst->cluster_state->mutex);
+
+	freeReplyObject(reply);
+
+	if (refresh) {
+		redis_cluster_refresh(inst, dissocket->conn, node->hostname);
+	}
+
+	*ask = moved ? NULL : target;
+
+	return 1;
+}
+
+/*
+ *	Run one command against a pool, re-connecting if necessary.
+ *
+ *	The reply is left in dissocket->reply.
+ */
+static int redis_command(REDIS_INST *inst, fr_connection_pool_t *pool,
+			 REDISSOCK **dissocket_p, const char *query)
+{
+	REDISSOCK *dissocket;
+
+	dissocket = *dissocket_p;
+
+	DEBUG2("executing query %s", query);
+	dissocket->reply = redisCommand(dissocket->conn, query);
+
+	if (!dissocket->reply) {
+		radlog(L_ERR, "rlm_redis: (%s) REDIS error: %s",
+		       inst->xlat_name, dissocket->conn->errstr);
+
+		dissocket = fr_connection_reconnect(pool, dissocket);
+		if (!dissocket) {
+		error:
+			*dissocket_p = NULL;
+			return -1;
+		}
+
+		dissocket->reply = redisCommand(dissocket->conn, query);
+		if (!dissocket->reply) {
+			radlog(L_ERR, "rlm_redis (%s): failed after re-connect",
+			       inst->xlat_name);
+			fr_connection_del(pool, dissocket);
+			goto error;
+		}
+
+		*dissocket_p = dissocket;
+	}
+
+	return 0;
+}
+
+/*
+ *	Run one command against the cluster, following redirects.
+ */
+static redisReply *redis_cluster_command(REDIS_INST *inst, int slot,
+					 char *query, int readonly,
+					 redis_node_t *ask)
+{
+	int i;
+	redis_node_t *node;
+	fr_connection_pool_t *pool;
+	REDISSOCK *dissocket;
+	redisReply *reply;
+
+	for (i = 0; i <= REDIS_MAX_REDIRECTS; i++) {
+		node = ask ? ask : redis_cluster_node(inst, slot, readonly);
+
+		pool = redis_node_pool(inst, node);
+		if (!pool) {
+			/*
+			 *	Fall back to the master.
+			 */
+			if (readonly && !ask) {
+				readonly = 0;
+				continue;
+			}
+			return NULL;
+		}
+
+		dissocket = fr_connection_get(pool);
+		if (!dissocket) {
+			radlog(L_ERR, "rlm_redis (%s): No connections available to %s:%d",
+			       inst->xlat_name, node->hostname, node->port);
+			if (readonly && !ask) {
+				readonly = 0;
+				continue;
+			}
+			return NULL;
+		}
+
+		if (ask) {
+			if (redis_command(inst, pool, &dissocket, "ASKING") < 0) {
+				return NULL;
+			}
+			rlm_redis_finish_query(dissocket);
+		}
+
+		if (redis_command(inst, pool, &dissocket, query) < 0) {
+			return NULL;
+		}
+
+		reply = dissocket->reply;
+		dissocket->reply = NULL;
+
+		if (!redis_cluster_redirect(inst, dissocket, node, reply, &ask)) {
+			fr_connection_release(pool, dissocket);
+			return reply;
+		}
+
+		fr_connection_release(pool, dissocket);
+	}
+
+	radlog(L_ERR, "rlm_redis (%s): Too many redirects for query %s",
+	       inst->xlat_name, query);
+
+	return NULL;
+}
+
 static size_t redis_escape_func(UNUSED REQUEST *request,
 	char *out, size_t outlen, const char *in, UNUSED void *arg)
 {
@@ -190,6 +754,8 @@ static size_t redis_xlat(void *instance, REQUEST *request,
 {
 	REDIS_INST *inst = instance;
 	REDISSOCK *dissocket;
+	redisReply *reply;
+	int slot;
 	size_t ret = 0;
 	char *buffer_ptr;
 	char buffer[21];
@@ -203,32 +769,58 @@ static size_t redis_xlat(void *instance, REQUEST *request,
 		return 0;
 	}
 
-	dissocket = fr_connection_get(inst->pool);
-	if (!dissocket) {
-		radlog(L_ERR, "rlm_redis (%s): redis_get_socket() failed",
-		       inst->xlat_name);
-        
-		return 0;
-	}
+	slot = -1;
+	if (inst->cluster) slot = redis_query_slot(querystr);
 
-	/* Query failed for some reason, release socket and return */
-	if (rlm_redis_query(&dissocket, inst, querystr) < 0) {
-		goto release;
+	/*
+	 *	Keyed commands are sent to the node which serves the
+	 *	slot, so they don't need a connection to the seed.
+	 */
+	if (slot >= 0) {
+		dissocket = NULL;
+		reply = redis_cluster_command(inst, slot, querystr,
+					      inst->read_replicas &&
+					      redis_query_readonly(querystr),
+					      NULL);
+		if (!reply) return 0;
+
+		if (reply->type == REDIS_REPLY_ERROR) {
+			radlog(L_ERR, "rlm_redis (%s): query failed, %s",
+			       inst->xlat_name, querystr);
+			goto release;
+		}
+
+	} else {
+		dissocket = fr_connection_get(inst->pool);
+		if (!dissocket) {
+			radlog(L_ERR, "rlm_redis (%s): redis_get_socket() failed",
+			       inst->xlat_name);
+
+			return 0;
+		}
+
+		/* Query failed for some reason, release socket and return */
+		if (redis_query(&dissocket, inst, querystr, 0) < 0) {
+			reply = NULL;
+			goto release;
+		}
+
+		reply = dissocket->reply;
 	}
 
-        switch (dissocket->reply->type) {
+        switch (reply->type) {
 	case REDIS_REPLY_INTEGER:
                 buffer_ptr = buffer;
                 snprintf(buffer_ptr, sizeof(buffer), "%lld",
-			 dissocket->reply->integer);
+			 reply->integer);
 
                 ret = strlen(buffer_ptr);
                 break;
 
 	case REDIS_REPLY_STATUS:
 	case REDIS_REPLY_STRING:
-                buffer_ptr = dissocket->reply->str;
-                ret = dissocket->reply->len;
+                buffer_ptr = reply->str;
+                ret = reply->len;
                 break;
 
 	default:
@@ -242,13 +834,17 @@ static size_t redis_xlat(void *instance, REQUEST *request,
 		ret = 0;
 		goto release;
 	}
-	
+
 	strlcpy(out, buffer_ptr, freespace);
 
 release:
-	rlm_redis_finish_query(dissocket);
-	fr_connection_release(inst->pool, dissocket);
-	
+	if (dissocket) {
+		rlm_redis_finish_query(dissocket);
+		fr_connection_release(inst->pool, dissocket);
+	} else if (reply) {
+		freeReplyObject(reply);
+	}
+
 	return ret;
 }
 
@@ -259,63 +855,298 @@ release:
 static int redis_detach(void *instance)
 {
 	REDIS_INST *inst = instance;
+	redis_node_t *node, *next;
 
-	fr_connection_pool_delete(inst->pool);
+	if (inst->cluster_state) {
+		for (node = inst->cluster_state->nodes; node != NULL; node = next) {
+			next = node->next;
+
+			if (node->pool) fr_connection_pool_delete(node->pool);
+			free(node->hostname);
+			free(node);
+		}
+
+#ifdef HAVE_PTHREAD_H
+		pthread_mutex_destroy(&inst->cluster_state->mutex);
+#endif
+		free(inst->cluster_state);
+	}
 
 	if (inst->xlat_name) {
 		xlat_unregister(inst->xlat_name, redis_xlat, instance);
 		free(inst->xlat_name);
 	}
-	free(inst->xlat_name);
 	free(inst);
 
 	return 0;
 }
 
 /*
- *	Query the redis database
+ *	Query the redis database, or the cluster.
  */
-int rlm_redis_query(REDISSOCK **dissocket_p, REDIS_INST *inst, char *query)
+static int redis_query(REDISSOCK **dissocket_p, REDIS_INST *inst,
+		       char *query, int readonly)
 {
+	int slot;
 	REDISSOCK *dissocket;
 
 	if (!query || !*query || !inst || !dissocket_p) {
 		return -1;
 	}
 
+	slot = -1;
+	if (inst->cluster) slot = redis_query_slot(query);
+
+	/*
+	 *	Commands without keys go to the server the
+	 *	connection came from.
+	 */
+	if (slot < 0) {
+		if (redis_command(inst, inst->pool, dissocket_p, query) < 0) {
+			return -1;
+		}
+
+	} else {
+		(*dissocket_p)->reply = redis_cluster_command(inst, slot, query,
+							      readonly, NULL);
+		if (!(*dissocket_p)->reply) return -1;
+	}
+
 	dissocket = *dissocket_p;
 
-	DEBUG2("executing query %s", query);
-	dissocket->reply = redisCommand(dissocket->conn, query);
+	if (dissocket->reply->type == REDIS_REPLY_ERROR) {
+		radlog(L_ERR, "rlm_redis (%s): query failed, %s",
+		       inst->xlat_name, query);
+		return -1;
+	}
 
-	if (!dissocket->reply) {
+	return 0;
+}
+
+int rlm_redis_query(REDISSOCK **dissocket_p, REDIS_INST *inst, char *query)
+{
+	return redis_query(dissocket_p, inst, query, 0);
+}
+
+/*
+ *	Write all of the queries to the connection, and then read
+ *	all of the replies.
+ */
+static int redis_pipeline_send(redisContext *conn, int count,
+			       char **queries, redisReply **replies)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (redisAppendCommand(conn, queries[i]) != REDIS_OK) {
+			return -1;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		if (redisGetReply(conn, (void **) &replies[i]) != REDIS_OK) {
+			while (i-- > 0) {
+				freeReplyObject(replies[i]);
+				replies[i] = NULL;
+			}
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ *	Run a pipeline against one pool, re-connecting if necessary.
+ */
+static int redis_pipeline(REDIS_INST *inst, fr_connection_pool_t *pool,
+			  REDISSOCK **dissocket_p, int count,
+			  char **queries, redisReply **replies)
+{
+	REDISSOCK *dissocket;
+
+	dissocket = *dissocket_p;
+
+	if (redis_pipeline_send(dissocket->conn, count, queries, replies) < 0) {
 		radlog(L_ERR, "rlm_redis: (%s) REDIS error: %s",
 		       inst->xlat_name, dissocket->conn->errstr);
 
-		dissocket = fr_connection_reconnect(inst->pool, dissocket);
+		dissocket = fr_connection_reconnect(pool, dissocket);
 		if (!dissocket) {
 		error:
 			*dissocket_p = NULL;
 			return -1;
 		}
 
-		dissocket->reply = redisCommand(dissocket->conn, query);
-		if (!dissocket->reply) {
+		if (redis_pipeline_send(dissocket->conn, count, queries,
+					replies) < 0) {
 			radlog(L_ERR, "rlm_redis (%s): failed after re-connect",
 			       inst->xlat_name);
-			fr_connection_del(inst->pool, dissocket);
+			fr_connection_del(pool, dissocket);
 			goto error;
 		}
 
 		*dissocket_p = dissocket;
 	}
 
-	if (dissocket->reply->type == REDIS_REPLY_ERROR) {
-		radlog(L_ERR, "rlm_redis (%s): query failed, %s",
-		       inst->xlat_name, query);
+	return 0;
+}
+
+/*
+ *	Split a pipeline up by cluster node, and send each part to
+ *	its node.  Queries without keys use the caller's connection.
+ */
+static int redis_cluster_pipeline(REDISSOCK **dissocket_p, REDIS_INST *inst,
+				  int count, char **queries,
+				  redisReply **replies)
+{
+	int i, j, num, rcode = 0;
+	int *slots, *index;
+	char **subset;
+	redisReply **subreplies;
+	redis_node_t **nodes, *node, *ask;
+	fr_connection_pool_t *pool;
+	REDISSOCK *dissocket;
+
+	slots = rad_malloc(sizeof(slots[0]) * count);
+	index = rad_malloc(sizeof(index[0]) * count);
+	subset = rad_malloc(sizeof(subset[0]) * count);
+	subreplies = rad_malloc(sizeof(subreplies[0]) * count);
+	nodes = rad_malloc(sizeof(nodes[0]) * count);
+
+	for (i = 0; i < count; i++) {
+		slots[i] = redis_query_slot(queries[i]);
+		nodes[i] = redis_cluster_node(inst, slots[i], 0);
+	}
+
+	for (i = 0; i < count; i++) {
+		if (!nodes[i]) continue;
+		node = nodes[i];
+
+		num = 0;
+		for (j = i; j < count; j++) {
+			if (nodes[j] != node) continue;
+
+			index[num] = j;
+			subset[num++] = queries[j];
+			nodes[j] = NULL;
+		}
+
+		if (node == inst->cluster_state->seed) {
+			if (redis_pipeline(inst, inst->pool, dissocket_p, num,
+					   subset, subreplies) < 0) {
+				rcode = -1;
+				break;
+			}
+
+		} else {
+			pool = redis_node_pool(inst, node);
+			if (!pool) {
+				rcode = -1;
+				break;
+			}
+
+			dissocket = fr_connection_get(pool);
+			if (!dissocket) {
+				radlog(L_ERR, "rlm_redis (%s): No connections available to %s:%d",
+				       inst->xlat_name, node->hostname, node->port);
+				rcode = -1;
+				break;
+			}
+
+			if (redis_pipeline(inst, pool, &dissocket, num,
+					   subset, subreplies) < 0) {
+				rcode = -1;
+				break;
+			}
+
+			fr_connection_release(pool, dissocket);
+		}
+
+		for (j = 0; j < num; j++) {
+			replies[index[j]] = subreplies[j];
+		}
+
+		/*
+		 *	Re-send anything which was redirected.  They're
+		 *	re-sent in order, so commands for the same key
+		 *	are still run in order.
+		 */
+		for (j = 0; j < num; j++) {
+			if (!redis_cluster_redirect(inst, *dissocket_p, node,
+						    replies[index[j]], &ask)) {
+				continue;
+			}
+
+			replies[index[j]] = redis_cluster_command(inst,
+								  slots[index[j]],
+								  subset[j], 0,
+								  ask);
+			if (!replies[index[j]]) {
+				rcode = -1;
+				break;
+			}
+		}
+		if (rcode < 0) break;
+	}
+
+	free(slots);
+	free(index);
+	free(subset);
+	free(subreplies);
+	free(nodes);
+
+	if (rcode < 0) {
+		for (i = 0; i < count; i++) {
+			if (replies[i]) freeReplyObject(replies[i]);
+			replies[i] = NULL;
+		}
+	}
+
+	return rcode;
+}
+
+/*
+ *	Run multiple queries in one round trip.
+ *
+ *	The replies are returned in "replies", in the same order as the
+ *	queries, and must be freed by the caller with freeReplyObject().
+ *	Replies of type REDIS_REPLY_ERROR are not treated as a failure
+ *	of the pipeline.
+ */
+int rlm_redis_pipeline(REDISSOCK **dissocket_p, REDIS_INST *inst,
+		       int count, char **queries, redisReply **replies)
+{
+	int i;
+
+	if (!inst || !dissocket_p || !queries || !replies || (count <= 0)) {
+		return -1;
+	}
+
+	if (debug_flag > 1) for (i = 0; i < count; i++) {
+		DEBUG2("pipelining query %s", queries[i]);
+	}
+
+	memset(replies, 0, sizeof(replies[0]) * count);
+
+	if (inst->cluster) {
+		if (redis_cluster_pipeline(dissocket_p, inst, count,
+					   queries, replies) < 0) {
+			return -1;
+		}
+
+	} else if (redis_pipeline(inst, inst->pool, dissocket_p, count,
+				  queries, replies) < 0) {
 		return -1;
 	}
 
+	for (i = 0; i < count; i++) {
+		if (replies[i]->type == REDIS_REPLY_ERROR) {
+			radlog(L_ERR, "rlm_redis (%s): query failed, %s: %s",
+			       inst->xlat_name, queries[i], replies[i]->str);
+		}
+	}
+
 	return 0;
 }
 
@@ -337,6 +1168,7 @@ static int redis_instantiate(CONF_SECTION *conf, void **instance)
 {
 	REDIS_INST *inst;
 	const char *xlat_name;
+	REDISSOCK *dissocket;
 
 	/*
 	 *	Set up a storage area for instance data
@@ -364,16 +1196,63 @@ static int redis_instantiate(CONF_SECTION *conf, void **instance)
 	inst->xlat_name = strdup(xlat_name);
 	xlat_register(inst->xlat_name, redis_xlat, inst);
 
-	inst->pool = fr_connection_pool_init(conf, inst,
+	inst->cs = conf;
+
+	if (inst->cluster && inst->database) {
+		radlog(L_INFO, "rlm_redis (%s): Ignoring database, as Redis Cluster only supports database 0",
+		       inst->xlat_name);
+		inst->database = 0;
+	}
+
+	if (!inst->cluster && inst->read_replicas) {
+		radlog(L_INFO, "rlm_redis (%s): Ignoring read_replicas, as cluster is not enabled",
+		       inst->xlat_name);
+		inst->read_replicas = 0;
+	}
+
+	inst->cluster_state = rad_malloc(sizeof(*inst->cluster_state));
+	memset(inst->cluster_state, 0, sizeof(*inst->cluster_state));
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_init(&inst->cluster_state->mutex, NULL);
+#endif
+
+	inst->cluster_state->seed = redis_node_find(inst, inst->hostname,
+						    inst->port);
+
+	inst->pool = fr_connection_pool_init(conf, inst->cluster_state->seed,
 					     redis_create_conn, NULL,
 					     redis_delete_conn);
 	if (!inst->pool) {
 		redis_detach(inst);
 		return -1;
 	}
+	inst->cluster_state->seed->pool = inst->pool;
+
+	/*
+	 *	Discover the rest of the cluster.
+	 */
+	if (inst->cluster) {
+		dissocket = fr_connection_get(inst->pool);
+		if (!dissocket) {
+			radlog(L_ERR, "rlm_redis (%s): No connections available to %s:%d",
+			       inst->xlat_name, inst->hostname, inst->port);
+			redis_detach(inst);
+			return -1;
+		}
+
+		if (redis_cluster_refresh(inst, dissocket->conn,
+					  inst->hostname) < 0) {
+			fr_connection_release(inst->pool, dissocket);
+			redis_detach(inst);
+			return -1;
+		}
+
+		fr_connection_release(inst->pool, dissocket);
+	}
 
 	inst->redis_query = rlm_redis_query;
 	inst->redis_finish_query = rlm_redis_finish_query;
+	inst->redis_pipeline = rlm_redis_pipeline;
 	inst->redis_escape_func = redis_escape_func;
 
 	*instance = inst;
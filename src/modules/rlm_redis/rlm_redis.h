@@ -40,6 +40,8 @@ typedef struct redis_socket_t {
 } REDISSOCK;
 
 typedef struct rlm_redis_t REDIS_INST;
+typedef struct redis_node_t redis_node_t;
+typedef struct redis_cluster_t redis_cluster_t;
 
 typedef struct rlm_redis_t {
         char            *xlat_name;
@@ -48,9 +50,16 @@ typedef struct rlm_redis_t {
         int             port;
 	int		database;
 	char		*password;
+	int		cluster;
+	int		read_replicas;
+
+	CONF_SECTION	*cs;
 	fr_connection_pool_t *pool;
+	redis_cluster_t	*cluster_state;
 
         int (*redis_query)(REDISSOCK **dissocket_p, REDIS_INST *inst, char *query);
+        int (*redis_pipeline)(REDISSOCK **dissocket_p, REDIS_INST *inst,
+			      int count, char **queries, redisReply **replies);
         int (*redis_finish_query)(REDISSOCK *dissocket);
         size_t (*redis_escape_func)(REQUEST *request, char *out, size_t outlen, const char *in, void *);
 
@@ -60,6 +69,8 @@ typedef struct rlm_redis_t {
 
 int rlm_redis_query(REDISSOCK **dissocket_p, REDIS_INST *inst, char *query);
 int rlm_redis_finish_query(REDISSOCK *dissocket);
+int rlm_redis_pipeline(REDISSOCK **dissocket_p, REDIS_INST *inst,
+		       int count, char **queries, redisReply **replies);
 
 #endif	/* RLM_REDIS_H */
 
@@ -31,6 +31,24 @@ RCSID("$Id$")
 
 #include <rlm_redis.h>
 
+/*
+ *	The commands for one accounting request, which are sent to
+ *	the server together.
+ */
+typedef struct rediswho_cmds_t {
+	int		count;
+	char		*queries[3];
+	char		buffer[3][MAX_STRING_LEN * 4];
+
+	rlm_rcode_t	rcode;
+	int		state;
+	struct rediswho_cmds_t *next;
+} rediswho_cmds_t;
+
+#define REDISWHO_PENDING	(0)
+#define REDISWHO_SENDING	(1)
+#define REDISWHO_DONE		(2)
+
 typedef struct rlm_rediswho_t {
 	const char *xlat_name;
 	CONF_SECTION *cs;
@@ -47,6 +65,23 @@ typedef struct rlm_rediswho_t {
 	 *	How many session updates to keep track of per user
 	 */
 	int trim_count;             
+
+	/*
+	 *	Send the commands for up to this many requests in one
+	 *	pipeline, waiting no more than batch_delay milliseconds
+	 *	for the batch to fill.
+	 */
+	int batch_size;
+	int batch_delay;
+
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_t	batch_mutex;
+	pthread_cond_t	batch_cond;
+	rediswho_cmds_t	*batch_head;
+	rediswho_cmds_t	**batch_tail;
+	int		batch_count;
+	struct timeval	batch_when;
+#endif
 } rlm_rediswho_t;
 
 static CONF_PARSER module_config[] = {
@@ -54,72 +89,208 @@ static CONF_PARSER module_config[] = {
 	  offsetof(rlm_rediswho_t, redis_instance_name), NULL, "redis"},
 	{ "trim-count", PW_TYPE_INTEGER,
 	  offsetof(rlm_rediswho_t, trim_count), NULL, "-1"},
+	{ "batch-size", PW_TYPE_INTEGER,
+	  offsetof(rlm_rediswho_t, batch_size), NULL, "0"},
+	{ "batch-delay", PW_TYPE_INTEGER,
+	  offsetof(rlm_rediswho_t, batch_delay), NULL, "10"},
 	{ NULL, -1, 0, NULL, NULL}
 };
 
 /*
- *	Query the database executing a command with no result rows
+ *	Expand a command, and add it to the list of commands for
+ *	this request.  Commands which expand to nothing are skipped.
  */
-static int rediswho_command(const char *fmt, REDISSOCK **dissocket_p,
-			    rlm_rediswho_t *inst, REQUEST *request)
+static int rediswho_expand(rlm_rediswho_t *inst, REQUEST *request,
+			   const char *fmt, rediswho_cmds_t *cmds)
 {
-	REDISSOCK *dissocket;
-	char query[MAX_STRING_LEN * 4];
-	int result = 0;
+	char *query;
 
 	if (!fmt) {
 		return 0;
 	}
 
+	query = cmds->buffer[cmds->count];
+
 	/*
 	 *	Do an xlat on the provided string
 	 */
-	if (request) {
-		if (!radius_xlat(query, sizeof (query), fmt, request,
-				 inst->redis_inst->redis_escape_func,
-				 inst->redis_inst)) {
-			radlog(L_ERR, "rediswho_command: xlat failed on: '%s'", query);
-			return 0;
+	if (!radius_xlat(query, sizeof(cmds->buffer[0]), fmt, request,
+			 inst->redis_inst->redis_escape_func,
+			 inst->redis_inst)) {
+		radlog(L_ERR, "rediswho_command: xlat failed on: '%s'", fmt);
+		return -1;
+	}
+
+	cmds->queries[cmds->count++] = query;
+
+	return 0;
+}
+
+/*
+ *	Send the commands for one or more requests in a single
+ *	pipeline, and set the result for each request.
+ */
+static void rediswho_flush(rlm_rediswho_t *inst, rediswho_cmds_t *head)
+{
+	int i, j, count = 0;
+	char **queries;
+	redisReply **replies;
+	REDISSOCK *dissocket;
+	rediswho_cmds_t *cmds;
+
+	for (cmds = head; cmds != NULL; cmds = cmds->next) {
+		cmds->rcode = RLM_MODULE_FAIL;
+		count += cmds->count;
+	}
+
+	queries = rad_malloc(sizeof(queries[0]) * count);
+	replies = rad_malloc(sizeof(replies[0]) * count);
+
+	i = 0;
+	for (cmds = head; cmds != NULL; cmds = cmds->next) {
+		for (j = 0; j < cmds->count; j++) {
+			queries[i++] = cmds->queries[j];
 		}
+	}
 
-	} else {
-		strcpy(query, fmt);
+	dissocket = fr_connection_get(inst->redis_inst->pool);
+	if (!dissocket) {
+		radlog(L_ERR, "rediswho: cannot allocate redis connection");
+		goto done;
 	}
 
-	if (inst->redis_inst->redis_query(dissocket_p, inst->redis_inst, query) < 0) {
+	if (inst->redis_inst->redis_pipeline(&dissocket, inst->redis_inst,
+					     count, queries, replies) < 0) {
+		radlog(L_ERR, "rediswho_command: database query error");
+		goto release;
+	}
 
-		radlog(L_ERR, "rediswho_command: database query error in: '%s'", query);
-		return -1;
+	i = 0;
+	for (cmds = head; cmds != NULL; cmds = cmds->next) {
+		cmds->rcode = RLM_MODULE_OK;
+
+		for (j = 0; j < cmds->count; j++, i++) {
+			switch (replies[i]->type) {
+			case REDIS_REPLY_INTEGER:
+				DEBUG("rediswho_command: query response %lld\n",
+				      replies[i]->integer);
+				break;
+			case REDIS_REPLY_STATUS:
+			case REDIS_REPLY_STRING:
+				DEBUG("rediswho_command: query response %s\n",
+				      replies[i]->str);
+				break;
+			case REDIS_REPLY_ERROR:
+				cmds->rcode = RLM_MODULE_FAIL;
+				break;
+			default:
+				break;
+			}
+
+			freeReplyObject(replies[i]);
+		}
+	}
+
+release:
+	if (dissocket) fr_connection_release(inst->redis_inst->pool, dissocket);
 
+done:
+	free(queries);
+	free(replies);
+}
+
+#ifdef HAVE_PTHREAD_H
+/*
+ *	Add the commands to the current batch, and wait for the
+ *	batch to be sent.
+ *
+ *	The batch is sent by whichever request fills it, or by the
+ *	first request to notice that batch_delay has passed.  Other
+ *	requests may start a new batch while one is being sent.
+ */
+static rlm_rcode_t rediswho_batch(rlm_rediswho_t *inst, rediswho_cmds_t *cmds)
+{
+	struct timeval now;
+	struct timespec when;
+	rediswho_cmds_t *head, *next;
+
+	cmds->state = REDISWHO_PENDING;
+	cmds->next = NULL;
+
+	pthread_mutex_lock(&inst->batch_mutex);
+
+	*inst->batch_tail = cmds;
+	inst->batch_tail = &cmds->next;
+	if (inst->batch_count++ == 0) {
+		gettimeofday(&inst->batch_when, NULL);
+		inst->batch_when.tv_sec += inst->batch_delay / 1000;
+		inst->batch_when.tv_usec += (inst->batch_delay % 1000) * 1000;
+		if (inst->batch_when.tv_usec >= 1000000) {
+			inst->batch_when.tv_sec++;
+			inst->batch_when.tv_usec -= 1000000;
+		}
 	}
-	dissocket = *dissocket_p;
-
-	switch (dissocket->reply->type) {
-	case REDIS_REPLY_INTEGER:
-		DEBUG("rediswho_command: query response %lld\n",
-		      dissocket->reply->integer);
-		if (dissocket->reply->integer > 0)
-			result = dissocket->reply->integer;
-		break;
-	case REDIS_REPLY_STATUS:
-	case REDIS_REPLY_STRING:
-		DEBUG("rediswho_command: query response %s\n",
-		      dissocket->reply->str);
-		break;
-	default:
-		break;
+
+	while (cmds->state != REDISWHO_DONE) {
+		if (cmds->state != REDISWHO_PENDING) {
+			pthread_cond_wait(&inst->batch_cond, &inst->batch_mutex);
+			continue;
+		}
+
+		gettimeofday(&now, NULL);
+		if ((inst->batch_count < inst->batch_size) &&
+		    timercmp(&now, &inst->batch_when, <)) {
+			when.tv_sec = inst->batch_when.tv_sec;
+			when.tv_nsec = inst->batch_when.tv_usec * 1000;
+			pthread_cond_timedwait(&inst->batch_cond,
+					       &inst->batch_mutex, &when);
+			continue;
+		}
+
+		/*
+		 *	Take the current batch, and send it.
+		 */
+		head = inst->batch_head;
+		for (next = head; next != NULL; next = next->next) {
+			next->state = REDISWHO_SENDING;
+		}
+		inst->batch_head = NULL;
+		inst->batch_tail = &inst->batch_head;
+		inst->batch_count = 0;
+
+		pthread_mutex_unlock(&inst->batch_mutex);
+		rediswho_flush(inst, head);
+		pthread_mutex_lock(&inst->batch_mutex);
+
+		/*
+		 *	The entries live on the stacks of the waiting
+		 *	requests, so don't touch them once they're done.
+		 */
+		while (head) {
+			next = head->next;
+			head->state = REDISWHO_DONE;
+			head = next;
+		}
+		pthread_cond_broadcast(&inst->batch_cond);
 	}
 
-	(inst->redis_inst->redis_finish_query)(dissocket);
+	pthread_mutex_unlock(&inst->batch_mutex);
 
-	return result;
+	return cmds->rcode;
 }
+#endif
 
 static int rediswho_detach(void *instance)
 {
 	rlm_rediswho_t *inst;
 
 	inst = instance;
+#ifdef HAVE_PTHREAD_H
+	if (inst->batch_tail) {
+		pthread_mutex_destroy(&inst->batch_mutex);
+		pthread_cond_destroy(&inst->batch_cond);
+	}
+#endif
 	free(inst);
 
 	return 0;
@@ -175,46 +346,33 @@ static int rediswho_instantiate(CONF_SECTION * conf, void ** instance)
 
 	inst->redis_inst = (REDIS_INST *) modinst->insthandle;
 
-	return 0;
-}
-
-static int rediswho_accounting_all(REDISSOCK **dissocket_p,
-				   rlm_rediswho_t *inst, REQUEST *request,
-				   const char *insert,
-				   const char *trim,
-				   const char *expire)
-{
-	int result;
-
-	result = rediswho_command(insert, dissocket_p, inst, request);
-	if (result < 0) {
-		return RLM_MODULE_FAIL;
-	}
-
-	/* Only trim if necessary */
-	if (inst->trim_count >= 0 && result > inst->trim_count) {
-		if (rediswho_command(trim, dissocket_p,
-				     inst, request) < 0) {
-			return RLM_MODULE_FAIL;
+	if (inst->batch_size > 1) {
+#ifdef HAVE_PTHREAD_H
+		if (inst->batch_delay <= 0) {
+			radlog(L_ERR, "rediswho: batch-delay must be greater than zero");
+			rediswho_detach(inst);
+			return -1;
 		}
-	}
 
-	if (rediswho_command(expire, dissocket_p, inst, request) < 0) {
-		return RLM_MODULE_FAIL;
+		pthread_mutex_init(&inst->batch_mutex, NULL);
+		pthread_cond_init(&inst->batch_cond, NULL);
+		inst->batch_tail = &inst->batch_head;
+#else
+		radlog(L_INFO, "rediswho: Ignoring batch-size, as the server was built without threads");
+		inst->batch_size = 0;
+#endif
 	}
 
-	return RLM_MODULE_OK;
+	return 0;
 }
 
 static rlm_rcode_t rediswho_accounting(void * instance, REQUEST * request)
 {
-	rlm_rcode_t rcode;
 	VALUE_PAIR * vp;
 	DICT_VALUE *dv;
 	CONF_SECTION *cs;
-	const char *insert, *trim, *expire;
 	rlm_rediswho_t *inst = (rlm_rediswho_t *) instance;
-	REDISSOCK *dissocket;
+	rediswho_cmds_t cmds;
 
 	vp = pairfind(request->packet->vps, PW_ACCT_STATUS_TYPE, 0, TAG_ANY);
 	if (!vp) {
@@ -234,24 +392,40 @@ static rlm_rcode_t rediswho_accounting(void * instance, REQUEST * request)
 		return RLM_MODULE_NOOP;
 	}
 
-	dissocket = fr_connection_get(inst->redis_inst->pool);
-	if (!dissocket) {
-		RDEBUG("cannot allocate redis connection");
+	/*
+	 *	All of the commands are sent in one pipeline, so we
+	 *	can't wait for the result of the insert to decide
+	 *	whether or not to trim.  LTRIM is a no-op on short
+	 *	lists, so we always send it.
+	 */
+	cmds.count = 0;
+	if ((rediswho_expand(inst, request,
+			     cf_pair_value(cf_pair_find(cs, "insert")),
+			     &cmds) < 0) ||
+	    ((inst->trim_count >= 0) &&
+	     (rediswho_expand(inst, request,
+			      cf_pair_value(cf_pair_find(cs, "trim")),
+			      &cmds) < 0)) ||
+	    (rediswho_expand(inst, request,
+			     cf_pair_value(cf_pair_find(cs, "expire")),
+			     &cmds) < 0)) {
 		return RLM_MODULE_FAIL;
 	}
 
-	insert = cf_pair_value(cf_pair_find(cs, "insert"));
-	trim = cf_pair_value(cf_pair_find(cs, "trim"));
-	expire = cf_pair_value(cf_pair_find(cs, "expire"));
+	if (cmds.count == 0) {
+		return RLM_MODULE_OK;
+	}
 
-	rcode = rediswho_accounting_all(&dissocket, inst, request,
-					insert,
-					trim,
-					expire);
+#ifdef HAVE_PTHREAD_H
+	if (inst->batch_size > 1) {
+		return rediswho_batch(inst, &cmds);
+	}
+#endif
 
-	if (dissocket) fr_connection_release(inst->redis_inst->pool, dissocket);
+	cmds.next = NULL;
+	rediswho_flush(inst, &cmds);
 
-	return rcode;
+	return cmds.rcode;
 }
 
 
@@ -30,6 +30,7 @@ RCSID("$Id$")
 #include <ctype.h>
 #include <string.h>
 #include <time.h>
+#include <fcntl.h>
 
 #include <freeradius-devel/radiusd.h>
 #include <freeradius-devel/libradius.h>
@@ -250,6 +251,314 @@ void rest_cleanup(void)
 	curl_global_cleanup();
 }
 
+#ifdef HAVE_PTHREAD_H
+/*
+ *	A transfer waiting for, or being processed by the multi thread.
+ */
+typedef struct rest_multi_xfer_t {
+	CURL			*candle;
+	CURLcode		result;
+	int			done;
+	struct rest_multi_xfer_t *next;
+} rest_multi_xfer_t;
+
+struct rlm_rest_multi_t {
+	rlm_rest_t		*instance;
+	CURLM			*mandle;
+
+	pthread_t		thread;
+	pthread_mutex_t		mutex;
+	pthread_cond_t		cond;		//!< Signalled when transfers
+						//!< complete.
+	int			wakeup[2];	//!< Pipe used to wake the
+						//!< thread for new transfers.
+	int			stop;
+
+	rest_multi_xfer_t	*pending;	//!< Submitted, not yet added
+						//!< to the multi handle.
+	rest_multi_xfer_t	**pending_tail;
+};
+
+/** Adds new transfers, and reports the ones which have finished.
+ *
+ * All transfers are driven by this one thread, which means libcurl can
+ * share connections (and HTTP/2 streams) between requests, and limit
+ * the number of connections to each host.
+ *
+ * @param[in] arg the rlm_rest_multi_t to run.
+ * @return NULL.
+ */
+static void *rest_multi_thread(void *arg)
+{
+	rlm_rest_multi_t	*multi = arg;
+	rest_multi_xfer_t	*xfer, *next;
+	CURLMsg			*msg;
+	CURLMcode		mret;
+#if LIBCURL_VERSION_NUM >= 0x071c00
+	struct curl_waitfd	extra;
+	int			numfds;
+#else
+	fd_set			read_fd, write_fd, except_fd;
+	struct timeval		tv;
+	long			timeout;
+	int			maxfd;
+#endif
+	int			running, left, completed;
+	char			buffer[64];
+	char			*priv;
+
+	for (;;) {
+		pthread_mutex_lock(&multi->mutex);
+		if (multi->stop) {
+			pthread_mutex_unlock(&multi->mutex);
+			break;
+		}
+
+		xfer = multi->pending;
+		multi->pending = NULL;
+		multi->pending_tail = &multi->pending;
+		pthread_mutex_unlock(&multi->mutex);
+
+		completed = 0;
+		while (xfer) {
+			next = xfer->next;
+
+			/*
+			 *	Can't be run, so report it as having
+			 *	finished with an error.
+			 */
+			mret = curl_multi_add_handle(multi->mandle,
+						     xfer->candle);
+			if (mret != CURLM_OK) {
+				radlog(L_ERR, "rlm_rest (%s): Failed adding "
+				       "transfer to multi handle: %i - %s",
+				       multi->instance->xlat_name,
+				       mret, curl_multi_strerror(mret));
+
+				pthread_mutex_lock(&multi->mutex);
+				xfer->result = CURLE_FAILED_INIT;
+				xfer->done = TRUE;
+				pthread_mutex_unlock(&multi->mutex);
+				completed++;
+			}
+			xfer = next;
+		}
+
+		curl_multi_perform(multi->mandle, &running);
+
+		while ((msg = curl_multi_info_read(multi->mandle, &left))) {
+			if (msg->msg != CURLMSG_DONE) continue;
+
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE,
+					  &priv);
+			xfer = (rest_multi_xfer_t *)(void *) priv;
+			curl_multi_remove_handle(multi->mandle,
+						 msg->easy_handle);
+
+			pthread_mutex_lock(&multi->mutex);
+			xfer->result = msg->data.result;
+			xfer->done = TRUE;
+			pthread_mutex_unlock(&multi->mutex);
+			completed++;
+		}
+		if (completed) pthread_cond_broadcast(&multi->cond);
+
+#if LIBCURL_VERSION_NUM >= 0x071c00
+		extra.fd = multi->wakeup[0];
+		extra.events = CURL_WAIT_POLLIN;
+		extra.revents = 0;
+
+		curl_multi_wait(multi->mandle, &extra, 1, 1000, &numfds);
+		if (!extra.revents) continue;
+#else
+		/*
+		 *	No curl_multi_wait() before 7.28.0, so select()
+		 *	on libcurl's sockets and the wakeup pipe.
+		 */
+		FD_ZERO(&read_fd);
+		FD_ZERO(&write_fd);
+		FD_ZERO(&except_fd);
+
+		maxfd = -1;
+		curl_multi_fdset(multi->mandle, &read_fd, &write_fd,
+				 &except_fd, &maxfd);
+		FD_SET(multi->wakeup[0], &read_fd);
+		if (multi->wakeup[0] > maxfd) maxfd = multi->wakeup[0];
+
+		timeout = -1;
+		curl_multi_timeout(multi->mandle, &timeout);
+		if ((timeout < 0) || (timeout > 1000)) timeout = 1000;
+
+		tv.tv_sec = timeout / 1000;
+		tv.tv_usec = (timeout % 1000) * 1000;
+
+		if (select(maxfd + 1, &read_fd, &write_fd, &except_fd,
+			   &tv) <= 0) continue;
+		if (!FD_ISSET(multi->wakeup[0], &read_fd)) continue;
+#endif
+
+		while (read(multi->wakeup[0], buffer, sizeof(buffer)) > 0) {
+			/* nothing */
+		}
+	}
+
+	return NULL;
+}
+
+/** Passes a transfer to the multi thread, and waits for it to complete.
+ *
+ * @param[in] multi handle to use.
+ * @param[in] candle configured easy handle.
+ * @return the result of the transfer.
+ */
+static CURLcode rest_multi_perform(rlm_rest_multi_t *multi, CURL *candle)
+{
+	rest_multi_xfer_t xfer;
+	CURLcode ret;
+
+	memset(&xfer, 0, sizeof(xfer));
+	xfer.candle = candle;
+
+	ret = curl_easy_setopt(candle, CURLOPT_PRIVATE, &xfer);
+	if (ret != CURLE_OK) return ret;
+
+	pthread_mutex_lock(&multi->mutex);
+	*multi->pending_tail = &xfer;
+	multi->pending_tail = &xfer.next;
+	pthread_mutex_unlock(&multi->mutex);
+
+	if (write(multi->wakeup[1], "", 1) < 0) {
+		/* the thread will pick it up within a second anyway */
+	}
+
+	pthread_mutex_lock(&multi->mutex);
+	while (!xfer.done) {
+		pthread_cond_wait(&multi->cond, &multi->mutex);
+	}
+	pthread_mutex_unlock(&multi->mutex);
+
+	return xfer.result;
+}
+#endif
+
+/** Creates the shared multi handle, and starts the thread which drives it.
+ *
+ * Does nothing if "multi" is not enabled.
+ *
+ * @see rest_multi_free
+ *
+ * @param[in] instance configuration data.
+ * @return TRUE on success, else FALSE.
+ */
+int rest_multi_init(rlm_rest_t *instance)
+{
+#ifdef HAVE_PTHREAD_H
+	rlm_rest_multi_t *multi;
+
+	if (!instance->multi) return TRUE;
+
+	multi = rad_malloc(sizeof(*multi));
+	memset(multi, 0, sizeof(*multi));
+
+	multi->instance = instance;
+	multi->pending_tail = &multi->pending;
+	multi->wakeup[0] = multi->wakeup[1] = -1;
+
+	multi->mandle = curl_multi_init();
+	if (!multi->mandle) {
+		radlog(L_ERR, "rlm_rest (%s): Failed to create CURL multi "
+		       "handle", instance->xlat_name);
+		free(multi);
+		return FALSE;
+	}
+
+#ifdef CURLPIPE_MULTIPLEX
+	curl_multi_setopt(multi->mandle, CURLMOPT_PIPELINING,
+			  CURLPIPE_MULTIPLEX);
+#endif
+#if LIBCURL_VERSION_NUM >= 0x071e00
+	if (instance->max_host_connections > 0) {
+		curl_multi_setopt(multi->mandle, CURLMOPT_MAX_HOST_CONNECTIONS,
+				  (long) instance->max_host_connections);
+	}
+#endif
+
+	if (pipe(multi->wakeup) < 0) {
+		radlog(L_ERR, "rlm_rest (%s): Failed creating pipe: %s",
+		       instance->xlat_name, strerror(errno));
+		goto error;
+	}
+	fcntl(multi->wakeup[0], F_SETFL,
+	      fcntl(multi->wakeup[0], F_GETFL) | O_NONBLOCK);
+
+	pthread_mutex_init(&multi->mutex, NULL);
+	pthread_cond_init(&multi->cond, NULL);
+
+	if (pthread_create(&multi->thread, NULL, rest_multi_thread,
+			   multi) != 0) {
+		radlog(L_ERR, "rlm_rest (%s): Failed creating thread: %s",
+		       instance->xlat_name, strerror(errno));
+		pthread_cond_destroy(&multi->cond);
+		pthread_mutex_destroy(&multi->mutex);
+		goto error;
+	}
+
+	instance->multi_handle = multi;
+
+	return TRUE;
+
+	error:
+	if (multi->wakeup[0] >= 0) close(multi->wakeup[0]);
+	if (multi->wakeup[1] >= 0) close(multi->wakeup[1]);
+	curl_multi_cleanup(multi->mandle);
+	free(multi);
+
+	return FALSE;
+#else
+	if (instance->multi) {
+		radlog(L_INFO, "rlm_rest (%s): Ignoring \"multi\", the server "
+		       "was built without threads", instance->xlat_name);
+	}
+
+	return TRUE;
+#endif
+}
+
+/** Stops the multi thread, and frees the multi handle.
+ *
+ * Must be called after all transfers have completed.
+ *
+ * @see rest_multi_init
+ *
+ * @param[in] instance configuration data.
+ */
+void rest_multi_free(rlm_rest_t *instance)
+{
+	rlm_rest_multi_t *multi = instance->multi_handle;
+
+	if (!multi) return;
+
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_lock(&multi->mutex);
+	multi->stop = TRUE;
+	pthread_mutex_unlock(&multi->mutex);
+
+	if (write(multi->wakeup[1], "", 1) < 0) {
+		/* it will time out within a second */
+	}
+	pthread_join(multi->thread, NULL);
+
+	close(multi->wakeup[0]);
+	close(multi->wakeup[1]);
+	pthread_cond_destroy(&multi->cond);
+	pthread_mutex_destroy(&multi->mutex);
+	curl_multi_cleanup(multi->mandle);
+	free(multi);
+
+	instance->multi_handle = NULL;
+#endif
+}
+
 /** Creates a new connection handle for use by the FR connection API.
  *
  * Matches the fr_connection_create_t function prototype, is passed to
@@ -296,6 +605,12 @@ void *rest_socket_create(void *instance)
 		return candle;
 	}
 
+	/*
+	 *	Transfers use the connections held by the multi handle,
+	 *	so there's no point in pre-connecting this one.
+	 */
+	if (inst->multi_handle) goto init;
+
 	/*
 	 *	Pre-establish TCP connection to webserver. This would usually be
 	 *	done on the first request, but we do it here to minimise
@@ -321,6 +636,7 @@ void *rest_socket_create(void *instance)
 		goto connection_error;
 	}
 
+	init:
 	/* 
 	 *	Malloc memory for the connection handle abstraction.
 	 */
@@ -508,6 +824,13 @@ static size_t rest_encode_post(void *ptr, size_t size, size_t nmemb,
 		 *	Write out single attribute string.
 		 */
 		len = vp_prints_value(p , s, current[0], 0);
+
+		/*
+		 *	vp_prints_value truncates without telling us, so
+		 *	as with JSON, a full buffer means not enough space.
+		 */
+		if (len >= (s - 1)) goto no_space;
+
 		escaped = curl_escape(p, len);
 		len = strlen(escaped);
 
@@ -563,10 +886,13 @@ static size_t rest_encode_post(void *ptr, size_t size, size_t nmemb,
 
 	/*
 	 *	The buffer wasn't big enough to encode a single attribute chunk.
+	 *	If we're not streaming, rest_read_wrapper will try again with
+	 *	a larger buffer.
 	 */
 	if (!len) {
-		radlog(L_ERR, "rlm_rest (%s): AVP exceeds buffer length" 
-		       " or chunk", ctx->instance->xlat_name);
+		if (ctx->chunk) radlog(L_ERR, "rlm_rest (%s): AVP exceeds "
+				       "buffer length or chunk",
+				       ctx->instance->xlat_name);
 	} else {
 		RDEBUG2("Returning %i bytes of POST data"
 			" (buffer full or chunk exceeded)", len);
@@ -575,6 +901,7 @@ static size_t rest_encode_post(void *ptr, size_t size, size_t nmemb,
 	return len;
 }
 
+#ifdef HAVE_JSON
 /** Encodes VALUE_PAIR linked list in JSON format
  *
  * This is a stream function matching the rest_read_t prototype. Multiple
@@ -641,15 +968,20 @@ static size_t rest_encode_json(void *ptr, size_t size, size_t nmemb,
 
 		if (!--s) goto no_space;
 		*p++ = '{';
+
+		/*
+		 *	We wrote the opening brace, record progress.
+		 */
+		f = p;
 	}
 
 	while (s > 0) {
 		if (!*current) {
-			ctx->state = READ_STATE_END;
-
-			if (!--s) goto no_space;
+			if (!s--) goto no_space;
 			*p++ = '}';
 
+			ctx->state = READ_STATE_END;
+
 			goto end_chunk;
 		}
 
@@ -706,6 +1038,7 @@ static size_t rest_encode_json(void *ptr, size_t size, size_t nmemb,
 			if (current[1] && 
 			    ((current[0]->attribute == current[1]->attribute) &&
 			     (current[0]->vendor == current[1]->vendor))) {
+				if (!s--) goto no_space;
 				*p++ = ',';
 				current++;
 
@@ -720,12 +1053,13 @@ static size_t rest_encode_json(void *ptr, size_t size, size_t nmemb,
 			}
 		}
 
-		if (!(s -= 2)) goto no_space;
+		if (s < 2) goto no_space;
+		s -= 2;
 		*p++ = ']';
 		*p++ = '}';
 
 		if (*++current) {
-			if (!--s) goto no_space;
+			if (!s--) goto no_space;
 			*p++ = ',';
 		}
 
@@ -761,10 +1095,13 @@ static size_t rest_encode_json(void *ptr, size_t size, size_t nmemb,
 
 	/*
 	 *	The buffer wasn't big enough to encode a single attribute chunk.
+	 *	If we're not streaming, rest_read_wrapper will try again with
+	 *	a larger buffer.
 	 */
 	if (!len) {
-		radlog(L_ERR, "rlm_rest (%s): AVP exceeds buffer length"
-		       " or chunk", ctx->instance->xlat_name);
+		if (ctx->chunk) radlog(L_ERR, "rlm_rest (%s): AVP exceeds "
+				       "buffer length or chunk",
+				       ctx->instance->xlat_name);
 	} else {
 		RDEBUG2("Returning %i bytes of JSON data"
 			" (buffer full or chunk exceeded)", len);
@@ -772,65 +1109,115 @@ static size_t rest_encode_json(void *ptr, size_t size, size_t nmemb,
 
 	return len;
 }
+#endif
 
 /** Emulates successive libcurl calls to an encoding function
  *
  * This function is used when the request will be sent to the HTTP server as one
- * contiguous entity. A buffer of REST_BODY_INCR bytes is allocated and passed
- * to the stream encoding function.
+ * contiguous entity. A buffer of REST_BODY_INCR bytes is allocated and the
+ * stream encoding function is called to fill as much of it as possible.
  * 
- * If the stream function does not return 0, a new buffer is allocated which is
- * the size of the previous buffer + REST_BODY_INCR bytes, the data from the
- * previous buffer is copied, and freed, and another call is made to the stream
- * function, passing a pointer into the new buffer at the end of the previously
- * written data.
+ * If the stream function runs out of space, the buffer is doubled in size
+ * (up to limit) and the stream function is called again, passing a pointer
+ * into the buffer at the end of the previously written data. The encoder
+ * writes directly into the final buffer, so data is only copied when
+ * realloc has to move it.
  * 
- * This process continues until the stream function signals (by returning 0)
- * that it has no more data to write.
+ * This process continues until the stream function signals (by returning 0
+ * and setting READ_STATE_END) that it has no more data to write.
  *
  * @param[out] buffer where the pointer to the malloced buffer should
  *	be written.
  * @param[in] func Stream function.
  * @param[in] limit Maximum buffer size to alloc.
- * @param[in] userdata rlm_rest_read_t to keep encoding state between calls to
+ * @param[in] ctx rlm_rest_read_t to keep encoding state between calls to
  *	stream function.
  * @return the length of the data written to the buffer (excluding NULL) or -1
- *	if alloc >= limit.
+ *	if the data would not fit in limit bytes.
  */
 static ssize_t rest_read_wrapper(char **buffer, rest_read_t func,
-				 size_t limit, void *userdata)
+				 size_t limit, rlm_rest_read_t *ctx)
 {
-	char *previous = NULL;
-	char *current;
+	char *current, *tmp;
 
 	size_t alloc = REST_BODY_INCR;	/* Size of buffer to malloc */
 	size_t used  = 0;		/* Size of data written */
 	size_t len   = 0;
 
-	while (alloc < limit) {
-		current = rad_malloc(alloc);
+	current = rad_malloc(alloc);
 
-		if (previous) {
-			strlcpy(current, previous, used + 1);
-			free(previous);
+	while (TRUE) {
+		/*
+		 *	The encoders need room for some data, and the
+		 *	trailing NULL.
+		 */
+		if ((alloc - used) > 2) {
+			len = func(current + used, alloc - used, 1, ctx);
+			used += len;
+			if (len) continue;
 		}
 
-		len = func(current + used, REST_BODY_INCR, 1, userdata);
-		used += len;
-		if (!len) {
+		if (ctx->state == READ_STATE_END) {
 			*buffer = current;
 			return used;
 		}
 
-		alloc += REST_BODY_INCR;
-		previous = current;
-	};
+		/*
+		 *	Not enough room for the next attribute.
+		 */
+		if (alloc >= limit) break;
+
+		alloc *= 2;
+		if (alloc > limit) alloc = limit;
+
+		tmp = realloc(current, alloc);
+		if (!tmp) break;
+		current = tmp;
+	}
 
 	free(current);
 
 	return -1;
 }
 
+/** Sorts an array of VALUE_PAIR pointers by vendor, then by attribute.
+ *
+ * This is a merge sort, so it's stable, and values of multi-valued
+ * attributes stay in the order they were in the request.
+ *
+ * @param[in,out] array to sort.
+ * @param[in] tmp scratch space, at least count entries.
+ * @param[in] count number of entries in array.
+ */
+static void rest_vp_sort(VALUE_PAIR **array, VALUE_PAIR **tmp,
+			 unsigned int count)
+{
+	unsigned int half, i, j, k;
+
+	if (count < 2) return;
+
+	half = count / 2;
+	rest_vp_sort(array, tmp, half);
+	rest_vp_sort(array + half, tmp, count - half);
+
+	memcpy(tmp, array, sizeof(*tmp) * count);
+
+	i = 0;
+	j = half;
+	k = 0;
+	while ((i < half) && (j < count)) {
+		if ((tmp[j]->vendor < tmp[i]->vendor) ||
+		    ((tmp[j]->vendor == tmp[i]->vendor) &&
+		     (tmp[j]->attribute < tmp[i]->attribute))) {
+			array[k++] = tmp[j++];
+		} else {
+			array[k++] = tmp[i++];
+		}
+	}
+	while (i < half) array[k++] = tmp[i++];
+	while (j < count) array[k++] = tmp[j++];
+}
+
 /** (Re-)Initialises the data in a rlm_rest_read_t.
  *
  * Resets the values of a rlm_rest_read_t to their defaults.
@@ -858,10 +1245,9 @@ static void rest_read_ctx_init(REQUEST *request,
 			       rlm_rest_read_t *ctx,
 			       int sort)
 {
-	unsigned short count = 0, i;
-	unsigned short swap;
+	unsigned int count = 0;
 
-	VALUE_PAIR **current, *tmp;
+	VALUE_PAIR **current, **tmp_array, *tmp;
 
 	/*
 	 * Setup stream read data
@@ -891,24 +1277,9 @@ static void rest_read_ctx_init(REQUEST *request,
 
 	if (!sort || (count < 2)) return;
 
-	/* TODO: Quicksort would be faster... */
-	do {
-		for(i = 1; i < count; i++) {
-			assert(current[i-1]->attribute &&
-			       current[i]->attribute);
-
-			swap = 0;
-			if ((current[i-1]->vendor > current[i]->vendor) ||
-			    ((current[i-1]->vendor == current[i]->vendor) &&
-			     (current[i-1]->attribute > current[i]->attribute)
-			    )) {
-				tmp	     = current[i];
-				current[i]   = current[i-1];
-				current[i-1] = tmp;
-				swap = 1;
-			}
-		}
-	} while (swap);
+	tmp_array = rad_malloc(sizeof(tmp) * count);
+	rest_vp_sort(current, tmp_array, count);
+	free(tmp_array);
 }
 
 /** Frees the VALUE_PAIR array created by rest_read_ctx_init.
@@ -1482,10 +1853,9 @@ static VALUE_PAIR *json_pairmake(rlm_rest_t *instance,
 
 /** Converts JSON response into VALUE_PAIRs and adds them to the request.
  * 
- * Converts the raw JSON string into a json-c object tree and passes it to
- * json_pairmake. After the tree has been parsed json_object_put is called
- * which decrements the reference count of the root node by one, and frees
- * the entire tree.
+ * The body was parsed into a json-c object tree by rest_write_body as it
+ * arrived.  The tree is passed to json_pairmake, and is freed by
+ * rest_write_free.
  *
  * @see rest_encode_json
  * @see json_pairmake
@@ -1494,42 +1864,25 @@ static VALUE_PAIR *json_pairmake(rlm_rest_t *instance,
  * @param[in] section configuration data.
  * @param[in,out] request Current request.
  * @param[in] handle REST handle.
- * @param[in] raw buffer containing JSON data.
- * @param[in] rawlen Length of data in raw buffer.
+ * @param[in] json parsed response, or NULL if the body was empty or
+ *	incomplete.
  * @return the number of VALUE_PAIRs processed or -1 on unrecoverable error.
  */
 static int rest_decode_json(rlm_rest_t *instance,
 			    UNUSED rlm_rest_section_t *section,
 			    REQUEST *request, UNUSED void *handle,
-			    char *raw, UNUSED size_t rawlen)
+			    struct json_object *json)
 {
-	const char *p = raw;
-	
-	struct json_object *json;
-	
 	int max = REST_BODY_MAX_ATTRS;
 
-	/*
-	 *	Empty response?
-	 */
-	while (isspace(*p)) p++;
-	if (*p == '\0') return FALSE;
-
-	json = json_tokener_parse(p);
 	if (!json) {
-		radlog(L_ERR, "rlm_rest (%s): Malformed JSON data \"%s\"",
-			instance->xlat_name, raw);
+		radlog(L_ERR, "rlm_rest (%s): Incomplete JSON data",
+		       instance->xlat_name);
 		return -1;
 	}
 
 	json_pairmake(instance, section, request, json, 0, &max);
 
-	/*
-	 *	Decrement reference count for root object, should free entire
-	 *	JSON tree.
-	 */
-	json_object_put(json);
-
 	return (REST_BODY_MAX_ATTRS - max);
 }
 #endif
@@ -1739,6 +2092,9 @@ static size_t rest_write_body(void *ptr, size_t size, size_t nmemb,
 	char *tmp;
 
 	const size_t t = (size * nmemb);
+#ifdef HAVE_JSON
+	size_t len;
+#endif
 
 	/*
 	 *	Any post processing of headers should go here...
@@ -1762,24 +2118,62 @@ static size_t rest_write_body(void *ptr, size_t size, size_t nmemb,
 
 			return t;
 
-		default:
-			if (t > (ctx->alloc - ctx->used)) {
-				ctx->alloc += ((t + 1) > REST_BODY_INCR) ?
-					t + 1 : REST_BODY_INCR;
+#ifdef HAVE_JSON
+		/*
+		 *	Feed JSON to the parser as it arrives, so the body
+		 *	doesn't need to be buffered.
+		 */
+		case HTTP_BODY_JSON:
+			ctx->used += t;
+			if (ctx->json) return t; /* trailing data */
 
-				tmp = ctx->buffer;
+			if (!ctx->tok) {
+				len = t;
+				while (len && isspace((int) *p)) {
+					p++;
+					len--;
+				}
+				if (!len) return t;
+
+				ctx->tok = json_tokener_new();
+				if (!ctx->tok) return 0;
+			} else {
+				len = t;
+			}
+
+			ctx->json = json_tokener_parse_ex(ctx->tok, p, len);
+			if (!ctx->json &&
+			    (json_tokener_get_error(ctx->tok) !=
+			     json_tokener_continue)) {
+				radlog(L_ERR, "rlm_rest (%s): Malformed JSON "
+				       "data: %s", ctx->instance->xlat_name,
+				       json_tokener_error_desc(json_tokener_get_error(ctx->tok)));
+				ctx->type = HTTP_BODY_INVALID;
+			}
 
-				ctx->buffer = rad_malloc(ctx->alloc);
+			break;
+#endif
 
-				/* If data has been written previously */
-				if (tmp) {
-					strlcpy(ctx->buffer, tmp,
-					       (ctx->used + 1));
-					free(tmp);
+		default:
+			/*
+			 *	Grow the buffer geometrically, so that large
+			 *	bodies aren't copied on every write.
+			 */
+			if ((t + 1) > (ctx->alloc - ctx->used)) {
+				if (ctx->alloc < REST_BODY_INCR) {
+					ctx->alloc = REST_BODY_INCR;
+				}
+				while ((t + 1) > (ctx->alloc - ctx->used)) {
+					ctx->alloc *= 2;
 				}
+
+				tmp = realloc(ctx->buffer, ctx->alloc);
+				if (!tmp) return 0;
+				ctx->buffer = tmp;
 			}
-			strlcpy(ctx->buffer + ctx->used, p, t + 1);
+			memcpy(ctx->buffer + ctx->used, p, t);
 			ctx->used += t;
+			ctx->buffer[ctx->used] = '\0';
 
 			break;
 	}
@@ -1809,6 +2203,10 @@ static void rest_write_ctx_init(REQUEST *request, rlm_rest_write_t *ctx,
 	ctx->alloc	= 0;
 	ctx->used	= 0;
 	ctx->buffer	= NULL;
+#ifdef HAVE_JSON
+	ctx->tok	= NULL;
+	ctx->json	= NULL;
+#endif
 }
 
 /** Frees the intermediary buffer created by rest_write.
@@ -1819,7 +2217,20 @@ static void rest_write_free(rlm_rest_write_t *ctx)
 {
 	if (ctx->buffer != NULL) {
 		free(ctx->buffer);
+		ctx->buffer = NULL;
 	}
+
+#ifdef HAVE_JSON
+	if (ctx->tok != NULL) {
+		json_tokener_free(ctx->tok);
+		ctx->tok = NULL;
+	}
+
+	if (ctx->json != NULL) {
+		json_object_put(ctx->json);
+		ctx->json = NULL;
+	}
+#endif
 }
 
 /** Configures body specific curlopts.
@@ -1852,7 +2263,7 @@ static int rest_request_config_body(rlm_rest_t *instance,
 		if (ret != CURLE_OK) goto error;
 
 		ret = curl_easy_setopt(candle, CURLOPT_READFUNCTION,
-				       rest_encode_json);
+				       func);
 		if (ret != CURLE_OK) goto error;
 	} else {
 		len = rest_read_wrapper(&ctx->body, func,
@@ -1939,6 +2350,22 @@ int rest_request_config(rlm_rest_t *instance, rlm_rest_section_t *section,
 				       section->timeout);
 		if (ret != CURLE_OK) goto error;
 	}
+
+	/*
+	 *	With the multi handle, prefer waiting for an existing
+	 *	HTTP/2 connection to opening a new one.
+	 */
+	if (instance->multi_handle) {
+#if LIBCURL_VERSION_NUM >= 0x072b00
+		ret = curl_easy_setopt(candle, CURLOPT_PIPEWAIT, val);
+		if (ret != CURLE_OK) goto error;
+#endif
+#if LIBCURL_VERSION_NUM >= 0x072f00
+		ret = curl_easy_setopt(candle, CURLOPT_HTTP_VERSION,
+				       (long) CURL_HTTP_VERSION_2TLS);
+		if (ret != CURLE_OK) goto error;
+#endif
+	}
 	
 	ret = curl_easy_setopt(candle, CURLOPT_PROTOCOLS,
 			       (CURLPROTO_HTTP | CURLPROTO_HTTPS));
@@ -2153,8 +2580,8 @@ int rest_request_config(rlm_rest_t *instance, rlm_rest_section_t *section,
 		case HTTP_METHOD_POST :
 		case HTTP_METHOD_PUT :
 		case HTTP_METHOD_CUSTOM :
+			ctx->read.chunk = section->chunk;
 			if (section->chunk > 0) {
-				ctx->read.chunk = section->chunk;
 
 				ctx->headers = curl_slist_append(ctx->headers,
 								 "Expect:");
@@ -2237,6 +2664,11 @@ int rest_request_perform(rlm_rest_t *instance,
 	CURL *candle		  = randle->handle;
 	CURLcode ret;
 
+#ifdef HAVE_PTHREAD_H
+	if (instance->multi_handle) {
+		ret = rest_multi_perform(instance->multi_handle, candle);
+	} else
+#endif
 	ret = curl_easy_perform(candle);
 	if (ret != CURLE_OK) {
 		radlog(L_ERR, "rlm_rest (%s): Request failed: %i - %s",
@@ -2268,7 +2700,7 @@ int rest_request_decode(rlm_rest_t *instance,
 
 	int ret;
 
-	if (ctx->write.buffer == NULL) {
+	if (ctx->write.used == 0) {
 		RDEBUG("Skipping attribute processing, no body data received");
 		return FALSE;
 	}
@@ -2284,9 +2716,16 @@ int rest_request_decode(rlm_rest_t *instance,
 			break;
 #ifdef HAVE_JSON
 		case HTTP_BODY_JSON:
+			/*
+			 *	Whitespace only is the same as no body.
+			 */
+			if (!ctx->write.tok) {
+				RDEBUG("Skipping attribute processing, empty body");
+				return FALSE;
+			}
+
 			ret = rest_decode_json(instance, section, request,
-					       handle, ctx->write.buffer,
-					       ctx->write.used);
+					       handle, ctx->write.json);
 			break;
 #endif
 		case HTTP_BODY_UNSUPPORTED:
@@ -2337,7 +2776,10 @@ void rest_request_cleanup(UNUSED rlm_rest_t *instance,
 	/*
    	 * Free body data (only used if chunking is disabled)
    	 */
-  	if (ctx->body != NULL) free(ctx->body);
+  	if (ctx->body != NULL) {
+		free(ctx->body);
+		ctx->body = NULL;
+	}
   
   	/*
    	 * Free other context info
@@ -129,6 +129,12 @@ typedef struct rlm_rest_section_t {
 	unsigned int chunk;
 } rlm_rest_section_t;
 
+/*
+ *	Shared curl multi handle, and the thread which drives it.  The
+ *	contents are private to rest.c.
+ */
+typedef struct rlm_rest_multi_t rlm_rest_multi_t;
+
 /*
  *	Structure for module configuration
  */
@@ -137,6 +143,10 @@ typedef struct rlm_rest_t {
 
 	char *connect_uri;
 
+	int multi;
+	int max_host_connections;
+	rlm_rest_multi_t *multi_handle;
+
 	fr_connection_pool_t *conn_pool;
 
 	rlm_rest_section_t authorize;
@@ -195,6 +205,11 @@ typedef struct rlm_rest_write_t {
 
 	int		 code;		/* HTTP Status Code */
 	http_body_type_t type;		/* HTTP Content Type */
+
+#ifdef HAVE_JSON
+	struct json_tokener *tok;	/* Incremental parser for JSON bodies */
+	struct json_object *json;	/* Parsed JSON body */
+#endif
 } rlm_rest_write_t;
 
 /*
@@ -229,6 +244,10 @@ int rest_init(rlm_rest_t *instance);
 
 void rest_cleanup(void);
 
+int rest_multi_init(rlm_rest_t *instance);
+
+void rest_multi_free(rlm_rest_t *instance);
+
 void *rest_socket_create(void *instance);
 
 int rest_socket_alive(void *instance, void *handle);
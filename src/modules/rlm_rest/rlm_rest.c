@@ -95,6 +95,10 @@ static const CONF_PARSER section_config[] = {
 static const CONF_PARSER module_config[] = {
 	{ "connect_uri", PW_TYPE_STRING_PTR,
 	 offsetof(rlm_rest_t, connect_uri), NULL, "http://localhost/" },
+	{ "multi", PW_TYPE_BOOLEAN,
+	 offsetof(rlm_rest_t, multi), NULL, "no" },
+	{ "max_host_connections", PW_TYPE_INTEGER,
+	 offsetof(rlm_rest_t, max_host_connections), NULL, "0" },
 
 	{ NULL, -1, 0, NULL, NULL }
 };
@@ -274,6 +278,10 @@ static int rlm_rest_instantiate(CONF_SECTION *conf, void **instance)
 		return -1;
 	}
 
+	if (!rest_multi_init(data)) {
+		return -1;
+	}
+
 	data->conn_pool = fr_connection_pool_init(conf, data,
 						  rest_socket_create,
 						  rest_socket_alive,
@@ -416,6 +424,8 @@ static int rlm_rest_detach(void *instance)
 
 	fr_connection_pool_delete(my_instance->conn_pool);
 
+	rest_multi_free(my_instance);
+
 	free(my_instance);
 
 	/* Free any memory used by libcurl */
@@ -236,7 +236,8 @@ static rlm_rcode_t sometimes_post_proxy(void *instance, REQUEST *request)
 module_t rlm_sometimes = {
 	RLM_MODULE_INIT,
 	"sometimes",
-	RLM_TYPE_CHECK_CONFIG_SAFE | RLM_TYPE_HUP_SAFE,   	/* type */
+	RLM_TYPE_CHECK_CONFIG_SAFE | RLM_TYPE_HUP_SAFE |
+	  RLM_TYPE_HUP_CHANGED,   	/* type */
 	sometimes_instantiate,		/* instantiation */
 	sometimes_detach,		/* detach */
 	{
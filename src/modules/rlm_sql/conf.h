@@ -41,6 +41,7 @@ RCSIDH(conf_h, "$Id$")
 
 /* SQL Errors */
 #define SQL_DOWN			1 /* for re-connect */
+#define SQL_BUSY			2 /* async query still running */
 
 #define MAX_COMMUNITY_LEN		50
 #define MAX_TABLE_LEN			20
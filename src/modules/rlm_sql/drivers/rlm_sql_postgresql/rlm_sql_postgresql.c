@@ -199,25 +199,17 @@ static int sql_init_socket(SQLSOCK *sqlsocket, SQL_CONFIG *config) {
 
 /*************************************************************************
  *
- *	Function: sql_query
+ *	Function: sql_check_result
  *
- *	Purpose: Issue a query to the database
+ *	Purpose: Translate the result of a query into an rlm_sql return code
  *
  *************************************************************************/
-static int sql_query(SQLSOCK * sqlsocket, UNUSED SQL_CONFIG *config,
-		     char *querystr) {
+static int sql_check_result(rlm_sql_postgres_sock *pg_sock) {
 
-	rlm_sql_postgres_sock *pg_sock = sqlsocket->conn;
 	int numfields = 0;
 	char *errorcode;
 	char *errormsg;
 
-	if (pg_sock->conn == NULL) {
-		radlog(L_ERR, "rlm_sql_postgresql: Socket not connected");
-		return SQL_DOWN;
-	}
-
-	pg_sock->result = PQexec(pg_sock->conn, querystr);
 		/*
 		 * Returns a PGresult pointer or possibly a null pointer.
 		 * A non-null pointer will generally be returned except in
@@ -323,6 +315,109 @@ static int sql_query(SQLSOCK * sqlsocket, UNUSED SQL_CONFIG *config,
 	return -1;
 }
 
+/*************************************************************************
+ *
+ *	Function: sql_query
+ *
+ *	Purpose: Issue a query to the database
+ *
+ *************************************************************************/
+static int sql_query(SQLSOCK * sqlsocket, UNUSED SQL_CONFIG *config,
+		     char *querystr) {
+
+	rlm_sql_postgres_sock *pg_sock = sqlsocket->conn;
+
+	if (pg_sock->conn == NULL) {
+		radlog(L_ERR, "rlm_sql_postgresql: Socket not connected");
+		return SQL_DOWN;
+	}
+
+	pg_sock->result = PQexec(pg_sock->conn, querystr);
+
+	return sql_check_result(pg_sock);
+}
+
+/*************************************************************************
+ *
+ *	Function: sql_socket_fd
+ *
+ *	Purpose: Return the file descriptor rlm_sql should wait on
+ *
+ *************************************************************************/
+static int sql_socket_fd(SQLSOCK * sqlsocket, UNUSED SQL_CONFIG *config) {
+
+	rlm_sql_postgres_sock *pg_sock = sqlsocket->conn;
+
+	if (pg_sock->conn == NULL) return -1;
+
+	return PQsocket(pg_sock->conn);
+}
+
+/*************************************************************************
+ *
+ *	Function: sql_query_start
+ *
+ *	Purpose: Send a query to the database without waiting for the result
+ *
+ *************************************************************************/
+static int sql_query_start(SQLSOCK * sqlsocket, UNUSED SQL_CONFIG *config,
+			   char *querystr) {
+
+	rlm_sql_postgres_sock *pg_sock = sqlsocket->conn;
+
+	if (pg_sock->conn == NULL) {
+		radlog(L_ERR, "rlm_sql_postgresql: Socket not connected");
+		return SQL_DOWN;
+	}
+
+	if (pg_sock->result) {
+		PQclear(pg_sock->result);
+		pg_sock->result = NULL;
+	}
+
+	if (!PQsendQuery(pg_sock->conn, querystr)) {
+		radlog(L_ERR, "rlm_sql_postgresql: Failed sending query: %s",
+		       PQerrorMessage(pg_sock->conn));
+		return SQL_DOWN;
+	}
+
+	return 0;
+}
+
+/*************************************************************************
+ *
+ *	Function: sql_query_poll
+ *
+ *	Purpose: Read whatever the server has sent.  Returns SQL_BUSY
+ *		 until the complete result of the query is available.
+ *
+ *************************************************************************/
+static int sql_query_poll(SQLSOCK * sqlsocket, UNUSED SQL_CONFIG *config) {
+
+	rlm_sql_postgres_sock *pg_sock = sqlsocket->conn;
+	PGresult *result;
+
+	if (!PQconsumeInput(pg_sock->conn)) {
+		radlog(L_ERR, "rlm_sql_postgresql: Failed reading result: %s",
+		       PQerrorMessage(pg_sock->conn));
+		return SQL_DOWN;
+	}
+
+	/*
+	 *	There is one result per statement, followed by NULL.
+	 *	Keep the last one, which is what PQexec would return.
+	 */
+	while (!PQisBusy(pg_sock->conn)) {
+		result = PQgetResult(pg_sock->conn);
+		if (!result) return sql_check_result(pg_sock);
+
+		if (pg_sock->result) PQclear(pg_sock->result);
+		pg_sock->result = result;
+	}
+
+	return SQL_BUSY;
+}
+
 
 /*************************************************************************
  *
@@ -540,4 +635,7 @@ rlm_sql_module_t rlm_sql_postgresql = {
 	sql_finish_query,
 	sql_finish_select_query,
 	sql_affected_rows,
+	sql_socket_fd,
+	sql_query_start,
+	sql_query_poll,
 };
@@ -509,7 +509,7 @@ static int sql_get_grouplist (SQL_INST *inst, SQLSOCK *sqlsocket, REQUEST *reque
 	    (inst->config->groupmemb_query[0] == 0))
 		return 0;
 
-	if (!radius_xlat(querystr, sizeof(querystr), inst->config->groupmemb_query, request, sql_escape_func, inst)) {
+	if (!radius_xlat_exp(querystr, sizeof(querystr), inst->groupmemb_exp, request, sql_escape_func, inst)) {
 		radlog_request(L_ERR, 0, request, "xlat \"%s\" failed.",
 			       inst->config->groupmemb_query);
 		return -1;
@@ -651,7 +651,7 @@ static int rlm_sql_process_groups(SQL_INST *inst, REQUEST *request, SQLSOCK *sql
 			return -1;
 		}
 		pairadd(&request->packet->vps, sql_group);
-		if (!radius_xlat(querystr, sizeof(querystr), inst->config->authorize_group_check_query, request, sql_escape_func, inst)) {
+		if (!radius_xlat_exp(querystr, sizeof(querystr), inst->authorize_group_check_exp, request, sql_escape_func, inst)) {
 			radlog_request(L_ERR, 0, request,
 				       "Error generating query; rejecting user");
 			/* Remove the grouup we added above */
@@ -679,7 +679,7 @@ static int rlm_sql_process_groups(SQL_INST *inst, REQUEST *request, SQLSOCK *sql
 				/*
 				 *	Now get the reply pairs since the paircompare matched
 				 */
-				if (!radius_xlat(querystr, sizeof(querystr), inst->config->authorize_group_reply_query, request, sql_escape_func, inst)) {
+				if (!radius_xlat_exp(querystr, sizeof(querystr), inst->authorize_group_reply_exp, request, sql_escape_func, inst)) {
 					radlog_request(L_ERR, 0, request, "Error generating query; rejecting user");
 					/* Remove the grouup we added above */
 					pairdelete(&request->packet->vps, PW_SQL_GROUP, 0, TAG_ANY);
@@ -714,7 +714,7 @@ static int rlm_sql_process_groups(SQL_INST *inst, REQUEST *request, SQLSOCK *sql
 			/*
 			 *	Now get the reply pairs since the paircompare matched
 			 */
-			if (!radius_xlat(querystr, sizeof(querystr), inst->config->authorize_group_reply_query, request, sql_escape_func, inst)) {
+			if (!radius_xlat_exp(querystr, sizeof(querystr), inst->authorize_group_reply_exp, request, sql_escape_func, inst)) {
 				radlog_request(L_ERR, 0, request, "Error generating query; rejecting user");
 				/* Remove the grouup we added above */
 				pairdelete(&request->packet->vps, PW_SQL_GROUP, 0, TAG_ANY);
@@ -756,6 +756,14 @@ static int rlm_sql_detach(void *instance)
 	SQL_INST *inst = instance;
 
 	paircompare_unregister(PW_SQL_GROUP, sql_groupcmp);
+
+	radius_xlat_exp_free(&inst->authorize_check_exp);
+	radius_xlat_exp_free(&inst->authorize_reply_exp);
+	radius_xlat_exp_free(&inst->authorize_group_check_exp);
+	radius_xlat_exp_free(&inst->authorize_group_reply_exp);
+	radius_xlat_exp_free(&inst->simul_count_exp);
+	radius_xlat_exp_free(&inst->simul_verify_exp);
+	radius_xlat_exp_free(&inst->groupmemb_exp);
 	
 	if (inst->config->postauth) free(inst->config->postauth);
 	if (inst->config->accounting) free(inst->config->accounting);
@@ -934,6 +942,14 @@ static int rlm_sql_instantiate(CONF_SECTION * conf, void **instance)
 		       inst->config->xlat_name);
 		goto error;
 	}
+
+	inst->authorize_check_exp = radius_xlat_compile(inst->config->authorize_check_query);
+	inst->authorize_reply_exp = radius_xlat_compile(inst->config->authorize_reply_query);
+	inst->authorize_group_check_exp = radius_xlat_compile(inst->config->authorize_group_check_query);
+	inst->authorize_group_reply_exp = radius_xlat_compile(inst->config->authorize_group_reply_query);
+	inst->simul_count_exp = radius_xlat_compile(inst->config->simul_count_query);
+	inst->simul_verify_exp = radius_xlat_compile(inst->config->simul_verify_query);
+	inst->groupmemb_exp = radius_xlat_compile(inst->config->groupmemb_query);
 		
 	/*
 	 *	Sanity check for crazy people.
@@ -1045,7 +1061,7 @@ static rlm_rcode_t rlm_sql_authorize(void *instance, REQUEST * request)
 	 */
 	if (inst->config->authorize_check_query &&
 	    *inst->config->authorize_check_query) {
-		if (!radius_xlat(querystr, sizeof(querystr), inst->config->authorize_check_query, request, sql_escape_func, inst)) {
+		if (!radius_xlat_exp(querystr, sizeof(querystr), inst->authorize_check_exp, request, sql_escape_func, inst)) {
 			radlog_request(L_ERR, 0, request, "Error generating query; rejecting user");
 	
 			goto error;
@@ -1083,7 +1099,7 @@ static rlm_rcode_t rlm_sql_authorize(void *instance, REQUEST * request)
 		/*
 		 *  Now get the reply pairs since the paircompare matched
 		 */
-		if (!radius_xlat(querystr, sizeof(querystr), inst->config->authorize_reply_query, request, sql_escape_func, inst)) {
+		if (!radius_xlat_exp(querystr, sizeof(querystr), inst->authorize_reply_exp, request, sql_escape_func, inst)) {
 			radlog_request(L_ERR, 0, request, "Error generating query; rejecting user");
 			
 			goto error;
@@ -1371,7 +1387,7 @@ static rlm_rcode_t rlm_sql_checksimul(void *instance, REQUEST * request) {
 	if(sql_set_user(inst, request, NULL) < 0)
 		return RLM_MODULE_FAIL;
 
-	radius_xlat(querystr, sizeof(querystr), inst->config->simul_count_query, request, sql_escape_func, inst);
+	radius_xlat_exp(querystr, sizeof(querystr), inst->simul_count_exp, request, sql_escape_func, inst);
 
 	/* initialize the sql socket */
 	sqlsocket = sql_get_socket(inst);
@@ -1415,7 +1431,7 @@ static rlm_rcode_t rlm_sql_checksimul(void *instance, REQUEST * request) {
 		return RLM_MODULE_OK;
 	}
 
-	radius_xlat(querystr, sizeof(querystr), inst->config->simul_verify_query, request, sql_escape_func, inst);
+	radius_xlat_exp(querystr, sizeof(querystr), inst->simul_verify_exp, request, sql_escape_func, inst);
 	if(rlm_sql_select_query(&sqlsocket, inst, querystr)) {
 		sql_release_socket(inst, sqlsocket);
 		return RLM_MODULE_FAIL;
@@ -96,6 +96,20 @@ typedef struct rlm_sql_module_t {
 	int (*sql_finish_query)(SQLSOCK *sqlsocket, SQL_CONFIG *config);
 	int (*sql_finish_select_query)(SQLSOCK *sqlsocket, SQL_CONFIG *config);
 	int (*sql_affected_rows)(SQLSOCK *sqlsocket, SQL_CONFIG *config);
+
+	/*
+	 *	Optional non-blocking interface.  Drivers which can
+	 *	send a query and collect its result separately fill
+	 *	these in, and rlm_sql waits on the socket itself.
+	 *
+	 *	sql_query_start sends the query and returns 0, or
+	 *	<0 / SQL_DOWN on error.  sql_query_poll reads whatever
+	 *	is available and returns SQL_BUSY if the result is not
+	 *	yet complete, otherwise the same codes as sql_query.
+	 */
+	int (*sql_socket_fd)(SQLSOCK *sqlsocket, SQL_CONFIG *config);
+	int (*sql_query_start)(SQLSOCK *sqlsocket, SQL_CONFIG *config, char *query);
+	int (*sql_query_poll)(SQLSOCK *sqlsocket, SQL_CONFIG *config);
 } rlm_sql_module_t;
 
 typedef struct sql_inst SQL_INST;
@@ -115,6 +129,17 @@ struct sql_inst {
 	int (*sql_query)(SQLSOCK **sqlsocket, SQL_INST *inst, char *query);
 	int (*sql_select_query)(SQLSOCK **sqlsocket, SQL_INST *inst, char *query);
 	int (*sql_fetch_row)(SQLSOCK **sqlsocket, SQL_INST *inst);
+
+	/*
+	 *	Queries from the configuration, compiled at instantiation.
+	 */
+	xlat_exp_t	*authorize_check_exp;
+	xlat_exp_t	*authorize_reply_exp;
+	xlat_exp_t	*authorize_group_check_exp;
+	xlat_exp_t	*authorize_group_reply_exp;
+	xlat_exp_t	*simul_count_exp;
+	xlat_exp_t	*simul_verify_exp;
+	xlat_exp_t	*groupmemb_exp;
 };
 
 typedef struct sql_grouplist {
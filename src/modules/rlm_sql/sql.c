@@ -31,6 +31,7 @@ RCSID("$Id$")
 
 #include	<sys/file.h>
 #include	<sys/stat.h>
+#include	<poll.h>
 
 #include	<ctype.h>
 
@@ -271,6 +272,74 @@ int rlm_sql_fetch_row(SQLSOCK **sqlsocket, SQL_INST *inst)
 	return ret;
 }
 
+/*************************************************************************
+ *
+ *	Function: sql_query_async
+ *
+ *	Purpose: Run a query through the driver's non-blocking interface,
+ *		 waiting on the socket for no longer than query_timeout.
+ *
+ *************************************************************************/
+static int sql_query_async(SQLSOCK *sqlsocket, SQL_INST *inst, char *query)
+{
+	int ret, fd, wait;
+	struct timeval start, now;
+
+	ret = (inst->module->sql_query_start)(sqlsocket, inst->config, query);
+	if (ret != 0) return ret;
+
+	fd = (inst->module->sql_socket_fd)(sqlsocket, inst->config);
+	if (fd < 0) return SQL_DOWN;
+
+	gettimeofday(&start, NULL);
+
+	while ((ret = (inst->module->sql_query_poll)(sqlsocket, inst->config)) == SQL_BUSY) {
+		int rcode;
+		struct pollfd pfd;
+
+		/*
+		 *	poll(), as the descriptor may be larger than
+		 *	FD_SETSIZE when there are many connections.
+		 */
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		wait = -1;
+		if (inst->config->query_timeout) {
+			gettimeofday(&now, NULL);
+			wait = (inst->config->query_timeout * 1000) -
+				(((now.tv_sec - start.tv_sec) * 1000) +
+				 ((now.tv_usec - start.tv_usec) / 1000));
+			if (wait < 0) goto timeout;
+		}
+
+		rcode = poll(&pfd, 1, wait);
+		if (rcode == 0) {
+		timeout:
+			radlog(L_ERR, "rlm_sql (%s): Query timed out after %d seconds",
+			       inst->config->xlat_name, inst->config->query_timeout);
+
+			/*
+			 *	The server is still working on the
+			 *	query, so the connection is unusable.
+			 *	Close it, and the next user of this
+			 *	socket will get SQL_DOWN and reconnect.
+			 */
+			(inst->module->sql_close)(sqlsocket, inst->config);
+			return -1;
+		}
+
+		if ((rcode < 0) && (errno != EINTR)) {
+			radlog(L_ERR, "rlm_sql (%s): Failed waiting for query result: %s",
+			       inst->config->xlat_name, strerror(errno));
+			return SQL_DOWN;
+		}
+	}
+
+	return ret;
+}
+
 /*************************************************************************
  *
  *	Function: rlm_sql_query
@@ -298,7 +367,11 @@ int rlm_sql_query(SQLSOCK **sqlsocket, SQL_INST *inst, char *query)
 		DEBUG("rlm_sql (%s): Executing query: '%s'",
 		      inst->config->xlat_name, query);
 
-		ret = (inst->module->sql_query)(*sqlsocket, inst->config, query);
+		if (inst->module->sql_query_start) {
+			ret = sql_query_async(*sqlsocket, inst, query);
+		} else {
+			ret = (inst->module->sql_query)(*sqlsocket, inst->config, query);
+		}
 		/*
 		 * Run through all available sockets until we exhaust all existing
 		 * sockets in the pool and fail to establish a *new* connection.
@@ -349,7 +422,11 @@ int rlm_sql_select_query(SQLSOCK **sqlsocket, SQL_INST *inst, char *query)
 		DEBUG("rlm_sql (%s): Executing query: '%s'",
 		      inst->config->xlat_name, query);
 
-		ret = (inst->module->sql_select_query)(*sqlsocket, inst->config, query);
+		if (inst->module->sql_query_start) {
+			ret = sql_query_async(*sqlsocket, inst, query);
+		} else {
+			ret = (inst->module->sql_select_query)(*sqlsocket, inst->config, query);
+		}
 		/*
 		 * Run through all available sockets until we exhaust all existing
 		 * sockets in the pool and fail to establish a *new* connection.
@@ -55,6 +55,7 @@ typedef struct rlm_sqlippool_t {
 	char *allocate_update;	/* SQL query to mark an IP as used */
 	char *allocate_commit;	/* SQL query to commit */
 	char *allocate_rollback; /* SQL query to rollback */
+	char *allocate_single;	/* SQL query to find and mark an IP in one step */
 
 	char *pool_check;	/* Query to check for the existence of the pool */
 
@@ -131,6 +132,8 @@ static CONF_PARSER module_config[] = {
     offsetof(rlm_sqlippool_t,allocate_commit), NULL, "COMMIT" },
   { "allocate-rollback", PW_TYPE_STRING_PTR,
     offsetof(rlm_sqlippool_t,allocate_rollback), NULL, "ROLLBACK" },
+  { "allocate-single", PW_TYPE_STRING_PTR,
+    offsetof(rlm_sqlippool_t,allocate_single), NULL, "" },
 
   { "pool-check", PW_TYPE_STRING_PTR,
     offsetof(rlm_sqlippool_t,pool_check), NULL, "" },
@@ -434,8 +437,11 @@ static int sqlippool_instantiate(CONF_SECTION * conf, void ** instance)
 	}
 
 	/*
-	 *	Check that all the queries are in place
+	 *	Check that all the queries are in place.  If
+	 *	"allocate-single" is set, it replaces the whole
+	 *	allocation sequence.
 	 */
+	if (!IS_EMPTY(data->allocate_single)) goto check_accounting;
 
 	if (IS_EMPTY(data->allocate_clear)) {
 		radlog(L_ERR, "rlm_sqlippool: the 'allocate-clear' statement must be set.");
@@ -455,6 +461,7 @@ static int sqlippool_instantiate(CONF_SECTION * conf, void ** instance)
 		return -1;
 	}
 
+check_accounting:
 	if (IS_EMPTY(data->start_update)) {
 		radlog(L_ERR, "rlm_sqlippool: the 'start-update' statement must be set.");
 		sqlippool_detach(data);
@@ -571,23 +578,35 @@ static rlm_rcode_t sqlippool_postauth(void *instance, REQUEST * request)
 	}
 
 	/*
-	 * BEGIN
+	 *	A single statement (or stored procedure) which
+	 *	clears any old lease, finds a free IP, marks it as
+	 *	used, and returns it.  The database does the
+	 *	locking, so there's no BEGIN / COMMIT around it.
 	 */
-	sqlippool_command(data->allocate_begin, sqlsocket, data, request,
-			  (char *) NULL, 0);
+	if (!IS_EMPTY(data->allocate_single)) {
+		allocation_len = sqlippool_query1(allocation, sizeof(allocation),
+						  data->allocate_single, sqlsocket,
+						  data, request, (char *) NULL, 0);
+	} else {
+		/*
+		 * BEGIN
+		 */
+		sqlippool_command(data->allocate_begin, sqlsocket, data,
+				  request, (char *) NULL, 0);
 
-	/*
-	 * CLEAR
-	 */
-	sqlippool_command(data->allocate_clear, sqlsocket, data, request,
-			  (char *) NULL, 0);
+		/*
+		 * CLEAR
+		 */
+		sqlippool_command(data->allocate_clear, sqlsocket, data,
+				  request, (char *) NULL, 0);
 
-	/*
-	 * FIND
-	 */
-	allocation_len = sqlippool_query1(allocation, sizeof(allocation),
-					  data->allocate_find, sqlsocket,
-					  data, request, (char *) NULL, 0);
+		/*
+		 * FIND
+		 */
+		allocation_len = sqlippool_query1(allocation, sizeof(allocation),
+						  data->allocate_find, sqlsocket,
+						  data, request, (char *) NULL, 0);
+	}
 
 	/*
 	 *	Nothing found...
@@ -596,8 +615,10 @@ static rlm_rcode_t sqlippool_postauth(void *instance, REQUEST * request)
 		/*
 		 * COMMIT
 		 */
-		sqlippool_command(data->allocate_commit, sqlsocket, instance,
-				  request, (char *) NULL, 0);
+		if (IS_EMPTY(data->allocate_single)) {
+			sqlippool_command(data->allocate_commit, sqlsocket,
+					  instance, request, (char *) NULL, 0);
+		}
 
 		/*
 		 * Should we perform pool-check ?
@@ -656,11 +677,27 @@ static rlm_rcode_t sqlippool_postauth(void *instance, REQUEST * request)
 	 */
 	if ((ip_hton(allocation, AF_INET, &ipaddr) < 0) ||
 	    ((ip_allocation = ipaddr.ipaddr.ip4addr.s_addr) == INADDR_NONE)) {
-		/*
-		 * COMMIT
-		 */
-		sqlippool_command(data->allocate_commit, sqlsocket, instance,
-				  request, (char *) NULL, 0);
+		if (IS_EMPTY(data->allocate_single)) {
+			/*
+			 * COMMIT
+			 */
+			sqlippool_command(data->allocate_commit, sqlsocket,
+					  instance, request, (char *) NULL, 0);
+
+		} else if (!IS_EMPTY(data->allocate_clear)) {
+			/*
+			 *	The single query has already marked the
+			 *	entry as used.  Release it again, so that
+			 *	it doesn't sit in the pool until the lease
+			 *	expires.
+			 */
+			sqlippool_command(data->allocate_clear, sqlsocket,
+					  instance, request, (char *) NULL, 0);
+
+		} else {
+			radlog_request(L_ERR, 0, request, "Invalid IP number [%s] was marked as used, but 'allocate-clear' is not set",
+				       allocation);
+		}
 
 		RDEBUG("Invalid IP number [%s] returned from database query.", allocation);
 		data->sql_inst->sql_release_socket(data->sql_inst, sqlsocket);
@@ -673,8 +710,10 @@ static rlm_rcode_t sqlippool_postauth(void *instance, REQUEST * request)
 	/*
 	 * UPDATE
 	 */
-	sqlippool_command(data->allocate_update, sqlsocket, data, request,
-			  allocation, allocation_len);
+	if (IS_EMPTY(data->allocate_single)) {
+		sqlippool_command(data->allocate_update, sqlsocket, data,
+				  request, allocation, allocation_len);
+	}
 
 	RDEBUG("Allocated IP %s [%08x]", allocation, ip_allocation);
 
@@ -685,8 +724,10 @@ static rlm_rcode_t sqlippool_postauth(void *instance, REQUEST * request)
 	/*
 	 * COMMIT
 	 */
-	sqlippool_command(data->allocate_commit, sqlsocket, data, request,
-			  (char *) NULL, 0);
+	if (IS_EMPTY(data->allocate_single)) {
+		sqlippool_command(data->allocate_commit, sqlsocket, data,
+				  request, (char *) NULL, 0);
+	}
 
 	data->sql_inst->sql_release_socket(data->sql_inst, sqlsocket);
 	radius_xlat(logstr, sizeof(logstr), data->log_success, request, NULL, NULL);